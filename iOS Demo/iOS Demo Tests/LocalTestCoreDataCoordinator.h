@@ -0,0 +1,25 @@
+//
+//  LocalTestCoreDataCoordinator.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** The smallest AbstractCoreDataCoordinator that does the job, for tests: one confinement
+    context over a throwaway in-memory store.  It counts the fetches that go through it, so
+    tests can tell a cache hit from a trip to the store. */
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "AbstractCoreDataCoordinator.h"
+
+@interface LocalTestCoreDataCoordinator : NSObject <AbstractCoreDataCoordinator>
+
+// Returns nil if the in-memory store can't be set up for the model.
+-(LocalTestCoreDataCoordinator*) initWithInMemoryStoreForModel:(NSManagedObjectModel*)model;
+
+@property (nonatomic, retain) NSManagedObjectContext* context;
+@property (nonatomic) int numFetches;
+
+@end
@@ -0,0 +1,68 @@
+//
+//  LocalTestCoreDataCoordinator.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "LocalTestCoreDataCoordinator.h"
+
+@implementation LocalTestCoreDataCoordinator
+
+-(LocalTestCoreDataCoordinator*) initWithInMemoryStoreForModel:(NSManagedObjectModel*)model {
+    if(self = [super init]) {
+        NSPersistentStoreCoordinator* storeCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+        NSError* error = nil;
+        if([storeCoordinator addPersistentStoreWithType:NSInMemoryStoreType configuration:nil URL:nil options:nil error:&error] == nil) {
+            NSLog(@"LocalTestCoreDataCoordinator could not add an in-memory store: %@", error);
+            return nil;
+        }
+        self.context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
+        self.context.persistentStoreCoordinator = storeCoordinator;
+        self.numFetches = 0;
+    }
+    return self;
+}
+
+-(NSEntityDescription*) getEntityForName:(NSString*)entityName {
+    return [NSEntityDescription entityForName:entityName inManagedObjectContext:self.context];
+}
+
+-(NSManagedObject*) createObject:(NSEntityDescription*)entity {
+    return [[NSManagedObject alloc] initWithEntity:entity insertIntoManagedObjectContext:self.context];
+}
+
+-(void) deleteObject:(NSManagedObject*)object {
+    [self.context deleteObject:object];
+}
+
+-(NSArray*) fetchManagedObjects:(NSEntityDescription*)entity withPredicate:(NSPredicate*)predicate withSortDescriptor:(NSSortDescriptor*)sortDescriptor {
+    NSFetchRequest* request = [[NSFetchRequest alloc] init];
+    request.entity = entity;
+    request.predicate = predicate;
+    request.sortDescriptors = (sortDescriptor != nil) ? @[ sortDescriptor ] : nil;
+    return [self executeFetchRequest:request];
+}
+
+-(NSManagedObject*) existingObjectWithID:(NSManagedObjectID*)objectID {
+    NSError* error = nil;
+    return [self.context existingObjectWithID:objectID error:&error];
+}
+
+-(NSArray*) executeFetchRequest:(NSFetchRequest*)fetchRequest {
+    self.numFetches++;
+    NSError* error = nil;
+    return [self.context executeFetchRequest:fetchRequest error:&error];
+}
+
+-(NSUInteger) countForFetchRequest:(NSFetchRequest*)fetchRequest {
+    NSError* error = nil;
+    return [self.context countForFetchRequest:fetchRequest error:&error];
+}
+
+-(NSPersistentStoreCoordinator*) persistentStoreCoordinator {
+    return self.context.persistentStoreCoordinator;
+}
+
+@end
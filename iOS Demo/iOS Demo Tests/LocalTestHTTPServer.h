@@ -0,0 +1,62 @@
+//
+//  LocalTestHTTPServer.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** A tiny HTTP/1.1 server on 127.0.0.1 for tests that need a real socket under a real
+    NSURLConnection.  Every connection is one request and one response (Connection: close).
+    The handler block fills in the response, and the response can be told to misbehave:
+    drop the connection partway through the body, or trickle it out at a capped rate.
+
+    It's blocking I/O on GCD threads and it's not fast.  Don't use it outside of tests. */
+
+#import <Foundation/Foundation.h>
+
+@interface LocalTestHTTPRequest : NSObject
+
+@property (nonatomic, retain) NSString* method;
+@property (nonatomic, retain) NSString* path;
+@property (nonatomic, retain) NSDictionary* headers;   // keys are lowercased
+@property (nonatomic, retain) NSData* body;
+
+-(NSString*) header:(NSString*)name;
+
+@end
+
+
+@interface LocalTestHTTPResponse : NSObject
+
+@property (nonatomic) int statusCode;                     // defaults to 200
+@property (nonatomic, retain) NSMutableDictionary* headers;
+@property (nonatomic, retain) NSData* body;
+
+// Close the socket after this many body bytes.  Negative (the default) means send it all.
+@property (nonatomic) long long dropAfterBytes;
+
+// Cap on how fast the body goes out.  Zero (the default) means as fast as possible.
+@property (nonatomic) double bytesPerSecond;
+
+@end
+
+
+typedef void (^LocalTestHTTPServerHandler)(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response);
+
+@interface LocalTestHTTPServer : NSObject
+
+-(LocalTestHTTPServer*) initWithHandler:(LocalTestHTTPServerHandler)handler;
+
+// Binds to a free port on 127.0.0.1.  Returns FALSE if that didn't work.
+-(BOOL) start;
+-(void) stop;
+
+@property (nonatomic, readonly) unsigned short port;
+-(NSString*) urlStringForPath:(NSString*)path;
+
+// Counters, for tests that want to know how much work the server did:
+@property (atomic, readonly) long numRequests;
+@property (atomic, readonly) long long numBodyBytesSent;
+
+@end
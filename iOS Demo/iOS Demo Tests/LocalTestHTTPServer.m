@@ -0,0 +1,248 @@
+//
+//  LocalTestHTTPServer.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "LocalTestHTTPServer.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+#define kMaxHeaderBytes 65536
+
+
+#pragma mark - Request and response
+
+@implementation LocalTestHTTPRequest
+
+-(NSString*) header:(NSString*)name {
+    return [self.headers objectForKey:[name lowercaseString]];
+}
+
+@end
+
+
+@implementation LocalTestHTTPResponse
+
+-(LocalTestHTTPResponse*) init {
+    if(self = [super init]) {
+        self.statusCode = 200;
+        self.headers = [[NSMutableDictionary alloc] init];
+        self.body = [NSData data];
+        self.dropAfterBytes = -1;
+        self.bytesPerSecond = 0.0;
+    }
+    return self;
+}
+
+@end
+
+
+#pragma mark - Server
+
+@interface LocalTestHTTPServer () {
+    int _listenSocket;
+}
+
+@property (nonatomic, copy)   LocalTestHTTPServerHandler handler;
+@property (nonatomic) unsigned short port;
+@property (nonatomic, retain) dispatch_source_t acceptSource;
+@property (nonatomic, retain) dispatch_queue_t  connectionQueue;
+@property (atomic) long numRequests;
+@property (atomic) long long numBodyBytesSent;
+
+@end
+
+@implementation LocalTestHTTPServer
+
+-(LocalTestHTTPServer*) initWithHandler:(LocalTestHTTPServerHandler)handler {
+    if(self = [super init]) {
+        _listenSocket = -1;
+        self.handler = handler;
+        self.connectionQueue = dispatch_queue_create("LocalTestHTTPServer.connections", DISPATCH_QUEUE_CONCURRENT);
+    }
+    return self;
+}
+
+-(void) dealloc {
+    [self stop];
+}
+
+-(BOOL) start {
+    _listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if(_listenSocket < 0) return FALSE;
+
+    int yes = 1;
+    setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t addrLength = sizeof(addr);
+    if(bind(_listenSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0
+       || listen(_listenSocket, 128) != 0
+       || getsockname(_listenSocket, (struct sockaddr*)&addr, &addrLength) != 0) {
+        close(_listenSocket);
+        _listenSocket = -1;
+        return FALSE;
+    }
+    self.port = ntohs(addr.sin_port);
+
+    int listenSocket = _listenSocket;
+    __weak LocalTestHTTPServer* weakSelf = self;
+    self.acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listenSocket, 0, self.connectionQueue);
+    dispatch_source_set_event_handler(self.acceptSource, ^{
+        int fd = accept(listenSocket, NULL, NULL);
+        LocalTestHTTPServer* server = weakSelf;
+        if(fd >= 0 && server != nil) {
+            dispatch_async(server.connectionQueue, ^{
+                [server serveConnection:fd];
+            });
+        } else if(fd >= 0) {
+            close(fd);
+        }
+    });
+    dispatch_source_set_cancel_handler(self.acceptSource, ^{
+        close(listenSocket);
+    });
+    dispatch_resume(self.acceptSource);
+
+    return TRUE;
+}
+
+-(void) stop {
+    if(self.acceptSource != nil) {
+        dispatch_source_cancel(self.acceptSource);
+        self.acceptSource = nil;
+        _listenSocket = -1;
+    }
+}
+
+-(NSString*) urlStringForPath:(NSString*)path {
+    return [NSString stringWithFormat:@"http://127.0.0.1:%hu%@", self.port, path];
+}
+
+
+#pragma mark - Serving one connection
+
+static BOOL sendAll(int fd, const void* bytes, size_t length) {
+    while(length > 0) {
+        ssize_t sent = send(fd, bytes, length, 0);
+        if(sent <= 0) return FALSE;
+        bytes = (const char*)bytes + sent;
+        length -= sent;
+    }
+    return TRUE;
+}
+
+-(void) serveConnection:(int)fd {
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+
+    LocalTestHTTPRequest* request = [self readRequest:fd];
+    if(request == nil) {
+        close(fd);
+        return;
+    }
+    
+    // Connections are served concurrently, so the counters' read-modify-writes are locked:
+    @synchronized (self) {
+        self.numRequests++;
+    }
+
+    LocalTestHTTPResponse* response = [[LocalTestHTTPResponse alloc] init];
+    self.handler(request, response);
+
+    // The head:
+    NSMutableString* head = [NSMutableString stringWithFormat:@"HTTP/1.1 %d %@\r\n", response.statusCode,
+                             [NSHTTPURLResponse localizedStringForStatusCode:response.statusCode]];
+    if([response.headers objectForKey:@"Content-Length"] == nil) {
+        [response.headers setObject:[NSString stringWithFormat:@"%lu", (unsigned long)response.body.length] forKey:@"Content-Length"];
+    }
+    [response.headers setObject:@"close" forKey:@"Connection"];
+    for(NSString* name in response.headers) {
+        [head appendFormat:@"%@: %@\r\n", name, [response.headers objectForKey:name]];
+    }
+    [head appendString:@"\r\n"];
+    NSData* headData = [head dataUsingEncoding:NSUTF8StringEncoding];
+
+    // The body, possibly cut short and possibly slowed down:
+    if(sendAll(fd, headData.bytes, headData.length)) {
+        long long limit = (long long)response.body.length;
+        if(response.dropAfterBytes >= 0 && response.dropAfterBytes < limit) {
+            limit = response.dropAfterBytes;
+        }
+        size_t chunk = (response.bytesPerSecond > 0.0) ? MAX(1, (size_t)(response.bytesPerSecond / 50.0)) : 65536;
+
+        long long sent = 0;
+        while(sent < limit) {
+            size_t n = (size_t)MIN((long long)chunk, limit - sent);
+            if(!sendAll(fd, (const char*)response.body.bytes + sent, n)) break;
+            sent += n;
+            @synchronized (self) {
+                self.numBodyBytesSent += n;
+            }
+            if(response.bytesPerSecond > 0.0) {
+                usleep((useconds_t)(1000000.0 * n / response.bytesPerSecond));
+            }
+        }
+    }
+
+    close(fd);
+}
+
+// Reads the request line, headers, and (Content-Length) body.  Returns nil on garbage.
+-(LocalTestHTTPRequest*) readRequest:(int)fd {
+    NSMutableData* buffer = [[NSMutableData alloc] init];
+    NSData* separator = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSRange headerEnd = NSMakeRange(NSNotFound, 0);
+    char chunk[4096];
+
+    while(headerEnd.location == NSNotFound) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0 || buffer.length > kMaxHeaderBytes) return nil;
+        [buffer appendBytes:chunk length:n];
+        headerEnd = [buffer rangeOfData:separator options:0 range:NSMakeRange(0, buffer.length)];
+    }
+
+    NSString* headString = [[NSString alloc] initWithData:[buffer subdataWithRange:NSMakeRange(0, headerEnd.location)] encoding:NSUTF8StringEncoding];
+    NSArray* lines = [headString componentsSeparatedByString:@"\r\n"];
+    NSArray* requestLine = [[lines firstObject] componentsSeparatedByString:@" "];
+    if(requestLine.count < 2) return nil;
+
+    LocalTestHTTPRequest* request = [[LocalTestHTTPRequest alloc] init];
+    request.method = requestLine[0];
+    request.path = requestLine[1];
+
+    NSMutableDictionary* headers = [[NSMutableDictionary alloc] init];
+    for(NSUInteger i = 1; i < lines.count; i++) {
+        NSRange colon = [lines[i] rangeOfString:@":"];
+        if(colon.location != NSNotFound) {
+            NSString* name  = [[lines[i] substringToIndex:colon.location] lowercaseString];
+            NSString* value = [[lines[i] substringFromIndex:colon.location + 1] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+            [headers setObject:value forKey:name];
+        }
+    }
+    request.headers = headers;
+
+    NSUInteger bodyStart = NSMaxRange(headerEnd);
+    NSUInteger bodyLength = (NSUInteger)[[headers objectForKey:@"content-length"] longLongValue];
+    while(buffer.length < bodyStart + bodyLength) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0) return nil;
+        [buffer appendBytes:chunk length:n];
+    }
+    request.body = [buffer subdataWithRange:NSMakeRange(bodyStart, bodyLength)];
+
+    return request;
+}
+
+@end
@@ -0,0 +1,55 @@
+//
+//  ManualTestURLConnectionBridge.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** An NKURLConnectionBridge for tests that want to say exactly when, and how, each call
+    answers.  Its connections do nothing on their own.  The test drives them from its own
+    thread, one delegate callback at a time or all at once.
+
+    Normally every connection is a new one and the bridge remembers the ones started, in
+    order.  With reusesOneConnection set, it hands out the same connection every time and
+    remembers nothing, so a test that counts allocations only sees the manager's own. */
+
+#import <Foundation/Foundation.h>
+#import "NKURLConnectionBridge.h"
+
+@interface ManualTestURLConnection : NSURLConnection
+
+@property (atomic, retain) NSURLRequest* manualRequest;
+@property (atomic, retain) id manualDelegate;
+@property (atomic) BOOL canceled;
+
+// One delegate callback each.  A negative contentLength leaves Content-Length out:
+-(void) respondWithStatus:(int)statusCode contentLength:(long long)contentLength;
+-(void) sendBytes:(NSData*)bytes;
+-(void) finish;
+
+// The whole answer: the status, the request's path as the body, and finish:
+-(void) finishWithStatus:(int)statusCode;
+
+// The same with a response and body made ahead of time, so it doesn't allocate.  It lets
+// go of the delegate first, so the connection doesn't hold on to a finished call:
+-(void) finishWithResponse:(NSURLResponse*)response body:(NSData*)body;
+
+@end
+
+
+@interface ManualTestURLConnectionBridge : NSObject <NKURLConnectionBridge>
+
+@property (atomic) BOOL reusesOneConnection;
+
+// The connection handed out most recently:
+@property (atomic, readonly) ManualTestURLConnection* lastConnection;
+
+// The connections started so far, in order (always empty with reusesOneConnection):
+-(NSArray*) startedConnections;
+-(NSArray*) startedPaths;
+
+// The first connection started for the path:
+-(ManualTestURLConnection*) connectionForPath:(NSString*)path;
+
+@end
@@ -0,0 +1,122 @@
+//
+//  ManualTestURLConnectionBridge.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "ManualTestURLConnectionBridge.h"
+
+@implementation ManualTestURLConnection
+
+-(ManualTestURLConnection*) init {
+    if(self = [super init]) {
+        self.manualRequest = nil;
+        self.manualDelegate = nil;
+        self.canceled = FALSE;
+    }
+    return self;
+}
+
+// The bridge and the test drive it, so the real thing never gets to:
+-(void) scheduleInRunLoop:(NSRunLoop*)aRunLoop forMode:(NSString*)mode { }
+-(void) start { }
+-(void) cancel { }
+
+-(void) respondWithStatus:(int)statusCode contentLength:(long long)contentLength {
+    NSDictionary* headers = (contentLength >= 0) ? @{ @"Content-Length" : [NSString stringWithFormat:@"%lld", contentLength] } : @{};
+    NSHTTPURLResponse* response = [[NSHTTPURLResponse alloc] initWithURL:self.manualRequest.URL statusCode:statusCode
+                                                              HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    [self.manualDelegate connection:self didReceiveResponse:response];
+}
+
+-(void) sendBytes:(NSData*)bytes {
+    [self.manualDelegate connection:self didReceiveData:bytes];
+}
+
+-(void) finish {
+    [self.manualDelegate connectionDidFinishLoading:self];
+}
+
+-(void) finishWithStatus:(int)statusCode {
+    NSData* body = [self.manualRequest.URL.path dataUsingEncoding:NSUTF8StringEncoding];
+    [self respondWithStatus:statusCode contentLength:(long long)body.length];
+    [self sendBytes:body];
+    [self finish];
+}
+
+-(void) finishWithResponse:(NSURLResponse*)response body:(NSData*)body {
+    id delegate = self.manualDelegate;
+    self.manualDelegate = nil;
+    [delegate connection:self didReceiveResponse:response];
+    [delegate connection:self didReceiveData:body];
+    [delegate connectionDidFinishLoading:self];
+}
+
+@end
+
+
+@interface ManualTestURLConnectionBridge ()
+@property (nonatomic, retain) NSMutableArray* started;
+@property (atomic, readwrite) ManualTestURLConnection* lastConnection;
+@end
+
+@implementation ManualTestURLConnectionBridge
+
+-(ManualTestURLConnectionBridge*) init {
+    if(self = [super init]) {
+        self.started = [[NSMutableArray alloc] init];
+        self.reusesOneConnection = FALSE;
+        self.lastConnection = nil;
+    }
+    return self;
+}
+
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately {
+    ManualTestURLConnection* connection = self.lastConnection;
+    if(connection == nil || !self.reusesOneConnection) {
+        connection = [[ManualTestURLConnection alloc] init];
+        self.lastConnection = connection;
+    }
+    connection.manualRequest = request;
+    connection.manualDelegate = delegate;
+    connection.canceled = FALSE;
+    return connection;
+}
+
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode { }
+
+-(void) startConnection:(NSURLConnection*)connection {
+    if(self.reusesOneConnection) return;
+    @synchronized(self) {
+        [self.started addObject:connection];
+    }
+}
+
+-(void) cancelConnection:(NSURLConnection*)connection {
+    ((ManualTestURLConnection*)connection).canceled = TRUE;
+}
+
+-(NSArray*) startedConnections {
+    @synchronized(self) {
+        return [self.started copy];
+    }
+}
+
+-(NSArray*) startedPaths {
+    NSMutableArray* paths = [[NSMutableArray alloc] init];
+    for(ManualTestURLConnection* connection in [self startedConnections]) {
+        [paths addObject:connection.manualRequest.URL.path];
+    }
+    return paths;
+}
+
+-(ManualTestURLConnection*) connectionForPath:(NSString*)path {
+    for(ManualTestURLConnection* connection in [self startedConnections]) {
+        if([connection.manualRequest.URL.path isEqualToString:path]) return connection;
+    }
+    return nil;
+}
+
+@end
@@ -12,6 +12,7 @@
 #import "DemoNetworkManager.h"
 #import "OverrideURLConnectionTester.h"
 #import "NKNetworkManager.h"
+#import "NKCallBehaviorURLRequest.h"
 
 @interface TestAbstractNetworkManagerWithNSURLConnection : XCTestCase <OverrideURLConnectionTesterDelegate, NetworkManagerDelegate>
 
@@ -24,6 +25,9 @@
 
 @property (nonatomic, retain) NSData* expectedData;
 
+// Set by didSaveFile for download-to-file calls:
+@property (nonatomic, retain) NSURL* savedFileURL;
+
 
 // These control the flow of callbacks:
 @property (nonatomic) BOOL expectingCallbacks;
@@ -75,6 +79,23 @@
     [self.networkManager get:@"" delegate:self context:self];
 }
 
+// A download-to-file call should hand back the body as a file, and the same bytes as
+// (mapped) data in didSucceed:
+-(void) testDownloadToFileCall {
+    NSDictionary* headers = @{ @"Content-Length" : [NSString stringWithFormat:@"%lu", (unsigned long)self.expectedData.length] };
+    self.response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:self.urlString] statusCode:200 HTTPVersion:@"1.1" headerFields:headers];
+    
+    NKCallBehaviorURLRequest* request = [[NKCallBehaviorURLRequest alloc] init];
+    request.URL = [NSURL URLWithString:self.urlString];
+    request.downloadToFile = TRUE;
+    
+    [self.networkManager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:8.0 withNumRetries:0 withContext:self];
+    
+    XCTAssertNotNil(self.savedFileURL, @"Download-to-file calls must report the file they saved.");
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:self.savedFileURL], self.expectedData);
+    [[NSFileManager defaultManager] removeItemAtURL:self.savedFileURL error:nil];
+}
+
 
 
 #pragma mark - Callbacks from the OverrideURLConnectionTester
@@ -124,6 +145,12 @@
 
 }
 
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSaveFile:(id)context
+               fileURL:(NSURL*)fileURL {
+    [self checkContext:context andManager:networkManager];
+    self.savedFileURL = fileURL;
+}
+
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
     [self checkContext:context andManager:networkManager];
     
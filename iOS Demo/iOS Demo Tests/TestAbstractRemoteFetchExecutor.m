@@ -0,0 +1,268 @@
+//
+//  TestAbstractRemoteFetchExecutor.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Runs an AbstractRemoteFetchExecutor subclass against a fake server that understands
+    version tokens: If-None-Match on single fetches (answered with an empty 304, the way
+    DemoNetworkManager passes one on) and X-Object-Versions on batch fetches (answered
+    with "unchanged" markers).  The server can also be told to ignore tokens, to check the
+    executor skips unchanged objects by itself. */
+
+#import <XCTest/XCTest.h>
+#import "AbstractRemoteFetchExecutor.h"
+#import "NetworkTransactionManager.h"
+#import "JSONHelpers.h"
+
+#define kSingleURL @"http://delta.local/item"
+#define kBatchURL  @"http://delta.local/items"
+
+@interface _DeltaSyncServer : NSObject <AbstractNetworkManager>
+@property (nonatomic, retain) NSMutableDictionary* versions;   // id -> version
+@property (nonatomic) BOOL ignoresTokens;
+@property (nonatomic) int numRequests;
+@property (nonatomic) int numNotModified;
+@property (nonatomic, retain) NSURLRequest* lastRequest;
+@property (nonatomic) int lastStatus;
+@property (nonatomic) int statusOverride;   // answer with this status instead, if it's set
+@end
+
+@implementation _DeltaSyncServer
+
+-(_DeltaSyncServer*) init {
+    if(self = [super init]) {
+        self.versions = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+-(NSMutableURLRequest*) buildURLRequest:(NSString*)urlString forRequestType:(NSString*)requestType {
+    NSMutableURLRequest* request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = requestType;
+    return request;
+}
+
+-(BOOL) overrideTestingURLConnectionClass:(Class)testingURLConnectionClass {
+    return FALSE;
+}
+
+-(NSDictionary*) objectJSON:(NSString*)idstring {
+    return @{ @"id" : idstring, @"version" : [self.versions objectForKey:idstring], @"name" : [@"name of " stringByAppendingString:idstring] };
+}
+
+// The IDs are the query string, comma-separated:
+-(NSData*) responseFor:(NSURLRequest*)request {
+    NSArray* idstrings = [request.URL.query componentsSeparatedByString:@","];
+
+    if(!self.ignoresTokens && idstrings.count == 1) {
+        NSString* ifNoneMatch = [request valueForHTTPHeaderField:@"If-None-Match"];
+        if(ifNoneMatch != nil && [ifNoneMatch isEqualToString:[self.versions objectForKey:[idstrings firstObject]]]) {
+            self.numNotModified++;
+            self.lastStatus = 304;
+            return [NSData data];
+        }
+        return [JSONHelpers toData:[self objectJSON:[idstrings firstObject]]];
+    }
+
+    NSDictionary* known = nil;
+    NSString* header = [request valueForHTTPHeaderField:@"X-Object-Versions"];
+    if(!self.ignoresTokens && header != nil) {
+        known = [NSJSONSerialization JSONObjectWithData:[header dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
+    }
+
+    NSMutableArray* objects = [NSMutableArray array];
+    BOOL anyChanged = FALSE;
+    for(NSString* idstring in idstrings) {
+        if([[known objectForKey:idstring] isEqualToString:[self.versions objectForKey:idstring]]) {
+            [objects addObject:@{ @"id" : idstring, @"unchanged" : @YES }];
+        } else {
+            [objects addObject:[self objectJSON:idstring]];
+            anyChanged = TRUE;
+        }
+    }
+    if(!anyChanged) {
+        return [JSONHelpers toData:@{ @"unchanged" : @YES }];
+    }
+    return [JSONHelpers toData:@{ @"objects" : objects }];
+}
+
+-(void) startNetworkCall:(NSMutableURLRequest*)request
+            withDelegate:(id<NetworkManagerDelegate>)delegate
+            onMainThread:(BOOL)onMainThread
+             withTimeout:(double)timeout
+          withNumRetries:(unsigned)numRetries
+             withContext:(id)context {
+    self.numRequests++;
+    self.lastRequest = request;
+    self.lastStatus = 200;
+    NSData* data = [self responseFor:request];
+    if(self.statusOverride != 0) self.lastStatus = self.statusOverride;
+    if([delegate respondsToSelector:@selector(networkManager:didReceiveResponse:httpStatus:)]) {
+        [delegate networkManager:self didReceiveResponse:context httpStatus:self.lastStatus];
+    }
+    [delegate networkManager:self didSucceed:context data:data];
+    [delegate networkManager:self didFinish:context];
+}
+
+@end
+
+
+// Records what it's asked to apply instead of writing to CoreData:
+@interface _DeltaItemExecutor : AbstractRemoteFetchExecutor
+@property (nonatomic, retain) NSMutableArray* appliedIDs;
+@property (nonatomic) int lastHTTPCode;
+@end
+
+@implementation _DeltaItemExecutor
+
+-(NSMutableURLRequest*) buildURLRequest:(BOOL)isBatch forObjects:(NSSet*)objectIDs {
+    NSArray* sorted = [[objectIDs allObjects] sortedArrayUsingSelector:@selector(compare:)];
+    NSString* url = [NSString stringWithFormat:@"%@?%@", (isBatch ? self.batchUpdateURL : self.singleObjectUpdateURL), [sorted componentsJoinedByString:@","]];
+    return [self.networkTransactionManager.networkManager buildURLRequest:url forRequestType:@"GET"];
+}
+
+-(BOOL) isSuccessJSON:(NSDictionary*)json forHTTPCode:(int)httpStatus {
+    self.lastHTTPCode = httpStatus;
+    return json != nil;
+}
+
+-(BOOL) processJSONToObject:(NSDictionary*)objectJSON {
+    if(self.appliedIDs == nil) self.appliedIDs = [NSMutableArray array];
+    [self.appliedIDs addObject:[objectJSON objectForKey:@"id"]];
+    return TRUE;
+}
+
+@end
+
+
+@interface TestAbstractRemoteFetchExecutor : XCTestCase
+@property (nonatomic, retain) _DeltaSyncServer* server;
+@property (nonatomic, retain) NetworkTransactionManager* transactionManager;
+@property (nonatomic, retain) _DeltaItemExecutor* executor;
+@end
+
+@implementation TestAbstractRemoteFetchExecutor
+
+- (void)setUp {
+    [super setUp];
+    self.server = [[_DeltaSyncServer alloc] init];
+    [self.server.versions setObject:@"v1" forKey:@"a"];
+    [self.server.versions setObject:@"v1" forKey:@"b"];
+    [self.server.versions setObject:@"v1" forKey:@"c"];
+    self.transactionManager = [[NetworkTransactionManager alloc] initWithNetworkManager:self.server];
+    self.executor = [[_DeltaItemExecutor alloc] initWithNetworkTransactionManager:self.transactionManager dataManager:nil
+                                                            singleObjectUpdateURL:kSingleURL batchUpdateURL:kBatchURL];
+    self.executor.batchInterval = 60.0;
+}
+
+- (void)tearDown {
+    self.executor = nil;
+    self.transactionManager = nil;
+    self.server = nil;
+    [super tearDown];
+}
+
+// Fetches now and waits for the handler.  Returns the updated IDs it got:
+-(NSSet*) helperFetch:(NSSet*)idstrings {
+    __block BOOL called = FALSE;
+    __block NSSet* result = nil;
+    [self.executor requestUpdateForObjectsIDs:idstrings handler:^(NSSet* updatedObjects) {
+        called = TRUE;
+        result = updatedObjects;
+    } force:TRUE];
+
+    NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while(!called && [giveUp timeIntervalSinceNow] > 0.0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    XCTAssertTrue(called, @"The fetch handler never came back.");
+    return result;
+}
+
+-(void) testSingleFetchSendsTokenAndSkips304 {
+    XCTAssertEqualObjects([self helperFetch:[NSSet setWithObject:@"a"]], [NSSet setWithObject:@"a"]);
+    XCTAssertNil([self.server.lastRequest valueForHTTPHeaderField:@"If-None-Match"], @"Nothing to send the first time.");
+    XCTAssertEqual(self.executor.lastHTTPCode, 200);
+    XCTAssertEqualObjects([self.executor versionTokenForID:@"a"], @"v1");
+
+    XCTAssertEqualObjects([self helperFetch:[NSSet setWithObject:@"a"]], [NSSet set]);
+    XCTAssertEqualObjects([self.server.lastRequest valueForHTTPHeaderField:@"If-None-Match"], @"v1");
+    XCTAssertEqual(self.server.numNotModified, 1);
+    XCTAssertEqual(self.executor.numUnchangedResponses, (UInt64)1);
+    XCTAssertEqualObjects(self.executor.appliedIDs, @[ @"a" ], @"A 304 shouldn't be applied.");
+
+    // Once it changes on the server, it's applied again:
+    [self.server.versions setObject:@"v2" forKey:@"a"];
+    XCTAssertEqualObjects([self helperFetch:[NSSet setWithObject:@"a"]], [NSSet setWithObject:@"a"]);
+    XCTAssertEqualObjects([self.executor versionTokenForID:@"a"], @"v2");
+    XCTAssertEqual(self.executor.appliedIDs.count, (NSUInteger)2);
+}
+
+// isSuccessJSON: hears the status the server really sent, and a 304 is known by its status
+// even when we had no token to send:
+-(void) testRealStatusReachesTheExecutor {
+    self.server.statusOverride = 203;
+    XCTAssertEqualObjects([self helperFetch:[NSSet setWithObject:@"a"]], [NSSet setWithObject:@"a"]);
+    XCTAssertEqual(self.executor.lastHTTPCode, 203);
+
+    [self.executor setVersionToken:nil forID:@"a"];
+    self.server.statusOverride = 304;
+    XCTAssertEqualObjects([self helperFetch:[NSSet setWithObject:@"a"]], [NSSet set]);
+    XCTAssertEqual(self.executor.numUnchangedResponses, (UInt64)1);
+    XCTAssertEqual(self.executor.appliedIDs.count, (NSUInteger)1);
+}
+
+-(void) testBatchFetchSkipsUnchangedObjects {
+    NSSet* all = [NSSet setWithObjects:@"a", @"b", @"c", nil];
+    XCTAssertEqualObjects([self helperFetch:all], all);
+    XCTAssertEqual(self.executor.numObjectsApplied, (UInt64)3);
+
+    [self.server.versions setObject:@"v2" forKey:@"b"];
+    XCTAssertEqualObjects([self helperFetch:all], [NSSet setWithObject:@"b"]);
+    XCTAssertNotNil([self.server.lastRequest valueForHTTPHeaderField:@"X-Object-Versions"]);
+    XCTAssertEqual(self.executor.numObjectsApplied, (UInt64)4);
+    XCTAssertEqual(self.executor.numObjectsSkipped, (UInt64)2);
+
+    // And with nothing changed, the whole response is one marker:
+    XCTAssertEqualObjects([self helperFetch:all], [NSSet set]);
+    XCTAssertEqual(self.executor.numUnchangedResponses, (UInt64)1);
+    XCTAssertEqual(self.executor.numObjectsApplied, (UInt64)4);
+}
+
+// A server that sends everything anyway still doesn't cause CoreData writes:
+-(void) testMatchingTokensAreSkippedEvenIfServerSendsThem {
+    self.server.ignoresTokens = TRUE;
+    NSSet* all = [NSSet setWithObjects:@"a", @"b", @"c", nil];
+    [self helperFetch:all];
+    XCTAssertEqualObjects([self helperFetch:all], [NSSet set]);
+    XCTAssertEqual(self.executor.numObjectsApplied, (UInt64)3);
+    XCTAssertEqual(self.executor.numObjectsSkipped, (UInt64)3);
+}
+
+// Without a batch URL, several objects go out as single fetches and come back together:
+-(void) testNoBatchURLFetchesSingly {
+    self.executor = [[_DeltaItemExecutor alloc] initWithNetworkTransactionManager:self.transactionManager dataManager:nil
+                                                            singleObjectUpdateURL:kSingleURL batchUpdateURL:nil];
+    NSSet* all = [NSSet setWithObjects:@"a", @"b", @"c", nil];
+    XCTAssertEqualObjects([self helperFetch:all], all);
+    XCTAssertEqual(self.server.numRequests, 3);
+
+    XCTAssertEqualObjects([self helperFetch:all], [NSSet set]);
+    XCTAssertEqual(self.server.numNotModified, 3);
+}
+
+-(void) testUnforcedRequestsWaitForTheThreshold {
+    self.executor.batchThreshold = 3;
+    [self.executor requestUpdateForObjectsIDs:[NSSet setWithObject:@"a"] handler:nil force:FALSE];
+    [self.executor requestUpdateForObjectsIDs:[NSSet setWithObject:@"b"] handler:nil force:FALSE];
+    XCTAssertEqual(self.server.numRequests, 0);
+
+    [self.executor requestUpdateForObjectsIDs:[NSSet setWithObject:@"c"] handler:nil force:FALSE];
+    XCTAssertEqual(self.server.numRequests, 1);
+    XCTAssertEqualObjects(self.server.lastRequest.URL.query, @"a,b,c");
+}
+
+@end
@@ -0,0 +1,113 @@
+//
+//  TestCallbackExecutor.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "CallbackExecutor.h"
+
+@interface TestCallbackExecutor : XCTestCase
+
+@end
+
+@implementation TestCallbackExecutor
+
+// Spins the main run loop for one short turn:
+-(void) helperRunMainRunLoopOnce {
+    [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+}
+
+// Everything handed to the main thread executor in one turn should run together on the
+// next turn, in order, and never synchronously inside execute:.
+-(void) testMainThreadBatchRunsInOneTurn {
+    CallbackExecutor* executor = [CallbackExecutor mainThreadExecutor];
+    NSMutableArray* order = [[NSMutableArray alloc] init];
+    const int numBlocks = 200;
+
+    for(int i = 0; i < numBlocks; i++) {
+        [executor execute:^{
+            XCTAssertTrue([NSThread isMainThread]);
+            [order addObject:@(i)];
+        }];
+    }
+    XCTAssertEqual(order.count, 0, @"CallbackExecutor must never run blocks synchronously.");
+
+    [self helperRunMainRunLoopOnce];
+    XCTAssertEqual(order.count, numBlocks, @"All blocks pending at the start of a turn should run in that turn.");
+    for(int i = 0; i < numBlocks; i++) {
+        XCTAssertEqualObjects(order[i], @(i), @"Blocks must run in the order they were queued.");
+    }
+}
+
+// With a tiny budget, a batch of slow blocks should be spread out over several turns
+// but still all get run, in order.
+-(void) testMainThreadBatchYieldsWhenOverBudget {
+    CallbackExecutor* executor = [CallbackExecutor mainThreadExecutor];
+    double oldBudget = executor.batchTimeBudget;
+    executor.batchTimeBudget = 0.001;
+
+    NSMutableArray* order = [[NSMutableArray alloc] init];
+    const int numBlocks = 10;
+    for(int i = 0; i < numBlocks; i++) {
+        [executor execute:^{
+            usleep(2000);
+            [order addObject:@(i)];
+        }];
+    }
+
+    [self helperRunMainRunLoopOnce];
+    XCTAssertTrue(order.count >= 1 && order.count < numBlocks, @"A batch over budget should run at least one block and yield the rest.");
+
+    NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:1.0];
+    while(order.count < numBlocks && [giveUp timeIntervalSinceNow] > 0.0) {
+        [self helperRunMainRunLoopOnce];
+    }
+    XCTAssertEqual(order.count, numBlocks);
+    for(int i = 0; i < numBlocks; i++) {
+        XCTAssertEqualObjects(order[i], @(i), @"Blocks must run in the order they were queued, even across turns.");
+    }
+
+    executor.batchTimeBudget = oldBudget;
+}
+
+// Thread pool executors should run their blocks on the pool thread:
+-(void) testThreadPoolExecutor {
+    CallbackExecutor* executor = [CallbackExecutor executorWithThreadPoolIdentifier:@"TestCallbackExecutor"];
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block NSString* threadName = nil;
+
+    [executor execute:^{
+        threadName = [NSThread currentThread].name;
+        dispatch_semaphore_signal(semaphore);
+    }];
+
+    long timedOut = dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1.0 * NSEC_PER_SEC)));
+    XCTAssertEqual(timedOut, 0);
+    XCTAssertTrue([threadName hasPrefix:@"TestCallbackExecutor"], @"Block should run on the pool thread, ran on %@", threadName);
+}
+
+// Queue executors should run their blocks on the queue:
+-(void) testQueueExecutor {
+    dispatch_queue_t queue = dispatch_queue_create("TestCallbackExecutorQueue", DISPATCH_QUEUE_SERIAL);
+    static void* kQueueKey = &kQueueKey;
+    dispatch_queue_set_specific(queue, kQueueKey, kQueueKey, NULL);
+
+    CallbackExecutor* executor = [CallbackExecutor executorWithQueue:queue];
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block BOOL onQueue = FALSE;
+
+    [executor execute:^{
+        onQueue = (dispatch_get_specific(kQueueKey) == kQueueKey);
+        dispatch_semaphore_signal(semaphore);
+    }];
+
+    long timedOut = dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1.0 * NSEC_PER_SEC)));
+    XCTAssertEqual(timedOut, 0);
+    XCTAssertTrue(onQueue);
+}
+
+@end
@@ -0,0 +1,256 @@
+//
+//  TestDataObjectCursor.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Walks DataObjectCursors over a throwaway in-memory store.  The model is built in code:
+    an Item entity (itemID, rank, name) with a to-one owner relationship to an Owner entity.
+    Ranks repeat, so sorting by rank alone has ties and itemID is the tiebreaker. */
+
+#import <XCTest/XCTest.h>
+#import <CoreData/CoreData.h>
+#import "AbstractDataObjectManager.h"
+#import "DataObjectCursor.h"
+#import "LocalTestCoreDataCoordinator.h"
+
+#define kNumItems 1000
+#define kNumRanks 7
+
+@interface TestDataObjectCursor : XCTestCase
+@property (nonatomic, retain) LocalTestCoreDataCoordinator* coordinator;
+@property (nonatomic, retain) AbstractDataObjectManager* manager;
+@end
+
+@implementation TestDataObjectCursor
+
+-(NSAttributeDescription*) helperAttribute:(NSString*)name type:(NSAttributeType)type {
+    NSAttributeDescription* attribute = [[NSAttributeDescription alloc] init];
+    attribute.name = name;
+    attribute.attributeType = type;
+    attribute.optional = YES;
+    return attribute;
+}
+
+-(NSManagedObjectModel*) helperBuildModel {
+    NSEntityDescription* owner = [[NSEntityDescription alloc] init];
+    owner.name = @"Owner";
+    owner.managedObjectClassName = @"NSManagedObject";
+
+    NSEntityDescription* item = [[NSEntityDescription alloc] init];
+    item.name = @"Item";
+    item.managedObjectClassName = @"NSManagedObject";
+
+    NSRelationshipDescription* itemOwner = [[NSRelationshipDescription alloc] init];
+    NSRelationshipDescription* ownerItems = [[NSRelationshipDescription alloc] init];
+    itemOwner.name = @"owner";
+    itemOwner.destinationEntity = owner;
+    itemOwner.minCount = 0;
+    itemOwner.maxCount = 1;
+    itemOwner.inverseRelationship = ownerItems;
+    ownerItems.name = @"items";
+    ownerItems.destinationEntity = item;
+    ownerItems.minCount = 0;
+    ownerItems.maxCount = 0;
+    ownerItems.inverseRelationship = itemOwner;
+
+    owner.properties = @[ [self helperAttribute:@"name" type:NSStringAttributeType], ownerItems ];
+    item.properties = @[ [self helperAttribute:@"itemID" type:NSInteger64AttributeType],
+                         [self helperAttribute:@"rank" type:NSInteger32AttributeType],
+                         [self helperAttribute:@"name" type:NSStringAttributeType],
+                         itemOwner ];
+
+    NSManagedObjectModel* model = [[NSManagedObjectModel alloc] init];
+    model.entities = @[ owner, item ];
+    return model;
+}
+
+- (void)setUp {
+    [super setUp];
+    self.coordinator = [[LocalTestCoreDataCoordinator alloc] initWithInMemoryStoreForModel:[self helperBuildModel]];
+    XCTAssertNotNil(self.coordinator);
+
+    NSManagedObject* owner = [self.coordinator createObject:[self.coordinator getEntityForName:@"Owner"]];
+    [owner setValue:@"someone" forKey:@"name"];
+
+    // Insert in a scrambled order so nothing passes just because of insertion order:
+    NSEntityDescription* itemEntity = [self.coordinator getEntityForName:@"Item"];
+    for(int i = 0; i < kNumItems; i++) {
+        int itemID = (i * 397) % kNumItems;
+        NSManagedObject* item = [self.coordinator createObject:itemEntity];
+        [item setValue:@(itemID) forKey:@"itemID"];
+        [item setValue:@(itemID % kNumRanks) forKey:@"rank"];
+        [item setValue:[NSString stringWithFormat:@"item %d", itemID] forKey:@"name"];
+        [item setValue:owner forKey:@"owner"];
+    }
+    NSError* error = nil;
+    XCTAssertTrue([self.coordinator.context save:&error], @"%@", error);
+
+    self.manager = [[AbstractDataObjectManager alloc] initWithCoreDataCoordinator:self.coordinator withEntity:itemEntity];
+    self.coordinator.numFetches = 0;
+}
+
+- (void)tearDown {
+    self.manager = nil;
+    self.coordinator = nil;
+    [super tearDown];
+}
+
+// Pages through the whole cursor and returns every row, checking the page sizes as it goes:
+-(NSArray*) helperDrain:(DataObjectCursor*)cursor {
+    NSMutableArray* rows = [NSMutableArray array];
+    for(int pages = 0; pages < kNumItems + 2; pages++) {
+        NSArray* page = [cursor nextPage];
+        XCTAssertNotNil(page);
+        XCTAssertLessThanOrEqual(page.count, cursor.pageSize);
+        if(page.count == 0) break;
+        [rows addObjectsFromArray:page];
+    }
+    XCTAssertFalse(cursor.hasMore);
+    XCTAssertEqual(cursor.numObjectsFetched, rows.count);
+    return rows;
+}
+
+// The rows' values for key, in order:
+-(NSArray*) helperValues:(NSArray*)rows forKey:(NSString*)key {
+    NSMutableArray* values = [NSMutableArray arrayWithCapacity:rows.count];
+    for(id row in rows) {
+        [values addObject:[row valueForKey:key]];
+    }
+    return values;
+}
+
+// What the whole query returns in one go, to compare the pages against:
+-(NSArray*) helperExpectedIDs:(NSPredicate*)predicate sortDescriptors:(NSArray*)sortDescriptors {
+    NSFetchRequest* request = [[NSFetchRequest alloc] init];
+    request.entity = self.manager.entity;
+    request.predicate = predicate;
+    request.sortDescriptors = sortDescriptors;
+    return [self helperValues:[self.coordinator executeFetchRequest:request] forKey:@"itemID"];
+}
+
+-(void) testKeysetPagingReturnsEveryRowOnceInOrder {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"rank" ascending:YES],
+                       [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 64;
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(cursor.effectivePaging, DataObjectCursorPagingKeyset);
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:nil sortDescriptors:sort]);
+    XCTAssertEqual(cursor.numPagesFetched, (NSUInteger)((kNumItems + 63) / 64));
+}
+
+-(void) testKeysetPagingDescendingWithPredicate {
+    NSPredicate* predicate = [NSPredicate predicateWithFormat:@"itemID >= 100"];
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"rank" ascending:NO],
+                       [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:predicate sortDescriptors:sort];
+    cursor.pageSize = 50;
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(rows.count, (NSUInteger)(kNumItems - 100));
+    XCTAssertEqual([cursor count], (NSUInteger)(kNumItems - 100));
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:predicate sortDescriptors:sort]);
+}
+
+-(void) testOffsetPaging {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:NO] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 100;
+    cursor.paging = DataObjectCursorPagingOffset;
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(cursor.effectivePaging, DataObjectCursorPagingOffset);
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:nil sortDescriptors:sort]);
+
+    // An exact multiple of the page size takes one more (empty) page to find the end:
+    XCTAssertEqual(cursor.numPagesFetched, (NSUInteger)(kNumItems / 100 + 1));
+}
+
+// A sort the database can't compare the same way falls back to offset, but still works:
+-(void) testUnsupportedSortFallsBackToOffset {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"name" ascending:YES selector:@selector(localizedStandardCompare:)] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 128;
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(cursor.effectivePaging, DataObjectCursorPagingOffset);
+    XCTAssertEqual(rows.count, (NSUInteger)kNumItems);
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:nil sortDescriptors:sort]);
+}
+
+// A nil sort value mid-walk switches to offset without losing or repeating rows:
+-(void) testNilSortValueSwitchesToOffset {
+    NSFetchRequest* request = [[NSFetchRequest alloc] init];
+    request.entity = self.manager.entity;
+    request.predicate = [NSPredicate predicateWithFormat:@"itemID == 19"];
+    NSManagedObject* item = [[self.coordinator executeFetchRequest:request] firstObject];
+    [item setValue:nil forKey:@"rank"];
+    [self.coordinator.context save:nil];
+
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"rank" ascending:YES],
+                       [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 1;
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(cursor.effectivePaging, DataObjectCursorPagingOffset);
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:nil sortDescriptors:sort]);
+}
+
+-(void) testPropertySubsetsComeBackAsDictionaries {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 300;
+    cursor.propertiesToFetch = @[ @"name" ];
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqual(rows.count, (NSUInteger)kNumItems);
+    XCTAssertEqual(cursor.effectivePaging, DataObjectCursorPagingKeyset);
+
+    NSDictionary* row = [rows objectAtIndex:42];
+    XCTAssertTrue([row isKindOfClass:[NSDictionary class]]);
+    XCTAssertEqualObjects([row objectForKey:@"name"], @"item 42");
+    XCTAssertEqualObjects([row objectForKey:@"itemID"], @42, @"The sort key should come along for keyset paging.");
+    XCTAssertNil([row objectForKey:@"rank"]);
+
+    NSManagedObjectID* objectID = [row objectForKey:kDataObjectCursorObjectIDKey];
+    XCTAssertTrue([objectID isKindOfClass:[NSManagedObjectID class]]);
+    XCTAssertEqualObjects([[self.coordinator.context objectWithID:objectID] valueForKey:@"itemID"], @42);
+}
+
+-(void) testPrefetchAndBatchSizeDontChangeResults {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 200;
+    cursor.fetchBatchSize = 20;
+    cursor.relationshipKeyPathsForPrefetching = @[ @"owner" ];
+
+    NSArray* rows = [self helperDrain:cursor];
+    XCTAssertEqualObjects([self helperValues:rows forKey:@"itemID"], [self helperExpectedIDs:nil sortDescriptors:sort]);
+    XCTAssertEqualObjects([[rows lastObject] valueForKeyPath:@"owner.name"], @"someone");
+}
+
+-(void) testResetStartsOver {
+    NSArray* sort = @[ [NSSortDescriptor sortDescriptorWithKey:@"itemID" ascending:YES] ];
+    DataObjectCursor* cursor = [self.manager cursorWithPredicate:nil sortDescriptors:sort];
+    cursor.pageSize = 10;
+
+    NSArray* first = [cursor nextPage];
+    [cursor nextPage];
+    [cursor reset];
+    XCTAssertEqual(cursor.numPagesFetched, (NSUInteger)0);
+    XCTAssertTrue(cursor.hasMore);
+    XCTAssertEqualObjects([self helperValues:[cursor nextPage] forKey:@"itemID"], [self helperValues:first forKey:@"itemID"]);
+
+    // Once it's run out, it stops asking the coordinator:
+    [self helperDrain:cursor];
+    int numFetches = self.coordinator.numFetches;
+    XCTAssertEqual([cursor nextPage].count, (NSUInteger)0);
+    XCTAssertEqual(self.coordinator.numFetches, numFetches);
+}
+
+@end
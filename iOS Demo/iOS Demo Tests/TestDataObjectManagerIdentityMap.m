@@ -0,0 +1,195 @@
+//
+//  TestDataObjectManagerIdentityMap.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Checks that AbstractDataObjectManager's identity map saves fetches on get: and stays
+    right as objects are created, saved and deleted - through the manager and behind its
+    back.  Runs against an in-memory store with a one-entity model built in code. */
+
+#import <XCTest/XCTest.h>
+#import <CoreData/CoreData.h>
+#import "AbstractDataObjectManager.h"
+#import "LocalTestCoreDataCoordinator.h"
+
+// A manager subclassed the way AbstractDataObjectManager.h says to:
+@interface _ItemManager : AbstractDataObjectManager
+@end
+
+@implementation _ItemManager
+
+-(NSManagedObject*) get:(NSString*)idstring {
+    return [self getByID:idstring];
+}
+
+-(NSManagedObject*) create:(NSString*)idstring {
+    @synchronized(self) {
+        NSManagedObject* obj = [self get:idstring];
+        if(obj == nil) {
+            obj = [self.coordinator createObject:self.entity];
+            [obj setValue:idstring forKey:@"id"];
+            [self rememberObject:obj forID:idstring];
+        }
+        return obj;
+    }
+}
+
+-(void) deleteObj:(NSManagedObject*)obj {
+    @synchronized(self) {
+        [self.coordinator deleteObject:obj];
+        [self forgetObject:obj];
+    }
+}
+
+@end
+
+
+@interface TestDataObjectManagerIdentityMap : XCTestCase
+@property (nonatomic, retain) LocalTestCoreDataCoordinator* coordinator;
+@property (nonatomic, retain) _ItemManager* manager;
+@end
+
+@implementation TestDataObjectManagerIdentityMap
+
+- (void)setUp {
+    [super setUp];
+    NSAttributeDescription* idAttribute = [[NSAttributeDescription alloc] init];
+    idAttribute.name = @"id";
+    idAttribute.attributeType = NSStringAttributeType;
+    NSAttributeDescription* nameAttribute = [[NSAttributeDescription alloc] init];
+    nameAttribute.name = @"name";
+    nameAttribute.attributeType = NSStringAttributeType;
+    nameAttribute.optional = YES;
+
+    NSEntityDescription* item = [[NSEntityDescription alloc] init];
+    item.name = @"Item";
+    item.managedObjectClassName = @"NSManagedObject";
+    item.properties = @[ idAttribute, nameAttribute ];
+    NSManagedObjectModel* model = [[NSManagedObjectModel alloc] init];
+    model.entities = @[ item ];
+
+    self.coordinator = [[LocalTestCoreDataCoordinator alloc] initWithInMemoryStoreForModel:model];
+    XCTAssertNotNil(self.coordinator);
+    self.manager = [[_ItemManager alloc] initWithCoreDataCoordinator:self.coordinator withEntity:[self.coordinator getEntityForName:@"Item"]];
+}
+
+- (void)tearDown {
+    self.manager = nil;
+    self.coordinator = nil;
+    [super tearDown];
+}
+
+// Inserts and saves an item without going through the manager:
+-(NSManagedObject*) helperInsertBehindManager:(NSString*)idstring {
+    NSManagedObject* obj = [self.coordinator createObject:self.manager.entity];
+    [obj setValue:idstring forKey:@"id"];
+    XCTAssertTrue([self.coordinator.context save:nil]);
+    return obj;
+}
+
+-(void) testCreatedObjectsAreHitsWithoutFetching {
+    NSManagedObject* created = [self.manager create:@"a"];
+    XCTAssertEqual(self.coordinator.numFetches, 1, @"create: checks the store once.");
+
+    for(int i = 0; i < 10; i++) {
+        XCTAssertEqual([self.manager get:@"a"], created);
+    }
+    XCTAssertEqual(self.coordinator.numFetches, 1);
+    XCTAssertEqual(self.manager.identityMapHits, (UInt64)10);
+    XCTAssertEqual(self.manager.identityMapMisses, (UInt64)1);
+}
+
+// Still a hit after the save swaps the temporary object ID for a permanent one:
+-(void) testSaveReplacesTemporaryObjectIDs {
+    NSManagedObject* created = [self.manager create:@"a"];
+    XCTAssertTrue(created.objectID.isTemporaryID);
+    XCTAssertTrue([self.coordinator.context save:nil]);
+    XCTAssertFalse(created.objectID.isTemporaryID);
+
+    int numFetches = self.coordinator.numFetches;
+    XCTAssertEqual([self.manager get:@"a"], created);
+    XCTAssertEqual(self.coordinator.numFetches, numFetches);
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)1);
+}
+
+// Objects inserted elsewhere are picked up from the save notification:
+-(void) testObjectsSavedBehindTheManagerAreHits {
+    NSManagedObject* inserted = [self helperInsertBehindManager:@"b"];
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)1);
+
+    XCTAssertEqual([self.manager get:@"b"], inserted);
+    XCTAssertEqual(self.coordinator.numFetches, 0);
+    XCTAssertEqual(self.manager.identityMapHits, (UInt64)1);
+}
+
+// Saves to another store don't touch the map, even for the same entity:
+-(void) testSavesToOtherStoresAreIgnored {
+    LocalTestCoreDataCoordinator* other = [[LocalTestCoreDataCoordinator alloc] initWithInMemoryStoreForModel:self.manager.entity.managedObjectModel];
+    NSManagedObject* elsewhere = [other createObject:[other getEntityForName:@"Item"]];
+    [elsewhere setValue:@"x" forKey:@"id"];
+    XCTAssertTrue([other.context save:nil]);
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)0);
+
+    XCTAssertNil([self.manager get:@"x"]);
+    XCTAssertEqual(self.coordinator.numFetches, 1);
+}
+
+// Something the map hasn't seen is fetched once, then remembered:
+-(void) testMissFetchesOnceThenHits {
+    NSManagedObject* inserted = [self helperInsertBehindManager:@"c"];
+    [self.manager clearIdentityMap];
+
+    XCTAssertEqual([self.manager get:@"c"], inserted);
+    XCTAssertEqual([self.manager get:@"c"], inserted);
+    XCTAssertEqual(self.coordinator.numFetches, 1);
+    XCTAssertEqual(self.manager.identityMapMisses, (UInt64)1);
+    XCTAssertEqual(self.manager.identityMapHits, (UInt64)1);
+}
+
+// IDs that don't exist aren't remembered, so they miss every time:
+-(void) testMissingIDsAreNotCached {
+    XCTAssertNil([self.manager get:@"nope"]);
+    XCTAssertNil([self.manager get:@"nope"]);
+    XCTAssertEqual(self.coordinator.numFetches, 2);
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)0);
+}
+
+-(void) testDeleteThroughManager {
+    NSManagedObject* created = [self.manager create:@"d"];
+    XCTAssertTrue([self.coordinator.context save:nil]);
+
+    [self.manager deleteObj:created];
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)0);
+    XCTAssertTrue([self.coordinator.context save:nil]);
+    XCTAssertNil([self.manager get:@"d"]);
+}
+
+// A delete saved elsewhere takes the ID out of the map:
+-(void) testDeleteBehindTheManager {
+    NSManagedObject* inserted = [self helperInsertBehindManager:@"e"];
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)1);
+
+    [self.coordinator.context deleteObject:inserted];
+    XCTAssertNil([self.manager get:@"e"], @"A pending delete shouldn't come back from get:.");
+    XCTAssertTrue([self.coordinator.context save:nil]);
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)0);
+    XCTAssertNil([self.manager get:@"e"]);
+}
+
+// Changing an object's ID moves its entry:
+-(void) testChangedIDsAreRemapped {
+    NSManagedObject* inserted = [self helperInsertBehindManager:@"f"];
+    [inserted setValue:@"g" forKey:@"id"];
+    XCTAssertTrue([self.coordinator.context save:nil]);
+
+    XCTAssertEqual(self.manager.identityMapCount, (NSUInteger)1);
+    int numFetches = self.coordinator.numFetches;
+    XCTAssertEqual([self.manager get:@"g"], inserted);
+    XCTAssertEqual(self.coordinator.numFetches, numFetches);
+    XCTAssertNil([self.manager get:@"f"]);
+}
+
+@end
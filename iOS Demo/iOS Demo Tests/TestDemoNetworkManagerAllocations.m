@@ -0,0 +1,213 @@
+//
+//  TestDemoNetworkManagerAllocations.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Counts heap allocations on DemoNetworkManager's call path once it's warmed up.  A manual
+    bridge hands out the same connection object every time, and the test answers every call
+    on the spot with a canned response, so what's left is (nearly) all the manager's own doing.
+    Allocations are counted with malloc_logger, the hook malloc stack logging uses, and only
+    on the test's thread.
+
+    The exact number moves with the OS, so the ceiling on it is a generous one.  The tighter
+    checks are that the number per call stays put however many calls go through, and that
+    the manager's call objects (and NetworkTransactionManager's callback wrappers) come out
+    of their pools instead of being allocated.  Watch the log for the numbers. */
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import <pthread.h>
+#import "DemoNetworkManager.h"
+#import "NetworkTransactionManager.h"
+#import "ManualTestURLConnectionBridge.h"
+
+#define kNumWarmUpCalls 100
+#define kNumShortRun    200
+#define kNumLongRun     800
+#define kNumTransactions 200
+
+// Allocations one call can make, tops.  Building the request is most of what it costs now:
+#define kMaxAllocationsPerCall 100.0
+
+
+#pragma mark - Counting allocations
+
+// This is private to libmalloc, but it's been there (and been used like this) for years:
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern malloc_logger_t* malloc_logger;
+
+#define kMallocLogTypeAllocate 2
+
+static malloc_logger_t* s_previousMallocLogger = NULL;
+static pthread_t s_countingThread;
+static volatile UInt64 s_numAllocations = 0;
+
+// Called for every malloc and free in the process.  It mustn't allocate anything itself:
+static void countingMallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip) {
+    if((type & kMallocLogTypeAllocate) && pthread_equal(pthread_self(), s_countingThread)) {
+        s_numAllocations++;
+    }
+    if(s_previousMallocLogger != NULL) {
+        s_previousMallocLogger(type, arg1, arg2, arg3, result, num_hot_frames_to_skip + 1);
+    }
+}
+
+
+#pragma mark - Tests
+
+@interface TestDemoNetworkManagerAllocations : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) DemoNetworkManager* manager;
+@property (nonatomic, retain) ManualTestURLConnectionBridge* bridge;
+@property (nonatomic, retain) NSHTTPURLResponse* response;
+@property (nonatomic, retain) NSData* body;
+@property (nonatomic) int numSucceeded;
+@property (nonatomic) int numFailed;
+
+@end
+
+@implementation TestDemoNetworkManagerAllocations
+
+- (void)setUp {
+    [super setUp];
+    self.bridge = [[ManualTestURLConnectionBridge alloc] init];
+    self.bridge.reusesOneConnection = TRUE;
+    self.body = [[NSMutableData alloc] initWithLength:512];
+    self.response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://allocations.local/item"] statusCode:200
+                                               HTTPVersion:@"HTTP/1.1" headerFields:@{ @"Content-Length" : @"512" }];
+    self.manager = [[DemoNetworkManager alloc] init];
+    self.manager.connectionBridge = self.bridge;
+    self.numSucceeded = 0;
+    self.numFailed = 0;
+}
+
+- (void)tearDown {
+    self.manager = nil;
+    self.bridge = nil;
+    self.response = nil;
+    self.body = nil;
+    [super tearDown];
+}
+
+// Sends numCalls calls one after another and returns how many allocations they made:
+-(UInt64) helperRunCalls:(int)numCalls {
+    s_countingThread = pthread_self();
+    s_numAllocations = 0;
+    s_previousMallocLogger = malloc_logger;
+    malloc_logger = countingMallocLogger;
+
+    for(int i = 0; i < numCalls; i++) {
+        @autoreleasepool {
+            NSMutableURLRequest* request = [self.manager buildURLRequest:@"http://allocations.local/item" forRequestType:@"GET"];
+            [self.manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:8.0 withNumRetries:0 withContext:@(i)];
+            [self.bridge.lastConnection finishWithResponse:self.response body:self.body];
+        }
+    }
+
+    malloc_logger = s_previousMallocLogger;
+    return s_numAllocations;
+}
+
+-(void) testSteadyStateAllocationsPerCallAreConstant {
+    [self helperRunCalls:kNumWarmUpCalls];
+    NetworkManagerStatistics* warmedUp = [self.manager currentStatistics];
+
+    UInt64 shortRun = [self helperRunCalls:kNumShortRun];
+    UInt64 longRun = [self helperRunCalls:kNumLongRun];
+    NetworkManagerStatistics* done = [self.manager currentStatistics];
+
+    double perCallShort = (double)shortRun / kNumShortRun;
+    double perCallLong = (double)longRun / kNumLongRun;
+    NSLog(@"DemoNetworkManager allocations per call: %.1lf over %d calls, %.1lf over %d calls.  Call objects: %llu allocated, %llu reused",
+          perCallShort, kNumShortRun, perCallLong, kNumLongRun, done.totalCallObjectsAllocated, done.totalCallObjectsReused);
+
+    XCTAssertEqual(self.numSucceeded, kNumWarmUpCalls + kNumShortRun + kNumLongRun);
+    XCTAssertEqual(self.numFailed, 0);
+
+    // Once warmed up, every call should reuse a call object:
+    XCTAssertEqual(done.totalCallObjectsAllocated, warmedUp.totalCallObjectsAllocated, @"Steady-state calls shouldn't allocate call objects.");
+    XCTAssertEqual(done.totalCallObjectsReused - warmedUp.totalCallObjectsReused, (UInt64)(kNumShortRun + kNumLongRun));
+
+    // And the rest of the cost per call shouldn't creep up the more calls go through:
+    XCTAssertGreaterThan(perCallShort, 0.0, @"The malloc hook didn't count anything - is it still there?");
+    XCTAssertLessThanOrEqual(perCallLong, perCallShort * 1.1 + 1.0, @"Allocations per call grew with the number of calls.");
+    
+    // Nor should it be much more than it is now, however steady:
+    XCTAssertLessThanOrEqual(perCallShort, kMaxAllocationsPerCall, @"A call allocates more than it used to.");
+    XCTAssertLessThanOrEqual(perCallLong, kMaxAllocationsPerCall, @"A call allocates more than it used to.");
+}
+
+// Transactions sent through a NetworkTransactionManager, one after another, should reuse its
+// callback wrappers the same way.  Each one waits for its call to start on the manager's
+// network thread, gets answered from here, and waits for its callback.  A wrapper goes back
+// in the pool just after its callback, so the next transaction can beat it there now and then;
+// that's the most the pool should ever have to make:
+-(void) testTransactionManagerReusesCallbackWrappers {
+    NSData* json = [@"{\"ok\":1}" dataUsingEncoding:NSUTF8StringEncoding];
+    NSHTTPURLResponse* response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://allocations.local/item"] statusCode:200 HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{ @"Content-Length" : [NSString stringWithFormat:@"%lu", (unsigned long)json.length] }];
+    NetworkTransactionManager* transactionManager = [[NetworkTransactionManager alloc] initWithNetworkManager:self.manager];
+    CallbackExecutor* executor = [CallbackExecutor executorWithQueue:dispatch_queue_create("TestDemoNetworkManagerAllocations", DISPATCH_QUEUE_SERIAL)];
+    dispatch_semaphore_t delivered = dispatch_semaphore_create(0);
+    __block int numTransactionsSucceeded = 0;
+    
+    for(int i = 0; i < kNumTransactions; i++) {
+        @autoreleasepool {
+            [transactionManager get:@"http://allocations.local/item" withData:nil success:^(NSDictionary* jsonData) {
+                numTransactionsSucceeded++;
+                dispatch_semaphore_signal(delivered);
+            } failure:^(NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary* jsonData) {
+                dispatch_semaphore_signal(delivered);
+            } callbackExecutor:executor];
+            
+            // The connection lets go of its delegate when it's answered, and gets the next call's when it starts:
+            NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:5.0];
+            while(self.bridge.lastConnection.manualDelegate == nil && [giveUp timeIntervalSinceNow] > 0.0) {
+                usleep(100);
+            }
+            XCTAssertNotNil(self.bridge.lastConnection.manualDelegate, @"Transaction %d never started", i);
+            [self.bridge.lastConnection finishWithResponse:response body:json];
+            
+            XCTAssertEqual(dispatch_semaphore_wait(delivered, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC))), 0);
+        }
+    }
+    
+    NSLog(@"NetworkTransactionManager callback wrappers over %d transactions: %llu allocated, %llu reused",
+          kNumTransactions, transactionManager.numCallbackWrappersAllocated, transactionManager.numCallbackWrappersReused);
+    XCTAssertEqual(numTransactionsSucceeded, kNumTransactions);
+    XCTAssertEqual(transactionManager.numCallbackWrappersAllocated + transactionManager.numCallbackWrappersReused, (UInt64)kNumTransactions);
+    XCTAssertLessThanOrEqual(transactionManager.numCallbackWrappersAllocated, (UInt64)2);
+}
+
+// Canceled calls go back in the pool too:
+-(void) testCanceledCallsAreReused {
+    for(int i = 0; i < 10; i++) {
+        NSMutableURLRequest* request = [self.manager buildURLRequest:@"http://allocations.local/item" forRequestType:@"GET"];
+        [self.manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:8.0 withNumRetries:0 withContext:@(i)];
+        [self.manager cancelForDelegate:self withContext:@(i)];
+    }
+
+    NetworkManagerStatistics* statistics = [self.manager currentStatistics];
+    XCTAssertEqual(statistics.totalCallObjectsAllocated, (UInt64)1);
+    XCTAssertEqual(statistics.totalCallObjectsReused, (UInt64)9);
+    XCTAssertEqual(statistics.numCallsInFlight, (UInt64)0);
+    XCTAssertEqual(self.numSucceeded, 0);
+    XCTAssertEqual(self.numFailed, 0);
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    self.numSucceeded++;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    self.numFailed++;
+}
+
+@end
@@ -0,0 +1,239 @@
+//
+//  TestDemoNetworkManagerMemoryBudget.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Tests DemoNetworkManager's response memory budget: the buffered byte count and its high
+    water mark, spilling big bodies to disk once we're over budget, and holding low-priority
+    calls back until there's room.  A manual bridge lets each test hand out response bytes
+    exactly when it wants to, on the test's thread. */
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "DemoNetworkManager.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "ManualTestURLConnectionBridge.h"
+
+
+@interface TestDemoNetworkManagerMemoryBudget : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) ManualTestURLConnectionBridge* bridge;
+@property (nonatomic, retain) DemoNetworkManager* manager;
+
+// Callbacks, by context (the path):
+@property (nonatomic, retain) NSMutableArray* started;
+@property (nonatomic, retain) NSMutableDictionary* bodies;
+@property (nonatomic, retain) NSMutableArray* savedFiles;
+@property (nonatomic) int numFailures;
+
+@end
+
+@implementation TestDemoNetworkManagerMemoryBudget
+
+- (void)setUp {
+    [super setUp];
+    self.bridge = [[ManualTestURLConnectionBridge alloc] init];
+    self.manager = [[DemoNetworkManager alloc] init];
+    self.manager.connectionBridge = self.bridge;
+    self.started = [[NSMutableArray alloc] init];
+    self.bodies = [[NSMutableDictionary alloc] init];
+    self.savedFiles = [[NSMutableArray alloc] init];
+    self.numFailures = 0;
+}
+
+- (void)tearDown {
+    self.manager = nil;
+    self.bridge = nil;
+    [super tearDown];
+}
+
+// A plain request, which never waits for memory:
+-(void) helperStart:(NSString*)path {
+    NSMutableURLRequest* request = [self.manager buildURLRequest:[@"http://budget.example.com" stringByAppendingString:path] forRequestType:@"GET"];
+    [self.manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:8.0 withNumRetries:0 withContext:path];
+}
+
+-(void) helperStart:(NSString*)path priority:(NKCallPriority)priority {
+    NKCallBehaviorURLRequest* request = [[NKCallBehaviorURLRequest alloc] init];
+    request.URL = [NSURL URLWithString:[@"http://budget.example.com" stringByAppendingString:path]];
+    request.priority = priority;
+    [self.manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:8.0 withNumRetries:0 withContext:path];
+}
+
+// numBytes of a pattern that depends on seed, so pieces of a body can be told apart:
+-(NSData*) helperBytes:(NSUInteger)numBytes seed:(int)seed {
+    NSMutableData* data = [NSMutableData dataWithLength:numBytes];
+    uint8_t* bytes = data.mutableBytes;
+    for(NSUInteger i = 0; i < numBytes; i++) {
+        bytes[i] = (uint8_t)(i * 7 + seed * 31);
+    }
+    return data;
+}
+
+-(NetworkManagerStatistics*) stats {
+    return [self.manager currentStatistics];
+}
+
+
+#pragma mark - Tests
+
+-(void) testBufferedBytesAndHighWaterMark {
+    [self helperStart:@"/a"];
+    [self helperStart:@"/b"];
+    ManualTestURLConnection* a = [self.bridge connectionForPath:@"/a"];
+    ManualTestURLConnection* b = [self.bridge connectionForPath:@"/b"];
+
+    [a respondWithStatus:200 contentLength:100000];
+    [b respondWithStatus:200 contentLength:50000];
+    [a sendBytes:[self helperBytes:100000 seed:1]];
+    [b sendBytes:[self helperBytes:50000 seed:2]];
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)150000);
+    XCTAssertEqual(self.stats.bufferedResponseBytesHighWater, (UInt64)150000);
+
+    [a finish];
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)50000);
+    XCTAssertEqual(self.stats.bufferedResponseBytesHighWater, (UInt64)150000);
+    XCTAssertEqual([[self.bodies objectForKey:@"/a"] length], (NSUInteger)100000);
+
+    [b finish];
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)0);
+    XCTAssertEqual(self.stats.totalBodiesSpilledToDisk, (UInt64)0);
+}
+
+// Without a budget nothing is ever spilled or held, however much comes in:
+-(void) testNoBudgetMeansNoLimit {
+    [self helperStart:@"/big"];
+    ManualTestURLConnection* big = [self.bridge connectionForPath:@"/big"];
+    [big respondWithStatus:200 contentLength:4000000];
+    [big sendBytes:[self helperBytes:4000000 seed:1]];
+
+    [self helperStart:@"/low" priority:NKCallPriorityBkg];
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/big", @"/low"]));
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)4000000);
+    XCTAssertEqual(self.stats.totalBodiesSpilledToDisk, (UInt64)0);
+}
+
+-(void) testBigBodySpillsToDiskOverBudget {
+    self.manager.responseMemoryBudget = 100000;
+    self.manager.spillThresholdBytes = 60000;
+
+    [self helperStart:@"/big"];
+    ManualTestURLConnection* big = [self.bridge connectionForPath:@"/big"];
+    [big respondWithStatus:200 contentLength:200000];
+
+    NSMutableData* expected = [[NSMutableData alloc] init];
+    for(int i = 0; i < 4; i++) {
+        NSData* chunk = [self helperBytes:50000 seed:i];
+        [expected appendData:chunk];
+        [big sendBytes:chunk];
+
+        // The chunk that tips us over the budget gets the body moved out right away:
+        XCTAssertLessThanOrEqual(self.stats.bufferedResponseBytes, (UInt64)100000);
+    }
+    XCTAssertEqual(self.stats.totalBodiesSpilledToDisk, (UInt64)1);
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)0);
+    XCTAssertEqual(self.stats.bufferedResponseBytesHighWater, (UInt64)150000);
+
+    [big finish];
+    XCTAssertEqualObjects([self.bodies objectForKey:@"/big"], expected, @"The spilled body should come back whole.");
+    XCTAssertEqual(self.savedFiles.count, (NSUInteger)0, @"A spilled body isn't a download - nobody should be told about the file.");
+    XCTAssertEqual(self.numFailures, 0);
+}
+
+// Small bodies stay in memory even over budget - it's not worth a file each:
+-(void) testSmallBodiesDontSpill {
+    self.manager.responseMemoryBudget = 100000;
+    self.manager.spillThresholdBytes = 60000;
+
+    for(NSString* path in @[@"/1", @"/2", @"/3"]) {
+        [self helperStart:path];
+        ManualTestURLConnection* connection = [self.bridge connectionForPath:path];
+        [connection respondWithStatus:200 contentLength:50000];
+        [connection sendBytes:[self helperBytes:50000 seed:1]];
+    }
+    XCTAssertEqual(self.stats.bufferedResponseBytes, (UInt64)150000);
+    XCTAssertEqual(self.stats.totalBodiesSpilledToDisk, (UInt64)0);
+}
+
+-(void) testLowPriorityCallsWaitWhileOverBudget {
+    self.manager.responseMemoryBudget = 100000;
+    self.manager.spillThresholdBytes = 10000000;
+
+    [self helperStart:@"/big"];
+    ManualTestURLConnection* big = [self.bridge connectionForPath:@"/big"];
+    [big respondWithStatus:200 contentLength:150000];
+    [big sendBytes:[self helperBytes:150000 seed:1]];
+
+    [self helperStart:@"/low" priority:NKCallPriorityLow];
+    [self helperStart:@"/bkg" priority:NKCallPriorityBkg];
+    [self helperStart:@"/medium" priority:NKCallPriorityMedium];
+    [self helperStart:@"/plain"];
+
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/big", @"/medium", @"/plain"]));
+    XCTAssertEqual(self.stats.numCallsWaitingForMemory, (UInt64)2);
+    XCTAssertEqual(self.stats.numCallsInFlight, (UInt64)3);
+    XCTAssertEqual(self.stats.totalCallsHeldForMemory, (UInt64)2);
+    XCTAssertEqualObjects(self.started, (@[@"/big", @"/low", @"/bkg", @"/medium", @"/plain"]), @"Held calls are still started as far as the delegate knows.");
+
+    // Once the big body is handed off, the held calls go, in order:
+    [big finish];
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/big", @"/medium", @"/plain", @"/low", @"/bkg"]));
+    XCTAssertEqual(self.stats.numCallsWaitingForMemory, (UInt64)0);
+}
+
+-(void) testRaisingBudgetReleasesWaitingCalls {
+    self.manager.responseMemoryBudget = 100000;
+    self.manager.spillThresholdBytes = 10000000;
+
+    [self helperStart:@"/big"];
+    ManualTestURLConnection* big = [self.bridge connectionForPath:@"/big"];
+    [big respondWithStatus:200 contentLength:150000];
+    [big sendBytes:[self helperBytes:150000 seed:1]];
+    [self helperStart:@"/low" priority:NKCallPriorityLow];
+    XCTAssertEqual(self.stats.numCallsWaitingForMemory, (UInt64)1);
+
+    self.manager.responseMemoryBudget = 0;
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/big", @"/low"]));
+}
+
+-(void) testCanceledWaitingCallNeverStarts {
+    self.manager.responseMemoryBudget = 100000;
+    self.manager.spillThresholdBytes = 10000000;
+
+    [self helperStart:@"/big"];
+    ManualTestURLConnection* big = [self.bridge connectionForPath:@"/big"];
+    [big respondWithStatus:200 contentLength:150000];
+    [big sendBytes:[self helperBytes:150000 seed:1]];
+    [self helperStart:@"/low" priority:NKCallPriorityLow];
+
+    [self.manager cancelForDelegate:self withContext:@"/low"];
+    XCTAssertEqual(self.stats.numCallsWaitingForMemory, (UInt64)0);
+
+    [big finish];
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/big"]));
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didStartCall:(id)context {
+    [self.started addObject:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    [self.bodies setObject:(data != nil) ? data : [NSData data] forKey:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    self.numFailures++;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSaveFile:(id)context fileURL:(NSURL*)fileURL {
+    [self.savedFiles addObject:fileURL];
+}
+
+@end
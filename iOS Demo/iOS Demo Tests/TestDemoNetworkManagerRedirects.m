@@ -0,0 +1,190 @@
+//
+//  TestDemoNetworkManagerRedirects.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "DemoNetworkManager.h"
+#import "NetworkManagerStatistics.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "LocalTestHTTPServer.h"
+
+#define kTestTimeout    10.0
+
+// A local server with the same shape as our CDN paths: /asset is a permanent redirect to
+// /cdn, which is a temporary redirect to /edge, which serves the body.
+
+@interface TestDemoNetworkManagerRedirects : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) DemoNetworkManager* networkManager;
+@property (nonatomic, retain) LocalTestHTTPServer* server;
+@property (nonatomic, retain) NSData* body;
+
+// What the server saw, in order, how many /edge requests to drop before serving one, and
+// how many /cdn requests to answer with a 404 first:
+@property (atomic, retain) NSMutableArray* requestedPaths;
+@property (atomic) int numEdgeDropsLeft;
+@property (atomic) int numCDNMissesLeft;
+
+// What came back:
+@property (nonatomic) BOOL finished;
+@property (nonatomic, retain) NSData* receivedData;
+@property (nonatomic, retain) NSMutableArray* redirects;
+
+@end
+
+@implementation TestDemoNetworkManagerRedirects
+
+- (void)setUp {
+    [super setUp];
+    self.body = [@"the asset" dataUsingEncoding:NSUTF8StringEncoding];
+    self.requestedPaths = [[NSMutableArray alloc] init];
+    self.numEdgeDropsLeft = 0;
+    self.numCDNMissesLeft = 0;
+
+    __weak TestDemoNetworkManagerRedirects* weakSelf = self;
+    self.server = [[LocalTestHTTPServer alloc] initWithHandler:^(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response) {
+        [weakSelf handleRequest:request response:response];
+    }];
+    XCTAssertTrue([self.server start]);
+
+    self.networkManager = [[DemoNetworkManager alloc] init];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [self.server stop];
+    self.server = nil;
+    self.networkManager = nil;
+}
+
+-(void) handleRequest:(LocalTestHTTPRequest*)request response:(LocalTestHTTPResponse*)response {
+    @synchronized (self) {
+        [self.requestedPaths addObject:request.path];
+    }
+
+    if([request.path isEqualToString:@"/asset"]) {
+        response.statusCode = 301;
+        [response.headers setObject:[self.server urlStringForPath:@"/cdn"] forKey:@"Location"];
+    } else if([request.path isEqualToString:@"/cdn"] && self.numCDNMissesLeft > 0) {
+        self.numCDNMissesLeft--;
+        response.statusCode = 404;
+    } else if([request.path isEqualToString:@"/cdn"]) {
+        response.statusCode = 302;
+        [response.headers setObject:[self.server urlStringForPath:@"/edge"] forKey:@"Location"];
+    } else if([request.path isEqualToString:@"/edge"]) {
+        response.body = self.body;
+        if(self.numEdgeDropsLeft > 0) {
+            self.numEdgeDropsLeft--;
+            response.dropAfterBytes = 2;
+        }
+    } else {
+        response.statusCode = 404;
+    }
+}
+
+-(void) helperFetchAsset:(NKRedirectRetryPolicy)policy {
+    self.finished = FALSE;
+    self.receivedData = nil;
+    self.redirects = [[NSMutableArray alloc] init];
+    @synchronized (self) {
+        [self.requestedPaths removeAllObjects];
+    }
+
+    NKCallBehaviorURLRequest* request = [[NKCallBehaviorURLRequest alloc] init];
+    request.URL = [NSURL URLWithString:[self.server urlStringForPath:@"/asset"]];
+    request.HTTPMethod = @"GET";
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    request.redirectRetryPolicy = policy;
+
+    [self.networkManager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:kTestTimeout withNumRetries:3 withContext:self];
+
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(!self.finished && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    XCTAssertTrue(self.finished, @"The call never finished.");
+    XCTAssertEqualObjects(self.receivedData, self.body);
+}
+
+// The second fetch skips the permanent hop but still reports both redirects:
+-(void) testPermanentRedirectIsSkippedNextTime {
+    NSArray* expectedRedirects = @[[self.server urlStringForPath:@"/cdn"], [self.server urlStringForPath:@"/edge"]];
+
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/asset", @"/cdn", @"/edge"]));
+    XCTAssertEqualObjects(self.redirects, expectedRedirects);
+
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/cdn", @"/edge"]));
+    XCTAssertEqualObjects(self.redirects, expectedRedirects);
+
+    NetworkManagerStatistics* stats = [self.networkManager currentStatistics];
+    XCTAssertEqual(stats.totalNumRedirects, 3);
+    XCTAssertEqual(stats.totalRedirectHopsSkipped, 1);
+}
+
+// The temporary hop must not outlive the call that saw it:
+-(void) testTemporaryRedirectIsNotCached {
+    [self helperFetchAsset:NKRedirectRetryPolicyStoreRedirectStack];
+    XCTAssertEqual(self.networkManager.redirectCache.count, 1);
+
+    [self helperFetchAsset:NKRedirectRetryPolicyStoreRedirectStack];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/cdn", @"/edge"]));
+}
+
+// With the redirect stack, a retry goes straight back to the last hop:
+-(void) testRetryStartsFromLastRedirect {
+    self.numEdgeDropsLeft = 1;
+    [self helperFetchAsset:NKRedirectRetryPolicyStoreRedirectStack];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/asset", @"/cdn", @"/edge", @"/edge"]));
+}
+
+// ... and without it, a retry starts over from the URL the call was given:
+-(void) testRetryFromTopURL {
+    self.numEdgeDropsLeft = 1;
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/asset", @"/cdn", @"/edge", @"/asset", @"/cdn", @"/edge"]));
+}
+
+// A 404 where a cached redirect pointed means it's out of date: it's forgotten, and the
+// retry asks the top URL again (and learns the redirect over):
+-(void) testStaleCachedRedirectIsEvicted {
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqual(self.networkManager.redirectCache.count, 1);
+
+    self.numCDNMissesLeft = 1;
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/cdn", @"/asset", @"/cdn", @"/edge"]));
+    XCTAssertEqual(self.networkManager.redirectCache.count, 1);
+
+    [self helperFetchAsset:NKRedirectRetryPolicyRetryFromTopURL];
+    XCTAssertEqualObjects(self.requestedPaths, (@[@"/cdn", @"/edge"]));
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didRedirectForContext:(id)context
+                newURL:(NSString*)newURL httpStatus:(int)httpStatus {
+    [self.redirects addObject:newURL];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    self.receivedData = data;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    XCTFail(@"Call failed with %d (HTTP %d)", errorType, httpStatus);
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFinish:(id)context {
+    self.finished = TRUE;
+}
+
+@end
@@ -0,0 +1,202 @@
+//
+//  TestDemoNetworkManagerResume.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "DemoNetworkManager.h"
+#import "NetworkManagerStatistics.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "LocalTestHTTPServer.h"
+
+#define kBodyLength     (1024*1024)
+#define kNumRetries     30
+#define kTestTimeout    30.0
+
+// These tests run real NSURLConnections against a local server that keeps dropping the
+// connection partway through the body.  A resumable download should pick up where it
+// left off with a Range request, and the bytes we get at the end must be exactly right.
+
+@interface TestDemoNetworkManagerResume : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) DemoNetworkManager* networkManager;
+@property (nonatomic, retain) LocalTestHTTPServer* server;
+@property (nonatomic, retain) NSData* body;
+
+// What the server does:
+@property (atomic, retain) NSString* etag;
+@property (atomic) BOOL changeETagEveryRequest;
+@property (atomic) int numRangeRequests;
+@property (atomic) unsigned int randomState;
+
+// What came back:
+@property (nonatomic) BOOL finished;
+@property (nonatomic, retain) NSData* receivedData;
+@property (nonatomic, retain) NSURL* savedFileURL;
+@property (nonatomic) NetworkManagerError failure;
+
+@end
+
+@implementation TestDemoNetworkManagerResume
+
+- (void)setUp {
+    [super setUp];
+
+    // A body where every offset is recognizable, so a misplaced chunk can't hide:
+    NSMutableData* body = [NSMutableData dataWithLength:kBodyLength];
+    uint32_t* words = body.mutableBytes;
+    for(uint32_t i = 0; i < kBodyLength/4; i++) {
+        words[i] = i * 2654435761u;
+    }
+    self.body = body;
+    self.etag = @"\"v1\"";
+    self.changeETagEveryRequest = FALSE;
+    self.numRangeRequests = 0;
+    self.randomState = 12345;
+    self.finished = FALSE;
+    self.failure = NetworkManagerErrorNoError;
+
+    __weak TestDemoNetworkManagerResume* weakSelf = self;
+    self.server = [[LocalTestHTTPServer alloc] initWithHandler:^(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response) {
+        [weakSelf handleRequest:request response:response];
+    }];
+    XCTAssertTrue([self.server start]);
+
+    self.networkManager = [[DemoNetworkManager alloc] init];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [self.server stop];
+    self.server = nil;
+    self.networkManager = nil;
+    if(self.savedFileURL != nil) {
+        [[NSFileManager defaultManager] removeItemAtURL:self.savedFileURL error:nil];
+    }
+}
+
+// Seeded, so a failing run can be reproduced:
+-(unsigned int) helperNextRandom {
+    @synchronized (self) {
+        self.randomState = self.randomState * 1103515245u + 12345u;
+        return (self.randomState >> 8);
+    }
+}
+
+// Serves self.body, honoring Range/If-Range, and drops every response somewhere in its
+// first 300KB until the last one:
+-(void) handleRequest:(LocalTestHTTPRequest*)request response:(LocalTestHTTPResponse*)response {
+    if(self.changeETagEveryRequest) {
+        self.etag = [NSString stringWithFormat:@"\"v%u\"", [self helperNextRandom]];
+    }
+
+    long long start = 0;
+    NSString* range = [request header:@"Range"];
+    NSString* ifRange = [request header:@"If-Range"];
+    if(range != nil && [range hasPrefix:@"bytes="] && (ifRange == nil || [ifRange isEqualToString:self.etag])) {
+        start = [[range substringFromIndex:6] longLongValue];
+    }
+
+    [response.headers setObject:self.etag forKey:@"ETag"];
+    [response.headers setObject:@"bytes" forKey:@"Accept-Ranges"];
+    [response.headers setObject:@"application/octet-stream" forKey:@"Content-Type"];
+
+    if(start >= (long long)self.body.length) {
+        response.statusCode = 416;
+        [response.headers setObject:[NSString stringWithFormat:@"bytes */%lu", (unsigned long)self.body.length] forKey:@"Content-Range"];
+        return;
+    }
+    if(start > 0) {
+        self.numRangeRequests++;
+        response.statusCode = 206;
+        [response.headers setObject:[NSString stringWithFormat:@"bytes %lld-%lu/%lu", start,
+                                     (unsigned long)self.body.length - 1, (unsigned long)self.body.length] forKey:@"Content-Range"];
+    }
+    response.body = [self.body subdataWithRange:NSMakeRange((NSUInteger)start, self.body.length - (NSUInteger)start)];
+
+    // Let roughly every fifth attempt (or anything short enough) go through:
+    if(response.body.length > 300000 && ([self helperNextRandom] % 5) != 0) {
+        response.dropAfterBytes = 1000 + ([self helperNextRandom] % 299000);
+    }
+}
+
+-(void) helperWaitForFinish {
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(!self.finished && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    XCTAssertTrue(self.finished, @"The call never finished.");
+}
+
+-(void) helperStartCallToFile:(BOOL)downloadToFile {
+    NKCallBehaviorURLRequest* request = [[NKCallBehaviorURLRequest alloc] init];
+    request.URL = [NSURL URLWithString:[self.server urlStringForPath:@"/big"]];
+    request.HTTPMethod = @"GET";
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    request.downloadToFile = downloadToFile;
+
+    [self.networkManager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:kTestTimeout withNumRetries:kNumRetries withContext:self];
+    [self helperWaitForFinish];
+}
+
+
+-(void) testResumeIntoMemory {
+    [self helperStartCallToFile:FALSE];
+
+    XCTAssertEqual(self.failure, NetworkManagerErrorNoError);
+    XCTAssertEqualObjects(self.receivedData, self.body);
+    XCTAssertGreaterThan(self.numRangeRequests, 0);
+    XCTAssertGreaterThan(self.networkManager.currentStatistics.totalNumResumedRetries, 0);
+
+    // Resuming means we don't pull the whole body down on every attempt:
+    XCTAssertLessThan(self.server.numBodyBytesSent, 2 * (long long)kBodyLength);
+}
+
+-(void) testResumeIntoFile {
+    [self helperStartCallToFile:TRUE];
+
+    XCTAssertEqual(self.failure, NetworkManagerErrorNoError);
+    XCTAssertNotNil(self.savedFileURL);
+    XCTAssertEqualObjects(self.receivedData, self.body);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:self.savedFileURL], self.body);
+    XCTAssertGreaterThan(self.numRangeRequests, 0);
+    XCTAssertLessThan(self.server.numBodyBytesSent, 2 * (long long)kBodyLength);
+}
+
+// When the representation changes between attempts, If-Range makes the server send the
+// whole thing again, and we must start over instead of splicing two versions together:
+-(void) testChangedETagStartsOver {
+    self.changeETagEveryRequest = TRUE;
+    [self helperStartCallToFile:FALSE];
+
+    XCTAssertEqual(self.failure, NetworkManagerErrorNoError);
+    XCTAssertEqualObjects(self.receivedData, self.body);
+    XCTAssertEqual(self.numRangeRequests, 0);
+    XCTAssertEqual(self.networkManager.currentStatistics.totalNumResumedRetries, 0);
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSaveFile:(id)context fileURL:(NSURL*)fileURL {
+    self.savedFileURL = fileURL;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    self.receivedData = data;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    self.failure = errorType;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFinish:(id)context {
+    self.finished = TRUE;
+}
+
+@end
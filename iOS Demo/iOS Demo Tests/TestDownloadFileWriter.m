@@ -0,0 +1,117 @@
+//
+//  TestDownloadFileWriter.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "DownloadFileWriter.h"
+
+@interface TestDownloadFileWriter : XCTestCase
+
+@property (nonatomic, retain) DownloadFileWriter* writer;
+
+@end
+
+@implementation TestDownloadFileWriter
+
+- (void)setUp {
+    [super setUp];
+    self.writer = [DownloadFileWriter temporaryFileWriter];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [[NSFileManager defaultManager] removeItemAtURL:self.writer.fileURL error:nil];
+    self.writer = nil;
+}
+
+// Makes a chunk of recognizable bytes:
+-(NSData*) helperChunk:(NSUInteger)length seed:(unsigned char)seed {
+    NSMutableData* data = [NSMutableData dataWithLength:length];
+    unsigned char* bytes = data.mutableBytes;
+    for(NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (unsigned char)(seed + i);
+    }
+    return data;
+}
+
+// Writes the chunks and checks that the mapped result is exactly the concatenation:
+-(void) helperWriteChunks:(NSArray*)chunks expectedLength:(long long)expectedLength {
+    NSMutableData* expected = [[NSMutableData alloc] init];
+
+    XCTAssertTrue([self.writer openWithExpectedLength:expectedLength]);
+    for(NSData* chunk in chunks) {
+        XCTAssertTrue([self.writer appendData:chunk]);
+        [expected appendData:chunk];
+    }
+    XCTAssertEqual(self.writer.bytesWritten, expected.length);
+
+    NSData* mapped = [self.writer finishAndMap];
+    XCTAssertEqualObjects(mapped, expected);
+
+    // Preallocated space must not be left at the end of the file:
+    NSDictionary* attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:self.writer.fileURL.path error:nil];
+    XCTAssertEqual([attributes fileSize], expected.length);
+}
+
+-(void) testExactContentLength {
+    NSArray* chunks = @[[self helperChunk:4096 seed:1], [self helperChunk:100000 seed:2], [self helperChunk:7 seed:3]];
+    [self helperWriteChunks:chunks expectedLength:4096 + 100000 + 7];
+}
+
+-(void) testContentLengthTooLarge {
+    NSArray* chunks = @[[self helperChunk:5000 seed:4], [self helperChunk:5000 seed:5]];
+    [self helperWriteChunks:chunks expectedLength:1000000];
+}
+
+-(void) testContentLengthTooSmall {
+    NSArray* chunks = @[[self helperChunk:5000 seed:6], [self helperChunk:5000 seed:7]];
+    [self helperWriteChunks:chunks expectedLength:10];
+}
+
+-(void) testUnknownContentLength {
+    NSArray* chunks = @[[self helperChunk:12345 seed:8], [self helperChunk:54321 seed:9]];
+    [self helperWriteChunks:chunks expectedLength:-1];
+}
+
+-(void) testEmptyBody {
+    [self helperWriteChunks:@[] expectedLength:-1];
+}
+
+// Reopening (which is what a retry does) must throw away what was there:
+-(void) testReopenStartsOver {
+    XCTAssertTrue([self.writer openWithExpectedLength:-1]);
+    XCTAssertTrue([self.writer appendData:[self helperChunk:3000 seed:10]]);
+    [self helperWriteChunks:@[[self helperChunk:100 seed:11]] expectedLength:100];
+}
+
+// Resuming keeps what we have and trims anything written past it:
+-(void) testReopenAtCurrentOffsetKeepsPrefix {
+    NSData* first = [self helperChunk:3000 seed:14];
+    NSData* second = [self helperChunk:2000 seed:15];
+    XCTAssertTrue([self.writer openWithExpectedLength:100000]);
+    XCTAssertTrue([self.writer appendData:first]);
+    XCTAssertTrue([self.writer reopenAtCurrentOffset]);
+    XCTAssertTrue([self.writer appendData:second]);
+
+    NSMutableData* expected = [NSMutableData dataWithData:first];
+    [expected appendData:second];
+    XCTAssertEqualObjects([self.writer finishAndMap], expected);
+}
+
+-(void) testDiscardDeletesFile {
+    XCTAssertTrue([self.writer openWithExpectedLength:1000]);
+    XCTAssertTrue([self.writer appendData:[self helperChunk:1000 seed:12]]);
+    [self.writer discard];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.writer.fileURL.path]);
+}
+
+-(void) testAppendBeforeOpenFails {
+    XCTAssertFalse([self.writer appendData:[self helperChunk:10 seed:13]]);
+}
+
+@end
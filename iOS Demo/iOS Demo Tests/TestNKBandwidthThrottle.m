@@ -0,0 +1,270 @@
+//
+//  TestNKBandwidthThrottle.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "NKBandwidthThrottle.h"
+#import "NKNetworkManager.h"
+#import "LocalTestHTTPServer.h"
+
+#define kTestTimeout        20.0
+#define kLinkBytesPerSecond (200*1024)
+#define kBkgBodyLength      (50*1024)
+
+// The first half drives NKBandwidthThrottle by hand, with made-up times, so the numbers
+// are exact.  The second half runs NKNetworkManager against a local server that caps
+// how fast it sends: BKG downloads going out alongside a slow HIGH download should be
+// held back until the HIGH one is done, then go at full speed.
+
+@interface TestNKBandwidthThrottle : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) NKBandwidthThrottle* throttle;
+@property (nonatomic) MonotonicTime t0;
+
+@property (nonatomic, retain) LocalTestHTTPServer* server;
+@property (nonatomic, retain) NKNetworkManager* networkManager;
+
+// When each /bkg/ request reached the server, and when each call succeeded, by path:
+@property (nonatomic, retain) NSMutableArray* bkgArrivals;
+@property (nonatomic, retain) NSMutableDictionary* successTimes;
+@property (nonatomic) int numFailed;
+
+@end
+
+@implementation TestNKBandwidthThrottle
+
+- (void)setUp {
+    [super setUp];
+    self.throttle = [[NKBandwidthThrottle alloc] init];
+    self.t0 = [MonotonicClock now];
+    self.bkgArrivals = [[NSMutableArray alloc] init];
+    self.successTimes = [[NSMutableDictionary alloc] init];
+    self.numFailed = 0;
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [self.server stop];
+    self.server = nil;
+    self.networkManager = nil;
+    self.throttle = nil;
+}
+
+-(MonotonicTime) at:(double)seconds {
+    return [MonotonicClock time:self.t0 plusSeconds:seconds];
+}
+
+
+#pragma mark - The throttle by itself
+
+-(void) testEstimates {
+    [self.throttle recordRTT:0.1];
+    [self.throttle recordRTT:0.2];
+    XCTAssertEqualWithAccuracy(self.throttle.estimatedRTTSeconds, 0.12, 1e-9);
+    XCTAssertEqualWithAccuracy(self.throttle.baselineRTTSeconds, 0.101, 1e-9, @"The baseline only creeps up.");
+    [self.throttle recordRTT:0.05];
+    XCTAssertEqualWithAccuracy(self.throttle.baselineRTTSeconds, 0.05, 1e-9, @"...but drops right away.");
+
+    [self.throttle recordTransferOfBytes:100 seconds:0.001];
+    XCTAssertEqual(self.throttle.estimatedBytesPerSecond, 0.0, @"Tiny bodies are all latency.");
+    [self.throttle recordTransferOfBytes:100000 seconds:1.0];
+    [self.throttle recordTransferOfBytes:200000 seconds:1.0];
+    XCTAssertEqualWithAccuracy(self.throttle.estimatedBytesPerSecond, 120000.0, 1e-6);
+}
+
+// Nothing else going on: no limit at all, no matter how much comes in.
+-(void) testIdleLinkIsNotThrottled {
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:FALSE];
+    XCTAssertFalse(self.throttle.throttling);
+    for(int i = 0; i < 10; i++) {
+        double charge = -1.0;
+        XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+        XCTAssertEqual(charge, 0.0);
+        [self.throttle settleCharge:charge actualBytes:1000000 completed:TRUE];
+    }
+    [self.throttle updateAtTime:[self at:0.01] foregroundActive:FALSE];
+    XCTAssertEqual(self.throttle.numCallsHeld, (UInt64)0);
+    XCTAssertEqualWithAccuracy(self.throttle.availableBytes, self.throttle.throttledBytesPerSecond, 1e-6, @"Full bucket.");
+}
+
+// 100KB/s link, so a quarter share is 25KB/s in a 25KB bucket.  Calls are 10KB:
+-(void) testForegroundTrafficMetersCalls {
+    [self.throttle recordTransferOfBytes:100000 seconds:1.0];
+    [self.throttle settleCharge:0.0 actualBytes:10000 completed:TRUE];
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:FALSE];
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:TRUE];
+    XCTAssertTrue(self.throttle.throttling);
+    XCTAssertEqualWithAccuracy(self.throttle.throttledBytesPerSecond, 25000.0, 1e-6);
+    XCTAssertEqualWithAccuracy(self.throttle.availableBytes, 25000.0, 1e-6);
+
+    double charge = 0.0;
+    XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+    XCTAssertEqualWithAccuracy(charge, 10000.0, 1e-6);
+    XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+    XCTAssertFalse([self.throttle mayStartThrottledCall:&charge], @"Only 5KB left.");
+    XCTAssertEqual(self.throttle.numCallsHeld, (UInt64)1);
+
+    // A quarter second later there's enough again:
+    [self.throttle updateAtTime:[self at:0.25] foregroundActive:TRUE];
+    XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+
+    // And once the foreground is done, everything goes:
+    [self.throttle updateAtTime:[self at:0.3] foregroundActive:FALSE];
+    XCTAssertFalse(self.throttle.throttling);
+    for(int i = 0; i < 5; i++) {
+        XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+    }
+}
+
+// A call that turns out bigger than expected puts the bucket in debt, and nothing else
+// starts until it's paid off:
+-(void) testDebtIsPaidBackBeforeTheNextCall {
+    [self.throttle recordTransferOfBytes:100000 seconds:1.0];
+    [self.throttle settleCharge:0.0 actualBytes:10000 completed:TRUE];
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:FALSE];
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:TRUE];
+
+    double charge = 0.0;
+    XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+    [self.throttle settleCharge:charge actualBytes:60000 completed:TRUE];
+    XCTAssertEqualWithAccuracy(self.throttle.availableBytes, -35000.0, 1e-6);
+
+    [self.throttle updateAtTime:[self at:1.0] foregroundActive:TRUE];
+    XCTAssertFalse([self.throttle mayStartThrottledCall:&charge]);
+    [self.throttle updateAtTime:[self at:2.5] foregroundActive:TRUE];
+    XCTAssertTrue([self.throttle mayStartThrottledCall:&charge]);
+}
+
+// With no foreground calls, a climbing RTT still means somebody's queueing:
+-(void) testRTTInflationThrottles {
+    [self.throttle recordRTT:0.05];
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:FALSE];
+    XCTAssertFalse(self.throttle.throttling);
+
+    [self.throttle recordRTT:1.0];
+    [self.throttle updateAtTime:[self at:0.1] foregroundActive:FALSE];
+    XCTAssertTrue(self.throttle.throttling);
+
+    // It settles back down as quick answers come in:
+    for(int i = 0; i < 20; i++) {
+        [self.throttle recordRTT:0.05];
+    }
+    [self.throttle updateAtTime:[self at:0.2] foregroundActive:FALSE];
+    XCTAssertFalse(self.throttle.throttling);
+}
+
+-(void) testMinimumRateAndDisabling {
+    [self.throttle updateAtTime:[self at:0.0] foregroundActive:TRUE];
+    XCTAssertEqualWithAccuracy(self.throttle.throttledBytesPerSecond, self.throttle.minBytesPerSecond, 1e-6, @"No estimate yet.");
+
+    self.throttle.enabled = FALSE;
+    [self.throttle updateAtTime:[self at:0.1] foregroundActive:TRUE];
+    XCTAssertFalse(self.throttle.throttling);
+}
+
+
+#pragma mark - Against a bandwidth-limited server
+
+-(void) helperStartServer {
+    __weak TestNKBandwidthThrottle* weakSelf = self;
+    self.server = [[LocalTestHTTPServer alloc] initWithHandler:^(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response) {
+        TestNKBandwidthThrottle* test = weakSelf;
+        NSUInteger length = kBkgBodyLength;
+        response.bytesPerSecond = kLinkBytesPerSecond;
+        if([request.path hasPrefix:@"/bkg/"]) {
+            @synchronized (test) {
+                [test.bkgArrivals addObject:[NSDate date]];
+            }
+        } else if([request.path isEqualToString:@"/warmup"]) {
+            length = 2 * kBkgBodyLength;
+        } else if([request.path isEqualToString:@"/foreground"]) {
+            // 1.5s of body behind an immediate header, so the RTT stays low:
+            length = 3 * kBkgBodyLength;
+            response.bytesPerSecond = 3 * kBkgBodyLength / 1.5;
+        }
+        response.body = [NSMutableData dataWithLength:length];
+    }];
+    XCTAssertTrue([self.server start]);
+
+    self.networkManager = [[NKNetworkManager alloc] initWithConnectionBridge:[[NKDefaultURLConnectionBridge alloc] init]];
+    self.networkManager.bandwidthThrottle.throttledShare = 0.1;
+}
+
+-(void) helperStart:(NSString*)path priority:(NKCallPriority)priority {
+    NKCallBehaviorURLRequest* request = [self.networkManager buildURLRequest:[self.server urlStringForPath:path] forRequestType:@"GET"];
+    request.priority = priority;
+    request.numRetries = 0;
+    request.timeoutSeconds = kTestTimeout;
+    [self.networkManager startNetworkCall:request withDelegate:self withContext:path];
+}
+
+-(BOOL) helperWaitForNumSucceeded:(NSUInteger)numSucceeded {
+    NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(self.successTimes.count < numSucceeded && self.numFailed == 0 && [giveUp timeIntervalSinceNow] > 0.0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    return self.successTimes.count >= numSucceeded;
+}
+
+// The warmup gives the throttle a throughput estimate and a typical body size.  Then a HIGH
+// download and three BKG ones go out together.  Returns how many BKG requests reached the
+// server before the HIGH one finished.
+-(NSUInteger) helperRunForegroundWithBackground:(BOOL)throttled {
+    [self helperStartServer];
+    self.networkManager.bandwidthThrottle.enabled = throttled;
+    [self helperStart:@"/warmup" priority:NKCallPriorityBkg];
+    XCTAssertTrue([self helperWaitForNumSucceeded:1]);
+    XCTAssertGreaterThan(self.networkManager.bandwidthThrottle.estimatedBytesPerSecond, 0.0);
+
+    [self helperStart:@"/foreground" priority:NKCallPriorityHigh];
+    for(int i = 1; i <= 3; i++) {
+        [self helperStart:[NSString stringWithFormat:@"/bkg/%d", i] priority:NKCallPriorityBkg];
+    }
+    XCTAssertTrue([self helperWaitForNumSucceeded:5]);
+    XCTAssertEqual(self.numFailed, 0);
+
+    NSDate* foregroundDone = [self.successTimes objectForKey:@"/foreground"];
+    NSUInteger numEarly = 0;
+    @synchronized (self) {
+        for(NSDate* arrival in self.bkgArrivals) {
+            if([arrival compare:foregroundDone] == NSOrderedAscending) numEarly++;
+        }
+    }
+    return numEarly;
+}
+
+-(void) testBackgroundWaitsForForeground {
+    NSUInteger numEarly = [self helperRunForegroundWithBackground:TRUE];
+    XCTAssertLessThan(numEarly, (NSUInteger)3, @"BKG calls weren't held back while the HIGH call ran.");
+    XCTAssertGreaterThan(self.networkManager.bandwidthThrottle.numCallsHeld, (UInt64)0);
+
+    // Full speed once the HIGH call is done - the rest take about 0.25s each:
+    NSDate* foregroundDone = [self.successTimes objectForKey:@"/foreground"];
+    NSDate* lastDone = [self.successTimes objectForKey:@"/bkg/3"];
+    XCTAssertLessThan([lastDone timeIntervalSinceDate:foregroundDone], 1.5);
+    XCTAssertFalse(self.networkManager.bandwidthThrottle.throttling);
+}
+
+// The same run with the throttle off, to show the BKG calls really would have competed:
+-(void) testBackgroundCompetesWhenThrottleIsOff {
+    XCTAssertEqual([self helperRunForegroundWithBackground:FALSE], (NSUInteger)3);
+    XCTAssertEqual(self.networkManager.bandwidthThrottle.numCallsHeld, (UInt64)0);
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    [self.successTimes setObject:[NSDate date] forKey:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    self.numFailed++;
+}
+
+@end
@@ -0,0 +1,148 @@
+//
+//  TestNKNetworkManagerDownloadToFile.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "NKNetworkManager.h"
+#import "ManualTestURLConnectionBridge.h"
+
+#define kTestTimeout    5.0
+
+
+@interface TestNKNetworkManagerDownloadToFile : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) ManualTestURLConnectionBridge* bridge;
+@property (nonatomic, retain) NKNetworkManager* networkManager;
+@property (nonatomic, retain) NSURL* fileURL;
+
+// What the delegate got:
+@property (nonatomic, retain) NSURL* savedFileURL;
+@property (nonatomic, retain) NSData* succeededData;
+@property (nonatomic, retain) NSData* failedData;
+@property (nonatomic) NetworkManagerError failedError;
+@property (nonatomic) BOOL finished;
+
+@end
+
+@implementation TestNKNetworkManagerDownloadToFile
+
+- (void)setUp {
+    [super setUp];
+    self.bridge = [[ManualTestURLConnectionBridge alloc] init];
+    self.networkManager = [[NKNetworkManager alloc] initWithConnectionBridge:self.bridge];
+    self.fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+    self.savedFileURL = nil;
+    self.succeededData = nil;
+    self.failedData = nil;
+    self.failedError = NetworkManagerErrorNoError;
+    self.finished = FALSE;
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.fileURL error:nil];
+    self.networkManager = nil;
+    self.bridge = nil;
+    [super tearDown];
+}
+
+// Starts a download-to-file call for path, and gets hold of its connection once it's on the wire:
+-(ManualTestURLConnection*) helperStartDownload:(NSString*)path toFileURL:(NSURL*)fileURL {
+    NKCallBehaviorURLRequest* request = [self.networkManager buildURLRequest:[@"http://test.example.com" stringByAppendingString:path] forRequestType:@"GET"];
+    request.numRetries = 0;
+    request.downloadToFile = TRUE;
+    request.downloadFileURL = fileURL;
+    [self.networkManager startNetworkCall:request withDelegate:self withContext:path];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return [self.bridge connectionForPath:path] != nil; }]);
+    return [self.bridge connectionForPath:path];
+}
+
+// Runs the main run loop until the condition holds (or the test times out):
+-(BOOL) helperWaitFor:(BOOL (^)(void))condition {
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(!condition() && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    return condition();
+}
+
+
+// The body goes into the file, and the delegate gets the file and a mapping of it:
+-(void) testBodyIsSavedToFile {
+    NSData* body = [@"a body that's better off on disk" dataUsingEncoding:NSUTF8StringEncoding];
+    ManualTestURLConnection* connection = [self helperStartDownload:@"/file" toFileURL:self.fileURL];
+    [connection respondWithStatus:200 contentLength:(long long)body.length];
+    [connection sendBytes:[body subdataWithRange:NSMakeRange(0, 5)]];
+    [connection sendBytes:[body subdataWithRange:NSMakeRange(5, body.length - 5)]];
+    [connection finish];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return self.finished; }]);
+    XCTAssertEqualObjects(self.savedFileURL, self.fileURL, @"didSaveFile should come before didSucceed");
+    XCTAssertEqualObjects(self.succeededData, body);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:self.fileURL], body);
+}
+
+// Without a downloadFileURL, the body goes to a temporary file that's the delegate's to keep:
+-(void) testTemporaryFileIsUsedWithoutAFileURL {
+    ManualTestURLConnection* connection = [self helperStartDownload:@"/temporary" toFileURL:nil];
+    [connection finishWithStatus:200];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return self.finished; }]);
+    XCTAssertNotNil(self.savedFileURL);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:self.savedFileURL], [@"/temporary" dataUsingEncoding:NSUTF8StringEncoding]);
+    [[NSFileManager defaultManager] removeItemAtURL:self.savedFileURL error:nil];
+}
+
+// An error response's body is for didFail, not the file:
+-(void) testErrorBodyIsNotSaved {
+    ManualTestURLConnection* connection = [self helperStartDownload:@"/missing" toFileURL:self.fileURL];
+    [connection finishWithStatus:404];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return self.finished; }]);
+    XCTAssertEqual(self.failedError, NetworkManagerErrorBadRequest);
+    XCTAssertEqualObjects(self.failedData, [@"/missing" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertNil(self.savedFileURL);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.fileURL.path]);
+}
+
+// A canceled download's file is deleted:
+-(void) testCanceledDownloadIsDeleted {
+    ManualTestURLConnection* connection = [self helperStartDownload:@"/canceled" toFileURL:self.fileURL];
+    [connection respondWithStatus:200 contentLength:100];
+    [connection sendBytes:[@"partial" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:self.fileURL.path]);
+
+    [self.networkManager cancelForDelegate:self withContext:@"/canceled"];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.fileURL.path]);
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+    XCTAssertFalse(self.finished);
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSaveFile:(id)context fileURL:(NSURL*)fileURL {
+    XCTAssertNil(self.succeededData);
+    self.savedFileURL = fileURL;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    self.succeededData = data;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    self.failedError = errorType;
+    self.failedData = data;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFinish:(id)context {
+    self.finished = TRUE;
+}
+
+@end
@@ -0,0 +1,315 @@
+//
+//  TestNKNetworkManagerScheduling.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "NKNetworkManager.h"
+#import "ManualTestURLConnectionBridge.h"
+#import "SharedThreadPool.h"
+
+#define kTestTimeout    5.0
+
+
+@interface TestNKNetworkManagerScheduling : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) ManualTestURLConnectionBridge* bridge;
+@property (nonatomic, retain) NKNetworkManager* networkManager;
+
+// Contexts (the paths) of calls that got each callback:
+@property (nonatomic, retain) NSMutableArray* started;
+@property (nonatomic, retain) NSMutableArray* succeeded;
+@property (nonatomic, retain) NSMutableDictionary* failures;
+
+@end
+
+@implementation TestNKNetworkManagerScheduling
+
+- (void)setUp {
+    [super setUp];
+    self.bridge = [[ManualTestURLConnectionBridge alloc] init];
+    self.networkManager = [[NKNetworkManager alloc] initWithConnectionBridge:self.bridge];
+    self.networkManager.defaultCallBehavior = [[NKCallBehaviorURLRequest alloc] init];
+    self.started = [[NSMutableArray alloc] init];
+    self.succeeded = [[NSMutableArray alloc] init];
+    self.failures = [[NSMutableDictionary alloc] init];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    self.networkManager = nil;
+    self.bridge = nil;
+}
+
+-(void) helperStart:(NSString*)path priority:(NKCallPriority)priority deadlineIn:(double)seconds {
+    [self helperStart:path priority:priority deadlineIn:seconds group:nil];
+}
+
+-(void) helperStart:(NSString*)path priority:(NKCallPriority)priority deadlineIn:(double)seconds group:(id)group {
+    NKCallBehaviorURLRequest* request = [self.networkManager buildURLRequest:[@"http://test.example.com" stringByAppendingString:path] forRequestType:@"GET"];
+    request.priority = priority;
+    request.numRetries = 0;
+    request.deadline = (seconds > 0.0) ? [NSDate dateWithTimeIntervalSinceNow:seconds] : nil;
+    request.callGroup = group;
+    [self.networkManager startNetworkCall:request withDelegate:self withContext:path];
+}
+
+// Runs the main run loop until the condition holds (or the test times out):
+-(BOOL) helperWaitFor:(BOOL (^)(void))condition {
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(!condition() && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    return condition();
+}
+
+-(void) helperWaitForNumStarted:(NSUInteger)numStarted {
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return [self.bridge startedPaths].count >= numStarted; }],
+                  @"Only %lu of %lu calls started", (unsigned long)[self.bridge startedPaths].count, (unsigned long)numStarted);
+}
+
+// Gives anything that's going to happen a moment to happen:
+-(void) helperSettle {
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+}
+
+
+// BKG goes one at a time.  Behind a call in flight, the rest go out by deadline, and the
+// ones without a deadline go last in the order they came:
+-(void) testWaitingCallsGoEarliestDeadlineFirst {
+    [self helperStart:@"/blocker" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+
+    [self helperStart:@"/none-1" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperStart:@"/in-30"  priority:NKCallPriorityBkg deadlineIn:30.0];
+    [self helperStart:@"/in-10"  priority:NKCallPriorityBkg deadlineIn:10.0];
+    [self helperStart:@"/none-2" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperStart:@"/in-20"  priority:NKCallPriorityBkg deadlineIn:20.0];
+    XCTAssertEqual([self.networkManager numCallsWaitingWithPriority:NKCallPriorityBkg], 5);
+
+    for(NSUInteger i = 1; i <= 5; i++) {
+        [[self.bridge connectionForPath:[[self.bridge startedPaths] lastObject]] finishWithStatus:200];
+        [self helperWaitForNumStarted:i + 1];
+    }
+
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/blocker", @"/in-10", @"/in-20", @"/in-30", @"/none-1", @"/none-2"]));
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return self.succeeded.count == 5; }]);
+}
+
+// A call whose deadline passes while it waits never goes out:
+-(void) testExpiredCallIsDroppedBeforeSending {
+    [self helperStart:@"/blocker" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+    [self helperStart:@"/soon" priority:NKCallPriorityBkg deadlineIn:0.3];
+    [self helperStart:@"/later" priority:NKCallPriorityBkg deadlineIn:30.0];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return [self.failures objectForKey:@"/soon"] != nil; }]);
+    XCTAssertEqualObjects([self.failures objectForKey:@"/soon"], @(NetworkManagerErrorDeadlineMissed));
+    XCTAssertEqual(self.networkManager.totalCallsDroppedPastDeadline, 1);
+
+    // The quota goes to the call that's still worth making:
+    [[self.bridge connectionForPath:@"/blocker"] finishWithStatus:200];
+    [self helperWaitForNumStarted:2];
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/blocker", @"/later"]));
+}
+
+// Already too late - fails without starting:
+-(void) testPastDeadlineFailsRightAway {
+    NKCallBehaviorURLRequest* request = [self.networkManager buildURLRequest:@"http://test.example.com/late" forRequestType:@"GET"];
+    request.deadline = [NSDate dateWithTimeIntervalSinceNow:-1.0];
+    [self.networkManager startNetworkCall:request withDelegate:self withContext:@"/late"];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return [self.failures objectForKey:@"/late"] != nil; }]);
+    XCTAssertEqualObjects([self.failures objectForKey:@"/late"], @(NetworkManagerErrorDeadlineMissed));
+    XCTAssertEqual(self.started.count, 0);
+    XCTAssertEqual([self.bridge startedPaths].count, 0);
+}
+
+// A BKG thumbnail that becomes visible jumps straight out when promoted to HIGH:
+-(void) testPromotion {
+    [self helperStart:@"/blocker" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperStart:@"/thumb" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+    [self helperSettle];
+    XCTAssertEqual([self.bridge startedPaths].count, 1);
+
+    XCTAssertTrue([self.networkManager setPriority:NKCallPriorityHigh forDelegate:self withContext:@"/thumb"]);
+    [self helperWaitForNumStarted:2];
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/blocker", @"/thumb"]));
+    XCTAssertEqual([self.networkManager numCallsInFlightWithPriority:NKCallPriorityHigh], 1);
+
+    // In flight now, so it can't be moved:
+    XCTAssertFalse([self.networkManager setPriority:NKCallPriorityBkg forDelegate:self withContext:@"/thumb"]);
+}
+
+// MEDIUM's quota is full; demoting the fifth call to LOW gets it out on LOW's quota:
+-(void) testDemotion {
+    for(int i = 0; i < 5; i++) {
+        [self helperStart:[NSString stringWithFormat:@"/medium-%d", i] priority:NKCallPriorityMedium deadlineIn:0.0];
+    }
+    [self helperWaitForNumStarted:4];
+    [self helperSettle];
+    XCTAssertEqual([self.networkManager numCallsWaitingWithPriority:NKCallPriorityMedium], 1);
+
+    XCTAssertTrue([self.networkManager setPriority:NKCallPriorityLow forDelegate:self withContext:@"/medium-4"]);
+    [self helperWaitForNumStarted:5];
+    XCTAssertEqual([self.networkManager numCallsInFlightWithPriority:NKCallPriorityLow], 1);
+}
+
+// Moving a deadline up reorders the queue:
+-(void) testSetDeadlineReorders {
+    [self helperStart:@"/blocker" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+    [self helperStart:@"/a" priority:NKCallPriorityBkg deadlineIn:10.0];
+    [self helperStart:@"/b" priority:NKCallPriorityBkg deadlineIn:20.0];
+
+    XCTAssertTrue([self.networkManager setDeadline:[NSDate dateWithTimeIntervalSinceNow:5.0] forDelegate:self withContext:@"/b"]);
+    [[self.bridge connectionForPath:@"/blocker"] finishWithStatus:200];
+    [self helperWaitForNumStarted:2];
+    XCTAssertEqualObjects([[self.bridge startedPaths] lastObject], @"/b");
+}
+
+// Canceled waiting calls never start, and give no callbacks:
+-(void) testCancelWaitingCall {
+    [self helperStart:@"/blocker" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperStart:@"/gone" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+
+    [self.networkManager cancelForDelegate:self withContext:@"/gone"];
+    XCTAssertEqual([self.networkManager numCallsWaitingWithPriority:NKCallPriorityBkg], 0);
+    [[self.bridge connectionForPath:@"/blocker"] finishWithStatus:200];
+    [self helperSettle];
+
+    XCTAssertEqualObjects([self.bridge startedPaths], (@[@"/blocker"]));
+    XCTAssertEqualObjects(self.succeeded, (@[@"/blocker"]));
+    XCTAssertNil([self.failures objectForKey:@"/gone"]);
+}
+
+// A call that's finished but whose callback hasn't reached the main thread yet can still
+// be canceled, and then the callback never comes:
+-(void) testCancelBetweenCompletionAndDelivery {
+    [self helperStart:@"/done" priority:NKCallPriorityMedium deadlineIn:0.0 group:@"screen"];
+    [self helperStart:@"/failed" priority:NKCallPriorityMedium deadlineIn:0.0];
+    [self helperStart:@"/kept" priority:NKCallPriorityMedium deadlineIn:0.0];
+    [self helperWaitForNumStarted:3];
+    [self helperSettle];
+
+    // The main thread doesn't get back to its run loop between these, so the callbacks
+    // are queued but not delivered when the cancels happen:
+    [[self.bridge connectionForPath:@"/done"] finishWithStatus:200];
+    [[self.bridge connectionForPath:@"/failed"] finishWithStatus:404];
+    [[self.bridge connectionForPath:@"/kept"] finishWithStatus:200];
+    XCTAssertEqual([self.networkManager cancelCallsInGroup:@"screen"], (NSUInteger)0);
+    [self.networkManager cancelForDelegate:self withContext:@"/failed"];
+    [self helperSettle];
+
+    XCTAssertEqualObjects(self.succeeded, (@[@"/kept"]));
+    XCTAssertEqual(self.failures.count, 0);
+}
+
+
+// Leaving a screen cancels everything it started, in flight or not, and nothing else:
+-(void) testCancelGroup {
+    [self helperStart:@"/screen-1" priority:NKCallPriorityMedium deadlineIn:0.0 group:@"screen"];
+    [self helperStart:@"/screen-2" priority:NKCallPriorityMedium deadlineIn:0.0 group:@"screen"];
+    [self helperStart:@"/other" priority:NKCallPriorityBkg deadlineIn:0.0];
+    [self helperStart:@"/screen-3" priority:NKCallPriorityBkg deadlineIn:0.0 group:@"screen"];
+    [self helperWaitForNumStarted:3];
+    [self helperSettle];
+
+    XCTAssertEqual([self.networkManager cancelCallsInGroup:@"screen"], (NSUInteger)3);
+    XCTAssertTrue([self.bridge connectionForPath:@"/screen-1"].canceled);
+    XCTAssertTrue([self.bridge connectionForPath:@"/screen-2"].canceled);
+    XCTAssertFalse([self.bridge connectionForPath:@"/other"].canceled);
+    XCTAssertEqual([self.networkManager numCallsWaitingWithPriority:NKCallPriorityBkg], 0);
+    XCTAssertEqual([self.networkManager cancelCallsInGroup:@"screen"], (NSUInteger)0);
+
+    // Late answers for the canceled calls go nowhere:
+    [[self.bridge connectionForPath:@"/screen-1"] finishWithStatus:200];
+    [[self.bridge connectionForPath:@"/other"] finishWithStatus:200];
+    [self helperSettle];
+    XCTAssertEqualObjects(self.succeeded, (@[@"/other"]));
+    XCTAssertEqual(self.failures.count, 0);
+}
+
+// Pausing a group frees its quota for everyone else.  On resume, its calls start over:
+-(void) testPauseAndResumeGroup {
+    NSObject* group = [[NSObject alloc] init];
+    [self helperStart:@"/thumb-1" priority:NKCallPriorityBkg deadlineIn:0.0 group:group];
+    [self helperWaitForNumStarted:1];
+    [self helperStart:@"/thumb-2" priority:NKCallPriorityBkg deadlineIn:0.0 group:group];
+    [self helperStart:@"/sync" priority:NKCallPriorityBkg deadlineIn:0.0];
+
+    XCTAssertEqual([self.networkManager pauseCallsInGroup:group], (NSUInteger)2);
+    XCTAssertTrue([self.bridge connectionForPath:@"/thumb-1"].canceled);
+    [self helperWaitForNumStarted:2];
+    XCTAssertEqualObjects([[self.bridge startedPaths] lastObject], @"/sync");
+
+    [[self.bridge connectionForPath:@"/sync"] finishWithStatus:200];
+    [self helperSettle];
+    XCTAssertEqual([self.bridge startedPaths].count, (NSUInteger)2, @"Paused calls mustn't go out.");
+
+    XCTAssertEqual([self.networkManager resumeCallsInGroup:group], (NSUInteger)2);
+    [self helperWaitForNumStarted:3];
+    XCTAssertEqualObjects([[self.bridge startedPaths] lastObject], @"/thumb-1");
+    [[[self.bridge startedConnections] lastObject] finishWithStatus:200];
+    [self helperWaitForNumStarted:4];
+    [[[self.bridge startedConnections] lastObject] finishWithStatus:200];
+
+    XCTAssertTrue([self helperWaitFor:^BOOL{ return self.succeeded.count == 3; }]);
+    XCTAssertEqual(self.failures.count, 0);
+}
+
+// Bringing a screen to the front promotes its calls, waiting and in flight:
+-(void) testSetPriorityForGroup {
+    [self helperStart:@"/screen-1" priority:NKCallPriorityBkg deadlineIn:0.0 group:@"screen"];
+    [self helperWaitForNumStarted:1];
+    [self helperStart:@"/screen-2" priority:NKCallPriorityBkg deadlineIn:0.0 group:@"screen"];
+    [self helperStart:@"/screen-3" priority:NKCallPriorityBkg deadlineIn:0.0 group:@"screen"];
+    [self helperSettle];
+    XCTAssertEqual([self.bridge startedPaths].count, (NSUInteger)1);
+
+    XCTAssertEqual([self.networkManager setPriority:NKCallPriorityHigh forCallsInGroup:@"screen"], (NSUInteger)3);
+    [self helperWaitForNumStarted:3];
+    XCTAssertEqual([self.networkManager numCallsInFlightWithPriority:NKCallPriorityHigh], 3);
+    XCTAssertEqual([self.networkManager numCallsInFlightWithPriority:NKCallPriorityBkg], 0);
+}
+
+// The queue servicing goes to the network thread by way of the pool, so the pool's metrics
+// for that thread see it:
+-(void) testNetworkThreadWorkShowsInPoolMetrics {
+    UInt64 numPerformsBefore = [self helperNetworkThreadMetrics].numPerformsRun;
+    [self helperStart:@"/measured" priority:NKCallPriorityHigh deadlineIn:0.0];
+    [self helperWaitForNumStarted:1];
+    XCTAssertGreaterThan([self helperNetworkThreadMetrics].numPerformsRun, numPerformsBefore);
+}
+
+// NKNetworkManager uses the pool's thread for the nil identifier:
+-(SharedThreadPoolThreadMetrics*) helperNetworkThreadMetrics {
+    for(SharedThreadPoolThreadMetrics* metrics in [[SharedThreadPool singleton] threadMetrics]) {
+        if([metrics.identifier isEqual:[NSNull null]]) return metrics;
+    }
+    return nil;
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didStartCall:(id)context {
+    [self.started addObject:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    [self.succeeded addObject:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    [self.failures setObject:@(errorType) forKey:context];
+}
+
+@end
@@ -0,0 +1,456 @@
+//
+//  TestNKRequestOutbox.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "NKRequestOutbox.h"
+#import "DemoNetworkManager.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "NKSimulationURLConnectionBridge.h"
+#import "NKVirtualClock.h"
+
+// A network manager that only writes down what it's asked to start.  The test says how
+// each call ends, so replay order and concurrency can be checked step by step.
+@interface _OutboxScriptedManager : NSObject <AbstractNetworkManager>
+@property (nonatomic, retain) NSMutableArray* started;   // NSURLRequests
+@property (nonatomic, retain) NSMutableArray* contexts;
+@property (nonatomic, retain) NSMutableArray* delegates;
+@end
+
+@implementation _OutboxScriptedManager
+
+-(_OutboxScriptedManager*) init {
+    if(self = [super init]) {
+        self.started = [[NSMutableArray alloc] init];
+        self.contexts = [[NSMutableArray alloc] init];
+        self.delegates = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+-(NSMutableURLRequest*) buildURLRequest:(NSString*)urlString forRequestType:(NSString*)requestType {
+    NSMutableURLRequest* request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = requestType;
+    return request;
+}
+
+-(void) startNetworkCall:(NSMutableURLRequest*)request
+            withDelegate:(id<NetworkManagerDelegate>)delegate
+            onMainThread:(BOOL)onMainThread
+             withTimeout:(double)timeout
+          withNumRetries:(unsigned)numRetries
+             withContext:(id)context {
+    [self.started addObject:request];
+    [self.contexts addObject:context];
+    [self.delegates addObject:delegate];
+}
+
+-(BOOL) overrideTestingURLConnectionClass:(Class)testingURLConnectionClass {
+    return FALSE;
+}
+
+-(NSArray*) startedPaths {
+    NSMutableArray* paths = [[NSMutableArray alloc] init];
+    for(NSURLRequest* request in self.started) {
+        [paths addObject:request.URL.path];
+    }
+    return paths;
+}
+
+// Ends the index'th call started.  A 2xx succeeds, anything else fails with that status
+// (or, for -1, with no connection at all):
+-(void) finishCall:(NSUInteger)index status:(int)status {
+    id<NetworkManagerDelegate> delegate = [self.delegates objectAtIndex:index];
+    id context = [self.contexts objectAtIndex:index];
+    if(status >= 0 && [delegate respondsToSelector:@selector(networkManager:didReceiveResponse:httpStatus:)]) {
+        [delegate networkManager:self didReceiveResponse:context httpStatus:status];
+    }
+    if(status >= 200 && status < 300) {
+        [delegate networkManager:self didSucceed:context data:[NSData data]];
+    } else {
+        NetworkManagerError error = (status < 0) ? NetworkManagerErrorNoConnection : NetworkManagerErrorBadRequest;
+        [delegate networkManager:self didFail:context error:error httpStatus:status data:nil];
+    }
+}
+
+@end
+
+
+@interface TestNKRequestOutbox : XCTestCase <NKRequestOutboxDelegate, NetworkManagerDelegate>
+
+@property (nonatomic, retain) NSURL* fileURL;
+@property (nonatomic, retain) NSMutableArray* delivered;   // entries
+@property (nonatomic, retain) NSMutableArray* dropped;     // entries
+@property (nonatomic, retain) NSMutableDictionary* callErrors;   // context -> NetworkManagerError
+
+@end
+
+@implementation TestNKRequestOutbox
+
+- (void)setUp {
+    [super setUp];
+    NSString* name = [NSString stringWithFormat:@"outbox-%@.journal", [[NSUUID UUID] UUIDString]];
+    self.fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:name]];
+    self.delivered = [[NSMutableArray alloc] init];
+    self.dropped = [[NSMutableArray alloc] init];
+    self.callErrors = [[NSMutableDictionary alloc] init];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.fileURL error:nil];
+    [super tearDown];
+}
+
+
+#pragma mark - Helpers
+
+-(NSMutableURLRequest*) helperRequest:(NSString*)method path:(NSString*)path body:(NSString*)body {
+    NSString* urlString = [@"http://outbox.test" stringByAppendingString:path];
+    NSMutableURLRequest* request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = method;
+    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    request.HTTPBody = [body dataUsingEncoding:NSUTF8StringEncoding];
+    return request;
+}
+
+-(NKRequestOutboxEntry*) helperQueue:(NKRequestOutbox*)outbox method:(NSString*)method path:(NSString*)path {
+    return [outbox enqueueRequest:[self helperRequest:method path:path body:[NSString stringWithFormat:@"{\"p\":\"%@\"}", path]]];
+}
+
+-(NSArray*) helperDescribe:(NSArray*)entries {
+    NSMutableArray* descriptions = [[NSMutableArray alloc] init];
+    for(NKRequestOutboxEntry* entry in entries) {
+        [descriptions addObject:[NSString stringWithFormat:@"%@ %@", entry.method, [NSURL URLWithString:entry.urlString].path]];
+    }
+    return descriptions;
+}
+
+
+#pragma mark - The journal
+
+// What's queued is still queued in a new outbox on the same file - same order, same keys,
+// same bodies:
+-(void) testJournalSurvivesReopen {
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertNotNil(outbox);
+    [self helperQueue:outbox method:@"POST" path:@"/1"];
+    [self helperQueue:outbox method:@"PUT" path:@"/2"];
+    [self helperQueue:outbox method:@"DELETE" path:@"/3"];
+    XCTAssertNil([self helperQueue:outbox method:@"GET" path:@"/4"]);
+    NSArray* before = [outbox pendingEntries];
+    [outbox flush];
+    outbox = nil;
+
+    NKRequestOutbox* reopened = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    NSArray* after = [reopened pendingEntries];
+    XCTAssertEqualObjects([self helperDescribe:after], (@[ @"POST /1", @"PUT /2", @"DELETE /3" ]));
+    for(NSUInteger i = 0; i < after.count; i++) {
+        NKRequestOutboxEntry* a = [before objectAtIndex:i];
+        NKRequestOutboxEntry* b = [after objectAtIndex:i];
+        XCTAssertEqualObjects(a.entryID, b.entryID);
+        XCTAssertEqualObjects(a.body, b.body);
+        XCTAssertEqualObjects([b.headers objectForKey:@"Content-Type"], @"application/json");
+    }
+}
+
+// A crash partway through a record loses that record and nothing else, and what's
+// appended afterwards is readable:
+-(void) testCutOffTailIsIgnored {
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    [self helperQueue:outbox method:@"POST" path:@"/1"];
+    [self helperQueue:outbox method:@"POST" path:@"/2"];
+    [outbox flush];
+    outbox = nil;
+
+    NSFileHandle* handle = [NSFileHandle fileHandleForWritingToURL:self.fileURL error:nil];
+    [handle seekToEndOfFile];
+    uint8_t partial[] = { 200, 0, 0, 0, 'b', 'p', 'l' };
+    [handle writeData:[NSData dataWithBytes:partial length:sizeof(partial)]];
+    [handle closeFile];
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqual(outbox.count, (NSUInteger)2);
+    [self helperQueue:outbox method:@"POST" path:@"/3"];
+    [outbox flush];
+    outbox = nil;
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], (@[ @"POST /1", @"POST /2", @"POST /3" ]));
+}
+
+// Appends still waiting for their sync are written when the outbox goes away:
+-(void) testUnsyncedAppendsSurviveDealloc {
+    @autoreleasepool {
+        NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+        outbox.flushInterval = 60.0;
+        [self helperQueue:outbox method:@"POST" path:@"/1"];
+        [self helperQueue:outbox method:@"PUT" path:@"/2"];
+        XCTAssertEqual(outbox.numJournalSyncs, (UInt64)0);
+        outbox = nil;
+    }
+
+    NKRequestOutbox* reopened = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqualObjects([self helperDescribe:[reopened pendingEntries]], (@[ @"POST /1", @"PUT /2" ]));
+}
+
+// A file that isn't a journal is left alone:
+-(void) testRefusesOtherFiles {
+    [[@"not a journal" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:self.fileURL atomically:YES];
+    XCTAssertNil([[NKRequestOutbox alloc] initWithFileURL:self.fileURL]);
+}
+
+// A burst of writes is one sync:
+-(void) testAppendsShareOneSync {
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.flushInterval = 60.0;
+    for(int i = 0; i < 100; i++) {
+        [self helperQueue:outbox method:@"POST" path:[NSString stringWithFormat:@"/%d", i]];
+    }
+    XCTAssertEqual(outbox.numJournalSyncs, (UInt64)0);
+    [outbox flush];
+    XCTAssertEqual(outbox.numJournalSyncs, (UInt64)1);
+}
+
+// PUT and DELETE replace what's waiting for the same URL.  POST doesn't, and isn't replaced:
+-(void) testLaterWriteSupersedesEarlier {
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    [self helperQueue:outbox method:@"PUT" path:@"/a"];
+    [self helperQueue:outbox method:@"POST" path:@"/b"];
+    [self helperQueue:outbox method:@"POST" path:@"/a"];
+    [self helperQueue:outbox method:@"PUT" path:@"/a"];
+    [self helperQueue:outbox method:@"DELETE" path:@"/a"];
+
+    NSArray* expected = @[ @"POST /b", @"POST /a", @"DELETE /a" ];
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], expected);
+    XCTAssertEqual(outbox.numEntriesSuperseded, (UInt64)2);
+    [outbox flush];
+    outbox = nil;
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], expected);
+}
+
+// Once the file is mostly dead records it's rewritten, and it shrinks:
+-(void) testJournalIsRewritten {
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.flushInterval = 60.0;
+    for(int i = 0; i < 200; i++) {
+        [self helperQueue:outbox method:@"PUT" path:@"/same"];
+    }
+    [outbox flush];
+    XCTAssertEqual(outbox.count, (NSUInteger)1);
+    XCTAssertEqual(outbox.numJournalRewrites, (UInt64)1);
+
+    NSNumber* size = nil;
+    [self.fileURL getResourceValue:&size forKey:NSURLFileSizeKey error:nil];
+    XCTAssertLessThan(size.unsignedLongLongValue, 1024ULL);
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], (@[ @"PUT /same" ]));
+}
+
+
+#pragma mark - Replay
+
+// In order, two at a time, and never two for the same URL at once.  Each carries its key:
+-(void) testReplayOrderAndConcurrency {
+    _OutboxScriptedManager* manager = [[_OutboxScriptedManager alloc] init];
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.networkManager = manager;
+    outbox.delegate = self;
+    outbox.maxConcurrentReplays = 2;
+
+    NKRequestOutboxEntry* a1 = [self helperQueue:outbox method:@"POST" path:@"/a"];
+    NKRequestOutboxEntry* a2 = [self helperQueue:outbox method:@"POST" path:@"/a"];
+    [self helperQueue:outbox method:@"POST" path:@"/b"];
+    NSMutableURLRequest* keyed = [self helperRequest:@"POST" path:@"/c" body:@"{}"];
+    [keyed setValue:@"my-own-key" forHTTPHeaderField:@"idempotency-key"];
+    XCTAssertEqualObjects([outbox enqueueRequest:keyed].entryID, @"my-own-key");
+    XCTAssertEqual(outbox.count, (NSUInteger)4);
+
+    [outbox replay];
+    XCTAssertEqualObjects([manager startedPaths], (@[ @"/a", @"/b" ]));
+    XCTAssertEqualObjects([[manager.started objectAtIndex:0] valueForHTTPHeaderField:@"Idempotency-Key"], a1.entryID);
+    XCTAssertEqualObjects([[manager.started objectAtIndex:0] HTTPBody], a1.body);
+
+    // /b is done, and the second /a still has to wait for the first:
+    [manager finishCall:1 status:200];
+    XCTAssertEqualObjects([manager startedPaths], (@[ @"/a", @"/b", @"/c" ]));
+    XCTAssertEqualObjects([[manager.started objectAtIndex:2] valueForHTTPHeaderField:@"Idempotency-Key"], @"my-own-key");
+
+    [manager finishCall:0 status:200];
+    XCTAssertEqualObjects([manager startedPaths], (@[ @"/a", @"/b", @"/c", @"/a" ]));
+    XCTAssertEqualObjects([[manager.started objectAtIndex:3] valueForHTTPHeaderField:@"Idempotency-Key"], a2.entryID);
+
+    [manager finishCall:2 status:201];
+    [manager finishCall:3 status:200];
+    XCTAssertEqual(outbox.count, (NSUInteger)0);
+    XCTAssertEqual(((NKRequestOutboxEntry*)[manager.contexts objectAtIndex:2]).httpStatus, 201);
+    XCTAssertEqual(self.delivered.count, (NSUInteger)4);
+    XCTAssertEqual(outbox.numEntriesDelivered, (UInt64)4);
+    [outbox flush];
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqual(outbox.count, (NSUInteger)0);
+}
+
+// A 4xx is dropped.  No connection leaves the entry queued and stops replay until it's due,
+// and the retry carries the same key:
+-(void) testRejectedAndDeferred {
+    _OutboxScriptedManager* manager = [[_OutboxScriptedManager alloc] init];
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.networkManager = manager;
+    outbox.delegate = self;
+    outbox.maxConcurrentReplays = 1;
+    outbox.retryIntervalSeconds = 60.0;
+
+    [self helperQueue:outbox method:@"POST" path:@"/ok"];
+    [self helperQueue:outbox method:@"POST" path:@"/bad"];
+    NKRequestOutboxEntry* later = [self helperQueue:outbox method:@"POST" path:@"/later"];
+    [self helperQueue:outbox method:@"POST" path:@"/last"];
+
+    [outbox replay];
+    [manager finishCall:0 status:200];
+    [manager finishCall:1 status:422];
+    XCTAssertEqualObjects([self helperDescribe:self.dropped], (@[ @"POST /bad" ]));
+    XCTAssertEqualObjects([manager startedPaths], (@[ @"/ok", @"/bad", @"/later" ]));
+
+    [manager finishCall:2 status:-1];
+    XCTAssertEqual(outbox.numReplaysDeferred, (UInt64)1);
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], (@[ @"POST /later", @"POST /last" ]));
+
+    [outbox replayIfDue];
+    XCTAssertEqual(manager.started.count, (NSUInteger)3);
+
+    [outbox replay];
+    XCTAssertEqual(manager.started.count, (NSUInteger)4);
+    XCTAssertEqualObjects([[manager.started objectAtIndex:3] valueForHTTPHeaderField:@"Idempotency-Key"], later.entryID);
+    XCTAssertEqual(later.numAttempts, (unsigned)2);
+
+    // A 429 is "not now", not "no":
+    [manager finishCall:3 status:429];
+    XCTAssertEqual(self.dropped.count, (NSUInteger)1);
+    XCTAssertEqual(outbox.count, (NSUInteger)2);
+}
+
+// An entry that keeps failing in a way that might work later is dropped once it's used up
+// its attempts, and the ones behind it go on:
+-(void) testDroppedAfterMaxAttempts {
+    _OutboxScriptedManager* manager = [[_OutboxScriptedManager alloc] init];
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.networkManager = manager;
+    outbox.delegate = self;
+    outbox.maxConcurrentReplays = 1;
+    outbox.maxReplayAttempts = 3;
+
+    NKRequestOutboxEntry* stuck = [self helperQueue:outbox method:@"POST" path:@"/stuck"];
+    [self helperQueue:outbox method:@"POST" path:@"/next"];
+
+    for(NSUInteger i = 0; i < 2; i++) {
+        [outbox replay];
+        [manager finishCall:i status:503];
+        XCTAssertEqual(self.dropped.count, (NSUInteger)0);
+        XCTAssertEqual(outbox.count, (NSUInteger)2);
+    }
+    [outbox replay];
+    [manager finishCall:2 status:503];
+    XCTAssertEqualObjects(self.dropped, (@[ stuck ]));
+    XCTAssertEqual(outbox.numEntriesDropped, (UInt64)1);
+    XCTAssertEqual(outbox.numReplaysDeferred, (UInt64)2);
+
+    [outbox replay];
+    XCTAssertEqualObjects([manager startedPaths], (@[ @"/stuck", @"/stuck", @"/stuck", @"/next" ]));
+    [outbox flush];
+
+    outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    XCTAssertEqualObjects([self helperDescribe:[outbox pendingEntries]], (@[ @"POST /next" ]));
+}
+
+
+#pragma mark - With DemoNetworkManager
+
+// A write that opted in is queued when there's no connection, and goes out when there is.
+// Reads, and writes that didn't opt in, just fail as before:
+-(void) testManagerQueuesWritesWhileOffline {
+    NKVirtualClock* clock = [[NKVirtualClock alloc] init];
+    NSMutableArray* seenKeys = [[NSMutableArray alloc] init];
+    NKSimulationURLConnectionBridge* bridge = [[NKSimulationURLConnectionBridge alloc] initWithClock:clock seed:42 responder:^NKSimulatedResponse*(NSURLRequest* request) {
+        NSString* key = [request valueForHTTPHeaderField:@"Idempotency-Key"];
+        @synchronized (seenKeys) {
+            [seenKeys addObject:(key != nil) ? key : @""];
+        }
+        return [NKSimulatedResponse responseWithStatus:200 headers:nil body:[@"{}" dataUsingEncoding:NSUTF8StringEncoding]];
+    }];
+    NKSimulationProfile* offline = [[NKSimulationProfile alloc] init];
+    offline.errorProbability = 1.0;
+    offline.errorMix = @{ @(NSURLErrorNotConnectedToInternet) : @1 };
+    bridge.profile = offline;
+
+    DemoNetworkManager* networkManager = [[DemoNetworkManager alloc] init];
+    networkManager.connectionBridge = bridge;
+    NKRequestOutbox* outbox = [[NKRequestOutbox alloc] initWithFileURL:self.fileURL];
+    outbox.delegate = self;
+    networkManager.outbox = outbox;
+    XCTAssertEqualObjects(outbox.networkManager, networkManager);
+
+    NKCallBehaviorURLRequest* write = [[NKCallBehaviorURLRequest alloc] init];
+    write.URL = [NSURL URLWithString:@"http://outbox.test/things"];
+    write.HTTPMethod = @"POST";
+    write.HTTPBody = [@"{\"a\":1}" dataUsingEncoding:NSUTF8StringEncoding];
+    write.queueWhenOffline = TRUE;
+    [networkManager startNetworkCall:write withDelegate:self onMainThread:YES withTimeout:5.0 withNumRetries:0 withContext:@"write"];
+
+    NSMutableURLRequest* plainWrite = [networkManager buildURLRequest:@"http://outbox.test/other" forRequestType:@"POST"];
+    [networkManager startNetworkCall:plainWrite withDelegate:self onMainThread:YES withTimeout:5.0 withNumRetries:0 withContext:@"plainWrite"];
+
+    NKCallBehaviorURLRequest* read = [[NKCallBehaviorURLRequest alloc] init];
+    read.URL = [NSURL URLWithString:@"http://outbox.test/things"];
+    read.queueWhenOffline = TRUE;
+    [networkManager startNetworkCall:read withDelegate:self onMainThread:YES withTimeout:5.0 withNumRetries:0 withContext:@"read"];
+
+    [clock runUntilIdleOrTime:60.0];
+    XCTAssertEqualObjects([self.callErrors objectForKey:@"write"], @(NetworkManagerErrorQueued));
+    XCTAssertEqualObjects([self.callErrors objectForKey:@"plainWrite"], @(NetworkManagerErrorNoConnection));
+    XCTAssertEqualObjects([self.callErrors objectForKey:@"read"], @(NetworkManagerErrorNoConnection));
+    XCTAssertEqual(outbox.count, (NSUInteger)1);
+    NKRequestOutboxEntry* entry = [[outbox pendingEntries] firstObject];
+    XCTAssertEqualObjects(entry.body, write.HTTPBody);
+
+    // Back online:
+    bridge.profile = [[NKSimulationProfile alloc] init];
+    [outbox replay];
+    [clock runUntilIdleOrTime:120.0];
+
+    XCTAssertEqual(outbox.count, (NSUInteger)0);
+    XCTAssertEqualObjects([self helperDescribe:self.delivered], (@[ @"POST /things" ]));
+    XCTAssertEqualObjects([seenKeys lastObject], entry.entryID);
+    XCTAssertEqual(entry.httpStatus, 200);
+}
+
+
+#pragma mark - Callbacks
+
+-(void) requestOutbox:(NKRequestOutbox*)outbox didDeliver:(NKRequestOutboxEntry*)entry data:(NSData*)data {
+    [self.delivered addObject:entry];
+}
+
+-(void) requestOutbox:(NKRequestOutbox*)outbox didDrop:(NKRequestOutboxEntry*)entry
+                error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    [self.dropped addObject:entry];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    [self.callErrors setObject:@(NetworkManagerErrorNoError) forKey:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    [self.callErrors setObject:@(errorType) forKey:context];
+}
+
+@end
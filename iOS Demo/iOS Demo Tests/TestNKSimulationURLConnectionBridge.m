@@ -0,0 +1,265 @@
+//
+//  TestNKSimulationURLConnectionBridge.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "NKSimulationURLConnectionBridge.h"
+#import "NKVirtualClock.h"
+
+#define kLoadTestNumCalls   10000
+
+
+// Plays the part of a network manager's per-call object: records what happened to one
+// connection, and when (in virtual time).
+@interface _SimTestCall : NSObject <NSURLConnectionDataDelegate>
+
+@property (nonatomic, weak)   NKVirtualClock* clock;
+@property (nonatomic) int statusCode;
+@property (nonatomic, retain) NSMutableData* data;
+@property (nonatomic, retain) NSError* error;
+@property (nonatomic) BOOL finished;
+@property (nonatomic) double responseTime;
+@property (nonatomic) double endTime;
+
+@end
+
+@implementation _SimTestCall
+
+-(_SimTestCall*) initWithClock:(NKVirtualClock*)clock {
+    if(self = [super init]) {
+        self.clock = clock;
+        self.statusCode = -1;
+        self.data = [[NSMutableData alloc] init];
+        self.endTime = -1.0;
+    }
+    return self;
+}
+
+-(void) connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response {
+    self.statusCode = (int)((NSHTTPURLResponse*)response).statusCode;
+    self.responseTime = self.clock.now;
+}
+
+-(void) connection:(NSURLConnection*)connection didReceiveData:(NSData*)data {
+    [self.data appendData:data];
+}
+
+-(void) connectionDidFinishLoading:(NSURLConnection*)connection {
+    self.finished = TRUE;
+    self.endTime = self.clock.now;
+}
+
+-(void) connection:(NSURLConnection*)connection didFailWithError:(NSError*)error {
+    self.error = error;
+    self.endTime = self.clock.now;
+}
+
+@end
+
+
+@interface TestNKSimulationURLConnectionBridge : XCTestCase
+
+@property (nonatomic, retain) NKVirtualClock* clock;
+@property (nonatomic, retain) NKSimulationURLConnectionBridge* bridge;
+@property (nonatomic, retain) NSData* body;
+
+@end
+
+@implementation TestNKSimulationURLConnectionBridge
+
+- (void)setUp {
+    [super setUp];
+    self.body = [NSMutableData dataWithLength:100000];
+    self.clock = [[NKVirtualClock alloc] init];
+    self.bridge = [self helperBridgeWithSeed:42];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    self.bridge = nil;
+    self.clock = nil;
+}
+
+-(NKSimulationURLConnectionBridge*) helperBridgeWithSeed:(UInt64)seed {
+    NSData* body = self.body;
+    return [[NKSimulationURLConnectionBridge alloc] initWithClock:self.clock seed:seed responder:^NKSimulatedResponse*(NSURLRequest* request) {
+        if([request.URL.path isEqualToString:@"/missing"]) return nil;
+        return [NKSimulatedResponse responseWithStatus:200 headers:nil body:body];
+    }];
+}
+
+-(_SimTestCall*) helperStartCall:(NSString*)path {
+    NSURLRequest* request = [NSURLRequest requestWithURL:[NSURL URLWithString:[@"http://sim.example.com" stringByAppendingString:path]]];
+    _SimTestCall* call = [[_SimTestCall alloc] initWithClock:self.clock];
+    NSURLConnection* connection = [self.bridge getConnection:request delegate:call startImmediately:FALSE];
+    [self.bridge scheduleConnection:connection inRunLoop:[NSRunLoop currentRunLoop] forMode:NSRunLoopCommonModes];
+    [self.bridge startConnection:connection];
+    return call;
+}
+
+
+-(void) testNothingHappensUntilTheClockMoves {
+    self.bridge.profile.latencySeconds = 0.5;
+    _SimTestCall* call = [self helperStartCall:@"/a"];
+
+    XCTAssertEqual(call.statusCode, -1);
+    [self.clock advanceBy:0.4];
+    XCTAssertEqual(call.statusCode, -1);
+    [self.clock advanceBy:0.2];
+    XCTAssertEqual(call.statusCode, 200);
+    XCTAssertTrue(call.finished);
+    XCTAssertEqualObjects(call.data, self.body);
+}
+
+-(void) testMissingIs404 {
+    _SimTestCall* call = [self helperStartCall:@"/missing"];
+    [self.clock runUntilIdleOrTime:-1.0];
+    XCTAssertEqual(call.statusCode, 404);
+    XCTAssertTrue(call.finished);
+}
+
+// 100KB over a 100KB/s link after 100ms of latency takes 1.1 virtual seconds.  Two of
+// them at once share the link, so both take about twice as long:
+-(void) testBandwidthIsShared {
+    self.bridge.profile.latencySeconds = 0.1;
+    self.bridge.profile.bandwidthBytesPerSecond = 100000.0;
+
+    _SimTestCall* one = [self helperStartCall:@"/one"];
+    [self.clock runUntilIdleOrTime:-1.0];
+    XCTAssertEqualWithAccuracy(one.endTime, 1.1, 0.001);
+
+    double start = self.clock.now;
+    _SimTestCall* a = [self helperStartCall:@"/a"];
+    _SimTestCall* b = [self helperStartCall:@"/b"];
+    [self.clock runUntilIdleOrTime:-1.0];
+    XCTAssertEqualWithAccuracy(a.endTime - start, 2.1, 0.2);
+    XCTAssertEqualWithAccuracy(b.endTime - start, 2.1, 0.001);
+    XCTAssertEqualObjects(a.data, self.body);
+    XCTAssertEqualObjects(b.data, self.body);
+}
+
+-(void) testDisconnectDeliversOnlyAPrefix {
+    self.bridge.profile.disconnectProbability = 1.0;
+    _SimTestCall* call = [self helperStartCall:@"/a"];
+    [self.clock runUntilIdleOrTime:-1.0];
+
+    XCTAssertFalse(call.finished);
+    XCTAssertEqual(call.error.code, NSURLErrorNetworkConnectionLost);
+    XCTAssertLessThan(call.data.length, self.body.length);
+    XCTAssertEqualObjects(call.data, [self.body subdataWithRange:NSMakeRange(0, call.data.length)]);
+    XCTAssertEqual(self.bridge.numDisconnects, 1);
+}
+
+-(void) testHangNeverCallsBack {
+    self.bridge.profile.hangProbability = 1.0;
+    _SimTestCall* call = [self helperStartCall:@"/a"];
+    [self.clock advanceBy:3600.0];
+
+    XCTAssertEqual(call.statusCode, -1);
+    XCTAssertEqual(call.endTime, -1.0);
+    XCTAssertEqual(self.bridge.numHangs, 1);
+}
+
+-(void) testCancelStopsCallbacks {
+    self.bridge.profile.latencySeconds = 0.1;
+    self.bridge.profile.bandwidthBytesPerSecond = 100000.0;
+
+    NSURLRequest* request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://sim.example.com/a"]];
+    _SimTestCall* call = [[_SimTestCall alloc] initWithClock:self.clock];
+    NSURLConnection* connection = [self.bridge getConnection:request delegate:call startImmediately:TRUE];
+
+    [self.clock advanceBy:1.0];
+    NSUInteger lengthAtCancel = call.data.length;
+    XCTAssertGreaterThan(lengthAtCancel, 0);
+    [self.bridge cancelConnection:connection];
+    [self.clock runUntilIdleOrTime:-1.0];
+
+    XCTAssertEqual(call.data.length, lengthAtCancel);
+    XCTAssertFalse(call.finished);
+    XCTAssertNil(call.error);
+    XCTAssertEqual(self.bridge.numConnectionsCanceled, 1);
+}
+
+// Over a lot of calls, the error mix comes out in about the proportions asked for:
+-(void) testErrorMix {
+    self.bridge.profile.errorProbability = 0.5;
+    self.bridge.profile.errorMix = @{ @500 : @3, @(NSURLErrorNotConnectedToInternet) : @1 };
+
+    NSMutableArray* calls = [[NSMutableArray alloc] init];
+    for(int i = 0; i < 4000; i++) {
+        [calls addObject:[self helperStartCall:@"/a"]];
+    }
+    [self.clock runUntilIdleOrTime:-1.0];
+
+    int num200 = 0, num500 = 0, numOffline = 0;
+    for(_SimTestCall* call in calls) {
+        if(call.error.code == NSURLErrorNotConnectedToInternet) numOffline++;
+        else if(call.statusCode == 500) num500++;
+        else if(call.statusCode == 200) num200++;
+    }
+    XCTAssertEqual(num200 + num500 + numOffline, 4000);
+    XCTAssertEqualWithAccuracy(num200,     2000, 150);
+    XCTAssertEqualWithAccuracy(num500,     1500, 150);
+    XCTAssertEqualWithAccuracy(numOffline,  500, 100);
+    XCTAssertEqual(self.bridge.numInjectedErrors, (UInt64)(num500 + numOffline));
+}
+
+
+#pragma mark - Determinism under load
+
+// Runs kLoadTestNumCalls calls, arriving over a minute of virtual time, through a nasty
+// network, and boils the outcome down to a string that any difference would show up in.
+-(NSString*) helperRunLoadWithSeed:(UInt64)seed {
+    self.clock = [[NKVirtualClock alloc] init];
+    self.bridge = [self helperBridgeWithSeed:seed];
+
+    NKSimulationProfile* profile = self.bridge.profile;
+    profile.latencyDistribution = NKSimulationLatencyLogNormal;
+    profile.latencySeconds = 0.15;
+    profile.latencySpreadSeconds = 0.8;
+    profile.bandwidthBytesPerSecond = 5000000.0;
+    profile.stallProbability = 0.02;
+    profile.stallSeconds = 0.5;
+    profile.disconnectProbability = 0.05;
+    profile.hangProbability = 0.01;
+    profile.errorProbability = 0.05;
+    profile.errorMix = @{ @500 : @2, @503 : @1, @404 : @1, @(NSURLErrorTimedOut) : @1 };
+
+    NSMutableArray* calls = [[NSMutableArray alloc] init];
+    for(int i = 0; i < kLoadTestNumCalls; i++) {
+        [calls addObject:[self helperStartCall:[NSString stringWithFormat:@"/item/%d", i]]];
+        [self.clock advanceBy:0.006];
+    }
+    [self.clock runUntilIdleOrTime:-1.0];
+
+    double sumOfEndTimes = 0.0;
+    UInt64 numFinished = 0, numFailed = 0;
+    for(_SimTestCall* call in calls) {
+        if(call.endTime >= 0.0) sumOfEndTimes += call.endTime;
+        if(call.finished) numFinished++;
+        if(call.error != nil) numFailed++;
+    }
+    return [NSString stringWithFormat:@"%llu finished, %llu failed, %llu stalls, %llu bytes, %.9f", numFinished, numFailed,
+            self.bridge.numStalls, self.bridge.numBodyBytesDelivered, sumOfEndTimes];
+}
+
+-(void) testSameSeedSameRun {
+    NSDate* start = [NSDate date];
+    NSString* first = [self helperRunLoadWithSeed:1234];
+    NSLog(@"%d simulated calls took %.2lf real seconds: %@", kLoadTestNumCalls, -[start timeIntervalSinceNow], first);
+
+    XCTAssertEqualObjects([self helperRunLoadWithSeed:1234], first);
+    XCTAssertNotEqualObjects([self helperRunLoadWithSeed:4321], first);
+
+    XCTAssertEqual(self.bridge.numConnectionsStarted, kLoadTestNumCalls);
+    XCTAssertGreaterThan(self.bridge.numDisconnects, 0);
+    XCTAssertGreaterThan(self.bridge.numHangs, 0);
+    XCTAssertGreaterThan(self.bridge.numStalls, 0);
+}
+
+@end
@@ -27,6 +27,15 @@
 // Set this to TRUE when you want to cancel the call prematurely:
 @property (nonatomic) BOOL cancelCallInTheMiddle;
 
+// Counts the transaction callbacks that have actually been delivered:
+@property (nonatomic) NSUInteger numCallbacks;
+
+// Set this to TRUE to have startNetworkCall just hold on to each call's context and signal
+// callStarted, so the test can call back whenever it likes:
+@property (nonatomic) BOOL holdCalls;
+@property (nonatomic, retain) NSMutableArray* heldContexts;
+@property (nonatomic, retain) dispatch_semaphore_t callStarted;
+
 @end
 
 @implementation TestNetworkTransactionManager
@@ -39,6 +48,10 @@
     self.expectedURLString   = @"dummyURL";
     self.failCall = FALSE;
     self.cancelCallInTheMiddle = FALSE;
+    self.numCallbacks = 0;
+    self.holdCalls = FALSE;
+    self.heldContexts = [[NSMutableArray alloc] init];
+    self.callStarted = dispatch_semaphore_create(0);
 }
 
 - (void)tearDown {
@@ -67,6 +80,8 @@
     } else {
         [self.transactionManager post:self.expectedURLString withData:self.expectedBodyData delegate:self context:self];
     }
+    
+    [self helperCheckCallbacksDelivered];
 }
 
 // This helper allows the above methods to test block callbacks
@@ -86,6 +101,21 @@
             [self networkTransactionManager:self.transactionManager didFail:self networkError:networkError httpStatus:httpStatus jsonDecodingFailure:jsonError jsonData:jsonData rawData:nil];
         }];
     }
+    
+    [self helperCheckCallbacksDelivered];
+}
+
+// Callbacks are asynchronous (they go through the main thread CallbackExecutor), so
+// spin the main run loop until they show up.  A success or a failure should produce
+// exactly one callback and a canceled call should produce none at all.
+-(void) helperCheckCallbacksDelivered {
+    NSUInteger expected = self.cancelCallInTheMiddle ? 0 : 1;
+    NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:(expected == 0 ? 0.1 : 1.0)];
+    while((expected == 0 || self.numCallbacks < expected) && [giveUp timeIntervalSinceNow] > 0.0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    
+    XCTAssertEqual(self.numCallbacks, expected);
 }
 
 
@@ -95,6 +125,54 @@
     [self helperTestDelegateFailure:FALSE method:@"GET"];
 }
 
+// A call that's canceled can still have callbacks on the way from the network manager.  They
+// mustn't reach the transaction that reuses its wrapper:
+-(void) testLateCallbackAfterCancelDoesNotReachNextTransaction {
+    self.holdCalls = TRUE;
+    self.expectedRequestType = @"GET";
+    id firstContext = @"first";
+    [self.transactionManager get:self.expectedURLString withData:self.expectedBodyData delegate:self context:firstContext];
+    XCTAssertEqual(dispatch_semaphore_wait(self.callStarted, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1.0 * NSEC_PER_SEC))), 0);
+    [self.transactionManager cancelFromDelegate:self withContext:firstContext];
+    
+    [self.transactionManager get:self.expectedURLString withData:self.expectedBodyData delegate:self context:self];
+    XCTAssertEqual(dispatch_semaphore_wait(self.callStarted, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1.0 * NSEC_PER_SEC))), 0);
+    XCTAssertEqual(self.heldContexts.count, 2);
+    
+    // The canceled call's failure comes in late, then the new call succeeds.  Only the
+    // success should get through (didFail: asserts failCall, which is FALSE):
+    NSData* content = [JSONHelpers toData:self.expectedReturnData];
+    id<NetworkManagerDelegate> delegate = (id<NetworkManagerDelegate>)self.transactionManager;
+    [delegate networkManager:self didFail:self.heldContexts[0] error:NetworkManagerErrorBadRequest httpStatus:404 data:content];
+    [delegate networkManager:self didFinish:self.heldContexts[0]];
+    [delegate networkManager:self didSucceed:self.heldContexts[1] data:content];
+    [delegate networkManager:self didFinish:self.heldContexts[1]];
+    
+    [self helperCheckCallbacksDelivered];
+}
+
+// Callbacks should go to the executor named for the call, not the main thread:
+-(void) testBlockCallbackOnQueueExecutor {
+    self.expectedRequestType = @"GET";
+    dispatch_queue_t queue = dispatch_queue_create("TestNetworkTransactionManagerQueue", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block BOOL wasOnMainThread = TRUE;
+    __block NSDictionary* returnedJSON = nil;
+    
+    [self.transactionManager get:self.expectedURLString withData:self.expectedBodyData success:^(NSDictionary *jsonData) {
+        wasOnMainThread = [NSThread isMainThread];
+        returnedJSON = jsonData;
+        dispatch_semaphore_signal(semaphore);
+    } failure:^(NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary *jsonData) {
+        dispatch_semaphore_signal(semaphore);
+    } callbackExecutor:[CallbackExecutor executorWithQueue:queue]];
+    
+    long timedOut = dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1.0 * NSEC_PER_SEC)));
+    XCTAssertEqual(timedOut, 0, @"Callback must be delivered on the given queue.");
+    XCTAssertFalse(wasOnMainThread);
+    XCTAssertEqualObjects(self.expectedReturnData, returnedJSON);
+}
+
 // Test the network manager accessor
 -(void) testNetworkManagerAccessor {
     XCTAssertEqual(self, self.transactionManager.networkManager);
@@ -107,6 +185,8 @@
 -(void) networkTransactionManager:(NetworkTransactionManager*)manager
                        didSucceed:(id)context
                          jsonData:(NSDictionary*)jsonData {
+    self.numCallbacks++;
+    XCTAssertTrue([NSThread isMainThread], @"Default callbacks should be delivered on the main thread.");
     XCTAssertFalse(self.cancelCallInTheMiddle);
     XCTAssertFalse(self.failCall);
     XCTAssertEqual(self, context);
@@ -126,6 +206,8 @@
                          jsonData:(NSDictionary*)jsonData
                           rawData:(NSData*)rawData {
     
+    self.numCallbacks++;
+    XCTAssertTrue([NSThread isMainThread], @"Default callbacks should be delivered on the main thread.");
     XCTAssertFalse(self.cancelCallInTheMiddle);
     XCTAssertTrue(self.failCall);
     XCTAssertEqual(self, context);
@@ -159,9 +241,17 @@
              withContext:(id)context {
 
     XCTAssertEqual(self.transactionManager, delegate, @"NetworkTransactionManager should specify self as delegate for all network calls.");
-    XCTAssert(onMainThread, @"NetworkTransactionManager should run all calls on main thread.");
+    XCTAssertFalse(onMainThread, @"NetworkTransactionManager's callback executor should make the only hop to the main thread.");
+    XCTAssertFalse([NSThread isMainThread], @"NetworkTransactionManager should start its calls on its network thread.");
     XCTAssertNotNil(context, @"NetworkTransactionManager should not use nil context.");
     
+    if(self.holdCalls) {
+        @synchronized (self) {
+            [self.heldContexts addObject:context];
+        }
+        dispatch_semaphore_signal(self.callStarted);
+        return;
+    }
     
     // The NetworkTransactionManager should send the expected body data in JSON format:
     XCTAssertEqualObjects(request.HTTPBody, [JSONHelpers toData:self.expectedBodyData], @"NetworkTransactionManager should implicitly send HTTP body data");
@@ -193,7 +283,7 @@
     
     // DidFail: and didSucceed:
     if(self.failCall) {
-        [delegate networkManager:self didFail:content error:NetworkManagerErrorBadRequest httpStatus:404 data:content];
+        [delegate networkManager:self didFail:context error:NetworkManagerErrorBadRequest httpStatus:404 data:content];
     } else {
         [delegate networkManager:self didSucceed:context data:content];
     }
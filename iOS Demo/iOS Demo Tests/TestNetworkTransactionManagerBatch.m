@@ -0,0 +1,265 @@
+//
+//  TestNetworkTransactionManagerBatch.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "DemoNetworkManager.h"
+#import "NetworkTransactionManager.h"
+#import "JSONHelpers.h"
+#import "LocalTestHTTPServer.h"
+
+#define kTestTimeout    10.0
+
+// Batches against a local stand-in for a server with a batch endpoint.  It answers
+// /item/N with {"item":N} whether it's asked on its own or in a batch.  /flaky/N does the
+// same on its own but fails with a 500 inside a batch, /missing is a 404, and /rejected
+// comes back 200 with an "error" the verifying manager below doesn't like.
+
+// Fails anything with an "error" in it, the way a subclass for a real server would:
+@interface _BatchVerifyingTransactionManager : NetworkTransactionManager
+@end
+
+@implementation _BatchVerifyingTransactionManager
+
+-(NetworkManagerError) verifyJSON:(NSDictionary*)json {
+    return ([json objectForKey:@"error"] != nil) ? NetworkManagerErrorBadServer : NetworkManagerErrorNoError;
+}
+
+@end
+
+
+@interface TestNetworkTransactionManagerBatch : XCTestCase <NetworkTransactionManagerDelegate>
+
+@property (nonatomic, retain) LocalTestHTTPServer* server;
+@property (nonatomic, retain) DemoNetworkManager* networkManager;
+@property (nonatomic, retain) NetworkTransactionManager* transactionManager;
+
+// Every path the server was asked for, in order, batched items included as "batch:<path>":
+@property (atomic, retain) NSMutableArray* serverLog;
+
+// What came back, by the path each transaction was for:
+@property (nonatomic, retain) NSMutableDictionary* succeeded;      // path -> json
+@property (nonatomic, retain) NSMutableDictionary* failedStatuses; // path -> httpStatus
+@property (nonatomic, retain) NSMutableDictionary* failedErrors;   // path -> NetworkManagerError
+
+@end
+
+@implementation TestNetworkTransactionManagerBatch
+
+- (void)setUp {
+    [super setUp];
+    self.serverLog = [[NSMutableArray alloc] init];
+    self.succeeded = [[NSMutableDictionary alloc] init];
+    self.failedStatuses = [[NSMutableDictionary alloc] init];
+    self.failedErrors = [[NSMutableDictionary alloc] init];
+
+    __weak TestNetworkTransactionManagerBatch* weakSelf = self;
+    self.server = [[LocalTestHTTPServer alloc] initWithHandler:^(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response) {
+        [weakSelf handleRequest:request response:response];
+    }];
+    XCTAssertTrue([self.server start]);
+
+    self.networkManager = [[DemoNetworkManager alloc] init];
+    self.transactionManager = [[_BatchVerifyingTransactionManager alloc] initWithNetworkManager:self.networkManager];
+    self.transactionManager.batchURL = [self.server urlStringForPath:@"/batch"];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [self.server stop];
+    self.server = nil;
+    self.transactionManager = nil;
+    self.networkManager = nil;
+}
+
+
+#pragma mark - The server
+
+-(void) log:(NSString*)entry {
+    @synchronized (self.serverLog) {
+        [self.serverLog addObject:entry];
+    }
+}
+
+-(NSArray*) loggedRequests {
+    @synchronized (self.serverLog) {
+        return [self.serverLog copy];
+    }
+}
+
+// One resource, asked for on its own or from inside a batch:
+-(int) statusForPath:(NSString*)path inBatch:(BOOL)inBatch body:(NSDictionary**)body {
+    if([path hasPrefix:@"/item/"] || [path hasPrefix:@"/flaky/"]) {
+        if(inBatch && [path hasPrefix:@"/flaky/"]) return 500;
+        NSString* key = [[path pathComponents] objectAtIndex:1];
+        *body = @{ key : @([[path lastPathComponent] intValue]) };
+        return 200;
+    }
+    if([path isEqualToString:@"/rejected"]) {
+        *body = @{ @"error" : @"not today" };
+        return 200;
+    }
+    *body = @{ @"message" : @"no such thing" };
+    return 404;
+}
+
+-(void) handleRequest:(LocalTestHTTPRequest*)request response:(LocalTestHTTPResponse*)response {
+    NSDictionary* body = nil;
+    if(![request.path isEqualToString:@"/batch"]) {
+        [self log:request.path];
+        response.statusCode = [self statusForPath:request.path inBatch:FALSE body:&body];
+        response.body = [JSONHelpers toData:body];
+        return;
+    }
+
+    [self log:request.path];
+    NSDictionary* envelope = [JSONHelpers toJSON:request.body];
+    NSMutableArray* responses = [NSMutableArray array];
+    for(NSDictionary* item in [envelope objectForKey:@"requests"]) {
+        NSString* path = [NSURL URLWithString:[item objectForKey:@"url"]].path;
+        [self log:[@"batch:" stringByAppendingString:path]];
+        int status = [self statusForPath:path inBatch:TRUE body:&body];
+        [responses addObject:@{ @"id" : [item objectForKey:@"id"], @"status" : @(status), @"body" : body }];
+    }
+    response.body = [JSONHelpers toData:@{ @"responses" : responses }];
+}
+
+
+#pragma mark - Helpers
+
+-(void) helperAdd:(NSString*)path toBatch:(NetworkTransactionBatch*)batch {
+    [batch get:[self.server urlStringForPath:path] withData:nil success:^(NSDictionary* jsonData) {
+        [self.succeeded setObject:(jsonData ?: [NSNull null]) forKey:path];
+    } failure:^(NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary* jsonData) {
+        [self.failedStatuses setObject:@(httpStatus) forKey:path];
+        [self.failedErrors setObject:@(networkError) forKey:path];
+    }];
+}
+
+-(void) helperWaitForNumResults:(NSUInteger)numResults {
+    NSDate* giveUp = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    while(self.succeeded.count + self.failedStatuses.count < numResults && [giveUp timeIntervalSinceNow] > 0.0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    XCTAssertEqual(self.succeeded.count + self.failedStatuses.count, numResults);
+}
+
+// Spins a little longer to make sure nothing else turns up:
+-(void) helperSettle {
+    NSDate* until = [NSDate dateWithTimeIntervalSinceNow:0.2];
+    while([until timeIntervalSinceNow] > 0.0) {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+}
+
+
+#pragma mark - Tests
+
+// Eight transactions, one request:
+-(void) testBatchIsOneRequest {
+    NetworkTransactionBatch* batch = [self.transactionManager batch];
+    for(int i = 0; i < 8; i++) {
+        [self helperAdd:[NSString stringWithFormat:@"/item/%d", i] toBatch:batch];
+    }
+    XCTAssertEqual(batch.count, (NSUInteger)8);
+    [batch send];
+    [self helperWaitForNumResults:8];
+
+    for(int i = 0; i < 8; i++) {
+        XCTAssertEqualObjects([self.succeeded objectForKey:[NSString stringWithFormat:@"/item/%d", i]], @{ @"item" : @(i) });
+    }
+    NSArray* requests = [self loggedRequests];
+    XCTAssertEqual([requests filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"NOT SELF BEGINSWITH 'batch:'"]].count, (NSUInteger)1);
+    XCTAssertEqual(self.transactionManager.numBatchesSent, (UInt64)1);
+}
+
+// A 500 inside the batch is tried again on its own.  A 404 and a verifyJSON: failure are
+// real answers, so they aren't:
+-(void) testItemsAreSettledOneByOne {
+    NetworkTransactionBatch* batch = [self.transactionManager batch];
+    [self helperAdd:@"/item/1" toBatch:batch];
+    [self helperAdd:@"/flaky/2" toBatch:batch];
+    [self helperAdd:@"/missing" toBatch:batch];
+    [self helperAdd:@"/rejected" toBatch:batch];
+    [batch send];
+    [self helperWaitForNumResults:4];
+    [self helperSettle];
+
+    XCTAssertEqualObjects([self.succeeded objectForKey:@"/item/1"], @{ @"item" : @1 });
+    XCTAssertEqualObjects([self.succeeded objectForKey:@"/flaky/2"], @{ @"flaky" : @2 });
+    XCTAssertEqualObjects([self.failedStatuses objectForKey:@"/missing"], @404);
+    XCTAssertEqualObjects([self.failedErrors objectForKey:@"/missing"], @(NetworkManagerErrorBadRequest));
+    XCTAssertEqualObjects([self.failedErrors objectForKey:@"/rejected"], @(NetworkManagerErrorBadServer));
+
+    XCTAssertEqual(self.transactionManager.numBatchItemsRetried, (UInt64)1);
+    XCTAssertEqualObjects([self loggedRequests], (@[ @"/batch", @"batch:/item/1", @"batch:/flaky/2", @"batch:/missing", @"batch:/rejected", @"/flaky/2" ]));
+}
+
+// A server without the batch endpoint still gets every transaction, one at a time:
+-(void) testEnvelopeFailureFallsBackToSingleCalls {
+    self.transactionManager.batchURL = [self.server urlStringForPath:@"/no-batch-here"];
+    NetworkTransactionBatch* batch = [self.transactionManager batch];
+    for(int i = 0; i < 3; i++) {
+        [self helperAdd:[NSString stringWithFormat:@"/item/%d", i] toBatch:batch];
+    }
+    [batch send];
+    [self helperWaitForNumResults:3];
+
+    XCTAssertEqual(self.succeeded.count, (NSUInteger)3);
+    XCTAssertEqual(self.transactionManager.numBatchItemsRetried, (UInt64)3);
+}
+
+// Without a batch endpoint, there's no envelope at all:
+-(void) testNoBatchURLSendsSingly {
+    self.transactionManager.batchURL = nil;
+    NetworkTransactionBatch* batch = [self.transactionManager batch];
+    [self helperAdd:@"/item/1" toBatch:batch];
+    [self helperAdd:@"/item/2" toBatch:batch];
+    [batch send];
+    [self helperWaitForNumResults:2];
+
+    XCTAssertEqual(self.transactionManager.numBatchesSent, (UInt64)0);
+    XCTAssertEqual([self loggedRequests].count, (NSUInteger)2);
+}
+
+// Delegates work too, and a transaction canceled while its envelope is out hears nothing:
+-(void) testDelegateItemsAndCancel {
+    NetworkTransactionBatch* batch = [self.transactionManager batch];
+    [batch get:[self.server urlStringForPath:@"/item/1"] withData:nil delegate:self context:@"/item/1"];
+    [batch get:[self.server urlStringForPath:@"/item/2"] withData:nil delegate:self context:@"/item/2"];
+    [batch post:[self.server urlStringForPath:@"/item/3"] withData:@{ @"x" : @1 } delegate:self context:@"/item/3"];
+    [batch send];
+    [self.transactionManager cancelFromDelegate:self withContext:@"/item/2"];
+
+    [self helperWaitForNumResults:2];
+    [self helperSettle];
+    XCTAssertNotNil([self.succeeded objectForKey:@"/item/1"]);
+    XCTAssertNil([self.succeeded objectForKey:@"/item/2"]);
+    XCTAssertNil([self.failedStatuses objectForKey:@"/item/2"]);
+    XCTAssertNotNil([self.succeeded objectForKey:@"/item/3"]);
+}
+
+
+#pragma mark - Callbacks as NetworkTransactionManagerDelegate
+
+-(void) networkTransactionManager:(NetworkTransactionManager*)manager didSucceed:(id)context jsonData:(NSDictionary*)jsonData {
+    [self.succeeded setObject:(jsonData ?: [NSNull null]) forKey:context];
+}
+
+-(void) networkTransactionManager:(NetworkTransactionManager*)manager
+                          didFail:(id)context
+                     networkError:(NetworkManagerError)networkError
+                       httpStatus:(int)httpStatus
+              jsonDecodingFailure:(BOOL)jsonError
+                         jsonData:(NSDictionary*)jsonData
+                          rawData:(NSData*)rawData {
+    [self.failedStatuses setObject:@(httpStatus) forKey:context];
+    [self.failedErrors setObject:@(networkError) forKey:context];
+}
+
+@end
@@ -0,0 +1,140 @@
+//
+//  TestNetworkTransactionManagerThroughput.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Benchmarks for NetworkTransactionManager's decode pipeline.  A fake network manager
+    hands back a pile of large JSON responses all at once, and we time how long it takes
+    for every transaction to get its callback with the decode pool limited to one worker
+    versus one worker per core.  Watch the log for the numbers. */
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "AbstractNetworkManager.h"
+#import "NetworkTransactionManager.h"
+#import "JSONHelpers.h"
+
+#define kNumTransactions    64
+#define kItemsPerResponse   20000
+
+
+#pragma mark - Fake network manager
+
+// Succeeds every call immediately (synchronously) with the same big payload:
+@interface _ThroughputFakeNetworkManager : NSObject <AbstractNetworkManager>
+@property (nonatomic, retain) NSData* payload;
+@end
+
+@implementation _ThroughputFakeNetworkManager
+
+-(NSMutableURLRequest*) buildURLRequest:(NSString*)urlString forRequestType:(NSString*)requestType {
+    NSMutableURLRequest* request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = requestType;
+    return request;
+}
+
+-(void) startNetworkCall:(NSMutableURLRequest*)request
+            withDelegate:(id<NetworkManagerDelegate>)delegate
+            onMainThread:(BOOL)onMainThread
+             withTimeout:(double)timeout
+          withNumRetries:(unsigned)numRetries
+             withContext:(id)context {
+    [delegate networkManager:self didSucceed:context data:self.payload];
+    if([delegate respondsToSelector:@selector(networkManager:didFinish:)]) {
+        [delegate networkManager:self didFinish:context];
+    }
+}
+
+-(BOOL) overrideTestingURLConnectionClass:(Class)testingURLConnectionClass {
+    return FALSE;
+}
+
+@end
+
+
+#pragma mark - Benchmarks
+
+@interface TestNetworkTransactionManagerThroughput : XCTestCase
+
+@property (nonatomic, retain) _ThroughputFakeNetworkManager* networkManager;
+@property (nonatomic, retain) dispatch_queue_t callbackQueue;
+
+@end
+
+@implementation TestNetworkTransactionManagerThroughput
+
+- (void)setUp {
+    [super setUp];
+
+    // Build one big (a couple of MB) response to hand back for every call:
+    NSMutableArray* items = [[NSMutableArray alloc] initWithCapacity:kItemsPerResponse];
+    for(int i = 0; i < kItemsPerResponse; i++) {
+        [items addObject:@{ @"id" : [NSString stringWithFormat:@"object-%d", i],
+                            @"name" : @"Some fairly typical name string",
+                            @"count" : @(i),
+                            @"tags" : @[@"one", @"two", @"three"] }];
+    }
+
+    self.networkManager = [[_ThroughputFakeNetworkManager alloc] init];
+    self.networkManager.payload = [JSONHelpers toData:@{ @"items" : items }];
+    self.callbackQueue = dispatch_queue_create("TestNetworkTransactionManagerThroughput", DISPATCH_QUEUE_SERIAL);
+}
+
+- (void)tearDown {
+    [super tearDown];
+    self.networkManager = nil;
+}
+
+// Sends kNumTransactions calls at once and returns the seconds until every callback is in:
+-(NSTimeInterval) helperTimeTransactionsWithMaxConcurrentDecodes:(NSInteger)maxConcurrentDecodes {
+    NetworkTransactionManager* manager = [[NetworkTransactionManager alloc] initWithNetworkManager:self.networkManager];
+    manager.maxConcurrentDecodes = maxConcurrentDecodes;
+    CallbackExecutor* executor = [CallbackExecutor executorWithQueue:self.callbackQueue];
+    dispatch_group_t group = dispatch_group_create();
+    __block int numFailures = 0;
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for(int i = 0; i < kNumTransactions; i++) {
+        dispatch_group_enter(group);
+        [manager get:@"http://benchmark.local/items" withData:nil success:^(NSDictionary *jsonData) {
+            dispatch_group_leave(group);
+        } failure:^(NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary *jsonData) {
+            numFailures++;
+            dispatch_group_leave(group);
+        } callbackExecutor:executor];
+    }
+
+    long timedOut = dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(60.0 * NSEC_PER_SEC)));
+    NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - start;
+
+    XCTAssertEqual(timedOut, 0, @"All transactions should call back.");
+    XCTAssertEqual(numFailures, 0, @"All transactions should decode successfully.");
+    return elapsed;
+}
+
+// Decoding across all cores should beat decoding on one.
+-(void) testDecodeThroughputScalesWithCores {
+    NSInteger numCores = [[NSProcessInfo processInfo] activeProcessorCount];
+
+    NSTimeInterval serial   = [self helperTimeTransactionsWithMaxConcurrentDecodes:1];
+    NSTimeInterval parallel = [self helperTimeTransactionsWithMaxConcurrentDecodes:numCores];
+
+    NSLog(@"%d responses of %lu bytes: %.3lfs with 1 decode worker, %.3lfs with %ld (%.2lfx)",
+          kNumTransactions, (unsigned long)self.networkManager.payload.length, serial, parallel, (long)numCores, serial / parallel);
+
+    if(numCores > 1) {
+        XCTAssertLessThan(parallel, serial, @"Decoding on %ld workers should be faster than on one.", (long)numCores);
+    }
+}
+
+// For tracking the default configuration from build to build:
+-(void) testDecodeThroughputDefaultPerformance {
+    [self measureBlock:^{
+        [self helperTimeTransactionsWithMaxConcurrentDecodes:[[NSProcessInfo processInfo] activeProcessorCount]];
+    }];
+}
+
+@end
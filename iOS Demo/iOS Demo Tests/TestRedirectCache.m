@@ -0,0 +1,103 @@
+//
+//  TestRedirectCache.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import "RedirectCache.h"
+
+@interface TestRedirectCache : XCTestCase
+
+@property (nonatomic, retain) RedirectCache* cache;
+
+@end
+
+@implementation TestRedirectCache
+
+- (void)setUp {
+    [super setUp];
+    self.cache = [[RedirectCache alloc] initWithCapacity:4];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    self.cache = nil;
+}
+
+-(NSURL*) url:(NSString*)path {
+    return [NSURL URLWithString:[@"http://example.com" stringByAppendingString:path]];
+}
+
+-(void) testOnlyPermanentRedirectsAreStored {
+    [self.cache recordRedirectFrom:[self url:@"/a"] to:[self url:@"/b"] httpStatus:302];
+    [self.cache recordRedirectFrom:[self url:@"/c"] to:[self url:@"/d"] httpStatus:307];
+    [self.cache recordRedirectFrom:[self url:@"/e"] to:[self url:@"/f"] httpStatus:303];
+    XCTAssertEqual(self.cache.count, 0);
+
+    [self.cache recordRedirectFrom:[self url:@"/a"] to:[self url:@"/b"] httpStatus:301];
+    [self.cache recordRedirectFrom:[self url:@"/c"] to:[self url:@"/d"] httpStatus:308];
+    XCTAssertEqual(self.cache.count, 2);
+}
+
+-(void) testUnknownURLResolvesToItself {
+    NSArray* hops = nil;
+    NSURL* url = [self url:@"/nothing"];
+    XCTAssertEqualObjects([self.cache resolveURL:url hops:&hops], url);
+    XCTAssertEqual(hops.count, 0);
+}
+
+-(void) testChainsAreFollowed {
+    [self.cache recordRedirectFrom:[self url:@"/a"] to:[self url:@"/b"] httpStatus:301];
+    [self.cache recordRedirectFrom:[self url:@"/b"] to:[self url:@"/c"] httpStatus:308];
+
+    NSArray* hops = nil;
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/a"] hops:&hops], [self url:@"/c"]);
+    XCTAssertEqual(hops.count, 2);
+    XCTAssertEqualObjects(((RedirectCacheHop*)hops[0]).toURLString, [self url:@"/b"].absoluteString);
+    XCTAssertEqual(((RedirectCacheHop*)hops[0]).httpStatus, 301);
+    XCTAssertEqualObjects(((RedirectCacheHop*)hops[1]).toURLString, [self url:@"/c"].absoluteString);
+    XCTAssertEqual(((RedirectCacheHop*)hops[1]).httpStatus, 308);
+}
+
+-(void) testLoopsStop {
+    [self.cache recordRedirectFrom:[self url:@"/a"] to:[self url:@"/b"] httpStatus:301];
+    [self.cache recordRedirectFrom:[self url:@"/b"] to:[self url:@"/a"] httpStatus:301];
+
+    NSArray* hops = nil;
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/a"] hops:&hops], [self url:@"/b"]);
+    XCTAssertEqual(hops.count, 1);
+}
+
+-(void) testLeastRecentlyUsedIsEvicted {
+    for(int i = 0; i < 4; i++) {
+        [self.cache recordRedirectFrom:[self url:[NSString stringWithFormat:@"/from%d", i]]
+                                    to:[self url:[NSString stringWithFormat:@"/to%d", i]] httpStatus:301];
+    }
+
+    // Using /from0 makes /from1 the oldest:
+    [self.cache resolveURL:[self url:@"/from0"] hops:NULL];
+    [self.cache recordRedirectFrom:[self url:@"/from4"] to:[self url:@"/to4"] httpStatus:301];
+
+    XCTAssertEqual(self.cache.count, 4);
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/from0"] hops:NULL], [self url:@"/to0"]);
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/from1"] hops:NULL], [self url:@"/from1"]);
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/from4"] hops:NULL], [self url:@"/to4"]);
+}
+
+-(void) testRemove {
+    [self.cache recordRedirectFrom:[self url:@"/a"] to:[self url:@"/b"] httpStatus:301];
+    [self.cache recordRedirectFrom:[self url:@"/c"] to:[self url:@"/d"] httpStatus:301];
+
+    [self.cache removeRedirectFrom:[self url:@"/a"]];
+    XCTAssertEqualObjects([self.cache resolveURL:[self url:@"/a"] hops:NULL], [self url:@"/a"]);
+    XCTAssertEqual(self.cache.count, 1);
+
+    [self.cache removeAll];
+    XCTAssertEqual(self.cache.count, 0);
+}
+
+@end
@@ -148,6 +148,95 @@ static void __asyncAssertTrueTestFunc(id obj, BOOL test, NSString* str) {
 
 
 
+-(SharedThreadPoolThreadMetrics*) helperMetricsForIdentifier:(id)identifier {
+    for(SharedThreadPoolThreadMetrics* metrics in [self.pool threadMetrics]) {
+        if([metrics.identifier isEqual:identifier]) return metrics;
+    }
+    return nil;
+}
+
+// The metrics see subscribers, pins, and work sent with performBlock:onThread: - how much
+// is waiting, how long it waited, and how long the run loop was busy with it:
+-(void) testThreadMetrics {
+    NSThread* thread = [self.pool subscribeToThreadWithIdentifer:kIdentifier];
+    [self.pool pinThread:YES withIdentifier:kIdentifier];
+    
+    // The first block holds up the rest until we let it go:
+    dispatch_semaphore_t holding = dispatch_semaphore_create(0);
+    dispatch_semaphore_t release = dispatch_semaphore_create(0);
+    [self.pool performBlock:^{
+        dispatch_semaphore_signal(holding);
+        dispatch_semaphore_wait(release, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC)));
+    } onThread:thread];
+    for(int i = 0; i < 3; i++) {
+        [self.pool performBlock:^{ } onThread:thread];
+    }
+    [self.pool performBlock:^{ dispatch_semaphore_signal(self.semaphore); } onThread:thread];
+    
+    // Everything's been posted, and nothing after the first block can run yet:
+    XCTAssertEqual(dispatch_semaphore_wait(holding, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC))), 0);
+    NSDate* heldSince = [NSDate date];
+    SharedThreadPoolThreadMetrics* during = [self helperMetricsForIdentifier:kIdentifier];
+    XCTAssertGreaterThanOrEqual(during.queueDepth, 4);
+    XCTAssertGreaterThan(during.blockedSeconds, 0.0);
+    XCTAssertLessThanOrEqual(during.numPerformsRun, (UInt64)1);
+    
+    double heldFor = -[heldSince timeIntervalSinceNow];
+    dispatch_semaphore_signal(release);
+    
+    // Each perform is counted before its block runs, so by the last block's signal they all are.
+    // The ones held up waited at least as long as we held them (give or take the two clocks):
+    XCTAssertEqual(dispatch_semaphore_wait(self.semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC))), 0);
+    SharedThreadPoolThreadMetrics* after = [self helperMetricsForIdentifier:kIdentifier];
+    XCTAssertEqualObjects(after.name, thread.name);
+    XCTAssertEqual(after.numberOfSubscribers, 1);
+    XCTAssertTrue(after.pinned);
+    XCTAssertEqual(after.queueDepth, 0);
+    XCTAssertEqual(after.numPerformsRun, (UInt64)5);
+    XCTAssertGreaterThanOrEqual(after.maxPerformLatency, heldFor - 0.01);
+    XCTAssertGreaterThan(after.meanPerformLatency, 0.0);
+    XCTAssertLessThanOrEqual(after.meanPerformLatency, after.maxPerformLatency);
+    XCTAssertGreaterThanOrEqual(after.busySeconds, heldFor - 0.01);
+    
+    [self.pool pinThread:FALSE withIdentifier:kIdentifier];
+    [self.pool unsubscribeThreadWithIdentifier:kIdentifier];
+}
+
+// A thread stuck on one thing is flagged once, and a thread that's just waiting isn't:
+-(void) testWatchdogFlagsBlockedThread {
+    NSThread* thread = [self.pool subscribeToThreadWithIdentifer:kIdentifier];
+    NSThread* idleThread = [self.pool subscribeToThreadWithIdentifer:@"idle"];
+    XCTAssertNotNil(idleThread);
+    
+    NSMutableArray* flagged = [[NSMutableArray alloc] init];
+    [self.pool startWatchdogWithThreshold:0.2 handler:^(SharedThreadPoolThreadMetrics* metrics) {
+        @synchronized (flagged) {
+            [flagged addObject:metrics];
+        }
+    }];
+    
+    [self.pool performBlock:^{ [NSThread sleepForTimeInterval:1.0]; } onThread:thread];
+    [self.pool performBlock:^{ dispatch_semaphore_signal(self.semaphore); } onThread:thread];
+    XCTAssertEqual(dispatch_semaphore_wait(self.semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC))), 0);
+    
+    // Give it a few more looks with everything idle:
+    [NSThread sleepForTimeInterval:0.5];
+    [self.pool stopWatchdog];
+    
+    @synchronized (flagged) {
+        XCTAssertEqual(flagged.count, (NSUInteger)1);
+        SharedThreadPoolThreadMetrics* metrics = [flagged firstObject];
+        XCTAssertEqualObjects(metrics.identifier, kIdentifier);
+        XCTAssertGreaterThan(metrics.blockedSeconds, 0.2);
+        XCTAssertEqual(metrics.numWatchdogFlags, (UInt64)1);
+    }
+    XCTAssertEqual([self helperMetricsForIdentifier:@"idle"].numWatchdogFlags, (UInt64)0);
+    
+    [self.pool unsubscribeThreadWithIdentifier:kIdentifier];
+    [self.pool unsubscribeThreadWithIdentifier:@"idle"];
+}
+
+
 -(void) testAsynchronousExample {
     dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)), self.queue, ^{
         dispatch_semaphore_signal(self.semaphore);
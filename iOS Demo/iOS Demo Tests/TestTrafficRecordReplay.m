@@ -0,0 +1,367 @@
+//
+//  TestTrafficRecordReplay.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import <XCTest/XCTest.h>
+#import <Foundation/Foundation.h>
+#import <mach/mach.h>
+#import "DemoNetworkManager.h"
+#import "NKNetworkManager.h"
+#import "NKTrafficRecorder.h"
+#import "NKRecordingURLConnectionBridge.h"
+#import "NKReplayURLConnectionBridge.h"
+#import "LocalTestHTTPServer.h"
+
+#define kTestTimeout        20.0
+#define kNumRecordedCalls   200
+
+// Records a session against a local server, then plays it back into a fresh
+// DemoNetworkManager without touching the server.  The benchmark at the bottom replays the
+// same recording into DemoNetworkManager and NKNetworkManager and logs throughput, latency
+// and memory for each so they can be compared.
+
+@interface TestTrafficRecordReplay : XCTestCase <NetworkManagerDelegate>
+
+@property (nonatomic, retain) LocalTestHTTPServer* server;
+@property (nonatomic, retain) NSURL* fileURL;
+
+// Per-call results, keyed by the context (an NSNumber index):
+@property (nonatomic, retain) NSMutableDictionary* startTimes;
+@property (nonatomic, retain) NSMutableDictionary* latencies;
+@property (nonatomic, retain) NSMutableDictionary* receivedData;
+@property (nonatomic, retain) NSMutableDictionary* failedStatuses;
+@property (nonatomic) int numFinished;
+
+@end
+
+@implementation TestTrafficRecordReplay
+
+- (void)setUp {
+    [super setUp];
+    self.fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:
+                                           [NSString stringWithFormat:@"traffic-%@.nktraf", [[NSUUID UUID] UUIDString]]]];
+
+    self.server = [[LocalTestHTTPServer alloc] initWithHandler:^(LocalTestHTTPRequest* request, LocalTestHTTPResponse* response) {
+        if([request.path hasPrefix:@"/item/"]) {
+            response.body = [TestTrafficRecordReplay bodyForItem:[[request.path lastPathComponent] intValue]];
+        } else {
+            response.statusCode = 404;
+        }
+    }];
+    XCTAssertTrue([self.server start]);
+}
+
+- (void)tearDown {
+    [super tearDown];
+    [self.server stop];
+    self.server = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:self.fileURL error:nil];
+}
+
+// Different sizes and contents for each item, the same every time:
++(NSData*) bodyForItem:(int)item {
+    NSUInteger length = ((NSUInteger)item * 7919) % 60000 + 1;
+    NSMutableData* data = [NSMutableData dataWithLength:length];
+    uint8_t* bytes = data.mutableBytes;
+    for(NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)(i * 31 + item);
+    }
+    return data;
+}
+
+-(NSString*) pathForItem:(int)item {
+    return [NSString stringWithFormat:@"/item/%d", item];
+}
+
+-(void) helperResetResults {
+    self.startTimes = [[NSMutableDictionary alloc] init];
+    self.latencies = [[NSMutableDictionary alloc] init];
+    self.receivedData = [[NSMutableDictionary alloc] init];
+    self.failedStatuses = [[NSMutableDictionary alloc] init];
+    self.numFinished = 0;
+}
+
+-(unsigned long long) helperResidentMemory {
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+}
+
+// Sends a GET for each path, each one startOffsets[i] seconds after the first (or all at
+// once if startOffsets is nil), and runs the main run loop until they've all finished.
+// Returns the highest resident memory seen along the way.
+-(unsigned long long) helperRunCalls:(NSArray*)paths startOffsets:(NSArray*)startOffsets manager:(id<AbstractNetworkManager>)manager {
+    [self helperResetResults];
+    unsigned long long peakMemory = [self helperResidentMemory];
+
+    NSDate* start = [NSDate date];
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:kTestTimeout];
+    NSUInteger numStarted = 0;
+    while(self.numFinished < (int)paths.count && [deadline timeIntervalSinceNow] > 0) {
+        while(numStarted < paths.count && (startOffsets == nil || [[startOffsets objectAtIndex:numStarted] doubleValue] <= -[start timeIntervalSinceNow])) {
+            NSNumber* context = @(numStarted);
+            [self.startTimes setObject:[NSDate date] forKey:context];
+            NSString* urlString = [self.server urlStringForPath:[paths objectAtIndex:numStarted]];
+            NSMutableURLRequest* request = [manager buildURLRequest:urlString forRequestType:@"GET"];
+            [manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:kTestTimeout withNumRetries:0 withContext:context];
+            numStarted++;
+        }
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.005]];
+        peakMemory = MAX(peakMemory, [self helperResidentMemory]);
+    }
+    XCTAssertEqual(self.numFinished, (int)paths.count, @"Not every call finished.");
+    return peakMemory;
+}
+
+// Records a GET of each item, all at once:
+-(NSArray*) helperRecordItems:(int)numItems {
+    NKTrafficRecorder* recorder = [[NKTrafficRecorder alloc] initWithFileURL:self.fileURL];
+    XCTAssertNotNil(recorder);
+
+    DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+    [manager startRecordingTraffic:recorder];
+
+    NSMutableArray* paths = [[NSMutableArray alloc] init];
+    for(int i = 0; i < numItems; i++) {
+        [paths addObject:[self pathForItem:i]];
+    }
+    [self helperRunCalls:paths startOffsets:nil manager:manager];
+
+    [manager stopRecordingTraffic];
+    XCTAssertEqualObjects([manager.connectionBridge class], [NKDefaultURLConnectionBridge class]);
+    [recorder close];
+    XCTAssertEqual(recorder.numRecordsWritten, (UInt64)numItems);
+    return paths;
+}
+
+
+#pragma mark - Recording
+
+-(void) testRecordingReadsBack {
+    [self helperRecordItems:20];
+
+    NSArray* records = [NKTrafficRecorder recordsFromFileURL:self.fileURL];
+    XCTAssertEqual(records.count, 20);
+    for(NKTrafficRecord* record in records) {
+        int item = [[record.urlString lastPathComponent] intValue];
+        NSData* expected = [TestTrafficRecordReplay bodyForItem:item];
+
+        XCTAssertEqualObjects(record.method, @"GET");
+        XCTAssertEqual(record.statusCode, 200);
+        XCTAssertEqual(record.errorCode, 0);
+        XCTAssertEqual(record.bodyLength, (unsigned long long)expected.length);
+        XCTAssertEqualObjects(record.body, expected);
+        XCTAssertGreaterThanOrEqual(record.responseDelay, 0.0);
+        XCTAssertGreaterThanOrEqual(record.duration, record.responseDelay);
+        XCTAssertNotNil(record.responseHeaders);
+    }
+}
+
+// A second recorder on the same file appends to it:
+-(void) testRecordingAppends {
+    [self helperRecordItems:3];
+    [self helperRecordItems:4];
+    XCTAssertEqual([NKTrafficRecorder recordsFromFileURL:self.fileURL].count, 7);
+}
+
+-(void) testCutOffRecordIsIgnored {
+    [self helperRecordItems:5];
+
+    NSData* data = [NSData dataWithContentsOfURL:self.fileURL];
+    [[data subdataWithRange:NSMakeRange(0, data.length - 10)] writeToURL:self.fileURL atomically:YES];
+    XCTAssertEqual([NKTrafficRecorder recordsFromFileURL:self.fileURL].count, 4);
+
+    [@"not a recording" writeToURL:self.fileURL atomically:YES encoding:NSUTF8StringEncoding error:nil];
+    XCTAssertNil([NKTrafficRecorder recordsFromFileURL:self.fileURL]);
+    XCTAssertNil([[NKTrafficRecorder alloc] initWithFileURL:self.fileURL]);
+}
+
+
+#pragma mark - Replay
+
+-(void) testReplayServesRecordedResponses {
+    NSArray* paths = [self helperRecordItems:20];
+    NSArray* records = [NKTrafficRecorder recordsFromFileURL:self.fileURL];
+    long numServerRequests = self.server.numRequests;
+
+    NKReplayURLConnectionBridge* bridge = [[NKReplayURLConnectionBridge alloc] initWithRecords:records speed:0.0];
+    DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+    manager.connectionBridge = bridge;
+
+    NSMutableArray* pathsWithMissing = [paths mutableCopy];
+    [pathsWithMissing addObject:@"/never/recorded"];
+    [self helperRunCalls:pathsWithMissing startOffsets:nil manager:manager];
+
+    XCTAssertEqual(self.server.numRequests, numServerRequests, @"Replay went to the network.");
+    for(NSUInteger i = 0; i < paths.count; i++) {
+        XCTAssertEqualObjects([self.receivedData objectForKey:@(i)], [TestTrafficRecordReplay bodyForItem:(int)i]);
+    }
+    XCTAssertEqualObjects([self.failedStatuses objectForKey:@(paths.count)], @404);
+    XCTAssertEqual(bridge.numUnmatchedRequests, 1);
+    XCTAssertEqual(bridge.numConnectionsFinished, pathsWithMissing.count);
+}
+
+// Repeats of the same request get the recorded responses in order, and the last one after that:
+-(void) testRepeatsReplayInOrder {
+    NSMutableArray* records = [[NSMutableArray alloc] init];
+    for(NSNumber* status in @[@200, @503]) {
+        NKTrafficRecord* record = [[NKTrafficRecord alloc] init];
+        record.method = @"GET";
+        record.urlString = [self.server urlStringForPath:@"/again"];
+        record.statusCode = status.intValue;
+        record.responseDelay = 0.0;
+        [records addObject:record];
+    }
+
+    DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+    NKReplayURLConnectionBridge* bridge = [[NKReplayURLConnectionBridge alloc] initWithRecords:records speed:0.0];
+    manager.connectionBridge = bridge;
+
+    [self helperRunCalls:@[@"/again"] startOffsets:nil manager:manager];
+    XCTAssertNil([self.failedStatuses objectForKey:@0]);
+    [self helperRunCalls:@[@"/again"] startOffsets:nil manager:manager];
+    XCTAssertEqualObjects([self.failedStatuses objectForKey:@0], @503);
+    [self helperRunCalls:@[@"/again"] startOffsets:nil manager:manager];
+    XCTAssertEqualObjects([self.failedStatuses objectForKey:@0], @503);
+
+    XCTAssertEqual(bridge.numConnectionsFinished, 3);
+    XCTAssertEqual(bridge.numUnmatchedRequests, 0);
+}
+
+// A capped body still replays at full length, zero-padded past the part that was kept:
+-(void) testCappedBodyIsPaddedOnReplay {
+    NKTrafficRecorder* recorder = [[NKTrafficRecorder alloc] initWithFileURL:self.fileURL];
+    recorder.maxRecordedBodyLength = 100;
+    DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+    [manager startRecordingTraffic:recorder];
+    [self helperRunCalls:@[[self pathForItem:3]] startOffsets:nil manager:manager];
+    [recorder close];
+
+    NSData* original = [TestTrafficRecordReplay bodyForItem:3];
+    NKTrafficRecord* record = [[NKTrafficRecorder recordsFromFileURL:self.fileURL] firstObject];
+    XCTAssertEqual(record.body.length, 100);
+    XCTAssertEqual(record.bodyLength, (unsigned long long)original.length);
+
+    manager = [[DemoNetworkManager alloc] init];
+    manager.connectionBridge = [[NKReplayURLConnectionBridge alloc] initWithRecords:@[record] speed:0.0];
+    [self helperRunCalls:@[[self pathForItem:3]] startOffsets:nil manager:manager];
+
+    NSMutableData* expected = [NSMutableData dataWithLength:original.length];
+    [expected replaceBytesInRange:NSMakeRange(0, 100) withBytes:original.bytes];
+    XCTAssertEqualObjects([self.receivedData objectForKey:@0], expected);
+}
+
+// A call that took 0.6 seconds takes about 0.3 at double speed:
+-(void) testReplaySpeedScalesTiming {
+    NKTrafficRecord* record = [[NKTrafficRecord alloc] init];
+    record.method = @"GET";
+    record.urlString = [self.server urlStringForPath:@"/slow"];
+    record.statusCode = 200;
+    record.responseDelay = 0.2;
+    record.duration = 0.6;
+    record.body = [NSMutableData dataWithLength:100000];
+    record.bodyLength = record.body.length;
+
+    for(NSNumber* speed in @[@1.0, @2.0]) {
+        DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+        manager.connectionBridge = [[NKReplayURLConnectionBridge alloc] initWithRecords:@[record] speed:speed.doubleValue];
+        [self helperRunCalls:@[@"/slow"] startOffsets:nil manager:manager];
+
+        double latency = [[self.latencies objectForKey:@0] doubleValue];
+        XCTAssertEqualWithAccuracy(latency, 0.6 / speed.doubleValue, 0.1, @"At %@x", speed);
+        XCTAssertEqualObjects([self.receivedData objectForKey:@0], record.body);
+    }
+}
+
+
+#pragma mark - Benchmark
+
+// Records kNumRecordedCalls calls arriving over a second, then replays them as recorded,
+// at 10x, and flat out.  The numbers are logged rather than checked - they're for
+// comparing one run (or one network manager) against another.
+-(void) testReplayBenchmark {
+    NKTrafficRecorder* recorder = [[NKTrafficRecorder alloc] initWithFileURL:self.fileURL];
+    DemoNetworkManager* manager = [[DemoNetworkManager alloc] init];
+    [manager startRecordingTraffic:recorder];
+
+    NSMutableArray* paths = [[NSMutableArray alloc] init];
+    NSMutableArray* offsets = [[NSMutableArray alloc] init];
+    for(int i = 0; i < kNumRecordedCalls; i++) {
+        [paths addObject:[self pathForItem:i]];
+        [offsets addObject:@((double)i / kNumRecordedCalls)];
+    }
+    [self helperRunCalls:paths startOffsets:offsets manager:manager];
+    [recorder close];
+
+    // Replay wants the calls in the order they really started:
+    NSArray* records = [[NKTrafficRecorder recordsFromFileURL:self.fileURL] sortedArrayUsingComparator:^NSComparisonResult(NKTrafficRecord* a, NKTrafficRecord* b) {
+        return [@(a.startTime) compare:@(b.startTime)];
+    }];
+    XCTAssertEqual(records.count, kNumRecordedCalls);
+    double firstStart = ((NKTrafficRecord*)[records firstObject]).startTime;
+
+    for(NSNumber* speed in @[@1.0, @10.0, @0.0]) {
+        NSMutableArray* replayPaths = [[NSMutableArray alloc] init];
+        NSMutableArray* replayOffsets = [[NSMutableArray alloc] init];
+        for(NKTrafficRecord* record in records) {
+            [replayPaths addObject:[[NSURL URLWithString:record.urlString] path]];
+            [replayOffsets addObject:@((speed.doubleValue > 0.0) ? (record.startTime - firstStart) / speed.doubleValue : 0.0)];
+        }
+
+        for(int useNK = 0; useNK <= 1; useNK++) {
+            NKReplayURLConnectionBridge* bridge = [[NKReplayURLConnectionBridge alloc] initWithRecords:records speed:speed.doubleValue];
+            id<AbstractNetworkManager> replayManager = nil;
+            if(useNK) {
+                replayManager = [[NKNetworkManager alloc] initWithConnectionBridge:bridge];
+            } else {
+                DemoNetworkManager* demoManager = [[DemoNetworkManager alloc] init];
+                demoManager.connectionBridge = bridge;
+                replayManager = demoManager;
+            }
+
+            unsigned long long memoryBefore = [self helperResidentMemory];
+            NSDate* start = [NSDate date];
+            unsigned long long peakMemory = [self helperRunCalls:replayPaths startOffsets:replayOffsets manager:replayManager];
+            double seconds = -[start timeIntervalSinceNow];
+
+            NSArray* sorted = [[self.latencies allValues] sortedArrayUsingSelector:@selector(compare:)];
+            double p50 = [[sorted objectAtIndex:sorted.count / 2] doubleValue];
+            double p99 = [[sorted objectAtIndex:MIN(sorted.count - 1, sorted.count * 99 / 100)] doubleValue];
+            NSLog(@"%@ replay at %@: %d calls in %.3lfs (%.0lf calls/s), p50 %.1lfms, p99 %.1lfms, peak memory +%.1lfMB",
+                  NSStringFromClass([replayManager class]),
+                  (speed.doubleValue > 0.0) ? [NSString stringWithFormat:@"%gx", speed.doubleValue] : @"max speed",
+                  kNumRecordedCalls, seconds, kNumRecordedCalls / seconds, p50 * 1000.0, p99 * 1000.0,
+                  (peakMemory > memoryBefore) ? (peakMemory - memoryBefore) / 1048576.0 : 0.0);
+
+            XCTAssertEqual(self.receivedData.count, kNumRecordedCalls);
+            XCTAssertEqual(bridge.numUnmatchedRequests, 0);
+        }
+    }
+}
+
+
+#pragma mark - Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    [self.receivedData setObject:data forKey:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    [self.failedStatuses setObject:@(httpStatus) forKey:context];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFinish:(id)context {
+    NSDate* started = [self.startTimes objectForKey:context];
+    [self.latencies setObject:@(-[started timeIntervalSinceNow]) forKey:context];
+    self.numFinished++;
+}
+
+@end
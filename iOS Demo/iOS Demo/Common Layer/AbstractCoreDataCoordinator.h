@@ -29,4 +29,23 @@
 // Run a fetch request for the given objects:
 -(NSArray*) fetchManagedObjects:(NSEntityDescription*)entity withPredicate:(NSPredicate*)predicate withSortDescriptor:(NSSortDescriptor*)sortDescriptor;
 
+// Get the object with the given object ID without running a fetch request, or nil if it's
+// gone (or was never saved).  Use existingObjectWithID:error: on your context.
+-(NSManagedObject*) existingObjectWithID:(NSManagedObjectID*)objectID;
+
+// Run a fetch request that's already been set up (fetch limit, offset, batch size and so
+// on) and return the results, or nil if the fetch fails.  DataObjectCursor fetches its
+// pages with this.
+-(NSArray*) executeFetchRequest:(NSFetchRequest*)fetchRequest;
+
+// Count what a fetch request would return without fetching it.  Return NSNotFound if the
+// count fails.
+-(NSUInteger) countForFetchRequest:(NSFetchRequest*)fetchRequest;
+
+// The store coordinator behind your contexts.  AbstractDataObjectManager only listens to
+// saves that go through it; without it, a manager hears every save for its model, from
+// any store.
+@optional
+-(NSPersistentStoreCoordinator*) persistentStoreCoordinator;
+
 @end
\ No newline at end of file
@@ -11,19 +11,32 @@
     are kind of like ORM helpers that centralize the access to a given CoreData ManagedObject
     type.  There are effectively four core functions that a DataObjectManager performs:
         create:, get-by-id:, deleteObj: and get-with-predicate:.
+    For results that could be big, use a cursor (cursorWithPredicate:sortDescriptors:) to
+    get them a page at a time instead of get-with-predicate.
  
     WHEN YOU SUBCLASS AbstractDataObjectManager:
         - Override the get:, create:, and delete: methods to make them type-strict for the NSManagedObject subclass you're using.
-        - In your get: method implementation, call get-with-predicate with an appropriate predicate to search by ID.
-        - In your create: method, do a get: to check existance, call createObject:, and then populate any initial values (like the id!)
-        - In your deleteObj: method, break any associations and then call deleteObj: to remove the object.
+        - Set idAttributeName in your init if the ID attribute isn't called "id".
+        - In your get: method implementation, call getByID: (which goes through the identity map, below).
+        - In your create: method, do a get: to check existance, call createObject:, populate any initial values (like the id!)
+                and then call rememberObject:forID: so the next get: doesn't have to fetch it.
+        - In your deleteObj: method, break any associations, call deleteObj: to remove the object, and then call forgetObject:.
         - Optionally subclass the getWithPredicate: method if you want to add sugar.
         - To be thread-safe for two simultaneous operation for the same id, you'll need to lock on self inside the create and
                 delete methods.  Locking in the get method and the get-with-predicate method is optional but suggested.
+
+    THE IDENTITY MAP: looking up one object by ID is the most common thing we do (every sync
+    and every table cell does it), and a fetch against the store each time is slow.  So the
+    manager remembers which NSManagedObjectID goes with each ID string it's seen, and getByID:
+    goes straight to the object with existingObjectWithID: when it knows the ID.  It only
+    fetches on a miss.  create:/deleteObj: keep it up to date through the calls above, and
+    the manager watches context saves for everything else (inserts and deletes made elsewhere,
+    and temporary object IDs turning permanent).  IDs that don't exist aren't remembered.
  */
 
 #import <Foundation/Foundation.h>
 #import "AbstractCoreDataCoordinator.h"
+#import "DataObjectCursor.h"
 
 @interface AbstractDataObjectManager : NSObject
 
@@ -64,6 +77,32 @@
 // the request, override this method in subclass and wrap it in a synchronized block.
 -(NSArray*) getWithPredicate:(NSPredicate*)predicate sortBy:(NSSortDescriptor*)sortDescriptor;
 
+// The name of the string attribute that holds each object's ID.  Default @"id".
+@property (nonatomic, retain) NSString* idAttributeName;
+
+// Looks up the object with the given ID through the identity map, fetching only if the map
+// doesn't know it yet.  Returns nil if there's no such object.  Call this from your get:.
+-(NSManagedObject*) getByID:(NSString*)idstring;
+
+// Tell the identity map about an object you just created (call from your create:) or are
+// deleting (call from your deleteObj:).  Thread-safe.
+-(void) rememberObject:(NSManagedObject*)obj forID:(NSString*)idstring;
+-(void) forgetObject:(NSManagedObject*)obj;
+
+// Drop everything in the identity map (for example, on a memory warning).
+-(void) clearIdentityMap;
+
+// How well the identity map is doing.  A hit is a getByID: that didn't fetch.
+@property (nonatomic, readonly) UInt64 identityMapHits;
+@property (nonatomic, readonly) UInt64 identityMapMisses;
+@property (nonatomic, readonly) NSUInteger identityMapCount;
+
+// Like getWithPredicate:sortBy:, but hands the results out a page at a time instead of all
+// at once.  Use this for anything that could be big (lists, scrolling, bulk updates).  Set
+// the page size and the rest on the cursor before you ask it for the first page.  Make the
+// last sort descriptor unique (the id) so keyset paging works - see DataObjectCursor.h.
+-(DataObjectCursor*) cursorWithPredicate:(NSPredicate*)predicate sortDescriptors:(NSArray*)sortDescriptors;
+
 
 
 @end
@@ -8,8 +8,17 @@
 
 #import "AbstractDataObjectManager.h"
 
+@interface AbstractDataObjectManager ()
+
+// The identity map, both ways round.  Lock on self to touch these:
+@property (nonatomic, retain) NSMutableDictionary* objectIDsByID;   // NSString -> NSManagedObjectID
+@property (nonatomic, retain) NSMutableDictionary* idsByObjectID;   // NSManagedObjectID -> NSString
+
+@end
+
 @implementation AbstractDataObjectManager
 @synthesize coordinator = _coordinator, entity = _entity;
+@synthesize identityMapHits = _identityMapHits, identityMapMisses = _identityMapMisses;
 
 -(NSManagedObject*) get:(NSString*)idstr {
     [NSException raise:@"AbstractMethodNotOverridden" format:@"You must override this method!"];
@@ -33,12 +42,173 @@
     return arr;
 }
 
+-(DataObjectCursor*) cursorWithPredicate:(NSPredicate*)predicate sortDescriptors:(NSArray*)sortDescriptors {
+    return [[DataObjectCursor alloc] initWithCoreDataCoordinator:self.coordinator withEntity:self.entity
+                                                   withPredicate:predicate withSortDescriptors:sortDescriptors];
+}
+
 -(AbstractDataObjectManager*) initWithCoreDataCoordinator:(id<AbstractCoreDataCoordinator>)coordinator withEntity:(NSEntityDescription*)entity {
     if(self = [super init]) {
         _coordinator = coordinator;
         _entity      = entity;
+        self.idAttributeName = @"id";
+        self.objectIDsByID = [[NSMutableDictionary alloc] init];
+        self.idsByObjectID = [[NSMutableDictionary alloc] init];
+        _identityMapHits = 0;
+        _identityMapMisses = 0;
+
+        // Saves from any of the coordinator's contexts, so we hear about objects created and
+        // deleted behind our back (see isOurSave:):
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(contextDidSave:)
+                                                     name:NSManagedObjectContextDidSaveNotification object:nil];
     }
     return self;
 }
 
+-(void) dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+
+#pragma mark Identity map
+
+-(NSManagedObject*) getByID:(NSString*)idstring {
+    if(idstring == nil || self.coordinator == nil) return nil;
+
+    NSManagedObjectID* objectID = nil;
+    @synchronized(self) {
+        objectID = [self.objectIDsByID objectForKey:idstring];
+    }
+
+    // Don't hold the lock while we go to CoreData:
+    if(objectID != nil) {
+        NSManagedObject* obj = [self.coordinator existingObjectWithID:objectID];
+        if(obj != nil && !obj.isDeleted) {
+            @synchronized(self) {
+                _identityMapHits++;
+            }
+            return obj;
+        }
+
+        // It's gone, or it was a temporary ID that's since been saved:
+        @synchronized(self) {
+            if([[self.objectIDsByID objectForKey:idstring] isEqual:objectID]) {
+                [self forgetObjectIDHelper:objectID];
+            }
+        }
+    }
+
+    @synchronized(self) {
+        _identityMapMisses++;
+    }
+    NSPredicate* predicate = [NSPredicate predicateWithFormat:@"%K == %@", self.idAttributeName, idstring];
+    NSManagedObject* obj = [[self getWithPredicate:predicate sortBy:nil] firstObject];
+    if(obj != nil) {
+        [self rememberObject:obj forID:idstring];
+    }
+    return obj;
+}
+
+-(void) rememberObject:(NSManagedObject*)obj forID:(NSString*)idstring {
+    if(obj == nil || idstring == nil) return;
+    @synchronized(self) {
+        [self rememberObjectIDHelper:obj.objectID forID:idstring];
+    }
+}
+
+-(void) forgetObject:(NSManagedObject*)obj {
+    if(obj == nil) return;
+    @synchronized(self) {
+        [self forgetObjectIDHelper:obj.objectID];
+    }
+}
+
+-(void) clearIdentityMap {
+    @synchronized(self) {
+        [self.objectIDsByID removeAllObjects];
+        [self.idsByObjectID removeAllObjects];
+    }
+}
+
+-(NSUInteger) identityMapCount {
+    @synchronized(self) {
+        return self.objectIDsByID.count;
+    }
+}
+
+-(UInt64) identityMapHits {
+    @synchronized(self) {
+        return _identityMapHits;
+    }
+}
+
+-(UInt64) identityMapMisses {
+    @synchronized(self) {
+        return _identityMapMisses;
+    }
+}
+
+// Posted on the saving context's thread, after the save.  By now inserted objects have
+// their permanent object IDs, so this is where temporary IDs in the map get replaced.
+-(void) contextDidSave:(NSNotification*)notification {
+    if(![self isOurSave:notification]) return;
+    NSDictionary* userInfo = notification.userInfo;
+    NSString* idAttributeName = self.idAttributeName;
+
+    @synchronized(self) {
+        for(NSManagedObject* obj in [userInfo objectForKey:NSDeletedObjectsKey]) {
+            if([obj.entity isKindOfEntity:self.entity]) {
+                [self forgetObjectIDHelper:obj.objectID];
+            }
+        }
+
+        for(NSString* key in @[ NSInsertedObjectsKey, NSUpdatedObjectsKey ]) {
+            for(NSManagedObject* obj in [userInfo objectForKey:key]) {
+                if(![obj.entity isKindOfEntity:self.entity] || [obj.entity.attributesByName objectForKey:idAttributeName] == nil) continue;
+                id idstring = [obj valueForKey:idAttributeName];
+                if([idstring isKindOfClass:[NSString class]]) {
+                    [self rememberObjectIDHelper:obj.objectID forID:idstring];
+                }
+            }
+        }
+    }
+}
+
+// A save from a context on some other store has nothing to do with our objects, even if
+// it's for the same entity.  The object IDs it would put in the map aren't ours to fetch.
+-(BOOL) isOurSave:(NSNotification*)notification {
+    NSPersistentStoreCoordinator* savedTo = ((NSManagedObjectContext*)notification.object).persistentStoreCoordinator;
+    id<AbstractCoreDataCoordinator> coordinator = self.coordinator;
+    if([coordinator respondsToSelector:@selector(persistentStoreCoordinator)]) {
+        return savedTo == [coordinator persistentStoreCoordinator];
+    }
+    return savedTo.managedObjectModel == self.entity.managedObjectModel;
+}
+
+// Keeps both directions in step, so an object that changes ID (or an ID that changes
+// object) leaves nothing stale behind.
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) rememberObjectIDHelper:(NSManagedObjectID*)objectID forID:(NSString*)idstring {
+    NSManagedObjectID* oldObjectID = [self.objectIDsByID objectForKey:idstring];
+    if(oldObjectID != nil) {
+        [self.idsByObjectID removeObjectForKey:oldObjectID];
+    }
+    NSString* oldID = [self.idsByObjectID objectForKey:objectID];
+    if(oldID != nil) {
+        [self.objectIDsByID removeObjectForKey:oldID];
+    }
+    idstring = [idstring copy];
+    [self.objectIDsByID setObject:objectID forKey:idstring];
+    [self.idsByObjectID setObject:idstring forKey:objectID];
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) forgetObjectIDHelper:(NSManagedObjectID*)objectID {
+    NSString* idstring = [self.idsByObjectID objectForKey:objectID];
+    if(idstring != nil) {
+        [self.objectIDsByID removeObjectForKey:idstring];
+        [self.idsByObjectID removeObjectForKey:objectID];
+    }
+}
+
 @end
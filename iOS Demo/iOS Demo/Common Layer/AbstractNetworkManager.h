@@ -10,6 +10,7 @@
     NetworkManagerDelegate which is used for the callbacks. */
 
 #import "NetworkManagerEnums.h"
+#import "NKCallBehaviorURLRequest.h"
 
 @protocol NetworkManagerDelegate;
 
@@ -49,6 +50,17 @@
 
 
 
+// Call groups (see NKCallBehaviorURLRequest's callGroup).  Cancel stops every call in the
+// group, waiting or in flight, with no more callbacks.  Pause holds them - in-flight calls
+// are stopped and go back to waiting - until resume.  Each returns the number of calls it
+// touched.  setPriority moves the group's calls to another priority.  Not all
+// managers will implement these!
+@optional
+-(NSUInteger) cancelCallsInGroup:(id)group;
+-(NSUInteger) pauseCallsInGroup:(id)group;
+-(NSUInteger) resumeCallsInGroup:(id)group;
+-(NSUInteger) setPriority:(NKCallPriority)priority forCallsInGroup:(id)group;
+
 // This is a hook for testing.  It allows the test framework to specify a class for the
 // networkManager to use instead of NSURLConnection for its insides.  Returns FALSE if
 // the input was ignored.
@@ -79,6 +91,12 @@
                 newURL:(NSString*)newURL httpStatus:(int)httpStatus;
 
 
+// Called when a response arrives, with its HTTP status, right before didLoadHeader.  The
+// last one before didSucceed has the status the call succeeded with.
+@optional
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didReceiveResponse:(id)context
+            httpStatus:(int)httpStatus;
+
 // Called when the network manager loads the header for the remote resource.
 // This allows the delegate to choose to cancel the call if one of the the
 // HTTP headers is not as expected, and it gives the Content-Length, too.
@@ -86,6 +104,13 @@
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didLoadHeader:(id)context
                   size:(int)size headers:(NSDictionary*)allHeaderFields;
 
+// Called right before didSucceed when the call downloaded its body to a file (see
+// downloadToFile on NKCallBehaviorURLRequest).  The file is yours now - move it, keep it,
+// or delete it.  The data passed to didSucceed is a read-only mapping of this same file.
+@optional
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSaveFile:(id)context
+               fileURL:(NSURL*)fileURL;
+
 // Success!  This will be followed by didFinish.
 @required
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data;
@@ -42,18 +42,41 @@
             both lists of objects and single objects.
         - Override processJSONToObject: to properly upsert an returned object via the
                 AbstractDataObjectManager. Return TRUE if there were changes.
-        - Add any helper methods that you want. */
+        - If your server's responses aren't {"objects":[...]} or a single object, override
+                objectJSONsInSuccessJSON: to pull out the objects.
+        - Add any helper methods that you want.
+
+
+    DELTA SYNC: most refreshes come back with nothing new, so the executor remembers a version
+    token for each object (an ETag, an updated-at or a server revision - whatever the server
+    hands out) and sends the tokens it knows with each fetch.  Then:
+        - A response with no body (a 304 Not Modified) means nothing changed.  Nothing is processed.
+        - So does a response marked unchanged ({"unchanged":true}).  Nothing is processed.
+        - Otherwise each object is looked at on its own.  Objects marked unchanged, or whose token
+            matches the one we have, are skipped without touching CoreData.  The rest go to
+            processJSONToObject: and their new tokens are remembered.
+    By default, a single fetch sends its token as If-None-Match and a batch fetch sends
+    {"id":"token",...} in an X-Object-Versions header; override addVersionTokens:toRequest:isBatch:
+    to match your server.  Tokens are kept in memory; override versionTokenForID: and
+    setVersionToken:forID: to keep them somewhere that lasts (like an attribute on the object). */
 
 #import <Foundation/Foundation.h>
 #import "AbstractDataObjectManager.h"
 #import "NetworkTransactionManager.h"
 
 // When you request an update, pass one of these handlers - it will return when an object
-// update call succeeds and tell you which objects were updated.
+// update call succeeds and tell you which objects were updated (as ID strings; empty if
+// nothing changed).  If the call fails, updatedObjects is nil.
 typedef void (^onFetchHandler)(NSSet* updatedObjects);
 
 @interface AbstractRemoteFetchExecutor : NSObject
 
+// batchUpdateURL may be nil (see below).
+-(AbstractRemoteFetchExecutor*) initWithNetworkTransactionManager:(NetworkTransactionManager*)networkTransactionManager
+                                                      dataManager:(AbstractDataObjectManager*)dataManager
+                                            singleObjectUpdateURL:(NSString*)singleObjectUpdateURL
+                                                   batchUpdateURL:(NSString*)batchUpdateURL;
+
 -(void) requestUpdateForObjectID:(NSString*)idstring handler:(onFetchHandler)handler;  // implicit force when you call this method
 -(void) requestUpdateForObjectsIDs:(NSSet*)idstrings handler:(onFetchHandler)handler force:(BOOL)force;
 
@@ -69,8 +92,49 @@ typedef void (^onFetchHandler)(NSSet* updatedObjects);
 // {"status":"fail"} might be a failure case even though the code is 200.
 -(BOOL) isSuccessJSON:(NSDictionary*)json forHTTPCode:(int)httpStatus;
 
-// Subclassers MUST override this method!  If the call is deemed successful, this will be called.
+// If the call is deemed successful (and something changed), this will be called - but only
+// if handlesWholeResponse is TRUE.  The default implementation does the per-object delta sync
+// described above and returns TRUE if any object changed.  Override it (and set
+// handlesWholeResponse) only if you need to handle the whole response yourself, in which case
+// you're on your own for skipping unchanged objects, and a TRUE return reports every object
+// fetched as updated.
 -(BOOL) processSuccessJSON:(NSDictionary*)json;
+@property (nonatomic) BOOL handlesWholeResponse;
+
+// Subclassers MUST override this method!  Upsert the object via the dataManager.  Return TRUE
+// if there were changes.
+-(BOOL) processJSONToObject:(NSDictionary*)objectJSON;
+
+// The objects in a response.  Default: the "objects" array if there is one, otherwise the
+// whole response as one object.
+-(NSArray*) objectJSONsInSuccessJSON:(NSDictionary*)json;
+
+// An object's ID and version token.  Defaults: "id", and the first of "etag", "version",
+// "revision" or "updated_at" that's there.  Numbers are turned into strings.
+-(NSString*) idForObjectJSON:(NSDictionary*)objectJSON;
+-(NSString*) versionTokenForObjectJSON:(NSDictionary*)objectJSON;
+
+// TRUE if the response, or an object in it, says it hasn't changed.  Default: "unchanged" is true.
+-(BOOL) isUnchangedJSON:(NSDictionary*)json;
+
+// Puts the tokens we know ({idstring : token}, never empty) on the request.  See above for the default.
+-(void) addVersionTokens:(NSDictionary*)versionTokens toRequest:(NSMutableURLRequest*)request isBatch:(BOOL)isBatch;
+
+// Where version tokens are kept.  Default is in memory; thread-safe.  Setting nil forgets it.
+-(NSString*) versionTokenForID:(NSString*)idstring;
+-(void) setVersionToken:(NSString*)versionToken forID:(NSString*)idstring;
+
+
+// A non-forced request waits until this many objects are waiting (default 20) or this many
+// seconds have passed since the first of them (default 30), whichever comes first:
+@property (nonatomic) NSUInteger batchThreshold;
+@property (nonatomic) double batchInterval;
+
+// How well delta sync is doing:
+@property (nonatomic, readonly) UInt64 numFetchesSent;
+@property (nonatomic, readonly) UInt64 numUnchangedResponses;   // 304s and responses marked unchanged
+@property (nonatomic, readonly) UInt64 numObjectsApplied;       // went to processJSONToObject:
+@property (nonatomic, readonly) UInt64 numObjectsSkipped;       // unchanged marker or matching token
 
 // These are the URLs called against when the executor performs an update.  If batchUpdateURL
 // is specified nil in the constructor, batch fetches will be performed as single fetches.
@@ -7,7 +7,320 @@
 //
 
 #import "AbstractRemoteFetchExecutor.h"
+#import "JSONHelpers.h"
+#import "Logging.h"
+
+NSString* const LOGTAG_RFE = @"data";
+
+@interface AbstractRemoteFetchExecutor ()
+
+@property (nonatomic, retain) NetworkTransactionManager* networkTransactionManager;
+@property (nonatomic, retain) AbstractDataObjectManager* dataManager;
+@property (nonatomic, readwrite) NSString* singleObjectUpdateURL;
+@property (nonatomic, readwrite) NSString* batchUpdateURL;
+
+// Objects and handlers waiting for the next fetch.  Lock on self to touch these:
+@property (nonatomic, retain) NSMutableSet* pendingIDs;
+@property (nonatomic, retain) NSMutableArray* pendingHandlers;
+@property (nonatomic) BOOL flushScheduled;
+
+// idstring -> version token.  Lock on self:
+@property (nonatomic, retain) NSMutableDictionary* versionTokens;
+
+@end
 
 @implementation AbstractRemoteFetchExecutor
+@synthesize numFetchesSent = _numFetchesSent, numUnchangedResponses = _numUnchangedResponses;
+@synthesize numObjectsApplied = _numObjectsApplied, numObjectsSkipped = _numObjectsSkipped;
+
+-(AbstractRemoteFetchExecutor*) initWithNetworkTransactionManager:(NetworkTransactionManager*)networkTransactionManager
+                                                      dataManager:(AbstractDataObjectManager*)dataManager
+                                            singleObjectUpdateURL:(NSString*)singleObjectUpdateURL
+                                                   batchUpdateURL:(NSString*)batchUpdateURL {
+    if(self = [super init]) {
+        self.networkTransactionManager = networkTransactionManager;
+        self.dataManager = dataManager;
+        self.singleObjectUpdateURL = singleObjectUpdateURL;
+        self.batchUpdateURL = batchUpdateURL;
+
+        self.pendingIDs = [[NSMutableSet alloc] init];
+        self.pendingHandlers = [[NSMutableArray alloc] init];
+        self.flushScheduled = FALSE;
+        self.versionTokens = [[NSMutableDictionary alloc] init];
+
+        self.handlesWholeResponse = FALSE;
+        self.batchThreshold = 20;
+        self.batchInterval = 30.0;
+    }
+    return self;
+}
+
+-(NSEntityDescription*) entity {
+    return self.dataManager.entity;
+}
+
+
+#pragma mark Requesting updates
+
+-(void) requestUpdateForObjectID:(NSString*)idstring handler:(onFetchHandler)handler {
+    if(idstring == nil) return;
+    [self requestUpdateForObjectsIDs:[NSSet setWithObject:idstring] handler:handler force:TRUE];
+}
+
+-(void) requestUpdateForObjectsIDs:(NSSet*)idstrings handler:(onFetchHandler)handler force:(BOOL)force {
+    BOOL fetchNow = FALSE;
+    BOOL scheduleFlush = FALSE;
+
+    @synchronized(self) {
+        [self.pendingIDs unionSet:idstrings];
+        if(handler != NULL) {
+            [self.pendingHandlers addObject:[handler copy]];
+        }
+
+        fetchNow = force || self.pendingIDs.count >= MAX(self.batchThreshold, (NSUInteger)1);
+        if(!fetchNow && !self.flushScheduled) {
+            self.flushScheduled = TRUE;
+            scheduleFlush = TRUE;
+        }
+    }
+
+    if(fetchNow) {
+        [self fetchPending];
+    } else if(scheduleFlush) {
+        __weak AbstractRemoteFetchExecutor* weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.batchInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [weakSelf fetchPending];
+        });
+    }
+}
+
+// Sends everything that's waiting.  With no batch URL, that's one single fetch per object,
+// and the handlers hear back once they've all come back.
+-(void) fetchPending {
+    NSSet* idstrings = nil;
+    NSArray* handlers = nil;
+    @synchronized(self) {
+        idstrings = [self.pendingIDs copy];
+        handlers = [self.pendingHandlers copy];
+        [self.pendingIDs removeAllObjects];
+        [self.pendingHandlers removeAllObjects];
+        self.flushScheduled = FALSE;
+    }
+    if(idstrings.count == 0 && handlers.count == 0) return;
+
+    void (^finish)(NSSet*) = ^(NSSet* updatedIDs) {
+        for(onFetchHandler handler in handlers) {
+            handler(updatedIDs);
+        }
+    };
+
+    if(idstrings.count == 0) {
+        finish([NSSet set]);
+    } else if(idstrings.count == 1 || self.batchUpdateURL != nil) {
+        [self fetchObjects:idstrings isBatch:(idstrings.count > 1) completion:finish];
+    } else {
+        // These blocks all run on the network transaction manager's callback executor, which
+        // may not be a single thread, so the shared state is locked:
+        NSMutableSet* allUpdatedIDs = [[NSMutableSet alloc] init];
+        __block NSUInteger numRemaining = idstrings.count;
+        __block BOOL anyFailed = FALSE;
+        for(NSString* idstring in idstrings) {
+            [self fetchObjects:[NSSet setWithObject:idstring] isBatch:FALSE completion:^(NSSet* updatedIDs) {
+                BOOL done = FALSE;
+                @synchronized(allUpdatedIDs) {
+                    if(updatedIDs == nil) {
+                        anyFailed = TRUE;
+                    } else {
+                        [allUpdatedIDs unionSet:updatedIDs];
+                    }
+                    done = (--numRemaining == 0);
+                }
+                if(done) {
+                    finish(anyFailed ? nil : allUpdatedIDs);
+                }
+            }];
+        }
+    }
+}
+
+// One call to the server.  completion gets the IDs that changed, or nil if the call failed.
+-(void) fetchObjects:(NSSet*)idstrings isBatch:(BOOL)isBatch completion:(void (^)(NSSet* updatedIDs))completion {
+    NSMutableURLRequest* request = [self buildURLRequest:isBatch forObjects:idstrings];
+    if(request == nil) {
+        LogE(LOGTAG_RFE, @"%@ built no request for %lu objects", NSStringFromClass([self class]), (unsigned long)idstrings.count);
+        completion(nil);
+        return;
+    }
+
+    NSMutableDictionary* knownTokens = [[NSMutableDictionary alloc] initWithCapacity:idstrings.count];
+    for(NSString* idstring in idstrings) {
+        NSString* token = [self versionTokenForID:idstring];
+        if(token != nil) {
+            [knownTokens setObject:token forKey:idstring];
+        }
+    }
+    if(knownTokens.count > 0) {
+        [self addVersionTokens:knownTokens toRequest:request isBatch:isBatch];
+
+        // Otherwise the URL loading system may answer a 304 with whatever it has cached:
+        request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    }
+
+    @synchronized(self) {
+        _numFetchesSent++;
+    }
+
+    [self.networkTransactionManager send:request successWithStatus:^(NSDictionary* jsonData, int httpStatus) {
+        if(httpStatus == 304 || (jsonData == nil && knownTokens.count > 0)) {
+            // 304 Not Modified - no body, nothing to do:
+            [self countUnchangedResponse];
+            completion([NSSet set]);
+        } else if(![self isSuccessJSON:jsonData forHTTPCode:httpStatus]) {
+            completion(nil);
+        } else if([self isUnchangedJSON:jsonData]) {
+            [self countUnchangedResponse];
+            completion([NSSet set]);
+        } else if(self.handlesWholeResponse) {
+            completion([self processSuccessJSON:jsonData] ? idstrings : [NSSet set]);
+        } else {
+            completion([self applyObjectsInSuccessJSON:jsonData]);
+        }
+    } failure:^(NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary* jsonData) {
+        if(httpStatus == 304) {
+            [self countUnchangedResponse];
+            completion([NSSet set]);
+        } else {
+            LogW(LOGTAG_RFE, @"%@ fetch of %lu objects failed (error %d, HTTP %d)", NSStringFromClass([self class]), (unsigned long)idstrings.count, (int)networkError, httpStatus);
+            completion(nil);
+        }
+    } callbackExecutor:nil];
+}
+
+-(void) countUnchangedResponse {
+    @synchronized(self) {
+        _numUnchangedResponses++;
+    }
+}
+
+
+#pragma mark Delta sync
+
+-(BOOL) processSuccessJSON:(NSDictionary*)json {
+    return [self applyObjectsInSuccessJSON:json].count > 0;
+}
+
+// Returns the IDs of the objects that changed:
+-(NSSet*) applyObjectsInSuccessJSON:(NSDictionary*)json {
+    NSMutableSet* updatedIDs = [[NSMutableSet alloc] init];
+    UInt64 numApplied = 0, numSkipped = 0;
+
+    for(NSDictionary* objectJSON in [self objectJSONsInSuccessJSON:json]) {
+        if(![objectJSON isKindOfClass:[NSDictionary class]]) continue;
+
+        NSString* idstring = [self idForObjectJSON:objectJSON];
+        NSString* token = [self versionTokenForObjectJSON:objectJSON];
+        if([self isUnchangedJSON:objectJSON] || (idstring != nil && token != nil && [token isEqualToString:[self versionTokenForID:idstring]])) {
+            numSkipped++;
+            continue;
+        }
+
+        numApplied++;
+        if([self processJSONToObject:objectJSON] && idstring != nil) {
+            [updatedIDs addObject:idstring];
+        }
+        if(idstring != nil && token != nil) {
+            [self setVersionToken:token forID:idstring];
+        }
+    }
+
+    @synchronized(self) {
+        _numObjectsApplied += numApplied;
+        _numObjectsSkipped += numSkipped;
+    }
+    return updatedIDs;
+}
+
+-(NSArray*) objectJSONsInSuccessJSON:(NSDictionary*)json {
+    if(json == nil) return @[];
+    id objects = [json objectForKey:@"objects"];
+    if([objects isKindOfClass:[NSArray class]]) return objects;
+    return @[ json ];
+}
+
+// Strings as they are, numbers as strings, anything else nil:
+-(NSString*) stringForValue:(id)value {
+    if([value isKindOfClass:[NSString class]]) return value;
+    if([value isKindOfClass:[NSNumber class]]) return [value stringValue];
+    return nil;
+}
+
+-(NSString*) idForObjectJSON:(NSDictionary*)objectJSON {
+    return [self stringForValue:[objectJSON objectForKey:@"id"]];
+}
+
+-(NSString*) versionTokenForObjectJSON:(NSDictionary*)objectJSON {
+    for(NSString* key in @[ @"etag", @"version", @"revision", @"updated_at" ]) {
+        NSString* token = [self stringForValue:[objectJSON objectForKey:key]];
+        if(token != nil) return token;
+    }
+    return nil;
+}
+
+-(BOOL) isUnchangedJSON:(NSDictionary*)json {
+    id unchanged = [json objectForKey:@"unchanged"];
+    return [unchanged respondsToSelector:@selector(boolValue)] && [unchanged boolValue];
+}
+
+-(void) addVersionTokens:(NSDictionary*)versionTokens toRequest:(NSMutableURLRequest*)request isBatch:(BOOL)isBatch {
+    if(!isBatch && versionTokens.count == 1) {
+        [request setValue:[[versionTokens allValues] firstObject] forHTTPHeaderField:@"If-None-Match"];
+    } else {
+        NSData* data = [JSONHelpers toData:versionTokens];
+        if(data != nil) {
+            [request setValue:[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] forHTTPHeaderField:@"X-Object-Versions"];
+        }
+    }
+}
+
+-(NSString*) versionTokenForID:(NSString*)idstring {
+    if(idstring == nil) return nil;
+    @synchronized(self) {
+        return [self.versionTokens objectForKey:idstring];
+    }
+}
+
+-(void) setVersionToken:(NSString*)versionToken forID:(NSString*)idstring {
+    if(idstring == nil) return;
+    @synchronized(self) {
+        if(versionToken == nil) {
+            [self.versionTokens removeObjectForKey:idstring];
+        } else {
+            [self.versionTokens setObject:[versionToken copy] forKey:idstring];
+        }
+    }
+}
+
+-(UInt64) numFetchesSent         { @synchronized(self) { return _numFetchesSent; } }
+-(UInt64) numUnchangedResponses  { @synchronized(self) { return _numUnchangedResponses; } }
+-(UInt64) numObjectsApplied      { @synchronized(self) { return _numObjectsApplied; } }
+-(UInt64) numObjectsSkipped      { @synchronized(self) { return _numObjectsSkipped; } }
+
+
+#pragma mark Abstract methods
+
+-(NSMutableURLRequest*) buildURLRequest:(BOOL)isBatch forObjects:(NSSet*)objectIDs {
+    [NSException raise:@"AbstractMethodNotOverridden" format:@"You must override this method!"];
+    return nil;
+}
+
+-(BOOL) isSuccessJSON:(NSDictionary*)json forHTTPCode:(int)httpStatus {
+    [NSException raise:@"AbstractMethodNotOverridden" format:@"You must override this method!"];
+    return FALSE;
+}
+
+-(BOOL) processJSONToObject:(NSDictionary*)objectJSON {
+    [NSException raise:@"AbstractMethodNotOverridden" format:@"You must override this method!"];
+    return FALSE;
+}
 
 @end
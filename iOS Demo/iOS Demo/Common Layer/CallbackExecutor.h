@@ -0,0 +1,54 @@
+//
+//  CallbackExecutor.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** A CallbackExecutor is the place where a callback block gets run.  It can be the main
+    thread, a thread out of the SharedThreadPool (by identifier), or a dispatch queue that
+    the caller supplies.  NetworkTransactionManager uses these so each transaction can
+    say where its success and failure callbacks should be delivered.
+
+    Blocks handed to an executor are never run synchronously.  They're queued up and the
+    executor schedules ONE drain on its target for everything that's pending, so a burst
+    of a few hundred completions turns into one wakeup instead of a few hundred.  Each
+    drain has a time budget (batchTimeBudget) - once it's spent, the rest of the batch is
+    pushed to the next turn so the main thread can get back to drawing.  Blocks always run
+    in the order they were handed to execute:. */
+
+#import <Foundation/Foundation.h>
+
+// The kinds of executors there are:
+typedef enum {
+    CallbackExecutorTypeMainThread = 0,
+    CallbackExecutorTypeThreadPool,
+    CallbackExecutorTypeQueue,
+} CallbackExecutorType;
+
+@interface CallbackExecutor : NSObject
+
+// The main-thread executor is shared by everybody so that all the main-thread callbacks
+// in the app are coalesced into one batch per run-loop turn.
++(CallbackExecutor*) mainThreadExecutor;
+
+// Runs callbacks on the SharedThreadPool thread with the given identifier.  The executor
+// subscribes to that thread for as long as it's alive.
++(CallbackExecutor*) executorWithThreadPoolIdentifier:(NSString*)threadIdentifier;
+
+// Runs callbacks on the given dispatch queue.
++(CallbackExecutor*) executorWithQueue:(dispatch_queue_t)queue;
+
+@property (nonatomic, readonly) CallbackExecutorType type;
+
+// The maximum number of seconds a single drain will spend running blocks before it yields
+// the rest of the batch to the next turn.  At least one block is run per drain no matter
+// what.  Zero means no limit.  Defaults to 8ms for the main thread (half a frame) and to
+// zero for everything else.
+@property (atomic) double batchTimeBudget;
+
+// Queue up a block to be run on this executor.  Never runs the block synchronously.
+-(void) execute:(dispatch_block_t)block;
+
+@end
@@ -0,0 +1,165 @@
+//
+//  CallbackExecutor.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "CallbackExecutor.h"
+#import "SharedThreadPool.h"
+#import "Logging.h"
+
+// Half a frame at 60fps.  This is the budget for a main-thread batch by default.
+#define kDefaultMainThreadBatchTimeBudget 0.008
+
+
+@interface CallbackExecutor ()
+
+@property (nonatomic) CallbackExecutorType type;
+@property (nonatomic, retain) NSObject* lock;
+
+// Blocks waiting for the next drain, and whether that drain has been scheduled yet:
+@property (nonatomic, retain) NSMutableArray* pendingBlocks;
+@property (nonatomic) BOOL drainScheduled;
+
+// Only one of these is used, depending on type:
+@property (nonatomic, retain) NSString* threadIdentifier;
+@property (nonatomic, retain) NSThread* thread;
+@property (nonatomic, retain) dispatch_queue_t queue;
+
+@end
+
+
+@implementation CallbackExecutor
+
+#pragma mark - Construction
+
+-(CallbackExecutor*) initWithType:(CallbackExecutorType)type {
+    if(self = [super init]) {
+        self.type = type;
+        self.lock = [[NSObject alloc] init];
+        self.pendingBlocks = [[NSMutableArray alloc] init];
+        self.drainScheduled = FALSE;
+        self.batchTimeBudget = (type == CallbackExecutorTypeMainThread) ? kDefaultMainThreadBatchTimeBudget : 0.0;
+    }
+    return self;
+}
+
++(CallbackExecutor*) mainThreadExecutor {
+    static CallbackExecutor* __mainThreadExecutor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __mainThreadExecutor = [[CallbackExecutor alloc] initWithType:CallbackExecutorTypeMainThread];
+    });
+    return __mainThreadExecutor;
+}
+
++(CallbackExecutor*) executorWithThreadPoolIdentifier:(NSString*)threadIdentifier {
+    CallbackExecutor* executor = [[CallbackExecutor alloc] initWithType:CallbackExecutorTypeThreadPool];
+    executor.threadIdentifier = threadIdentifier;
+    executor.thread = [[SharedThreadPool singleton] subscribeToThreadWithIdentifer:threadIdentifier];
+    return executor;
+}
+
++(CallbackExecutor*) executorWithQueue:(dispatch_queue_t)queue {
+    CallbackExecutor* executor = nil;
+    if(queue != nil) {
+        executor = [[CallbackExecutor alloc] initWithType:CallbackExecutorTypeQueue];
+        executor.queue = queue;
+    } else {
+        LogWTF(@"CallbackExecutor - asked for an executor with a nil queue!  Using the main thread instead.");
+        executor = [CallbackExecutor mainThreadExecutor];
+    }
+    return executor;
+}
+
+-(void) dealloc {
+    if(self.type == CallbackExecutorTypeThreadPool) {
+        [[SharedThreadPool singleton] unsubscribeThreadWithIdentifier:self.threadIdentifier];
+    }
+}
+
+
+#pragma mark - Running blocks
+
+-(void) execute:(dispatch_block_t)block {
+    if(block != NULL) {
+        @synchronized (self.lock) {
+            [self.pendingBlocks addObject:[block copy]];
+
+            // Only the first block in a batch needs to schedule the drain.  Everything
+            // else that shows up before it runs just rides along.
+            if(!self.drainScheduled) {
+                self.drainScheduled = TRUE;
+                [self scheduleDrain];
+            }
+        }
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) scheduleDrain {
+    switch (self.type) {
+        case CallbackExecutorTypeMainThread: {
+            // CFRunLoopPerformBlock runs once per turn of the run loop, in any common mode (so
+            // it keeps going during scrolling), which is exactly the batching we want:
+            CFRunLoopRef mainRunLoop = CFRunLoopGetMain();
+            CFRunLoopPerformBlock(mainRunLoop, kCFRunLoopCommonModes, ^{
+                [self drain];
+            });
+            CFRunLoopWakeUp(mainRunLoop);
+            break;
+        }
+        case CallbackExecutorTypeThreadPool:
+            // Through the pool, so the wait shows up in its threadMetrics:
+            [[SharedThreadPool singleton] performBlock:^{
+                [self drain];
+            } onThread:self.thread];
+            break;
+        case CallbackExecutorTypeQueue:
+            dispatch_async(self.queue, ^{
+                [self drain];
+            });
+            break;
+    }
+}
+
+// Runs as much of the pending batch as fits in the time budget, then either reschedules
+// for the leftovers (and anything that came in while we were running) or goes idle.
+-(void) drain {
+    NSArray* batch = nil;
+    double budget = self.batchTimeBudget;
+    @synchronized (self.lock) {
+        batch = self.pendingBlocks;
+        self.pendingBlocks = [[NSMutableArray alloc] init];
+    }
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    NSUInteger numRun = 0;
+    for(dispatch_block_t block in batch) {
+        block();
+        numRun++;
+
+        if(budget > 0.0 && (CFAbsoluteTimeGetCurrent() - start) > budget) {
+            break;
+        }
+    }
+
+    @synchronized (self.lock) {
+        if(numRun < batch.count) {
+            // Out of time.  Put the rest back at the front so the order is kept:
+            NSRange leftovers = NSMakeRange(numRun, batch.count - numRun);
+            [self.pendingBlocks insertObjects:[batch subarrayWithRange:leftovers]
+                                    atIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, leftovers.length)]];
+        }
+
+        if(self.pendingBlocks.count > 0) {
+            [self scheduleDrain];
+        } else {
+            self.drainScheduled = FALSE;
+        }
+    }
+}
+
+@end
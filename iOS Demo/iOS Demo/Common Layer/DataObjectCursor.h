@@ -0,0 +1,109 @@
+//
+//  DataObjectCursor.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** A DataObjectCursor walks the results of a query one page at a time, so you can scroll
+    through a big table without faulting the whole thing in.  Get one from an
+    AbstractDataObjectManager (cursorWithPredicate:sortDescriptors:) or make one yourself
+    against any AbstractCoreDataCoordinator.  Set it up, then call nextPage until it comes
+    back empty.  The cursor doesn't hold on to the pages it hands out, so once you let go of
+    a page, CoreData can let go of its rows (call refreshObject:mergeChanges:NO on them if
+    your context is holding them strongly).
+
+    There are two ways to page:
+        - Keyset (the default): each page asks for the rows that sort after the last row
+            of the page before.  With an index on the sort keys, every page costs about
+            the same however far down you are.  For this to work, every sort descriptor
+            has to be a plain attribute of the entity compared with compare:, none of the
+            values can be nil, and the LAST sort descriptor has to be unique (the id is
+            usually the right thing) or rows that tie on every key get skipped.
+        - Offset: each page skips the rows it's already returned.  Works with any sort,
+            but the database still walks the skipped rows, so pages get slower the further
+            down you go.
+    If you ask for keyset paging and the sort can't support it, the cursor logs a warning
+    and pages by offset instead.  If it hits a nil sort value along the way, it switches
+    to offset for the rest of the walk.
+
+    Set everything up BEFORE the first nextPage.  A cursor isn't thread-safe; use it on
+    the thread (or queue) that owns the coordinator's context. */
+
+#import <Foundation/Foundation.h>
+#import "AbstractCoreDataCoordinator.h"
+
+typedef enum {
+    DataObjectCursorPagingKeyset = 0,  // "sorts after the last row" - constant cost per page
+    DataObjectCursorPagingOffset = 1,  // fetchOffset - works with any sort, slower further down
+} DataObjectCursorPaging;
+
+// The default for pageSize:
+#define kDataObjectCursorDefaultPageSize 50
+
+// With propertiesToFetch set, each row comes back as a dictionary, and the row's
+// NSManagedObjectID is under this key:
+#define kDataObjectCursorObjectIDKey @"objectID"
+
+@interface DataObjectCursor : NSObject
+
+// sortDescriptors may be nil, but then the order isn't defined and you get offset paging.
+-(DataObjectCursor*) initWithCoreDataCoordinator:(id<AbstractCoreDataCoordinator>)coordinator
+                                      withEntity:(NSEntityDescription*)entity
+                                   withPredicate:(NSPredicate*)predicate
+                             withSortDescriptors:(NSArray*)sortDescriptors;
+
+// Returns the next page of results (at most pageSize of them), or an empty array when
+// there's nothing left.  Returns nil if the fetch failed.
+-(NSArray*) nextPage;
+
+// Go back to the start.  The setup stays the same.
+-(void) reset;
+
+// Counts every row the query matches.  This asks the database; it doesn't fetch anything.
+-(NSUInteger) count;
+
+
+#pragma mark Setup
+
+// How many rows come back from each nextPage.  Default kDataObjectCursorDefaultPageSize.
+@property (nonatomic) NSUInteger pageSize;
+
+// Passed on to NSFetchRequest's fetchBatchSize: the rows within a page are faulted in this
+// many at a time as you touch them.  0 (the default) fetches a page's rows all at once.
+@property (nonatomic) NSUInteger fetchBatchSize;
+
+// Keyset or offset - see above.  Default keyset.
+@property (nonatomic) DataObjectCursorPaging paging;
+
+// Attribute names.  When this is set, rows come back as NSDictionaries holding just these
+// attributes (plus the sort keys and kDataObjectCursorObjectIDKey) instead of managed
+// objects.  Use it for lists that only show a couple of fields.  Default nil.
+@property (nonatomic, copy) NSArray* propertiesToFetch;
+
+// Relationship key paths to fetch along with each page, so touching them doesn't fault
+// them in one row at a time.  Ignored when propertiesToFetch is set.  Default nil.
+@property (nonatomic, copy) NSArray* relationshipKeyPathsForPrefetching;
+
+
+#pragma mark Progress
+
+@property (nonatomic, readonly) NSEntityDescription* entity;
+@property (nonatomic, readonly) NSPredicate* predicate;
+@property (nonatomic, readonly) NSArray* sortDescriptors;
+
+// FALSE once a page has come back short.
+@property (nonatomic, readonly) BOOL hasMore;
+
+// How the cursor is actually paging (see above for when this differs from paging):
+@property (nonatomic, readonly) DataObjectCursorPaging effectivePaging;
+
+@property (nonatomic, readonly) NSUInteger numPagesFetched;
+@property (nonatomic, readonly) NSUInteger numObjectsFetched;
+
+// How long the fetches took, in seconds:
+@property (nonatomic, readonly) double lastPageFetchSeconds;
+@property (nonatomic, readonly) double maxPageFetchSeconds;
+
+@end
@@ -0,0 +1,213 @@
+//
+//  DataObjectCursor.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "DataObjectCursor.h"
+#import "MonotonicClock.h"
+#import "Logging.h"
+
+NSString* const LOGTAG_DOC = @"data";
+
+@interface DataObjectCursor ()
+
+@property (nonatomic, retain) id<AbstractCoreDataCoordinator> coordinator;
+@property (nonatomic, readwrite) NSEntityDescription* entity;
+@property (nonatomic, readwrite) NSPredicate* predicate;
+@property (nonatomic, readwrite) NSArray* sortDescriptors;
+
+@property (nonatomic, readwrite) BOOL hasMore;
+@property (nonatomic, readwrite) DataObjectCursorPaging effectivePaging;
+@property (nonatomic, readwrite) NSUInteger numPagesFetched;
+@property (nonatomic, readwrite) NSUInteger numObjectsFetched;
+@property (nonatomic, readwrite) double lastPageFetchSeconds;
+@property (nonatomic, readwrite) double maxPageFetchSeconds;
+
+// The sort key values of the last row handed out, for keyset paging.  nil before the first page:
+@property (nonatomic, retain) NSArray* lastSortValues;
+
+// FALSE until the first nextPage works out effectivePaging:
+@property (nonatomic) BOOL started;
+
+@end
+
+@implementation DataObjectCursor
+
+-(DataObjectCursor*) initWithCoreDataCoordinator:(id<AbstractCoreDataCoordinator>)coordinator
+                                      withEntity:(NSEntityDescription*)entity
+                                   withPredicate:(NSPredicate*)predicate
+                             withSortDescriptors:(NSArray*)sortDescriptors {
+    if(self = [super init]) {
+        self.coordinator = coordinator;
+        self.entity = entity;
+        self.predicate = predicate;
+        self.sortDescriptors = sortDescriptors;
+
+        self.pageSize = kDataObjectCursorDefaultPageSize;
+        self.fetchBatchSize = 0;
+        self.paging = DataObjectCursorPagingKeyset;
+        self.propertiesToFetch = nil;
+        self.relationshipKeyPathsForPrefetching = nil;
+
+        [self reset];
+    }
+    return self;
+}
+
+-(void) reset {
+    self.hasMore = TRUE;
+    self.effectivePaging = self.paging;
+    self.numPagesFetched = 0;
+    self.numObjectsFetched = 0;
+    self.lastPageFetchSeconds = 0.0;
+    self.maxPageFetchSeconds = 0.0;
+    self.lastSortValues = nil;
+    self.started = FALSE;
+}
+
+-(NSUInteger) count {
+    NSFetchRequest* request = [[NSFetchRequest alloc] init];
+    request.entity = self.entity;
+    request.predicate = self.predicate;
+    return [self.coordinator countForFetchRequest:request];
+}
+
+-(NSArray*) nextPage {
+    if(!self.hasMore || self.coordinator == nil) return @[];
+
+    if(!self.started) {
+        self.started = TRUE;
+        self.effectivePaging = self.paging;
+        if(self.effectivePaging == DataObjectCursorPagingKeyset && ![self sortSupportsKeyset]) {
+            LogW(LOGTAG_DOC, @"DataObjectCursor for %@ can't page by keyset with sort %@; paging by offset instead.", self.entity.name, self.sortDescriptors);
+            self.effectivePaging = DataObjectCursorPagingOffset;
+        }
+    }
+
+    NSUInteger pageSize = (self.pageSize > 0) ? self.pageSize : kDataObjectCursorDefaultPageSize;
+    NSFetchRequest* request = [self buildFetchRequest:pageSize];
+
+    MonotonicTime start = [MonotonicClock now];
+    NSArray* page = [self.coordinator executeFetchRequest:request];
+    self.lastPageFetchSeconds = [MonotonicClock secondsSince:start];
+    self.maxPageFetchSeconds = MAX(self.maxPageFetchSeconds, self.lastPageFetchSeconds);
+
+    if(page == nil) {
+        LogE(LOGTAG_DOC, @"DataObjectCursor for %@ failed fetching page %lu.", self.entity.name, (unsigned long)self.numPagesFetched);
+        return nil;
+    }
+
+    self.numPagesFetched++;
+    self.numObjectsFetched += page.count;
+    if(page.count < pageSize) {
+        self.hasMore = FALSE;
+    }
+    else if(self.effectivePaging == DataObjectCursorPagingKeyset) {
+        [self rememberSortValuesOf:[page lastObject]];
+    }
+    return page;
+}
+
+
+#pragma mark Helpers
+
+-(NSFetchRequest*) buildFetchRequest:(NSUInteger)pageSize {
+    NSFetchRequest* request = [[NSFetchRequest alloc] init];
+    request.entity = self.entity;
+    request.sortDescriptors = self.sortDescriptors;
+    request.fetchLimit = pageSize;
+    request.fetchBatchSize = self.fetchBatchSize;
+
+    NSPredicate* predicate = self.predicate;
+    if(self.effectivePaging == DataObjectCursorPagingKeyset) {
+        if(self.lastSortValues != nil) {
+            NSPredicate* after = [self predicateAfterSortValues:self.lastSortValues];
+            predicate = (predicate == nil) ? after : [NSCompoundPredicate andPredicateWithSubpredicates:@[ predicate, after ]];
+        }
+    }
+    else {
+        request.fetchOffset = self.numObjectsFetched;
+    }
+    request.predicate = predicate;
+
+    if(self.propertiesToFetch != nil) {
+        // Dictionaries hold only what we ask for, so add the sort keys (keyset paging needs
+        // them) and the object ID (so the caller can get at the full object):
+        NSMutableArray* properties = [NSMutableArray arrayWithArray:self.propertiesToFetch];
+        NSDictionary* attributes = self.entity.attributesByName;
+        for(NSSortDescriptor* sortDescriptor in self.sortDescriptors) {
+            if(sortDescriptor.key != nil && [attributes objectForKey:sortDescriptor.key] != nil && ![properties containsObject:sortDescriptor.key]) {
+                [properties addObject:sortDescriptor.key];
+            }
+        }
+        NSExpressionDescription* objectID = [[NSExpressionDescription alloc] init];
+        objectID.name = kDataObjectCursorObjectIDKey;
+        objectID.expression = [NSExpression expressionForEvaluatedObject];
+        objectID.expressionResultType = NSObjectIDAttributeType;
+        [properties addObject:objectID];
+
+        request.resultType = NSDictionaryResultType;
+        request.includesPendingChanges = NO;  // not supported with dictionaries; you get what's saved
+        request.propertiesToFetch = properties;
+    }
+    else if(self.relationshipKeyPathsForPrefetching != nil) {
+        request.relationshipKeyPathsForPrefetching = self.relationshipKeyPathsForPrefetching;
+    }
+    return request;
+}
+
+// Keyset paging turns "sorts after the last row" into a predicate, which only works if the
+// database compares the keys the same way the sort does:
+-(BOOL) sortSupportsKeyset {
+    if(self.sortDescriptors.count == 0) return FALSE;
+
+    NSDictionary* attributes = self.entity.attributesByName;
+    for(NSSortDescriptor* sortDescriptor in self.sortDescriptors) {
+        if(sortDescriptor.key == nil || [attributes objectForKey:sortDescriptor.key] == nil) return FALSE;
+        if(sortDescriptor.selector != NULL && sortDescriptor.selector != @selector(compare:)) return FALSE;
+    }
+    return TRUE;
+}
+
+// Rows come back as managed objects or dictionaries; valueForKey: works for both.
+-(void) rememberSortValuesOf:(id)row {
+    NSMutableArray* values = [NSMutableArray arrayWithCapacity:self.sortDescriptors.count];
+    for(NSSortDescriptor* sortDescriptor in self.sortDescriptors) {
+        id value = [row valueForKey:sortDescriptor.key];
+        if(value == nil || value == [NSNull null]) {
+            // Can't say "after nil" in a predicate, but we know how many rows we've had:
+            LogW(LOGTAG_DOC, @"DataObjectCursor for %@ hit a nil %@ after %lu rows; paging by offset from here.",
+                 self.entity.name, sortDescriptor.key, (unsigned long)self.numObjectsFetched);
+            self.effectivePaging = DataObjectCursorPagingOffset;
+            self.lastSortValues = nil;
+            return;
+        }
+        [values addObject:value];
+    }
+    self.lastSortValues = values;
+}
+
+// For sort keys k1..kn and the last row's values v1..vn, a row sorts after the last one if
+//      (k1 > v1) OR (k1 == v1 AND k2 > v2) OR ... OR (k1 == v1 AND ... AND kn > vn)
+// with < in place of > for descending keys.
+-(NSPredicate*) predicateAfterSortValues:(NSArray*)values {
+    NSMutableArray* alternatives = [NSMutableArray arrayWithCapacity:self.sortDescriptors.count];
+    for(NSUInteger i = 0; i < self.sortDescriptors.count; i++) {
+        NSMutableArray* terms = [NSMutableArray arrayWithCapacity:i + 1];
+        for(NSUInteger j = 0; j < i; j++) {
+            NSSortDescriptor* equalKey = [self.sortDescriptors objectAtIndex:j];
+            [terms addObject:[NSPredicate predicateWithFormat:@"%K == %@", equalKey.key, [values objectAtIndex:j]]];
+        }
+        NSSortDescriptor* sortDescriptor = [self.sortDescriptors objectAtIndex:i];
+        NSString* format = sortDescriptor.ascending ? @"%K > %@" : @"%K < %@";
+        [terms addObject:[NSPredicate predicateWithFormat:format, sortDescriptor.key, [values objectAtIndex:i]]];
+
+        [alternatives addObject:(terms.count == 1) ? [terms firstObject] : [NSCompoundPredicate andPredicateWithSubpredicates:terms]];
+    }
+    return (alternatives.count == 1) ? [alternatives firstObject] : [NSCompoundPredicate orPredicateWithSubpredicates:alternatives];
+}
+
+@end
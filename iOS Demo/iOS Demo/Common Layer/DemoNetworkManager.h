@@ -18,6 +18,10 @@
 #import <Foundation/Foundation.h>
 #import "AbstractNetworkManager.h"
 #import "NetworkManagerStatistics.h"
+#import "RedirectCache.h"
+#import "NKURLConnectionBridge.h"
+#import "NKTrafficRecorder.h"
+#import "NKRequestOutbox.h"
 @class NetworkCall;
 
 @interface DemoNetworkManager : NSObject <AbstractNetworkManager>
@@ -25,6 +29,39 @@
 // Returns the current statistics of this NetworkManager:
 -(NetworkManagerStatistics*) currentStatistics;
 
+// Permanent (301/308) redirects seen by GET and HEAD calls.  New calls to a URL in here go
+// straight to where it ends up, and the delegate still gets didRedirectForContext for each
+// hop that was skipped.  Clear it if you know the server has moved things around.
+@property (nonatomic, readonly) RedirectCache* redirectCache;
+
+// Where this manager gets its connections.  Defaults to an NKDefaultURLConnectionBridge, and
+// setting nil puts that back.  Only change it while no calls are in flight - a call that's
+// already running is canceled through whichever bridge is set when it ends.
+@property (atomic, retain) id<NKURLConnectionBridge> connectionBridge;
+
+// A cap on how many bytes of response body all the calls in flight can hold in memory
+// between them.  0 (the default) means no cap.  While buffered bodies add up to more than
+// this, a body that grows past spillThresholdBytes is moved into a temporary file and the
+// rest of it goes there too (the delegate still gets an NSData, mapped from that file, and
+// the file is deleted once it's mapped).  New calls whose NKCallBehaviorURLRequest asks for
+// NKCallPriorityLow or NKCallPriorityBkg wait, without a timeout, until usage comes back
+// under the cap.  Everything else starts right away.  See currentStatistics for usage.
+@property (atomic) unsigned long long responseMemoryBudget;
+
+// How big a body has to be before it's worth moving to disk.  Defaults to 256KB.
+@property (atomic) unsigned long long spillThresholdBytes;
+
+// Records every connection from now on to the given recorder, by wrapping connectionBridge
+// in an NKRecordingURLConnectionBridge.  stopRecordingTraffic unwraps it again.
+-(void) startRecordingTraffic:(NKTrafficRecorder*)recorder;
+-(void) stopRecordingTraffic;
+
+// Where writes go when there's no connection (see NKRequestOutbox).  Only calls whose
+// NKCallBehaviorURLRequest sets queueWhenOffline are queued.  The manager replays the
+// outbox whenever one of its other calls succeeds and retries it from the maintenance
+// timer.  Setting an outbox makes this manager its networkManager.  Defaults to nil.
+@property (atomic, retain) NKRequestOutbox* outbox;
+
 // These are implemented from AbstractNetworkManager:
 -(void) get:(NSString*)urlString  delegate:(id<NetworkManagerDelegate>)delegate context:(id)context;
 -(void) post:(NSString*)urlString delegate:(id<NetworkManagerDelegate>)delegate context:(id)context data:(NSData*)data;
@@ -40,8 +77,10 @@
 
 // Methods for NetworkCall to call (see NetworkCall.h):
 -(void) networkCall:(NetworkCall*)call didRecieveResponse:(NSURLResponse*)response;
+-(void) networkCall:(NetworkCall*)call didReceiveData:(NSData*)data;
 -(void) networkCallDidFinishLoading:(NetworkCall*)call;
 -(void) networkCall:(NetworkCall*)call didFailWithError:(NSError*)error;
+-(NSURLRequest*) networkCall:(NetworkCall*)call willRedirectTo:(NSURLRequest*)request redirectResponse:(NSURLResponse*)response;
 
 
 // This is a hook for testing.  It allows the test framework to specify a class for the
@@ -8,6 +8,9 @@
 
 #import "DemoNetworkManager.h"
 #import "NetworkCall.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "NKRecordingURLConnectionBridge.h"
+#import "MonotonicClock.h"
 #import "Logging.h"
 
 NSString* const LOGTAG_DNM = @"network";
@@ -16,15 +19,41 @@ NSString* const LOGTAG_DNM = @"network";
 double const kDefaultTimeoutSeconds = 8.0;
 double const kMaintenanceTimerInterval = 0.25;
 int const kDefaultNumRetries = 3;
+NSUInteger const kRedirectCacheCapacity = 256;
+NSUInteger const kNetworkCallPoolCapacity = 64;
+unsigned long long const kDefaultSpillThresholdBytes = 256 * 1024;
 
 
+// Header lookups have to be case-insensitive.  NSHTTPURLResponse normalizes some names
+// ("Etag") and not others, so don't trust valueForKey: for anything but Content-Length.
+static NSString* headerValue(NSDictionary* headers, NSString* name) {
+    for(NSString* key in headers) {
+        if([key caseInsensitiveCompare:name] == NSOrderedSame) {
+            return [headers objectForKey:key];
+        }
+    }
+    return nil;
+}
+
 
 @interface DemoNetworkManager ()
 
 @property (nonatomic, retain) NSTimer* maintenanceTimer;
 @property (nonatomic, retain) NSMutableSet* allNetworkCalls;
 
+// Low-priority calls that are tracked but not started, because response bodies were over
+// budget when they came in.  First in, first out:
+@property (nonatomic, retain) NSMutableArray* callsWaitingForMemory;
+
+// Finished NetworkCalls waiting to be used again (see dequeueNetworkCall...):
+@property (nonatomic, retain) NSMutableArray* networkCallPool;
+
+// HTTP method -> an NSURLRequest with our defaults already set.  buildURLRequest: copies
+// one of these instead of setting up every header from scratch:
+@property (nonatomic, retain) NSDictionary* requestTemplates;
+
 @property (nonatomic, retain) NetworkManagerStatistics* statistics;
+@property (nonatomic, retain) RedirectCache* redirectCache;
 @property (nonatomic) UInt64 totalSuccessfulCalls;
 @property (nonatomic) double totalLatencySuccessfulCalls;
 
@@ -39,16 +68,88 @@ int const kDefaultNumRetries = 3;
 -(DemoNetworkManager*) init {
     if(self = [super init]) {
         self.allNetworkCalls = [[NSMutableSet alloc] init];
+        self.callsWaitingForMemory = [[NSMutableArray alloc] init];
+        self.networkCallPool = [[NSMutableArray alloc] initWithCapacity:kNetworkCallPoolCapacity];
+        _responseMemoryBudget = 0;
+        _spillThresholdBytes = kDefaultSpillThresholdBytes;
+        self.requestTemplates = [self buildRequestTemplates];
         self.maintenanceTimer = [NSTimer scheduledTimerWithTimeInterval:kMaintenanceTimerInterval target:self
                                                                selector:@selector(maintenanceTimerFired) userInfo:nil repeats:YES];
         
         self.testingURLConnectionClass = nil;
         self.statistics = [[NetworkManagerStatistics alloc] init];
+        self.redirectCache = [[RedirectCache alloc] initWithCapacity:kRedirectCacheCapacity];
+        _connectionBridge = [[NKDefaultURLConnectionBridge alloc] init];
     }
     return self;
 }
 
 
+// The bridge is set under the same lock as everything else, so a call never sees
+// it half-swapped:
+@synthesize connectionBridge = _connectionBridge;
+
+-(void) setConnectionBridge:(id<NKURLConnectionBridge>)connectionBridge {
+    @synchronized(self) {
+        _connectionBridge = (connectionBridge != nil) ? connectionBridge : [[NKDefaultURLConnectionBridge alloc] init];
+    }
+}
+
+-(id<NKURLConnectionBridge>) connectionBridge {
+    @synchronized(self) {
+        return _connectionBridge;
+    }
+}
+
+// Changing the budget can let waiting calls go:
+@synthesize responseMemoryBudget = _responseMemoryBudget;
+
+-(void) setResponseMemoryBudget:(unsigned long long)responseMemoryBudget {
+    @synchronized(self) {
+        _responseMemoryBudget = responseMemoryBudget;
+        [self startCallsWaitingForMemory];
+    }
+}
+
+-(unsigned long long) responseMemoryBudget {
+    @synchronized(self) {
+        return _responseMemoryBudget;
+    }
+}
+
+// The outbox replays through us:
+@synthesize outbox = _outbox;
+
+-(void) setOutbox:(NKRequestOutbox*)outbox {
+    @synchronized(self) {
+        _outbox = outbox;
+        outbox.networkManager = self;
+    }
+}
+
+-(NKRequestOutbox*) outbox {
+    @synchronized(self) {
+        return _outbox;
+    }
+}
+
+-(void) startRecordingTraffic:(NKTrafficRecorder*)recorder {
+    @synchronized(self) {
+        [self stopRecordingTraffic];
+        self.connectionBridge = [[NKRecordingURLConnectionBridge alloc] initWithBridge:self.connectionBridge recorder:recorder];
+    }
+}
+
+-(void) stopRecordingTraffic {
+    @synchronized(self) {
+        id<NKURLConnectionBridge> bridge = self.connectionBridge;
+        if([bridge isKindOfClass:[NKRecordingURLConnectionBridge class]]) {
+            self.connectionBridge = ((NKRecordingURLConnectionBridge*)bridge).wrappedBridge;
+        }
+    }
+}
+
+
 // Returns the current statistics of this NetworkManager:
 -(NetworkManagerStatistics*) currentStatistics {
     NetworkManagerStatistics* retval = nil;
@@ -58,7 +159,8 @@ int const kDefaultNumRetries = 3;
         retval.date = [NSDate date];
         
         retval.numRetriesInFlight = retval.numCallsInFlight = 0;
-        retval.numCallsInFlight = self.allNetworkCalls.count;
+        retval.numCallsInFlight = self.allNetworkCalls.count - self.callsWaitingForMemory.count;
+        retval.numCallsWaitingForMemory = self.callsWaitingForMemory.count;
         for(NetworkCall* call in self.allNetworkCalls) {
             if(call.numRetries > 0 && call.connection != nil) {
                 retval.numRetriesInFlight++;
@@ -99,28 +201,43 @@ int const kDefaultNumRetries = 3;
         NSURL* url = [NSURL URLWithString:urlString];
         
         if(url != nil) {
-            request = [[NSMutableURLRequest alloc] initWithURL:url];
-            
-            // We want to force a reload every time.
-            request.cachePolicy = NSURLRequestReloadIgnoringCacheData;
-            
-            // Some other params.  Connection=close increases reliability because the underlying NSURLConnection seems to never let go of calls sometimes.
-            [request setValue:@"close" forHTTPHeaderField:@"Connection"];
-            [request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
-            
-            // Set the request type.  Valid options are "GET" "HEAD" "POST" "PUT" "DELETE"
-            [request setHTTPMethod:@"GET"];
-            if([requestType isEqualToString:@"HEAD"] || [requestType isEqualToString:@"POST"] || [requestType isEqualToString:@"PUT"] || [requestType isEqualToString:@"DELETE"]) {
-                [request setHTTPMethod:requestType];
-            } else {
+            // Valid options are "GET" "HEAD" "POST" "PUT" "DELETE"
+            NSURLRequest* template = (requestType != nil) ? [self.requestTemplates objectForKey:requestType] : nil;
+            if(template == nil) {
                 LogW(LOGTAG_DNM, @"Request made with unsupported method %@!  Defaulting to GET request.  URL is %@", requestType, urlString);
+                template = [self.requestTemplates objectForKey:@"GET"];
             }
+            
+            request = [template mutableCopy];
+            request.URL = url;
         }
     }
     
     return request;
 }
 
+// One template per method we support.  These are never handed out or changed, so
+// they're safe to copy from any thread.
+-(NSDictionary*) buildRequestTemplates {
+    NSMutableDictionary* templates = [[NSMutableDictionary alloc] init];
+    
+    for(NSString* method in @[@"GET", @"HEAD", @"POST", @"PUT", @"DELETE"]) {
+        NSMutableURLRequest* request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:@"http://localhost/"]];
+        
+        // We want to force a reload every time.
+        request.cachePolicy = NSURLRequestReloadIgnoringCacheData;
+        
+        // Some other params.  Connection=close increases reliability because the underlying NSURLConnection seems to never let go of calls sometimes.
+        [request setValue:@"close" forHTTPHeaderField:@"Connection"];
+        [request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
+        
+        [request setHTTPMethod:method];
+        [templates setObject:[request copy] forKey:method];
+    }
+    
+    return templates;
+}
+
 -(void) startNetworkCall:(NSMutableURLRequest*)request
             withDelegate:(id<NetworkManagerDelegate>)delegate
             onMainThread:(BOOL)onMainThread
@@ -132,12 +249,51 @@ int const kDefaultNumRetries = 3;
     NetworkManagerError earlyCallbackError = NetworkManagerErrorNoError;
     BOOL makeStartedCallCallback = FALSE;
     
-    // Let's build a NetworkCall to track this connection:
-    NetworkCall* call = [[NetworkCall alloc] initWithManager:self delegate:delegate delegateContext:context timeout:timeout maxRetries:numRetries];
+    // Let's get a NetworkCall to track this connection:
+    NetworkCall* call = [self dequeueNetworkCallWithDelegate:delegate delegateContext:context timeout:timeout maxRetries:numRetries];
     call.request = request;
+    call.originalRequest = request;
     call.urlString = request.URL.absoluteString;
     call.runLoop = onMainThread ? [NSRunLoop mainRunLoop] : [NSRunLoop currentRunLoop];
     
+    // We don't take NKCallBehaviorURLRequest options in general, but download-to-file is
+    // too important for memory to ignore.  The body goes to disk instead of into call.data:
+    if([request isKindOfClass:[NKCallBehaviorURLRequest class]] && ((NKCallBehaviorURLRequest*)request).downloadToFile) {
+        NSURL* fileURL = ((NKCallBehaviorURLRequest*)request).downloadFileURL;
+        call.fileWriter = (fileURL != nil) ? [[DownloadFileWriter alloc] initWithFileURL:fileURL] : [DownloadFileWriter temporaryFileWriter];
+        call.data = nil;
+    }
+    
+    // The same goes for keeping temporary redirects around for retries, and for letting
+    // low-priority calls wait when we're short on memory:
+    BOOL canWaitForMemory = FALSE;
+    if([request isKindOfClass:[NKCallBehaviorURLRequest class]]) {
+        NKCallBehaviorURLRequest* behavior = (NKCallBehaviorURLRequest*)request;
+        call.storeRedirectStack = (behavior.redirectRetryPolicy == NKRedirectRetryPolicyStoreRedirectStack);
+        canWaitForMemory = (behavior.priority == NKCallPriorityLow || behavior.priority == NKCallPriorityBkg);
+        call.queueWhenOffline = behavior.queueWhenOffline && [NKRequestOutbox canQueueMethod:behavior.HTTPMethod];
+    }
+    
+    // Skip any permanent redirects we already know about.  We change a copy so the caller's
+    // request is left alone (done last, since the copy won't be an NKCallBehaviorURLRequest):
+    NSArray* skippedRedirects = nil;
+    if([self redirectsAreCacheableForMethod:request.HTTPMethod]) {
+        NSURL* resolvedURL = [self.redirectCache resolveURL:request.URL hops:&skippedRedirects];
+        if(skippedRedirects.count > 0) {
+            LogD(LOGTAG_DNM, @"Skipping %lu cached redirect(s) from %@ to %@", (unsigned long)skippedRedirects.count, request.URL, resolvedURL);
+            NSMutableArray* sources = [NSMutableArray arrayWithObject:request.URL];
+            for(NSUInteger i = 0; i + 1 < skippedRedirects.count; i++) {
+                NSURL* hopURL = [NSURL URLWithString:((RedirectCacheHop*)[skippedRedirects objectAtIndex:i]).toURLString];
+                if(hopURL != nil) [sources addObject:hopURL];
+            }
+            call.skippedRedirectSources = sources;
+            request = [request mutableCopy];
+            request.URL = resolvedURL;
+            call.request = request;
+            call.originalRequest = request;
+        }
+    }
+    
     @synchronized (self) {
         // Set up the timeout on the NSURLRequest... this is different than the timeout on the NetworkCall
         // object and in fact will probably never get encountered.  There's some evidance that it's not
@@ -151,37 +307,61 @@ int const kDefaultNumRetries = 3;
             earlyCallbackError = NetworkManagerErrorNoConnection;
         } else {
             [self.allNetworkCalls addObject:call];
-            [self startCallHelper:call];
+            if(canWaitForMemory && [self isOverResponseMemoryBudget]) {
+                [self.callsWaitingForMemory addObject:call];
+                self.statistics.totalCallsHeldForMemory++;
+                LogD(LOGTAG_DNM, @"Holding call until response memory is back under budget: %@ %@", request.HTTPMethod, [request.URL absoluteString]);
+            } else {
+                [self startCallHelper:call];
+                LogD(LOGTAG_DNM, @"Started call: %@ %@", request.HTTPMethod, [request.URL absoluteString]);
+            }
             makeStartedCallCallback = TRUE;
-            
-            LogD(LOGTAG_DNM, @"Started call: %@ %@", request.HTTPMethod, [request.URL absoluteString]);
+            self.statistics.totalRedirectHopsSkipped += skippedRedirects.count;
         }
     }
     
     // Outside the synchronized block, make callbacks as needed:
     if(earlyCallbackError != NetworkManagerErrorNoError) {
         [self makeFailureCallback:call httpCode:-1 networkManagerError:earlyCallbackError error:nil];
+        [self recycleNetworkCall:call];
     } else if(makeStartedCallCallback) {
         if(delegate != nil) {
             if([delegate respondsToSelector:@selector(networkManager:didStartCall:)]) {
                 [delegate networkManager:self didStartCall:context];
             }
+            
+            // Report the redirects we skipped as if they'd happened, so delegates that
+            // track the final URL see the same thing either way:
+            if([delegate respondsToSelector:@selector(networkManager:didRedirectForContext:newURL:httpStatus:)]) {
+                for(RedirectCacheHop* hop in skippedRedirects) {
+                    [delegate networkManager:self didRedirectForContext:context newURL:hop.toURLString httpStatus:hop.httpStatus];
+                }
+            }
         }
     }
 }
 
 -(void) cancelForDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context {
+    NSMutableArray* canceledCalls = [[NSMutableArray alloc] init];
+    
     @synchronized (self) {
         // TASK: The right way to structure this is to have a map (i.e. NSMutableDictionary) of
         // delegates (weakly held!) to network calls.  This requires a little bit of finageling
         // because the delegates are held weakly... but it can be done.  I'm not going to do
-        // that now, however, so we default to this O(n) search strategy.
-        for(NetworkCall* call in self.allNetworkCalls) {
+        // that now, however, so we default to this O(n) search strategy.  We walk a copy
+        // because unTrackCall removes from the set.
+        for(NetworkCall* call in [self.allNetworkCalls copy]) {
             if(call.delegate == delegate && call.delegateContext == context) {
                 [self unTrackCall:call];
+                [canceledCalls addObject:call];
             }
         }
     }
+    
+    // No more callbacks go out for these, so they can go straight back in the pool:
+    for(NetworkCall* call in canceledCalls) {
+        [self recycleNetworkCall:call];
+    }
 }
 
 
@@ -190,14 +370,22 @@ int const kDefaultNumRetries = 3;
 -(void) networkCall:(NetworkCall*)call didRecieveResponse:(NSURLResponse*)response {
     BOOL connectionIsValid = FALSE;
     BOOL shouldCallBackFailure = FALSE;
+    NetworkManagerError failureType = NetworkManagerErrorNoError;
     int httpCode = -100;
     int size = -1;
     NSDictionary* allHeaders = nil;
+    id<NetworkManagerDelegate> delegate = nil;
+    id delegateContext = nil;
     
     @synchronized (self) {
         if([self networkCallIsValidHelper:call]) {
             BOOL errorOccured = FALSE;
             
+            // Once we let go of the lock the call could be canceled and reused, so take
+            // what the callbacks need now:
+            delegate = call.delegate;
+            delegateContext = call.delegateContext;
+            
             if([response isKindOfClass:[NSHTTPURLResponse class]]) {
                 // Parse this as an HTTP response:
                 NSHTTPURLResponse* httpResponse = (NSHTTPURLResponse*)response;
@@ -207,9 +395,27 @@ int const kDefaultNumRetries = 3;
                 
                 if(httpCode >= 400) {
                     errorOccured = TRUE;
+                    
+                    // Nothing where a cached redirect sent us?  It's out of date:
+                    if(httpCode == 404 || httpCode == 410) {
+                        [self evictSkippedRedirectsForCall:call];
+                    }
+                    
+                    // A temporary redirect may have stopped working.  Retry from the top:
+                    if(call.redirectedRequest != nil) {
+                        call.redirectedRequest = nil;
+                        [self discardPartialBodyForCall:call];
+                    }
+                    
+                    // 416 means the range we resumed from is no good.  Start over next time:
+                    if(httpCode == 416 && call.resumeOffset > 0) {
+                        [self discardPartialBodyForCall:call];
+                        call.acceptsRanges = FALSE;
+                    }
                 } else {
-                    // got a successful 200 response!
+                    // got a successful 200 (or 206) response!
                     connectionIsValid = TRUE;
+                    BOOL fileOpenFailed = FALSE;
                     
                     // let's parse the content-length really quick while we're here:
                     NSString* contentLengthString = [allHeaders valueForKey:@"Content-Length"];
@@ -225,6 +431,49 @@ int const kDefaultNumRetries = 3;
                     }
                     
                     LogD(LOGTAG_DNM, @"Recieved %d response (Content-Length %d) from URL %@", httpCode, size, call.urlString);
+                    
+                    if(call.resumeOffset > 0 && httpCode == 206) {
+                        // This is a resumed retry.  Make sure we got the range we asked for
+                        // before we glue it onto what we already have:
+                        if([self resumeResponseIsValid:httpResponse forCall:call]) {
+                            LogD(LOGTAG_DNM, @"Resuming call to %@ (%p) at byte %llu", call.urlString, call, call.resumeOffset);
+                            self.statistics.totalNumResumedRetries++;
+                            if(call.expectedTotalLength >= 0) {
+                                size = (int)call.expectedTotalLength;
+                            }
+                            if(call.fileWriter != nil) {
+                                fileOpenFailed = ![call.fileWriter reopenAtCurrentOffset];
+                            }
+                        } else {
+                            LogW(LOGTAG_DNM, @"Got a bad 206 response resuming %@ (%p) at byte %llu - starting over", call.urlString, call, call.resumeOffset);
+                            [self discardPartialBodyForCall:call];
+                            call.acceptsRanges = FALSE;
+                            connectionIsValid = FALSE;
+                            errorOccured = TRUE;
+                        }
+                    } else {
+                        // A full response.  If we'd asked for a range, the server ignored it or the
+                        // resource changed under us (If-Range didn't match).  Either way, start over:
+                        if(call.resumeOffset > 0) {
+                            LogD(LOGTAG_DNM, @"Server sent the whole body for resumed call to %@ (%p) - starting over", call.urlString, call);
+                            [self discardPartialBodyForCall:call];
+                        }
+                        [self recordResumeInfoForCall:call response:httpResponse size:size];
+                        
+                        // Download-to-file calls get their file (re)opened and sized here.
+                        if(call.fileWriter != nil) {
+                            fileOpenFailed = ![call.fileWriter openWithExpectedLength:size];
+                        }
+                    }
+                    
+                    // If we can't write the file, a retry won't help, so fail the call right away:
+                    if(fileOpenFailed) {
+                        connectionIsValid = FALSE;
+                        shouldCallBackFailure = TRUE;
+                        failureType = NetworkManagerErrorInternal;
+                        self.statistics.failuresInternalError++;
+                        [self unTrackCall:call];
+                    }
                 }
                 
             } else {
@@ -237,7 +486,8 @@ int const kDefaultNumRetries = 3;
             // callbacks will stop and start over again with a new connection, so we don't have to
             // worry about an errant didFinishLoading call from this network call.
             if(errorOccured) {
-                shouldCallBackFailure = [self retryOrFail:call withError:[self decodeError:httpCode error:nil hint:0]];
+                NetworkManagerError hint = (httpCode == 206) ? NetworkManagerErrorBadServer : NetworkManagerErrorNoError;
+                shouldCallBackFailure = [self retryOrFail:call withError:[self decodeError:httpCode error:nil hint:hint]];
             }
             
         } else {
@@ -246,39 +496,100 @@ int const kDefaultNumRetries = 3;
     }
     
     if(shouldCallBackFailure) {
-        [self makeFailureCallback:call httpCode:httpCode networkManagerError:0 error:nil];
-    } else if(connectionIsValid && call.delegate != nil) {
+        [self makeFailureCallback:call httpCode:httpCode networkManagerError:failureType error:nil];
+        [self recycleNetworkCall:call];
+    } else if(connectionIsValid && delegate != nil) {
         // call back saying we recieved the header:
-        if([call.delegate respondsToSelector:@selector(networkManager:didLoadHeader:size:headers:)]) {
-            [call.delegate networkManager:self didLoadHeader:call.delegateContext size:size headers:allHeaders];
+        if([delegate respondsToSelector:@selector(networkManager:didReceiveResponse:httpStatus:)]) {
+            [delegate networkManager:self didReceiveResponse:delegateContext httpStatus:httpCode];
+        }
+        if([delegate respondsToSelector:@selector(networkManager:didLoadHeader:size:headers:)]) {
+            [delegate networkManager:self didLoadHeader:delegateContext size:size headers:allHeaders];
+        }
+    }
+}
+
+// Loaded some more body.  For download-to-file (and spilled) calls it goes straight to
+// disk.  A failed write is noted here and turned into a call failure when the connection
+// finishes.
+-(void) networkCall:(NetworkCall*)call didReceiveData:(NSData*)data {
+    @synchronized (self) {
+        if([self networkCallIsValidHelper:call]) {
+            if(call.fileWriter != nil) {
+                if(!call.fileWriteFailed && ![call.fileWriter appendData:data]) {
+                    call.fileWriteFailed = TRUE;
+                }
+            } else {
+                [call.data appendData:data];
+                [self addBufferedBytes:data.length];
+                [self spillCallIfOverBudget:call];
+            }
         }
     }
 }
 
 -(void) networkCallDidFinishLoading:(NetworkCall*)call {
     BOOL connectionIsValid = FALSE;
+    BOOL fileFailed = FALSE;
+    NSData* body = nil;
+    NSURL* fileURL = nil;
     
     @synchronized (self) {
         if([self networkCallIsValidHelper:call]) {
+            body = call.data;
+            
+            // For download-to-file calls, close out the file and map it.  Once that's done the
+            // file belongs to the delegate, so we let go of the writer (unTrackCall would delete it).
+            if(call.fileWriter != nil) {
+                fileURL = call.fileWriter.fileURL;
+                body = call.fileWriteFailed ? nil : [call.fileWriter finishAndMap];
+                if(body == nil) {
+                    [call.fileWriter discard];
+                    fileFailed = TRUE;
+                }
+                call.fileWriter = nil;
+                
+                // A spilled body's file was only ever ours.  The mapping outlives the file,
+                // so it can go now, and the delegate never hears about it:
+                if(call.spilledToDisk) {
+                    if(body != nil) {
+                        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+                    }
+                    fileURL = nil;
+                }
+            }
+            
             // This call finished successfully, so we'll permanently wipe it from our records (we can prove
             // that we won't get here unless the call has successfully passed didRecieveResponse without
             // hitting a retry-or-fail case.
-            connectionIsValid = TRUE;
+            connectionIsValid = !fileFailed;
             [self unTrackCall:call];
             
             // now we can update some stats:
-            self.totalSuccessfulCalls ++;
-            self.totalLatencySuccessfulCalls += [[NSDate date] timeIntervalSinceDate:call.dateCallStarted];
+            if(fileFailed) {
+                self.statistics.failuresInternalError++;
+            } else {
+                self.totalSuccessfulCalls ++;
+                self.totalLatencySuccessfulCalls += [MonotonicClock secondsSince:call.timeCallStarted];
+            }
         } else {
             LogW(LOGTAG_DNM, @"Recieved response to unbound connection wrapper %@!  URL is %@", call, call.urlString);
         }
     }
     
-    if(connectionIsValid) {
+    if(fileFailed) {
+        LogE(LOGTAG_DNM, @"Could not write or map the download file for URL %@", call.urlString);
+        [self makeFailureCallback:call httpCode:-1 networkManagerError:NetworkManagerErrorInternal error:nil];
+    } else if(connectionIsValid) {
         // call back with success:
         if(call.delegate != nil) {
+            // Let the delegate know where the file is, if there is one:
+            if(fileURL != nil && [call.delegate respondsToSelector:@selector(networkManager:didSaveFile:fileURL:)]) {
+                [call.delegate networkManager:self didSaveFile:call.delegateContext fileURL:fileURL];
+            }
+            
             // note that this method is "required" by the protocol, so we foregoe a guard:
-            [call.delegate networkManager:self didSucceed:call.delegateContext data:call.data];
+            [call.delegate networkManager:self didSucceed:call.delegateContext data:body];
             
             // call connection finished, if supported:
             if([call.delegate respondsToSelector:@selector(networkManager:didFinish:)]) {
@@ -286,17 +597,112 @@ int const kDefaultNumRetries = 3;
             }
         }
     }
+    
+    // A call got through, so anything waiting in the outbox may well get through too:
+    BOOL replayOutbox = connectionIsValid && call.delegate != (id)self.outbox;
+    
+    if(fileFailed || connectionIsValid) {
+        [self recycleNetworkCall:call];
+    }
+    if(replayOutbox) {
+        [self.outbox replay];
+    }
 }
 
 -(void) networkCall:(NetworkCall*)call didFailWithError:(NSError*)error {
     BOOL makeFailureCallback = FALSE;
     @synchronized (self) {
-        makeFailureCallback = [self retryOrFail:call withError:[self decodeError:-1 error:error hint:0]];
+        if([self networkCallIsValidHelper:call]) {
+            // Couldn't even reach where a cached redirect sent us?  It may be out of date:
+            if([error.domain isEqualToString:NSURLErrorDomain]
+               && (error.code == NSURLErrorCannotFindHost || error.code == NSURLErrorCannotConnectToHost
+                   || error.code == NSURLErrorDNSLookupFailed)) {
+                [self evictSkippedRedirectsForCall:call];
+            }
+            makeFailureCallback = [self retryOrFail:call withError:[self decodeError:-1 error:error hint:0]];
+        } else {
+            LogW(LOGTAG_DNM, @"Recieved failure for unbound connection wrapper %@!  URL is %@", call, call.urlString);
+        }
     }
     
     if(makeFailureCallback) {
         [self makeFailureCallback:call httpCode:-1 networkManagerError:0 error:error];
+        [self recycleNetworkCall:call];
+    }
+}
+
+-(NSURLRequest*) networkCall:(NetworkCall*)call willRedirectTo:(NSURLRequest*)request redirectResponse:(NSURLResponse*)response {
+    BOOL connectionIsValid = FALSE;
+    int httpCode = -1;
+    id<NetworkManagerDelegate> delegate = nil;
+    id delegateContext = nil;
+    
+    @synchronized (self) {
+        if([self networkCallIsValidHelper:call]) {
+            connectionIsValid = TRUE;
+            delegate = call.delegate;
+            delegateContext = call.delegateContext;
+            if([response isKindOfClass:[NSHTTPURLResponse class]]) {
+                httpCode = (int)((NSHTTPURLResponse*)response).statusCode;
+            }
+            LogD(LOGTAG_DNM, @"Call to %@ (%p) redirected (%d) from %@ to %@", call.urlString, call, httpCode, response.URL, request.URL);
+            self.statistics.totalNumRedirects++;
+            
+            // Permanent redirects are good for everybody, from now on:
+            if([self redirectsAreCacheableForMethod:call.originalRequest.HTTPMethod]) {
+                [self.redirectCache recordRedirectFrom:response.URL to:request.URL httpStatus:httpCode];
+            }
+            
+            // Any redirect is good for the rest of this call, if it asked for that.  We build
+            // on the original request rather than taking NSURLConnection's, so our headers
+            // (and not whatever Range this attempt had) go along.  A 303, or a 301/302 for a
+            // POST, turns into a GET, so we take the method and body from the new request:
+            if(call.storeRedirectStack) {
+                NSMutableURLRequest* redirected = [call.originalRequest mutableCopy];
+                redirected.URL = request.URL;
+                if(![request.HTTPMethod isEqualToString:redirected.HTTPMethod]) {
+                    redirected.HTTPMethod = request.HTTPMethod;
+                    redirected.HTTPBody = request.HTTPBody;
+                }
+                call.redirectedRequest = redirected;
+            }
+        }
+    }
+    
+    if(connectionIsValid && delegate != nil) {
+        if([delegate respondsToSelector:@selector(networkManager:didRedirectForContext:newURL:httpStatus:)]) {
+            [delegate networkManager:self didRedirectForContext:delegateContext newURL:request.URL.absoluteString httpStatus:httpCode];
+        }
+    }
+    return request;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Forgets the cached redirects this call skipped, and points its retries back at the URL
+// it was given, so the server gets to say where the resource lives now:
+-(void) evictSkippedRedirectsForCall:(NetworkCall*)call {
+    NSArray* sources = call.skippedRedirectSources;
+    if(sources.count == 0) return;
+    
+    LogD(LOGTAG_DNM, @"Forgetting %lu cached redirect(s) from %@ - the call to %@ failed", (unsigned long)sources.count, [sources firstObject], call.originalRequest.URL);
+    for(NSURL* url in sources) {
+        [self.redirectCache removeRedirectFrom:url];
     }
+    NSMutableURLRequest* topRequest = [call.originalRequest mutableCopy];
+    topRequest.URL = [sources firstObject];
+    call.originalRequest = topRequest;
+    call.redirectedRequest = nil;
+    call.skippedRedirectSources = nil;
+    
+    // What we have of the body came from somewhere else, so it can't be resumed:
+    call.acceptsRanges = FALSE;
+    [self discardPartialBodyForCall:call];
+}
+
+// Redirects for anything but GET and HEAD can change the method, and aren't safe to replay
+// on a later call, so we only remember redirects for those two:
+-(BOOL) redirectsAreCacheableForMethod:(NSString*)method {
+    return [method isEqualToString:@"GET"] || [method isEqualToString:@"HEAD"];
 }
 
 // CALL THIS FROM A SYNCHRONIZED BLOCK!!!
@@ -321,6 +727,11 @@ int const kDefaultNumRetries = 3;
             LogD(LOGTAG_DNM, @"Retrying call to %@ (%p).  Retry %d of %d", call.urlString, call, call.numRetries, call.maxRetries);
             call.numRetries++;
             [self clearInternalConnectionForCall:call];
+            
+            // Keep what we've got if the server lets us pick up where we left off:
+            if(![self prepareResumeForCall:call]) {
+                [self discardPartialBodyForCall:call];
+            }
             [self startCallHelper:call];
             failedCall = FALSE;
             self.statistics.totalNumRetries++;
@@ -358,34 +769,273 @@ int const kDefaultNumRetries = 3;
         LogW(@"network", @"WARNING WARNING WARNING - Substituting class %@ for NSURLConnection in DemoNetworkManager!  You'd better be testing!", self.testingURLConnectionClass);
         newConnection = [[self.testingURLConnectionClass alloc] initWithRequest:call.request delegate:call startImmediately:FALSE];
     }
-#endif
     
-    if(newConnection == nil) {
-        newConnection = [[NSURLConnection alloc] initWithRequest:call.request delegate:call startImmediately:FALSE];
+    if(newConnection != nil) {
+        [call setConnection:newConnection];
+        [newConnection scheduleInRunLoop:call.runLoop forMode:NSRunLoopCommonModes];
+        call.timeCallStarted = [MonotonicClock now];
+        [newConnection start];
+        return;
     }
+#endif
+    
+    id<NKURLConnectionBridge> bridge = self.connectionBridge;
+    newConnection = [bridge getConnection:call.request delegate:call startImmediately:FALSE];
     [call setConnection:newConnection];
     NSRunLoop* runloop = call.runLoop;
-    [newConnection scheduleInRunLoop:runloop forMode:NSRunLoopCommonModes];
+    [bridge scheduleConnection:newConnection inRunLoop:runloop forMode:NSRunLoopCommonModes];
     
     // Finally, we can start this connection:
-    call.dateCallStarted = [NSDate date];
-    [newConnection start];
+    call.timeCallStarted = [MonotonicClock now];
+    [bridge startConnection:newConnection];
+}
+
+
+// Test connections (see overrideTestingURLConnectionClass:) didn't come from the bridge,
+// so they're canceled directly.
+-(void) cancelConnectionHelper:(NSURLConnection*)connection {
+    if(connection == nil) return;
+#ifdef TESTING
+    if(self.testingURLConnectionClass != nil && [connection isKindOfClass:self.testingURLConnectionClass]) {
+        [connection cancel];
+        return;
+    }
+#endif
+    [self.connectionBridge cancelConnection:connection];
 }
 
 
 // CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Stops the connection but leaves whatever body we've received so far alone.
 -(void) clearInternalConnectionForCall:(NetworkCall*)call {
-    [call.connection cancel];
+    [self cancelConnectionHelper:call.connection];
     call.connection = nil;
-    call.data = [[NSMutableData alloc] init];
-    call.dateCallStarted = nil;
+    call.timeCallStarted = 0;
+}
+
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Throws away the partial body so the next attempt starts from byte zero with the
+// original request.  (A download file is emptied when the next response opens it.)  The
+// body hasn't been handed to anybody yet, so we empty it in place rather than make a new one.
+-(void) discardPartialBodyForCall:(NetworkCall*)call {
+    if(call.fileWriter != nil) {
+        call.data = nil;
+    } else if(call.data != nil) {
+        [self releaseBufferedBytes:call.data.length];
+        [call.data setLength:0];
+    } else {
+        call.data = [[NSMutableData alloc] init];
+    }
+    call.fileWriteFailed = FALSE;
+    call.resumeOffset = 0;
+    call.request = [self retryRequestForCall:call];
+}
+
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Where the next attempt starts: the last redirect if we're keeping them, otherwise the top.
+-(NSURLRequest*) retryRequestForCall:(NetworkCall*)call {
+    return (call.redirectedRequest != nil) ? call.redirectedRequest : call.originalRequest;
+}
+
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Remembers whether we'll be able to resume this body with a Range request if the call
+// gets interrupted.  We need the server to say it takes byte ranges, a strong validator
+// for If-Range (weak ETags aren't allowed there), and an unencoded body - NSURLConnection
+// un-gzips for us, so our byte offsets wouldn't match the server's for an encoded body.
+-(void) recordResumeInfoForCall:(NetworkCall*)call response:(NSHTTPURLResponse*)response size:(int)size {
+    NSDictionary* headers = response.allHeaderFields;
+    NSString* acceptRanges = headerValue(headers, @"Accept-Ranges");
+    NSString* encoding     = headerValue(headers, @"Content-Encoding");
+    NSString* etag         = headerValue(headers, @"ETag");
+    NSString* lastModified = headerValue(headers, @"Last-Modified");
+    
+    BOOL identityEncoding = (encoding == nil || [encoding caseInsensitiveCompare:@"identity"] == NSOrderedSame);
+    
+    call.resumeValidator = nil;
+    if(etag != nil && ![etag hasPrefix:@"W/"]) {
+        call.resumeValidator = etag;
+    } else if(lastModified != nil) {
+        call.resumeValidator = lastModified;
+    }
+    
+    call.acceptsRanges = identityEncoding
+                      && call.resumeValidator != nil
+                      && [acceptRanges rangeOfString:@"bytes" options:NSCaseInsensitiveSearch].location != NSNotFound;
+    call.expectedTotalLength = identityEncoding ? size : -1;
+}
+
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// If the call can be resumed, points call.request at a Range/If-Range version of the
+// original request starting after the bytes we already have, and returns TRUE.
+-(BOOL) prepareResumeForCall:(NetworkCall*)call {
+    unsigned long long bytesSoFar = (call.fileWriter != nil) ? call.fileWriter.bytesWritten : call.data.length;
+    
+    if(!call.acceptsRanges || call.resumeValidator == nil || call.fileWriteFailed || bytesSoFar == 0) {
+        return FALSE;
+    }
+    NSURLRequest* baseRequest = [self retryRequestForCall:call];
+    if(![baseRequest.HTTPMethod isEqualToString:@"GET"]) {
+        return FALSE;
+    }
+    if(call.expectedTotalLength >= 0 && bytesSoFar >= (unsigned long long)call.expectedTotalLength) {
+        return FALSE;
+    }
+    
+    NSMutableURLRequest* request = [baseRequest mutableCopy];
+    [request setValue:[NSString stringWithFormat:@"bytes=%llu-", bytesSoFar] forHTTPHeaderField:@"Range"];
+    [request setValue:call.resumeValidator forHTTPHeaderField:@"If-Range"];
+    [request setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"];
+    
+    call.request = request;
+    call.resumeOffset = bytesSoFar;
+    return TRUE;
+}
+
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// A 206 is only good if it starts exactly where we left off, is for the same
+// representation, and (when we know it) agrees about the total length.
+-(BOOL) resumeResponseIsValid:(NSHTTPURLResponse*)response forCall:(NetworkCall*)call {
+    NSDictionary* headers = response.allHeaderFields;
+    NSString* contentRange = headerValue(headers, @"Content-Range");
+    NSString* encoding     = headerValue(headers, @"Content-Encoding");
+    NSString* etag         = headerValue(headers, @"ETag");
+    
+    if(contentRange == nil) return FALSE;
+    if(encoding != nil && [encoding caseInsensitiveCompare:@"identity"] != NSOrderedSame) return FALSE;
+    if(etag != nil && [call.resumeValidator hasPrefix:@"\""] && ![etag isEqualToString:call.resumeValidator]) return FALSE;
+    
+    // Content-Range: bytes <first>-<last>/<total or *>
+    long long first = -1, last = -1, total = -1;
+    NSScanner* scanner = [[NSScanner alloc] initWithString:contentRange];
+    if(![scanner scanString:@"bytes" intoString:NULL]
+       || ![scanner scanLongLong:&first]
+       || ![scanner scanString:@"-" intoString:NULL]
+       || ![scanner scanLongLong:&last]
+       || ![scanner scanString:@"/" intoString:NULL]) {
+        return FALSE;
+    }
+    if(![scanner scanLongLong:&total]) {
+        total = -1;  // "*" means the server doesn't know
+    }
+    
+    if(first != (long long)call.resumeOffset || last < first) return FALSE;
+    if(total >= 0 && call.expectedTotalLength >= 0 && total != call.expectedTotalLength) return FALSE;
+    if(total >= 0 && last >= total) return FALSE;
+    
+    return TRUE;
+}
+
+
+// Takes a NetworkCall from the pool, or makes one if the pool is empty, and sets it up
+// for a new call.  Don't call this from a synchronized block - resetting a call takes its
+// lock, and NetworkCall holds that lock while it calls into us.
+-(NetworkCall*) dequeueNetworkCallWithDelegate:(id<NetworkManagerDelegate>)delegate delegateContext:(id)context
+                                       timeout:(double)timeout maxRetries:(unsigned)maxRetries {
+    NetworkCall* call = nil;
+    @synchronized (self) {
+        call = [self.networkCallPool lastObject];
+        if(call != nil) {
+            [self.networkCallPool removeLastObject];
+            self.statistics.totalCallObjectsReused++;
+        } else {
+            self.statistics.totalCallObjectsAllocated++;
+        }
+    }
+    
+    if(call == nil) {
+        return [[NetworkCall alloc] initWithManager:self delegate:delegate delegateContext:context timeout:timeout maxRetries:maxRetries];
+    }
+    [call resetWithManager:self delegate:delegate delegateContext:context timeout:timeout maxRetries:maxRetries];
+    return call;
+}
+
+// Puts a call back in the pool.  Only the code that untracked the call gets to do this,
+// and only once it's made the call's last callback (or decided there won't be one).
+// Don't call this from a synchronized block, for the same reason as above.
+-(void) recycleNetworkCall:(NetworkCall*)call {
+    [call prepareForReuse];
+    @synchronized (self) {
+        if(self.networkCallPool.count < kNetworkCallPoolCapacity) {
+            [self.networkCallPool addObject:call];
+        }
+    }
 }
 
 
 // CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// If the call was downloading to a file and hasn't handed it off, the file is deleted.
 -(void) unTrackCall:(NetworkCall*)call {
-    [call.connection cancel];
-    [self.allNetworkCalls removeObject:call];
+    [self cancelConnectionHelper:call.connection];
+    [call.fileWriter discard];
+    call.fileWriter = nil;
+    if([self.allNetworkCalls containsObject:call]) {
+        [self.allNetworkCalls removeObject:call];
+        [self.callsWaitingForMemory removeObjectIdenticalTo:call];
+        
+        // Whoever gets the body now, it's not ours to count anymore:
+        [self releaseBufferedBytes:call.data.length];
+    }
+}
+
+
+#pragma mark - Response memory budget
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(BOOL) isOverResponseMemoryBudget {
+    return (_responseMemoryBudget > 0) && (self.statistics.bufferedResponseBytes > _responseMemoryBudget);
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) addBufferedBytes:(unsigned long long)numBytes {
+    self.statistics.bufferedResponseBytes += numBytes;
+    self.statistics.bufferedResponseBytesHighWater = MAX(self.statistics.bufferedResponseBytesHighWater, self.statistics.bufferedResponseBytes);
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Coming back under budget lets waiting calls go.
+-(void) releaseBufferedBytes:(unsigned long long)numBytes {
+    self.statistics.bufferedResponseBytes -= MIN(numBytes, self.statistics.bufferedResponseBytes);
+    [self startCallsWaitingForMemory];
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// The waiting calls don't hold anything until they get a response, so once we're under
+// budget they can all go.  If that puts us back over, the next low-priority call waits.
+-(void) startCallsWaitingForMemory {
+    while(self.callsWaitingForMemory.count > 0 && ![self isOverResponseMemoryBudget]) {
+        NetworkCall* call = [self.callsWaitingForMemory firstObject];
+        [self.callsWaitingForMemory removeObjectAtIndex:0];
+        LogD(LOGTAG_DNM, @"Starting held call to %@ (%p) - response memory is under budget", call.urlString, call);
+        [self startCallHelper:call];
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// If we're over budget and this body is big enough to be worth it, moves it into a
+// temporary file.  The rest of the body follows it there (see didReceiveData).  If the
+// file can't be written we just keep the body in memory.
+-(void) spillCallIfOverBudget:(NetworkCall*)call {
+    if(![self isOverResponseMemoryBudget] || call.data.length < self.spillThresholdBytes) return;
+    
+    DownloadFileWriter* writer = [DownloadFileWriter temporaryFileWriter];
+    if(![writer openWithExpectedLength:call.expectedTotalLength] || ![writer appendData:call.data]) {
+        LogW(LOGTAG_DNM, @"Couldn't spill %lu byte body of %@ (%p) to disk - keeping it in memory", (unsigned long)call.data.length, call.urlString, call);
+        [writer discard];
+        return;
+    }
+    
+    LogD(LOGTAG_DNM, @"Spilled %lu byte body of %@ (%p) to %@", (unsigned long)call.data.length, call.urlString, call, writer.fileURL);
+    NSUInteger numBytes = call.data.length;
+    call.fileWriter = writer;
+    call.spilledToDisk = TRUE;
+    call.data = nil;
+    self.statistics.totalBodiesSpilledToDisk++;
+    [self releaseBufferedBytes:numBytes];
 }
 
 
@@ -410,6 +1060,14 @@ int const kDefaultNumRetries = 3;
                 && [[error.userInfo objectForKey:@"NSLocalizedDescription"] isEqualToString:@"The Internet connection appears to be offline."]) {
             hintErrorType = NetworkManagerErrorNoConnection;
         }
+        // The outbox depends on telling "no connection" apart, so the usual codes for it
+        // count too, whatever the description says:
+        else if([error.domain isEqualToString:NSURLErrorDomain]
+                && (error.code == NSURLErrorNotConnectedToInternet || error.code == NSURLErrorCannotFindHost
+                    || error.code == NSURLErrorCannotConnectToHost || error.code == NSURLErrorDNSLookupFailed
+                    || error.code == NSURLErrorNetworkConnectionLost)) {
+            hintErrorType = NetworkManagerErrorNoConnection;
+        }
     }
     
     return hintErrorType;
@@ -425,6 +1083,14 @@ int const kDefaultNumRetries = 3;
         errorType = [self decodeError:httpCode error:error hint:NetworkManagerErrorNoError];
     }
     
+    // Writes that asked for it wait in the outbox for the connection to come back:
+    if(errorType == NetworkManagerErrorNoConnection && call.queueWhenOffline) {
+        NKRequestOutbox* outbox = self.outbox;
+        if(outbox != nil && [outbox enqueueRequest:call.originalRequest] != nil) {
+            errorType = NetworkManagerErrorQueued;
+        }
+    }
+    
     // call back with failure:
     if(call.delegate != nil) {
         // note that this method is "required" by the protocol, so we foregoe a guard:
@@ -452,14 +1118,16 @@ int const kDefaultNumRetries = 3;
     NSMutableArray* callsToFail = [[NSMutableArray alloc] init];
     
     @synchronized (self) {
-        NSDate* now = [NSDate date];
+        MonotonicTime now = [MonotonicClock now];
         double delta = 0.0;
         
         // Determine if any calls need to be retried (or failed) by looping
-        // through and checking the timeout interval.
-        for(NetworkCall* call in self.allNetworkCalls) {
-            delta = [now timeIntervalSinceDate:call.dateCallStarted];
-            if(call.dateCallStarted != nil && delta > call.timeout) {
+        // through and checking the timeout interval.  We walk a copy because
+        // failing a call removes it from the set.
+        for(NetworkCall* call in [self.allNetworkCalls copy]) {
+            if(call.timeCallStarted == 0) continue;
+            delta = [MonotonicClock secondsFrom:call.timeCallStarted to:now];
+            if(delta > call.timeout) {
                 LogD(LOGTAG_DNM, @"Call to %@ (%p) has timed out after %lf seconds.", call.urlString, call, delta);
                 if([self retryOrFail:call withError:NetworkManagerErrorTimedOut]) {
                     [callsToFail addObject:call];
@@ -471,7 +1139,11 @@ int const kDefaultNumRetries = 3;
     // If any calls were failed in the block above, call back to their delegates:
     for(NetworkCall* call in callsToFail) {
         [self makeFailureCallback:call httpCode:-1 networkManagerError:NetworkManagerErrorTimedOut error:nil];
+        [self recycleNetworkCall:call];
     }
+    
+    // And give the outbox another go, if it's been long enough since the last one failed:
+    [self.outbox replayIfDue];
 }
 
 
@@ -0,0 +1,49 @@
+//
+//  DownloadFileWriter.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Writes a response body into a file as it comes in, so a big download never has to sit
+    in RAM.  When the length is known up front (Content-Length), the file is preallocated
+    to that size so the filesystem doesn't have to keep growing it chunk by chunk.  When
+    the download is done, finishAndMap hands back a read-only memory-mapped NSData - the
+    pages are only faulted in as somebody reads them, and the kernel can drop them again
+    under memory pressure because they're backed by the file.
+
+    This class is NOT thread-safe.  The owner (NetworkCall) serializes access to it. */
+
+#import <Foundation/Foundation.h>
+
+@interface DownloadFileWriter : NSObject
+
+// Where the bytes go.  Anything already in the file is overwritten.
+-(DownloadFileWriter*) initWithFileURL:(NSURL*)fileURL;
+
+// Makes a writer for a new, unique file in NSTemporaryDirectory().
++(DownloadFileWriter*) temporaryFileWriter;
+
+@property (nonatomic, readonly) NSURL* fileURL;
+@property (nonatomic, readonly) unsigned long long bytesWritten;
+
+// Opens (or reopens) the file, empty, and preallocates expectedLength bytes if it's
+// positive.  Returns FALSE if the file couldn't be opened.
+-(BOOL) openWithExpectedLength:(long long)expectedLength;
+
+// Keeps the bytesWritten we already have and gets ready to append after them, reopening
+// the file if it was closed.  Used when a retry resumes a download with a Range request.
+-(BOOL) reopenAtCurrentOffset;
+
+// Appends the chunk at the current end of the body.  Returns FALSE on a write error.
+-(BOOL) appendData:(NSData*)data;
+
+// Closes the file, trims off any preallocated space that wasn't used, and maps it.
+// Returns nil if the file couldn't be mapped.  The file is left on disk for the caller.
+-(NSData*) finishAndMap;
+
+// Closes and deletes the file.  Use this when the download is abandoned.
+-(void) discard;
+
+@end
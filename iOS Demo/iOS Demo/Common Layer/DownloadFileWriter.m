@@ -0,0 +1,146 @@
+//
+//  DownloadFileWriter.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "DownloadFileWriter.h"
+#import "Logging.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+NSString* const LOGTAG_DFW = @"network";
+
+
+@interface DownloadFileWriter () {
+    int _fd;
+}
+
+@property (nonatomic, retain) NSURL* fileURL;
+@property (nonatomic) unsigned long long bytesWritten;
+
+@end
+
+
+@implementation DownloadFileWriter
+
+-(DownloadFileWriter*) initWithFileURL:(NSURL*)fileURL {
+    if(self = [super init]) {
+        _fd = -1;
+        self.fileURL = fileURL;
+        self.bytesWritten = 0;
+    }
+    return self;
+}
+
++(DownloadFileWriter*) temporaryFileWriter {
+    NSString* name = [NSString stringWithFormat:@"download-%@", [[NSUUID UUID] UUIDString]];
+    NSURL* url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:name]];
+    return [[DownloadFileWriter alloc] initWithFileURL:url];
+}
+
+-(void) dealloc {
+    // If nobody finished or discarded us, at least don't leak the descriptor:
+    if(_fd >= 0) {
+        close(_fd);
+    }
+}
+
+
+-(BOOL) openWithExpectedLength:(long long)expectedLength {
+    if(_fd >= 0) {
+        close(_fd);
+    }
+    self.bytesWritten = 0;
+
+    _fd = open([self.fileURL fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(_fd < 0) {
+        LogE(LOGTAG_DFW, @"DownloadFileWriter could not open %@ (errno %d)", self.fileURL, errno);
+        return FALSE;
+    }
+
+    if(expectedLength > 0) {
+        // Ask for contiguous space first, and settle for any space if that fails.  This is
+        // only a hint - if it doesn't work, the file just grows as we write to it.
+        fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, expectedLength, 0 };
+        if(fcntl(_fd, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;
+            fcntl(_fd, F_PREALLOCATE, &store);
+        }
+    }
+
+    return TRUE;
+}
+
+-(BOOL) reopenAtCurrentOffset {
+    if(_fd < 0) {
+        _fd = open([self.fileURL fileSystemRepresentation], O_RDWR | O_CREAT, 0644);
+        if(_fd < 0) {
+            LogE(LOGTAG_DFW, @"DownloadFileWriter could not reopen %@ (errno %d)", self.fileURL, errno);
+            return FALSE;
+        }
+    }
+    
+    // Whatever the dropped connection may have left past our offset is garbage:
+    if(ftruncate(_fd, (off_t)self.bytesWritten) != 0) {
+        LogE(LOGTAG_DFW, @"DownloadFileWriter could not trim %@ to %llu bytes (errno %d)", self.fileURL, self.bytesWritten, errno);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+-(BOOL) appendData:(NSData*)data {
+    if(_fd < 0) {
+        LogE(LOGTAG_DFW, @"DownloadFileWriter got data for %@ before it was opened!", self.fileURL);
+        return FALSE;
+    }
+
+    const char* bytes = data.bytes;
+    size_t remaining = data.length;
+    while(remaining > 0) {
+        ssize_t written = pwrite(_fd, bytes, remaining, (off_t)self.bytesWritten);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            LogE(LOGTAG_DFW, @"DownloadFileWriter write to %@ failed (errno %d)", self.fileURL, errno);
+            return FALSE;
+        }
+        bytes += written;
+        remaining -= written;
+        self.bytesWritten += written;
+    }
+    return TRUE;
+}
+
+-(NSData*) finishAndMap {
+    if(_fd >= 0) {
+        // Preallocation may have reserved more than we got (gzip, or a lying Content-Length):
+        ftruncate(_fd, (off_t)self.bytesWritten);
+        close(_fd);
+        _fd = -1;
+    }
+
+    // mmap won't map an empty file, but there's nothing to map anyway:
+    if(self.bytesWritten == 0) {
+        return [NSData data];
+    }
+
+    NSError* error = nil;
+    NSData* mapped = [NSData dataWithContentsOfURL:self.fileURL options:NSDataReadingMappedAlways error:&error];
+    if(mapped == nil) {
+        LogE(LOGTAG_DFW, @"DownloadFileWriter could not map %@: %@", self.fileURL, error);
+    }
+    return mapped;
+}
+
+-(void) discard {
+    if(_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    unlink([self.fileURL fileSystemRepresentation]);
+    self.bytesWritten = 0;
+}
+
+@end
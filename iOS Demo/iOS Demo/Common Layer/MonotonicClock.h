@@ -0,0 +1,37 @@
+//
+//  MonotonicClock.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Plain integer timestamps for timing calls.  [NSDate date] allocates an object every
+    time it's called, and it jumps whenever the user (or NTP) changes the wall clock, which
+    is the wrong thing for a timeout anyway.  A MonotonicTime is nanoseconds on
+    mach_absolute_time's clock: it only ever goes up, and it costs nothing to read or store.
+
+    Note that this clock doesn't run while the device is asleep.  That's what we want for
+    timeouts - a call doesn't time out because the phone was in a pocket - but don't use
+    it for anything that has to line up with the wall clock. */
+
+#import <Foundation/Foundation.h>
+
+// Nanoseconds.  Zero is never a real time, so it's safe to use for "not set".
+typedef UInt64 MonotonicTime;
+
+@interface MonotonicClock : NSObject
+
+// The current time.  Safe to call from any thread.
++(MonotonicTime) now;
+
+// end - start in seconds (negative if end is before start):
++(double) secondsFrom:(MonotonicTime)start to:(MonotonicTime)end;
+
+// Seconds since time, or 0.0 if time is zero:
++(double) secondsSince:(MonotonicTime)time;
+
+// The time that's seconds after time (seconds can be negative; the result stops at 1):
++(MonotonicTime) time:(MonotonicTime)time plusSeconds:(double)seconds;
+
+@end
@@ -0,0 +1,54 @@
+//
+//  MonotonicClock.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "MonotonicClock.h"
+#include <mach/mach_time.h>
+
+// mach_absolute_time ticks are 1ns on the simulator but not on devices, so we scale by
+// the timebase.  It never changes, so we only ask once:
+static mach_timebase_info_data_t s_timebase;
+
+@implementation MonotonicClock
+
++(void) initialize {
+    if(self == [MonotonicClock class]) {
+        mach_timebase_info(&s_timebase);
+    }
+}
+
++(MonotonicTime) now {
+    UInt64 ticks = mach_absolute_time();
+    if(s_timebase.numer == s_timebase.denom) return ticks;
+
+    // Split the multiply so it doesn't overflow for long uptimes:
+    UInt64 whole = ticks / s_timebase.denom;
+    UInt64 part  = ticks % s_timebase.denom;
+    return whole * s_timebase.numer + (part * s_timebase.numer) / s_timebase.denom;
+}
+
++(double) secondsFrom:(MonotonicTime)start to:(MonotonicTime)end {
+    if(end >= start) {
+        return (double)(end - start) / (double)NSEC_PER_SEC;
+    }
+    return -(double)(start - end) / (double)NSEC_PER_SEC;
+}
+
++(double) secondsSince:(MonotonicTime)time {
+    if(time == 0) return 0.0;
+    return [self secondsFrom:time to:[self now]];
+}
+
++(MonotonicTime) time:(MonotonicTime)time plusSeconds:(double)seconds {
+    double nanoseconds = seconds * (double)NSEC_PER_SEC;
+    if(nanoseconds < 0.0 && (double)time <= -nanoseconds) {
+        return 1;
+    }
+    return (MonotonicTime)((double)time + nanoseconds);
+}
+
+@end
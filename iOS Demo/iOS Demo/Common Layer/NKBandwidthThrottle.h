@@ -0,0 +1,89 @@
+//
+//  NKBandwidthThrottle.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Keeps LOW and BKG traffic from crowding out the calls the user is waiting on.  BKG's
+    quota of one call doesn't help much when that one call is a big download on a slow link:
+    it takes the whole pipe, and the HIGH and MEDIUM calls behind it wait.
+
+    NKNetworkManager feeds this what it sees on completed calls - the time to the response
+    header (our round trip time) and how fast the body came in (our throughput).  From that
+    it keeps a smoothed throughput, a smoothed RTT, and a baseline RTT (the best we've seen,
+    creeping up slowly so a change of network doesn't leave it stuck too low).
+
+    Throttled calls are metered through a token bucket counted in response bytes.  It only
+    applies while the link is contended: foreground (HIGH or MEDIUM) calls are active, or
+    the RTT has climbed well above baseline, which means something is queueing.  Then the
+    bucket fills at throttledShare of the estimated throughput, and a throttled call may
+    start only when the bucket holds about one call's worth of bytes.  The bytes it's
+    expected to take come out when it starts and are squared up with what it really took
+    when it ends, so the bucket can go into debt.  Once the link is quiet again the bucket
+    is kept full and throttled calls go out at full speed.
+
+    NSURLConnection has no way to slow down a transfer that's already going, so this works
+    by holding calls back, not by pacing bytes.  Keep big BKG bodies in reasonable chunks.
+
+    This class is thread-safe. */
+
+#import <Foundation/Foundation.h>
+#import "MonotonicClock.h"
+
+@interface NKBandwidthThrottle : NSObject
+
+-(NKBandwidthThrottle*) init;
+
+// Tuning.  Set these before starting calls:
+//    - enabled: FALSE turns the throttle off entirely (default TRUE).
+//    - throttledShare: the fraction of the estimated throughput left for throttled calls
+//          while the link is contended (default 0.25).
+//    - minBytesPerSecond: the bucket never fills slower than this, so throttled calls
+//          can't be starved completely, and it's the rate used before there's an estimate
+//          (default 8KB/s).
+//    - burstSeconds: the bucket holds this many seconds at the throttled rate (default 1.0).
+//    - rttInflationFactor and rttSlackSeconds: the link counts as contended when the
+//          smoothed RTT is above baseline * factor + slack (defaults 2.0 and 0.05s).
+//    - minSampleBytes: bodies smaller than this are mostly latency and don't go into the
+//          throughput estimate (default 8KB).
+@property (nonatomic) BOOL enabled;
+@property (nonatomic) double throttledShare;
+@property (nonatomic) double minBytesPerSecond;
+@property (nonatomic) double burstSeconds;
+@property (nonatomic) double rttInflationFactor;
+@property (nonatomic) double rttSlackSeconds;
+@property (nonatomic) NSUInteger minSampleBytes;
+
+
+// What NKNetworkManager has seen.  Each call's time to its response header is an RTT
+// sample; each finished body is a throughput sample.  Throttled calls also report every
+// attempt's body size, finished or not, with the charge they started with (see below).
+-(void) recordRTT:(double)seconds;
+-(void) recordTransferOfBytes:(NSUInteger)bytes seconds:(double)seconds;
+
+// Refills the bucket up to now and works out whether the link is contended.  The manager
+// calls this each time it services its queues.
+-(void) updateAtTime:(MonotonicTime)now foregroundActive:(BOOL)foregroundActive;
+
+// Asks to start a throttled call.  On TRUE, *charge is the number of bytes taken from the
+// bucket for it (zero if nothing is being throttled right now).  Hand it back to
+// settleCharge:actualBytes:completed: when the attempt ends, however it ends.
+-(BOOL) mayStartThrottledCall:(double*)charge;
+-(void) settleCharge:(double)charge actualBytes:(NSUInteger)actualBytes completed:(BOOL)completed;
+
+
+// The current estimates.  Zero means there's no sample yet:
+@property (atomic, readonly) double estimatedBytesPerSecond;
+@property (atomic, readonly) double estimatedRTTSeconds;
+@property (atomic, readonly) double baselineRTTSeconds;
+@property (atomic, readonly) double expectedCallBytes;     // a typical throttled body
+
+// And what it's doing about them:
+@property (atomic, readonly) BOOL   throttling;
+@property (atomic, readonly) double throttledBytesPerSecond;
+@property (atomic, readonly) double availableBytes;        // negative when in debt
+@property (atomic, readonly) UInt64 numCallsHeld;          // times mayStartThrottledCall: said no
+
+@end
@@ -0,0 +1,151 @@
+//
+//  NKBandwidthThrottle.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKBandwidthThrottle.h"
+#import "Logging.h"
+
+NSString* const LOGTAG_NKBT = @"network";
+
+// How much each new sample moves a smoothed estimate, and how far a higher RTT sample
+// pulls the baseline up toward it:
+#define kSampleWeight   0.2
+#define kBaselineCreep  0.01
+
+
+@interface NKBandwidthThrottle ()
+
+@property (atomic, readwrite) double estimatedBytesPerSecond;
+@property (atomic, readwrite) double estimatedRTTSeconds;
+@property (atomic, readwrite) double baselineRTTSeconds;
+@property (atomic, readwrite) double expectedCallBytes;
+
+@property (atomic, readwrite) BOOL   throttling;
+@property (atomic, readwrite) double throttledBytesPerSecond;
+@property (atomic, readwrite) double availableBytes;
+@property (atomic, readwrite) UInt64 numCallsHeld;
+
+// When the bucket was last filled (0 before the first update):
+@property (nonatomic) MonotonicTime lastUpdate;
+
+@end
+
+
+@implementation NKBandwidthThrottle
+
+-(NKBandwidthThrottle*) init {
+    if(self = [super init]) {
+        self.enabled = TRUE;
+        self.throttledShare = 0.25;
+        self.minBytesPerSecond = 8192.0;
+        self.burstSeconds = 1.0;
+        self.rttInflationFactor = 2.0;
+        self.rttSlackSeconds = 0.05;
+        self.minSampleBytes = 8192;
+
+        self.estimatedBytesPerSecond = 0.0;
+        self.estimatedRTTSeconds = 0.0;
+        self.baselineRTTSeconds = 0.0;
+        self.expectedCallBytes = 0.0;
+        self.throttling = FALSE;
+        self.throttledBytesPerSecond = self.minBytesPerSecond;
+        self.availableBytes = self.minBytesPerSecond * self.burstSeconds;
+        self.numCallsHeld = 0;
+        self.lastUpdate = 0;
+    }
+    return self;
+}
+
+
+#pragma mark Samples
+
+-(void) recordRTT:(double)seconds {
+    if(seconds <= 0.0) return;
+    @synchronized (self) {
+        double estimate = self.estimatedRTTSeconds;
+        self.estimatedRTTSeconds = (estimate == 0.0) ? seconds : estimate + kSampleWeight * (seconds - estimate);
+
+        double baseline = self.baselineRTTSeconds;
+        self.baselineRTTSeconds = (baseline == 0.0 || seconds < baseline) ? seconds : baseline + kBaselineCreep * (seconds - baseline);
+    }
+}
+
+-(void) recordTransferOfBytes:(NSUInteger)bytes seconds:(double)seconds {
+    if(bytes < self.minSampleBytes || seconds <= 0.0) return;
+    double sample = (double)bytes / seconds;
+    @synchronized (self) {
+        double estimate = self.estimatedBytesPerSecond;
+        self.estimatedBytesPerSecond = (estimate == 0.0) ? sample : estimate + kSampleWeight * (sample - estimate);
+    }
+}
+
+
+#pragma mark The bucket
+
+-(void) updateAtTime:(MonotonicTime)now foregroundActive:(BOOL)foregroundActive {
+    @synchronized (self) {
+        double rate = MAX(self.minBytesPerSecond, self.throttledShare * self.estimatedBytesPerSecond);
+        double capacity = rate * MAX(self.burstSeconds, 0.0);
+
+        double available = self.availableBytes;
+        if(self.lastUpdate != 0 && now > self.lastUpdate) {
+            available += rate * [MonotonicClock secondsFrom:self.lastUpdate to:now];
+        }
+        self.lastUpdate = now;
+
+        double rtt = self.estimatedRTTSeconds;
+        double baseline = self.baselineRTTSeconds;
+        BOOL rttInflated = (rtt > 0.0 && baseline > 0.0 && rtt > baseline * self.rttInflationFactor + self.rttSlackSeconds);
+
+        BOOL throttling = self.enabled && (foregroundActive || rttInflated);
+        if(throttling != self.throttling) {
+            LogD(LOGTAG_NKBT, @"%@ throttling LOW/BKG calls (foreground %d, RTT %.3lfs vs baseline %.3lfs, %.0lf bytes/s)",
+                 throttling ? @"Started" : @"Stopped", foregroundActive, rtt, baseline, rate);
+        }
+        self.throttling = throttling;
+        self.throttledBytesPerSecond = rate;
+
+        // A quiet link means full speed, and a full bucket for the next time it isn't:
+        if(!throttling || available > capacity) {
+            available = capacity;
+        }
+        self.availableBytes = available;
+    }
+}
+
+// The bucket has to hold about one typical call's worth (but no more than it can ever hold),
+// which also means it has to be out of debt:
+-(BOOL) mayStartThrottledCall:(double*)charge {
+    @synchronized (self) {
+        double cost = 0.0;
+        if(self.throttling) {
+            double capacity = self.throttledBytesPerSecond * MAX(self.burstSeconds, 0.0);
+            if(self.availableBytes < MIN(self.expectedCallBytes, capacity)) {
+                self.numCallsHeld++;
+                return FALSE;
+            }
+            cost = self.expectedCallBytes;
+            self.availableBytes -= cost;
+        }
+        if(charge != NULL) *charge = cost;
+        return TRUE;
+    }
+}
+
+-(void) settleCharge:(double)charge actualBytes:(NSUInteger)actualBytes completed:(BOOL)completed {
+    @synchronized (self) {
+        // A call that went out before throttling started still used the link, so its bytes
+        // count too.  If nothing's being throttled, the next update fills the bucket anyway.
+        self.availableBytes += charge - (double)actualBytes;
+        if(completed) {
+            double expected = self.expectedCallBytes;
+            self.expectedCallBytes = (expected == 0.0) ? (double)actualBytes : expected + kSampleWeight * ((double)actualBytes - expected);
+        }
+    }
+}
+
+@end
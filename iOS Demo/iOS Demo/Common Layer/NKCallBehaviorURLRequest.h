@@ -55,7 +55,10 @@ typedef enum {
     NKRetryDelayPolicyLogarithmicDelay,
 } NKRetryDelayPolicy;
 
-// Options for how retries are handled if there's been a redirect:
+// Options for how retries are handled if there's been a redirect.  RetryFromTopURL starts
+// every retry at the request's URL.  StoreRedirectStack starts a retry at the last URL this
+// call was redirected to, temporary redirects included.  Either way, permanent (301/308)
+// redirects are remembered across calls by the network manager.
 typedef enum {
     NKRedirectRetryPolicyRetryFromTopURL,
     NKRedirectRetryPolicyStoreRedirectStack,
@@ -68,6 +71,19 @@ typedef enum {
 // this call?  Defaults to NKCallPriorityMedium.
 @property (nonatomic) NKCallPriority priority;
 
+// The latest the call is any use.  Within a priority, waiting calls go out earliest
+// deadline first (calls without one go after those with one, in the order they were
+// started), and a call still waiting when its deadline passes - for its first attempt or
+// a retry - is dropped and fails with NetworkManagerErrorDeadlineMissed.  A call that's
+// already on the wire is left to finish.  Defaults to nil (no deadline).
+@property (nonatomic, retain) NSDate* deadline;
+
+// Which call group this call belongs to.  Any object will do as the token - calls are in
+// the same group if their tokens are isEqual: - so make one per screen or task (a fresh
+// NSObject, or a name) and you can cancel, pause or reprioritize all of its calls at once
+// with NKNetworkManager's ...CallsInGroup: methods.  Defaults to nil (no group).
+@property (nonatomic, retain) id callGroup;
+
 // On which thread is the call run within the system?
 // Defaults to [NSThread mainThread] if nil.
 @property (nonatomic, retain) NSThread* callbackThread;
@@ -86,6 +102,21 @@ typedef enum {
 // overlay on NSURLRequestCachePolicy.  Defaults to FALSE.
 @property (nonatomic) BOOL allowCachedResponses;
 
+// Download-to-file.  When downloadToFile is TRUE, the body is written to a file as it
+// arrives instead of being held in memory, and the delegate gets a read-only memory-mapped
+// NSData in didSucceed (plus the file URL in didSaveFile, if it implements it).  Use this
+// for anything big.  If downloadFileURL is nil, a unique file in NSTemporaryDirectory()
+// is used.  Either way the file belongs to the delegate once the call succeeds; on
+// failure or cancel, it's deleted.  Defaults to FALSE and nil.
+@property (nonatomic) BOOL   downloadToFile;
+@property (nonatomic, retain) NSURL* downloadFileURL;
+
+// Opts a POST, PUT or DELETE into DemoNetworkManager's outbox (see NKRequestOutbox).  If
+// the call fails with NetworkManagerErrorNoConnection and the manager has an outbox, the
+// request is queued there to be sent later, and the delegate gets didFail with
+// NetworkManagerErrorQueued instead.  Defaults to FALSE.
+@property (nonatomic) BOOL queueWhenOffline;
+
 // Default and copy constructors:
 -(NKCallBehaviorURLRequest*) init;
 -(NKCallBehaviorURLRequest*) init:(NKCallBehaviorURLRequest*)base;
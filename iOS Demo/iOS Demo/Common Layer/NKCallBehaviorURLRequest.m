@@ -13,6 +13,8 @@
 -(NKCallBehaviorURLRequest*) init {
     if(self = [super init]) {
         self.priority = NKCallPriorityMedium;
+        self.deadline = nil;
+        self.callGroup = nil;
         self.callbackThread = nil;
         self.acceptGzip = TRUE;
         self.timeoutSeconds = 8.0;
@@ -21,12 +23,17 @@
         self.retryDelayPolicy = NKRetryDelayPolicyFixedInterval;
         self.redirectRetryPolicy = NKRedirectRetryPolicyRetryFromTopURL;
         self.allowCachedResponses = FALSE;
+        self.downloadToFile = FALSE;
+        self.downloadFileURL = nil;
+        self.queueWhenOffline = FALSE;
     }
     return self;
 }
 -(NKCallBehaviorURLRequest*) init:(NKCallBehaviorURLRequest*)base {
     if(self = [super init]) {
         self.priority = base.priority;
+        self.deadline = base.deadline;
+        self.callGroup = base.callGroup;
         self.callbackThread = base.callbackThread;
         self.acceptGzip = base.acceptGzip;
         self.timeoutSeconds = base.timeoutSeconds;
@@ -35,6 +42,9 @@
         self.retryDelayPolicy = base.retryDelayPolicy;
         self.redirectRetryPolicy = base.redirectRetryPolicy;
         self.allowCachedResponses = base.allowCachedResponses;
+        self.downloadToFile = base.downloadToFile;
+        self.downloadFileURL = base.downloadFileURL;
+        self.queueWhenOffline = base.queueWhenOffline;
     }
     return self;
 }
@@ -0,0 +1,76 @@
+//
+//  NKNetworkCall.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** NKNetworkManager's record of one call, from startNetworkCall: until its last callback.
+    It's the delegate for the call's connection and passes the callbacks straight through
+    to the manager, the same way NetworkCall does for DemoNetworkManager.  Everything here
+    belongs to the manager and is only touched under its lock. */
+
+#import <Foundation/Foundation.h>
+#import "AbstractNetworkManager.h"
+#import "NKCallBehaviorURLRequest.h"
+#import "MonotonicClock.h"
+#import "DownloadFileWriter.h"
+@class NKNetworkManager;
+
+@interface NKNetworkCall : NSObject <NSURLConnectionDataDelegate>
+
+-(NKNetworkCall*) initWithManager:(NKNetworkManager*)manager request:(NKCallBehaviorURLRequest*)request
+                         delegate:(id<NetworkManagerDelegate>)delegate context:(id)context;
+
+// Remember to hold the manager as a weak reference!
+@property (nonatomic, weak)   NKNetworkManager* manager;
+
+@property (nonatomic, retain) NKCallBehaviorURLRequest* request;
+@property (nonatomic, weak)   id<NetworkManagerDelegate> delegate;
+@property (nonatomic, retain) id context;
+
+// Where the call sits in the queues.  These start out as the request's priority and
+// deadline, but the manager can move the call while it's waiting.  sequenceNumber
+// breaks ties, so calls with the same deadline go in the order they were started.
+@property (nonatomic) NKCallPriority priority;
+@property (nonatomic, retain) NSDate* deadline;
+@property (nonatomic) UInt64 sequenceNumber;
+
+// A call that's waiting to retry isn't sent before this (0 for first attempts):
+@property (nonatomic) MonotonicTime notBefore;
+
+// The request's call group, and whether the group is paused.  A paused call stays in the
+// waiting queue but isn't sent until it's resumed:
+@property (nonatomic, retain) id callGroup;
+@property (nonatomic) BOOL paused;
+
+// The attempt in flight, if there is one:
+@property (nonatomic, retain) NSURLConnection* connection;
+@property (nonatomic) MonotonicTime timeAttemptStarted;
+@property (nonatomic) MonotonicTime timeResponseReceived;
+@property (nonatomic) int httpStatus;
+@property (nonatomic, retain) NSMutableData* data;
+
+// For a downloadToFile request, the file a successful response's body goes into instead of
+// data (an error response's body still goes into data, for didFail).  A failed write is
+// noted and turned into a failure when the attempt finishes:
+@property (nonatomic, retain) DownloadFileWriter* fileWriter;
+@property (nonatomic) BOOL fileWriteFailed;
+
+// The file handed off in the success callback.  If the call's canceled before that goes
+// out, the file is deleted instead:
+@property (nonatomic, retain) NSURL* savedFileURL;
+
+@property (nonatomic) unsigned numRetries;
+
+// Set when the call is canceled.  Callbacks already queued for it check this before
+// they're delivered:
+@property (nonatomic) BOOL canceled;
+
+// Whether the attempt in flight went out through the manager's bandwidth throttle, and
+// the bytes it was charged for (see NKBandwidthThrottle):
+@property (nonatomic) BOOL throttled;
+@property (nonatomic) double throttleCharge;
+
+@end
@@ -0,0 +1,64 @@
+//
+//  NKNetworkCall.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKNetworkCall.h"
+#import "NKNetworkManager.h"
+
+@implementation NKNetworkCall
+
+-(NKNetworkCall*) initWithManager:(NKNetworkManager*)manager request:(NKCallBehaviorURLRequest*)request
+                         delegate:(id<NetworkManagerDelegate>)delegate context:(id)context {
+    if(self = [super init]) {
+        self.manager = manager;
+        self.request = request;
+        self.delegate = delegate;
+        self.context = context;
+        self.priority = request.priority;
+        self.deadline = request.deadline;
+        self.sequenceNumber = 0;
+        self.notBefore = 0;
+        self.callGroup = request.callGroup;
+        self.paused = FALSE;
+        self.connection = nil;
+        self.timeAttemptStarted = 0;
+        self.timeResponseReceived = 0;
+        self.httpStatus = -1;
+        self.data = nil;
+        self.fileWriter = nil;
+        self.fileWriteFailed = FALSE;
+        self.savedFileURL = nil;
+        self.numRetries = 0;
+        self.canceled = FALSE;
+        self.throttled = FALSE;
+        self.throttleCharge = 0.0;
+    }
+    return self;
+}
+
+
+#pragma mark - NSURLConnectionDataDelegate
+
+// The manager checks that the connection is still this call's current one, so late
+// callbacks from a canceled attempt are ignored.
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+    [self.manager networkCall:self connection:connection didReceiveResponse:response];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+    [self.manager networkCall:self connection:connection didReceiveData:data];
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+    [self.manager networkCall:self connectionDidFinishLoading:connection];
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+    [self.manager networkCall:self connection:connection didFailWithError:error];
+}
+
+@end
@@ -16,6 +16,9 @@
 #import "AbstractNetworkManager.h"
 #import "NKCallBehaviorURLRequest.h"
 #import "NKURLConnectionBridge.h"
+#import "NKTrafficRecorder.h"
+#import "NKBandwidthThrottle.h"
+@class NKNetworkCall;
 
 @interface NKNetworkManager : NSObject <AbstractNetworkManager>
 
@@ -24,6 +27,11 @@
 // that can be a factory for dummy connection objects.
 -(NKNetworkManager*) initWithConnectionBridge:(id<NKURLConnectionBridge>)bridge;
 
+// Records every connection from now on to the given recorder, by wrapping the connection
+// bridge in an NKRecordingURLConnectionBridge.  stopRecordingTraffic unwraps it again.
+-(void) startRecordingTraffic:(NKTrafficRecorder*)recorder;
+-(void) stopRecordingTraffic;
+
 // This property holds the default NKCallBehaviorURLRequest for this network manager.
 // You can modify it to change the ways the network manager will handle calls by default.
 // The buildURLRequest: method returns a copy of this, modified with requestType and urlString.
@@ -62,6 +70,49 @@
              withContext:(id)context;
 
 
+// Moves calls for this delegate and context that are still waiting to go out to another
+// priority - say, a BKG thumbnail that just scrolled into view.  They take their place in
+// the new priority's queue by deadline like any other call.  Calls already in flight keep
+// the priority they went out with.  Returns FALSE if no waiting call matched.
+-(BOOL) setPriority:(NKCallPriority)priority forDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context;
+
+// Same, for the deadline (see NKCallBehaviorURLRequest).  Pass nil to clear it.
+-(BOOL) setDeadline:(NSDate*)deadline forDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context;
+
+// Call groups: everything with the given callGroup (see NKCallBehaviorURLRequest), waiting
+// or in flight, in one go.  Use these when the user leaves a screen (cancel), when its
+// calls can wait a bit (pause, then resume), or when it comes back to the front (priority).
+//    - cancel forgets the calls.  No more callbacks come for them.
+//    - pause holds waiting calls in their queues and stops calls in flight, putting them
+//          back in the queue to start over (without using up a retry) once resumed.  A
+//          paused call can still miss its deadline.
+//    - setPriority moves waiting calls to the new priority's queue and counts calls in
+//          flight against the new priority's quota from now on.
+// Each returns the number of calls it touched.
+-(NSUInteger) cancelCallsInGroup:(id)group;
+-(NSUInteger) pauseCallsInGroup:(id)group;
+-(NSUInteger) resumeCallsInGroup:(id)group;
+-(NSUInteger) setPriority:(NKCallPriority)priority forCallsInGroup:(id)group;
+
+// What's in the queues right now, and how many calls have been dropped for missing
+// their deadlines:
+-(NSUInteger) numCallsWaitingWithPriority:(NKCallPriority)priority;
+-(NSUInteger) numCallsInFlightWithPriority:(NKCallPriority)priority;
+@property (atomic, readonly) UInt64 totalCallsDroppedPastDeadline;
+
+// Meters LOW and BKG calls while HIGH or MEDIUM calls are active or the link looks
+// congested, from the throughput and RTT of the calls that came before (see
+// NKBandwidthThrottle).  Tune it, turn it off, or read its estimates here.
+@property (nonatomic, readonly) NKBandwidthThrottle* bandwidthThrottle;
+
+
+// Methods for NKNetworkCall to call (see NKNetworkCall.h):
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response;
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didReceiveData:(NSData*)data;
+-(void) networkCall:(NKNetworkCall*)call connectionDidFinishLoading:(NSURLConnection*)connection;
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didFailWithError:(NSError*)error;
+
+
 // This is wired to return FALSE because NKNetworkManager does not support this kind of
 // testing.  Instead see the other test cases for NKNetworkManager.
 -(BOOL) overrideTestingURLConnectionClass:(Class)testingURLConnectionClass;
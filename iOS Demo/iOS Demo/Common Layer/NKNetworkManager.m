@@ -7,7 +7,9 @@
 //
 
 #import "NKNetworkManager.h"
+#import "NKNetworkCall.h"
 #import "NKCallBehaviorURLRequest.h"
+#import "NKRecordingURLConnectionBridge.h"
 #import "WeakTargetTimer.h"
 #import "Logging.h"
 #import "SharedThreadPool.h"
@@ -24,18 +26,36 @@
     // This set holds an NSMutableSet for each level of call priority.
     NSMutableSet* _callsInFlight[NK_NUM_CALL_PRIORITIES];
 
-    // This array holds an NSMutableArray for each level of call priority.
-    NSMutableSet* _callsWaiting[NK_NUM_CALL_PRIORITIES];
+    // This array holds an NSMutableArray for each level of call priority.  Each one is
+    // kept in the order its calls go out: earliest deadline first, then first come first
+    // served (see compareWaitingCalls).
+    NSMutableArray* _callsWaiting[NK_NUM_CALL_PRIORITIES];
     
     // This NSMapTable is the master endpoint for all delegation checks.
     // It's easy to look up by delegate (and the delegates are held weakly!)
+    // Each value is an NSMutableArray of that delegate's NKNetworkCalls.
     NSMapTable*   _callsByDelegate;
+    
+    // Calls with callbacks on their way to the delegate's thread, counted once per
+    // callback.  A call that finished is already untracked, but canceling it still has to
+    // stop the callback that's queued for it:
+    NSCountedSet* _callsAwaitingCallbacks;
+    
+    // Handed out to calls as they start, to keep equal deadlines in order:
+    UInt64 _nextSequenceNumber;
 }
 
 // Properties that are basic to the operation of this object:
 @property (nonatomic, retain) NSObject* lock;
 @property (nonatomic, retain) id<NKURLConnectionBridge> bridge;
 
+// Connections are started and called back on this thread:
+@property (nonatomic, retain) NSThread* networkThread;
+@property (nonatomic) BOOL serviceQueuesScheduled;
+
+@property (atomic) UInt64 totalCallsDroppedPastDeadline;
+@property (nonatomic, readwrite) NKBandwidthThrottle* bandwidthThrottle;
+
 
 // The maintenance timer runs on the global NKNetworkManager thread.
 @property (nonatomic, retain) WeakTargetTimer*  maintenanceTimer;
@@ -43,6 +63,20 @@
 @end
 
 
+// The order calls go out in within a priority.  No deadline sorts after every deadline:
+static NSComparisonResult compareWaitingCalls(NKNetworkCall* a, NKNetworkCall* b) {
+    NSTimeInterval deadlineA = (a.deadline != nil) ? [a.deadline timeIntervalSinceReferenceDate] : DBL_MAX;
+    NSTimeInterval deadlineB = (b.deadline != nil) ? [b.deadline timeIntervalSinceReferenceDate] : DBL_MAX;
+    if(deadlineA != deadlineB) {
+        return (deadlineA < deadlineB) ? NSOrderedAscending : NSOrderedDescending;
+    }
+    if(a.sequenceNumber != b.sequenceNumber) {
+        return (a.sequenceNumber < b.sequenceNumber) ? NSOrderedAscending : NSOrderedDescending;
+    }
+    return NSOrderedSame;
+}
+
+
 @implementation NKNetworkManager
 
 #pragma mark - Lifecycle methods
@@ -58,17 +92,26 @@
         LOGTAG = @"NKNetworkManager";
         self.lock = [[NSObject alloc] init];
         self.bridge = bridge;
+        self.defaultCallBehavior = [[NKCallBehaviorURLRequest alloc] init];
         
         // Set up the three internal private vars: _callsInFlight, _callsWaiting, and _callsByDelegate:
-        _callsByDelegate = [[NSMapTable alloc] initWithKeyOptions:NSMapTableWeakMemory valueOptions:NSMapTableWeakMemory capacity:20];
+        _callsByDelegate = [[NSMapTable alloc] initWithKeyOptions:NSMapTableWeakMemory valueOptions:NSMapTableStrongMemory capacity:20];
+        _callsAwaitingCallbacks = [[NSCountedSet alloc] init];
         for(NSUInteger i = 0; i < NK_NUM_CALL_PRIORITIES; i++) {
             _callsInFlight[i] = [[NSMutableSet alloc] initWithCapacity:NKCallQuotasByPriority[i]];
-            _callsWaiting [i] = [[NSMutableSet alloc] initWithCapacity:10];
+            _callsWaiting [i] = [[NSMutableArray alloc] initWithCapacity:10];
         }
+        _nextSequenceNumber = 0;
+        self.serviceQueuesScheduled = FALSE;
+        self.totalCallsDroppedPastDeadline = 0;
+        self.bandwidthThrottle = [[NKBandwidthThrottle alloc] init];
         
-        // Start the maintenance timer - we do this by performing the selector to schedule the timer on the common thread:
-        [self performSelector:@selector(scheduleMaintenanceTimer) onThread:[[SharedThreadPool singleton] subscribeToThreadWithIdentifer:nil]
-                   withObject:nil waitUntilDone:FALSE modes:@[NSRunLoopCommonModes]];
+        // Start the maintenance timer - we do this by scheduling the timer on the common thread.
+        // Everything we send to the thread goes by way of the pool, so it shows up in its metrics:
+        self.networkThread = [[SharedThreadPool singleton] subscribeToThreadWithIdentifer:nil];
+        [[SharedThreadPool singleton] performBlock:^{
+            [self scheduleMaintenanceTimer];
+        } onThread:self.networkThread];
         
         [[SharedThreadPool singleton] pinThread:YES withIdentifier:nil];
 
@@ -84,14 +127,39 @@
     LogD(LOGTAG, @"NKNetworkManager started timer on thread %@", [NSThread currentThread].name);
 }
 
-// This is fired every kMaintenanceTimerInterval seconds.
+// This is fired every kMaintenanceTimerInterval seconds.  It times out attempts that have
+// taken too long, and services the queues so that retry delays and deadlines are noticed
+// even when nothing else is happening.
 -(void) maintenanceTimerFired {
-
+    NSMutableArray* timedOutCalls = [[NSMutableArray alloc] init];
+    @synchronized (self.lock) {
+        for(NSUInteger p = 0; p < NK_NUM_CALL_PRIORITIES; p++) {
+            for(NKNetworkCall* call in [_callsInFlight[p] copy]) {
+                double timeout = call.request.timeoutSeconds;
+                if(timeout > 0.0 && [MonotonicClock secondsSince:call.timeAttemptStarted] > timeout) {
+                    LogD(LOGTAG, @"Attempt to %@ timed out after %.1lfs", call.request.URL, timeout);
+                    if(![self retryOrUnTrackCall:call]) {
+                        [timedOutCalls addObject:call];
+                    }
+                }
+            }
+        }
+    }
+    
+    for(NKNetworkCall* call in timedOutCalls) {
+        [self makeFailureCallback:call error:NetworkManagerErrorTimedOut httpStatus:-1];
+    }
+    [self serviceQueues];
 }
 
-// In dealloc, make sure to invalidate the timer.
+// In dealloc, make sure to invalidate the timer.  Anything still in flight is canceled.
 -(void) dealloc {
     [self.maintenanceTimer invalidate];
+    for(NSUInteger p = 0; p < NK_NUM_CALL_PRIORITIES; p++) {
+        for(NKNetworkCall* call in _callsInFlight[p]) {
+            [self.bridge cancelConnection:call.connection];
+        }
+    }
     [[SharedThreadPool singleton] unsubscribeThreadWithIdentifier:nil];
 }
 
@@ -128,6 +196,22 @@
 }
 
 
+-(void) startRecordingTraffic:(NKTrafficRecorder*)recorder {
+    @synchronized (self.lock) {
+        [self stopRecordingTraffic];
+        self.bridge = [[NKRecordingURLConnectionBridge alloc] initWithBridge:self.bridge recorder:recorder];
+    }
+}
+
+-(void) stopRecordingTraffic {
+    @synchronized (self.lock) {
+        if([self.bridge isKindOfClass:[NKRecordingURLConnectionBridge class]]) {
+            self.bridge = ((NKRecordingURLConnectionBridge*)self.bridge).wrappedBridge;
+        }
+    }
+}
+
+
 // I'm overriding the accessors for defaultCallBehavior instead of just making
 // them "atomic" properties because I want to guarantee that this will lock on
 // self.lock when you try to set it.  Atomic just makes the accesses atomic to
@@ -161,21 +245,73 @@
     [self startNetworkCall:request withDelegate:delegate withContext:context];
 }
 
+// No more callbacks come for a canceled call: waiting, in flight, or finished with its
+// callback not delivered yet.
 -(void) cancelForDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context {
+    if(delegate == nil) return;
     
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [[_callsByDelegate objectForKey:delegate] copy]) {
+            if(call.context == context) {
+                [self cancelCall:call];
+            }
+        }
+        for(NKNetworkCall* call in _callsAwaitingCallbacks) {
+            if(call.delegate == delegate && call.context == context) {
+                call.canceled = TRUE;
+            }
+        }
+    }
+    [self scheduleServiceQueues];
 }
 
 
 
 // Call this method to start a network call if you are going to set all the options
 // on the NKCallBehaviorURLRequest object instead of using the older startNetworkCall method below.
+// The call goes into the waiting queue for its priority and is sent from the network
+// thread when the quota allows.
 -(void) startNetworkCall:(NKCallBehaviorURLRequest*)request
             withDelegate:(id<NetworkManagerDelegate>)delegate
              withContext:(id)context {
+    NKNetworkCall* call = [[NKNetworkCall alloc] initWithManager:self request:request delegate:delegate context:context];
+    
+    // The sending code sets this to a value other than NoError if we should call back "failure" immediately.
+    NetworkManagerError earlyCallbackError = NetworkManagerErrorNoError;
+    if(request.URL == nil || call.priority >= NK_NUM_CALL_PRIORITIES) {
+        earlyCallbackError = NetworkManagerErrorBadRequest;
+    } else if(call.deadline != nil && [call.deadline timeIntervalSinceNow] <= 0.0) {
+        earlyCallbackError = NetworkManagerErrorDeadlineMissed;
+    }
+    
+    if(earlyCallbackError != NetworkManagerErrorNoError) {
+        LogD(LOGTAG, @"Not starting call to %@ (error %d)", request.URL, earlyCallbackError);
+        if(earlyCallbackError == NetworkManagerErrorDeadlineMissed) {
+            @synchronized (self.lock) {
+                self.totalCallsDroppedPastDeadline++;
+            }
+        }
+        [self makeFailureCallback:call error:earlyCallbackError httpStatus:-1];
+        return;
+    }
+    
     @synchronized (self.lock) {
-        
-        
+        call.sequenceNumber = _nextSequenceNumber++;
+        [self insertWaitingCall:call];
+        if(delegate != nil) {
+            NSMutableArray* delegateCalls = [_callsByDelegate objectForKey:delegate];
+            if(delegateCalls == nil) {
+                delegateCalls = [[NSMutableArray alloc] init];
+                [_callsByDelegate setObject:delegateCalls forKey:delegate];
+            }
+            [delegateCalls addObject:call];
+        }
     }
+    
+    if([delegate respondsToSelector:@selector(networkManager:didStartCall:)]) {
+        [delegate networkManager:self didStartCall:context];
+    }
+    [self scheduleServiceQueues];
 }
 
 
@@ -209,4 +345,564 @@
 }
 
 
+#pragma mark - Reprioritizing waiting calls
+
+-(BOOL) setPriority:(NKCallPriority)priority forDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context {
+    if(priority >= NK_NUM_CALL_PRIORITIES) return FALSE;
+    
+    BOOL moved = FALSE;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self waitingCallsForDelegate:delegate context:context]) {
+            [_callsWaiting[call.priority] removeObjectIdenticalTo:call];
+            call.priority = priority;
+            [self insertWaitingCall:call];
+            moved = TRUE;
+        }
+    }
+    if(moved) {
+        [self scheduleServiceQueues];
+    }
+    return moved;
+}
+
+-(BOOL) setDeadline:(NSDate*)deadline forDelegate:(id<NetworkManagerDelegate>)delegate withContext:(id)context {
+    BOOL moved = FALSE;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self waitingCallsForDelegate:delegate context:context]) {
+            [_callsWaiting[call.priority] removeObjectIdenticalTo:call];
+            call.deadline = deadline;
+            [self insertWaitingCall:call];
+            moved = TRUE;
+        }
+    }
+    if(moved) {
+        [self scheduleServiceQueues];
+    }
+    return moved;
+}
+
+#pragma mark - Call groups
+
+-(NSUInteger) cancelCallsInGroup:(id)group {
+    NSUInteger numCalls = 0;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self callsInGroup:group]) {
+            [self cancelCall:call];
+            numCalls++;
+        }
+        for(NKNetworkCall* call in _callsAwaitingCallbacks) {
+            if([call.callGroup isEqual:group]) {
+                call.canceled = TRUE;
+            }
+        }
+    }
+    if(numCalls > 0) {
+        LogD(LOGTAG, @"Canceled %lu calls in group %@", (unsigned long)numCalls, group);
+        [self scheduleServiceQueues];
+    }
+    return numCalls;
+}
+
+-(NSUInteger) pauseCallsInGroup:(id)group {
+    NSUInteger numCalls = 0;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self callsInGroup:group]) {
+            if(call.paused) continue;
+            call.paused = TRUE;
+            numCalls++;
+            
+            // Stop the attempt on the wire and put the call back in line.  It's not the
+            // call's fault, so it doesn't count as a retry:
+            if(call.connection != nil) {
+                [self.bridge cancelConnection:call.connection];
+                call.connection = nil;
+                [self settleThrottleForCall:call completed:FALSE];
+                [_callsInFlight[call.priority] removeObject:call];
+                [self insertWaitingCall:call];
+            }
+        }
+    }
+    if(numCalls > 0) {
+        LogD(LOGTAG, @"Paused %lu calls in group %@", (unsigned long)numCalls, group);
+        [self scheduleServiceQueues];
+    }
+    return numCalls;
+}
+
+-(NSUInteger) resumeCallsInGroup:(id)group {
+    NSUInteger numCalls = 0;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self callsInGroup:group]) {
+            if(!call.paused) continue;
+            call.paused = FALSE;
+            numCalls++;
+        }
+    }
+    if(numCalls > 0) {
+        [self scheduleServiceQueues];
+    }
+    return numCalls;
+}
+
+-(NSUInteger) setPriority:(NKCallPriority)priority forCallsInGroup:(id)group {
+    if(priority >= NK_NUM_CALL_PRIORITIES) return 0;
+    
+    NSUInteger numCalls = 0;
+    @synchronized (self.lock) {
+        for(NKNetworkCall* call in [self callsInGroup:group]) {
+            if(call.priority == priority) continue;
+            numCalls++;
+            
+            if(call.connection != nil) {
+                [_callsInFlight[call.priority] removeObject:call];
+                call.priority = priority;
+                [_callsInFlight[priority] addObject:call];
+            } else {
+                [_callsWaiting[call.priority] removeObjectIdenticalTo:call];
+                call.priority = priority;
+                [self insertWaitingCall:call];
+            }
+        }
+    }
+    if(numCalls > 0) {
+        [self scheduleServiceQueues];
+    }
+    return numCalls;
+}
+
+
+-(NSUInteger) numCallsWaitingWithPriority:(NKCallPriority)priority {
+    if(priority >= NK_NUM_CALL_PRIORITIES) return 0;
+    @synchronized (self.lock) {
+        return _callsWaiting[priority].count;
+    }
+}
+
+-(NSUInteger) numCallsInFlightWithPriority:(NKCallPriority)priority {
+    if(priority >= NK_NUM_CALL_PRIORITIES) return 0;
+    @synchronized (self.lock) {
+        return _callsInFlight[priority].count;
+    }
+}
+
+
+#pragma mark - Queue helpers
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Every call in the group, waiting or in flight:
+-(NSArray*) callsInGroup:(id)group {
+    NSMutableArray* calls = [[NSMutableArray alloc] init];
+    if(group == nil) return calls;
+    
+    for(NSUInteger p = 0; p < NK_NUM_CALL_PRIORITIES; p++) {
+        for(NKNetworkCall* call in _callsWaiting[p]) {
+            if([call.callGroup isEqual:group]) [calls addObject:call];
+        }
+        for(NKNetworkCall* call in _callsInFlight[p]) {
+            if([call.callGroup isEqual:group]) [calls addObject:call];
+        }
+    }
+    return calls;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(NSArray*) waitingCallsForDelegate:(id<NetworkManagerDelegate>)delegate context:(id)context {
+    NSMutableArray* calls = [[NSMutableArray alloc] init];
+    if(delegate == nil) return calls;
+    
+    for(NKNetworkCall* call in [_callsByDelegate objectForKey:delegate]) {
+        if(call.context == context && [_callsWaiting[call.priority] indexOfObjectIdenticalTo:call] != NSNotFound) {
+            [calls addObject:call];
+        }
+    }
+    return calls;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) insertWaitingCall:(NKNetworkCall*)call {
+    NSMutableArray* queue = _callsWaiting[call.priority];
+    NSUInteger index = [queue indexOfObject:call inSortedRange:NSMakeRange(0, queue.count)
+                                    options:NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual
+                            usingComparator:^NSComparisonResult(id a, id b) {
+                                return compareWaitingCalls(a, b);
+                            }];
+    [queue insertObject:call atIndex:index];
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Untracks a call for good, and stops any callbacks still on their way for it:
+-(void) cancelCall:(NKNetworkCall*)call {
+    call.canceled = TRUE;
+    [self unTrackCall:call];
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Forgets the call completely, canceling its connection if it has one.  A download file
+// that hasn't been handed off is deleted.
+-(void) unTrackCall:(NKNetworkCall*)call {
+    if(call.connection != nil) {
+        [self.bridge cancelConnection:call.connection];
+        call.connection = nil;
+    }
+    [self settleThrottleForCall:call completed:FALSE];
+    [call.fileWriter discard];
+    call.fileWriter = nil;
+    [_callsWaiting[call.priority] removeObjectIdenticalTo:call];
+    [_callsInFlight[call.priority] removeObject:call];
+    
+    id<NetworkManagerDelegate> delegate = call.delegate;
+    if(delegate != nil) {
+        NSMutableArray* delegateCalls = [_callsByDelegate objectForKey:delegate];
+        [delegateCalls removeObjectIdenticalTo:call];
+        if(delegateCalls.count == 0) {
+            [_callsByDelegate removeObjectForKey:delegate];
+        }
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Ends the current attempt.  If the call has retries left it goes back in the queue to
+// wait out its retry delay and TRUE is returned; otherwise it's untracked and the caller
+// has to make the failure callback.
+-(BOOL) retryOrUnTrackCall:(NKNetworkCall*)call {
+    if(call.connection != nil) {
+        [self.bridge cancelConnection:call.connection];
+        call.connection = nil;
+    }
+    [self settleThrottleForCall:call completed:FALSE];
+    [_callsInFlight[call.priority] removeObject:call];
+    
+    if(call.numRetries >= call.request.numRetries) {
+        [self unTrackCall:call];
+        return FALSE;
+    }
+    
+    call.numRetries++;
+    double delay = call.request.retryDelaySeconds;
+    if(call.request.retryDelayPolicy == NKRetryDelayPolicyLogarithmicDelay) {
+        delay *= log2(1.0 + call.numRetries);
+    }
+    call.notBefore = [MonotonicClock time:[MonotonicClock now] plusSeconds:MAX(delay, 0.0)];
+    [self insertWaitingCall:call];
+    LogD(LOGTAG, @"Retry %u of %@ in %.2lfs", call.numRetries, call.request.URL, delay);
+    return TRUE;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Squares a throttled attempt up with the bandwidth throttle, once, however it ended:
+-(void) settleThrottleForCall:(NKNetworkCall*)call completed:(BOOL)completed {
+    if(!call.throttled) return;
+    [self.bandwidthThrottle settleCharge:call.throttleCharge actualBytes:[self bytesReceivedForCall:call] completed:completed];
+    call.throttled = FALSE;
+    call.throttleCharge = 0.0;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// The body bytes the attempt in flight has received so far, in memory or on disk:
+-(unsigned long long) bytesReceivedForCall:(NKNetworkCall*)call {
+    return (call.fileWriter != nil) ? call.fileWriter.bytesWritten : call.data.length;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// TRUE if HIGH or MEDIUM calls are on the wire, or about to be.  A call waiting out a
+// retry delay isn't about to be, so it doesn't hold the background back meanwhile:
+-(BOOL) isForegroundActiveAt:(MonotonicTime)monotonicNow {
+    for(NSUInteger p = NKCallPriorityHigh; p <= NKCallPriorityMedium; p++) {
+        if(_callsInFlight[p].count > 0) return TRUE;
+        for(NKNetworkCall* call in _callsWaiting[p]) {
+            if(!call.paused && call.notBefore <= monotonicNow) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Asks the network thread to service the queues.  Several requests before it gets
+// around to it only make it happen once.
+-(void) scheduleServiceQueues {
+    @synchronized (self.lock) {
+        if(self.serviceQueuesScheduled) return;
+        self.serviceQueuesScheduled = TRUE;
+    }
+    [[SharedThreadPool singleton] performBlock:^{
+        [self serviceQueues];
+    } onThread:self.networkThread];
+}
+
+// ONLY CALL THIS ON THE NETWORK THREAD!!!
+// Drops waiting calls that are past their deadlines, then sends as many of the rest as
+// each priority's quota allows, in queue order.  Calls still waiting out a retry delay,
+// and paused calls, are skipped over for now.  LOW and BKG calls also have to get past
+// the bandwidth throttle; once it holds one back, the rest of that queue waits too.
+-(void) serviceQueues {
+    NSMutableArray* droppedCalls = [[NSMutableArray alloc] init];
+    
+    @synchronized (self.lock) {
+        self.serviceQueuesScheduled = FALSE;
+        NSDate* now = [NSDate date];
+        MonotonicTime monotonicNow = [MonotonicClock now];
+        [self.bandwidthThrottle updateAtTime:monotonicNow foregroundActive:[self isForegroundActiveAt:monotonicNow]];
+        
+        for(NSUInteger p = 0; p < NK_NUM_CALL_PRIORITIES; p++) {
+            NSMutableArray* queue = _callsWaiting[p];
+            
+            // The queue is in deadline order, so the late ones are all at the front:
+            while(queue.count > 0) {
+                NKNetworkCall* call = [queue firstObject];
+                if(call.deadline == nil || [call.deadline compare:now] == NSOrderedDescending) break;
+                
+                LogD(LOGTAG, @"Dropping call to %@ - its deadline passed %.2lfs ago", call.request.URL, -[call.deadline timeIntervalSinceNow]);
+                [self unTrackCall:call];
+                [droppedCalls addObject:call];
+            }
+            
+            NSUInteger quota = (NSUInteger)NKCallQuotasByPriority[p];
+            BOOL throttled = (p == NKCallPriorityLow || p == NKCallPriorityBkg);
+            NSUInteger i = 0;
+            while(i < queue.count && (quota == 0 || _callsInFlight[p].count < quota)) {
+                NKNetworkCall* call = [queue objectAtIndex:i];
+                if(call.paused || call.notBefore > monotonicNow) {
+                    i++;
+                    continue;
+                }
+                double charge = 0.0;
+                if(throttled && ![self.bandwidthThrottle mayStartThrottledCall:&charge]) {
+                    break;
+                }
+                [queue removeObjectAtIndex:i];
+                call.throttled = throttled;
+                call.throttleCharge = charge;
+                [self startCallHelper:call];
+            }
+        }
+        self.totalCallsDroppedPastDeadline += droppedCalls.count;
+    }
+    
+    for(NKNetworkCall* call in droppedCalls) {
+        [self makeFailureCallback:call error:NetworkManagerErrorDeadlineMissed httpStatus:-1];
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK ON THE NETWORK THREAD!!!
+-(void) startCallHelper:(NKNetworkCall*)call {
+    call.notBefore = 0;
+    call.httpStatus = -1;
+    call.timeResponseReceived = 0;
+    call.fileWriteFailed = FALSE;
+    
+    // A retry's body hasn't gone to anybody, so its buffer can be emptied and used again:
+    if(call.data != nil) {
+        [call.data setLength:0];
+    } else {
+        call.data = [[NSMutableData alloc] init];
+    }
+    
+    NSURLConnection* connection = [self.bridge getConnection:call.request delegate:call startImmediately:FALSE];
+    call.connection = connection;
+    [_callsInFlight[call.priority] addObject:call];
+    [self.bridge scheduleConnection:connection inRunLoop:[NSRunLoop currentRunLoop] forMode:NSRunLoopCommonModes];
+    
+    call.timeAttemptStarted = [MonotonicClock now];
+    [self.bridge startConnection:connection];
+    LogD(LOGTAG, @"Started call: %@ %@", call.request.HTTPMethod, call.request.URL);
+}
+
+
+#pragma mark - Callbacks from NKNetworkCall
+
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response {
+    int size = -1;
+    int httpStatus = -1;
+    NSDictionary* headers = nil;
+    BOOL fileOpenFailed = FALSE;
+    @synchronized (self.lock) {
+        if(call.connection != connection) return;
+        
+        // The time to the header is as close as we get to a round trip time:
+        call.timeResponseReceived = [MonotonicClock now];
+        [self.bandwidthThrottle recordRTT:[MonotonicClock secondsFrom:call.timeAttemptStarted to:call.timeResponseReceived]];
+        
+        if([response isKindOfClass:[NSHTTPURLResponse class]]) {
+            call.httpStatus = (int)((NSHTTPURLResponse*)response).statusCode;
+            headers = ((NSHTTPURLResponse*)response).allHeaderFields;
+        }
+        httpStatus = call.httpStatus;
+        size = (int)response.expectedContentLength;
+        [call.data setLength:0];
+        
+        // A download-to-file call's body goes to its file (emptied for this attempt), unless
+        // it's an error response.  If the file can't be opened, a retry won't help:
+        if(call.request.downloadToFile && httpStatus >= 200 && httpStatus < 400) {
+            if(call.fileWriter == nil) {
+                NSURL* fileURL = call.request.downloadFileURL;
+                call.fileWriter = (fileURL != nil) ? [[DownloadFileWriter alloc] initWithFileURL:fileURL] : [DownloadFileWriter temporaryFileWriter];
+            }
+            if(![call.fileWriter openWithExpectedLength:response.expectedContentLength]) {
+                [self unTrackCall:call];
+                fileOpenFailed = TRUE;
+            }
+        } else if(call.fileWriter != nil) {
+            [call.fileWriter discard];
+            call.fileWriter = nil;
+        }
+    }
+    
+    if(fileOpenFailed) {
+        LogE(LOGTAG, @"Could not open the download file for %@", call.request.URL);
+        [self makeFailureCallback:call error:NetworkManagerErrorInternal httpStatus:httpStatus];
+        [self scheduleServiceQueues];
+        return;
+    }
+    
+    if([call.delegate respondsToSelector:@selector(networkManager:didReceiveResponse:httpStatus:)]) {
+        [self performCallbackForCall:call block:^(id<NetworkManagerDelegate> delegate) {
+            [delegate networkManager:self didReceiveResponse:call.context httpStatus:httpStatus];
+        }];
+    }
+    if([call.delegate respondsToSelector:@selector(networkManager:didLoadHeader:size:headers:)]) {
+        [self performCallbackForCall:call block:^(id<NetworkManagerDelegate> delegate) {
+            [delegate networkManager:self didLoadHeader:call.context size:size headers:headers];
+        }];
+    }
+}
+
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didReceiveData:(NSData*)data {
+    @synchronized (self.lock) {
+        if(call.connection == connection) {
+            if(call.fileWriter != nil) {
+                if(!call.fileWriteFailed && ![call.fileWriter appendData:data]) {
+                    call.fileWriteFailed = TRUE;
+                }
+            } else {
+                [call.data appendData:data];
+            }
+        }
+    }
+}
+
+-(void) networkCall:(NKNetworkCall*)call connectionDidFinishLoading:(NSURLConnection*)connection {
+    BOOL succeeded = FALSE;
+    BOOL failed = FALSE;
+    BOOL fileFailed = FALSE;
+    int httpStatus = -1;
+    NSData* data = nil;
+    NSURL* fileURL = nil;
+    
+    @synchronized (self.lock) {
+        if(call.connection != connection) return;
+        call.connection = nil;
+        
+        httpStatus = call.httpStatus;
+        data = call.data;
+        if(call.timeResponseReceived != 0) {
+            [self.bandwidthThrottle recordTransferOfBytes:[self bytesReceivedForCall:call] seconds:[MonotonicClock secondsSince:call.timeResponseReceived]];
+        }
+        [self settleThrottleForCall:call completed:TRUE];
+        
+        // A download file is mapped and handed off with the success callback.  Once it's
+        // mapped we let go of the writer, so unTrackCall doesn't delete it:
+        if(call.fileWriter != nil) {
+            NSData* mapped = call.fileWriteFailed ? nil : [call.fileWriter finishAndMap];
+            if(mapped != nil) {
+                data = mapped;
+                fileURL = call.fileWriter.fileURL;
+                call.savedFileURL = fileURL;
+                call.fileWriter = nil;
+            } else {
+                fileFailed = TRUE;
+            }
+        }
+        
+        if(fileFailed) {
+            [self unTrackCall:call];
+        } else if(httpStatus >= 200 && httpStatus < 400) {
+            [self unTrackCall:call];
+            succeeded = TRUE;
+        } else if(httpStatus >= 400 && httpStatus < 500) {
+            // The server won't change its mind about these:
+            [self unTrackCall:call];
+            failed = TRUE;
+        } else {
+            failed = ![self retryOrUnTrackCall:call];
+        }
+    }
+    
+    if(fileFailed) {
+        LogE(LOGTAG, @"Could not write or map the download file for %@", call.request.URL);
+        [self makeFailureCallback:call error:NetworkManagerErrorInternal httpStatus:-1];
+    } else if(succeeded) {
+        [self performCallbackForCall:call block:^(id<NetworkManagerDelegate> delegate) {
+            if(fileURL != nil && [delegate respondsToSelector:@selector(networkManager:didSaveFile:fileURL:)]) {
+                [delegate networkManager:self didSaveFile:call.context fileURL:fileURL];
+            }
+            [delegate networkManager:self didSucceed:call.context data:data];
+            if([delegate respondsToSelector:@selector(networkManager:didFinish:)]) {
+                [delegate networkManager:self didFinish:call.context];
+            }
+        }];
+    } else if(failed) {
+        NetworkManagerError error = (httpStatus >= 400 && httpStatus < 500) ? NetworkManagerErrorBadRequest : NetworkManagerErrorBadServer;
+        [self makeFailureCallback:call error:error httpStatus:httpStatus];
+    }
+    [self scheduleServiceQueues];
+}
+
+-(void) networkCall:(NKNetworkCall*)call connection:(NSURLConnection*)connection didFailWithError:(NSError*)error {
+    BOOL failed = FALSE;
+    @synchronized (self.lock) {
+        if(call.connection != connection) return;
+        call.connection = nil;
+        failed = ![self retryOrUnTrackCall:call];
+    }
+    
+    if(failed) {
+        NetworkManagerError errorType = NetworkManagerErrorTimedOut;
+        if([error.domain isEqualToString:NSURLErrorDomain] &&
+           (error.code == NSURLErrorNotConnectedToInternet || error.code == NSURLErrorNetworkConnectionLost)) {
+            errorType = NetworkManagerErrorNoConnection;
+        }
+        [self makeFailureCallback:call error:errorType httpStatus:-1];
+    }
+    [self scheduleServiceQueues];
+}
+
+
+#pragma mark - Delegate callbacks
+
+// Delegate callbacks happen on the request's callbackThread (the main thread if it
+// doesn't have one), and only if the delegate is still around by then and the call
+// wasn't canceled in the meantime.
+-(void) performCallbackForCall:(NKNetworkCall*)call block:(void (^)(id<NetworkManagerDelegate> delegate))block {
+    NSThread* thread = (call.request.callbackThread != nil) ? call.request.callbackThread : [NSThread mainThread];
+    @synchronized (self.lock) {
+        [_callsAwaitingCallbacks addObject:call];
+    }
+    dispatch_block_t callback = ^{
+        BOOL canceled = FALSE;
+        @synchronized (self.lock) {
+            [_callsAwaitingCallbacks removeObject:call];
+            canceled = call.canceled;
+        }
+        id<NetworkManagerDelegate> delegate = call.delegate;
+        if(delegate != nil && !canceled) {
+            block(delegate);
+        } else if(call.savedFileURL != nil) {
+            // Nobody's getting the download file, so it's deleted like any other canceled one's:
+            [[NSFileManager defaultManager] removeItemAtURL:call.savedFileURL error:nil];
+        }
+    };
+    [[SharedThreadPool singleton] performBlock:callback onThread:thread];
+}
+
+-(void) makeFailureCallback:(NKNetworkCall*)call error:(NetworkManagerError)errorType httpStatus:(int)httpStatus {
+    NSData* data = call.data;
+    [self performCallbackForCall:call block:^(id<NetworkManagerDelegate> delegate) {
+        // note that this method is "required" by the protocol, so we foregoe a guard:
+        [delegate networkManager:self didFail:call.context error:errorType httpStatus:httpStatus data:data];
+        if([delegate respondsToSelector:@selector(networkManager:didFinish:)]) {
+            [delegate networkManager:self didFinish:call.context];
+        }
+    }];
+}
+
+
 @end
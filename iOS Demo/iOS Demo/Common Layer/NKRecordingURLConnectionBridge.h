@@ -0,0 +1,32 @@
+//
+//  NKRecordingURLConnectionBridge.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Wraps another NKURLConnectionBridge and writes everything that goes through it to an
+    NKTrafficRecorder.  Connections still come from the wrapped bridge and behave exactly
+    as they would without recording; the delegate callbacks just pass through a small
+    forwarding object on the way.  One record per connection, written when the connection
+    finishes, fails, or is canceled. */
+
+#import <Foundation/Foundation.h>
+#import "NKURLConnectionBridge.h"
+#import "NKTrafficRecorder.h"
+
+@interface NKRecordingURLConnectionBridge : NSObject <NKURLConnectionBridge>
+
+-(NKRecordingURLConnectionBridge*) initWithBridge:(id<NKURLConnectionBridge>)bridge recorder:(NKTrafficRecorder*)recorder;
+
+@property (nonatomic, readonly) id<NKURLConnectionBridge> wrappedBridge;
+@property (nonatomic, readonly) NKTrafficRecorder* recorder;
+
+// From NKURLConnectionBridge:
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately;
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode;
+-(void) startConnection:(NSURLConnection*)connection;
+-(void) cancelConnection:(NSURLConnection*)connection;
+
+@end
@@ -0,0 +1,213 @@
+//
+//  NKRecordingURLConnectionBridge.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKRecordingURLConnectionBridge.h"
+
+@interface NKRecordingURLConnectionBridge ()
+-(void) connectionEnded:(NSURLConnection*)connection;
+@end
+
+
+// Sits between a connection and its real delegate, passing every callback along and
+// keeping notes for the record.  The connection holds on to it the same way it would
+// have held on to the real delegate.
+@interface _NKRecordingDelegate : NSObject <NSURLConnectionDataDelegate>
+
+@property (nonatomic, retain) id target;
+@property (nonatomic, weak)   NKRecordingURLConnectionBridge* bridge;
+@property (nonatomic, retain) NKTrafficRecorder* recorder;
+@property (nonatomic, retain) NKTrafficRecord* record;
+@property (nonatomic, retain) NSMutableData* body;
+@property (nonatomic) unsigned long long bodyLength;      // all of it, even past maxBodyLength
+@property (nonatomic) unsigned long long maxBodyLength;   // the recorder's; zero keeps it all
+@property (nonatomic) BOOL written;
+
+-(void) writeRecordWithErrorCode:(NSInteger)errorCode;
+
+@end
+
+@implementation _NKRecordingDelegate
+
+-(_NKRecordingDelegate*) initWithTarget:(id)target bridge:(NKRecordingURLConnectionBridge*)bridge request:(NSURLRequest*)request {
+    if(self = [super init]) {
+        NKTrafficRecorder* recorder = bridge.recorder;
+        self.target = target;
+        self.bridge = bridge;
+        self.recorder = recorder;
+        self.body = [[NSMutableData alloc] init];
+        self.bodyLength = 0;
+        self.maxBodyLength = recorder.maxRecordedBodyLength;
+        self.written = FALSE;
+
+        NKTrafficRecord* record = [[NKTrafficRecord alloc] init];
+        record.startTime = [recorder currentTime];
+        record.method = (request.HTTPMethod != nil) ? request.HTTPMethod : @"GET";
+        record.urlString = request.URL.absoluteString;
+        record.requestHeaders = request.allHTTPHeaderFields;
+        record.requestBodyLength = request.HTTPBody.length;
+        self.record = record;
+    }
+    return self;
+}
+
+// Anything we don't watch goes straight to the real delegate:
+-(BOOL) respondsToSelector:(SEL)aSelector {
+    return [super respondsToSelector:aSelector] || [self.target respondsToSelector:aSelector];
+}
+
+-(id) forwardingTargetForSelector:(SEL)aSelector {
+    return self.target;
+}
+
+-(void) markStarted {
+    @synchronized(self) {
+        self.record.startTime = [self.recorder currentTime];
+    }
+}
+
+-(void) writeRecordWithErrorCode:(NSInteger)errorCode {
+    NKTrafficRecord* record = nil;
+    @synchronized(self) {
+        if(self.written) return;
+        self.written = TRUE;
+
+        record = self.record;
+        record.duration = [self.recorder currentTime] - record.startTime;
+        record.bodyLength = self.bodyLength;
+        record.body = self.body;
+        record.errorCode = errorCode;
+    }
+    [self.recorder appendRecord:record];
+}
+
+- (NSURLRequest *)connection:(NSURLConnection *)connection willSendRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)response {
+    if([self.target respondsToSelector:@selector(connection:willSendRequest:redirectResponse:)]) {
+        return [self.target connection:connection willSendRequest:request redirectResponse:response];
+    }
+    return request;
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+    @synchronized(self) {
+        // A second response means NSURLConnection started the body over:
+        self.record.responseDelay = [self.recorder currentTime] - self.record.startTime;
+        if([response isKindOfClass:[NSHTTPURLResponse class]]) {
+            self.record.statusCode = (int)((NSHTTPURLResponse*)response).statusCode;
+            self.record.responseHeaders = ((NSHTTPURLResponse*)response).allHeaderFields;
+        }
+        [self.body setLength:0];
+        self.bodyLength = 0;
+    }
+    if([self.target respondsToSelector:@selector(connection:didReceiveResponse:)]) {
+        [self.target connection:connection didReceiveResponse:response];
+    }
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+    @synchronized(self) {
+        // The file only gets the first maxBodyLength bytes, so there's no point keeping more:
+        self.bodyLength += data.length;
+        if(self.maxBodyLength == 0) {
+            [self.body appendData:data];
+        } else if(self.body.length < self.maxBodyLength) {
+            NSUInteger room = (NSUInteger)(self.maxBodyLength - self.body.length);
+            [self.body appendBytes:data.bytes length:MIN(room, data.length)];
+        }
+    }
+    if([self.target respondsToSelector:@selector(connection:didReceiveData:)]) {
+        [self.target connection:connection didReceiveData:data];
+    }
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+    [self writeRecordWithErrorCode:0];
+    [self.bridge connectionEnded:connection];
+    if([self.target respondsToSelector:@selector(connectionDidFinishLoading:)]) {
+        [self.target connectionDidFinishLoading:connection];
+    }
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+    [self writeRecordWithErrorCode:(error.code != 0) ? error.code : NSURLErrorUnknown];
+    [self.bridge connectionEnded:connection];
+    if([self.target respondsToSelector:@selector(connection:didFailWithError:)]) {
+        [self.target connection:connection didFailWithError:error];
+    }
+}
+
+@end
+
+
+@interface NKRecordingURLConnectionBridge ()
+
+@property (nonatomic, retain) id<NKURLConnectionBridge> wrappedBridge;
+@property (nonatomic, retain) NKTrafficRecorder* recorder;
+
+// Connection -> _NKRecordingDelegate, for connections that haven't ended yet:
+@property (nonatomic, retain) NSMapTable* liveConnections;
+
+@end
+
+
+@implementation NKRecordingURLConnectionBridge
+
+-(NKRecordingURLConnectionBridge*) initWithBridge:(id<NKURLConnectionBridge>)bridge recorder:(NKTrafficRecorder*)recorder {
+    if(self = [super init]) {
+        self.wrappedBridge = bridge;
+        self.recorder = recorder;
+        self.liveConnections = [NSMapTable strongToStrongObjectsMapTable];
+    }
+    return self;
+}
+
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately {
+    _NKRecordingDelegate* recordingDelegate = [[_NKRecordingDelegate alloc] initWithTarget:delegate bridge:self request:request];
+    NSURLConnection* connection = [self.wrappedBridge getConnection:request delegate:recordingDelegate startImmediately:startImmediately];
+    if(connection != nil) {
+        @synchronized(self) {
+            [self.liveConnections setObject:recordingDelegate forKey:connection];
+        }
+    }
+    return connection;
+}
+
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode {
+    [self.wrappedBridge scheduleConnection:connection inRunLoop:runLoop forMode:mode];
+}
+
+// The record's clock starts here if the connection wasn't started right away:
+-(void) startConnection:(NSURLConnection*)connection {
+    _NKRecordingDelegate* recordingDelegate = nil;
+    @synchronized(self) {
+        recordingDelegate = [self.liveConnections objectForKey:connection];
+    }
+    [recordingDelegate markStarted];
+    [self.wrappedBridge startConnection:connection];
+}
+
+-(void) connectionEnded:(NSURLConnection*)connection {
+    @synchronized(self) {
+        [self.liveConnections removeObjectForKey:connection];
+    }
+}
+
+// A canceled connection is recorded with NSURLErrorCancelled and whatever had arrived
+// by then.  Canceling one that already ended records nothing more.
+-(void) cancelConnection:(NSURLConnection*)connection {
+    if(connection == nil) return;
+
+    _NKRecordingDelegate* recordingDelegate = nil;
+    @synchronized(self) {
+        recordingDelegate = [self.liveConnections objectForKey:connection];
+        [self.liveConnections removeObjectForKey:connection];
+    }
+    [self.wrappedBridge cancelConnection:connection];
+    [recordingDelegate writeRecordWithErrorCode:NSURLErrorCancelled];
+}
+
+@end
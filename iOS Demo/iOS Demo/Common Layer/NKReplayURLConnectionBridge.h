@@ -0,0 +1,52 @@
+//
+//  NKReplayURLConnectionBridge.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** An NKURLConnectionBridge that plays back traffic recorded by NKTrafficRecorder instead
+    of going to the network.  Hand it to a network manager and send the same calls that were
+    recorded, and each one gets back what it got the first time: same status, headers and
+    body, with the same time to the response header and the same time to the end, divided
+    by the speed.  Bodies that were capped in the recording are padded back out with zeros.
+
+    Requests are matched on method and URL.  Records for the same method and URL are handed
+    out in the order they were recorded, and once they run out the last one is used again,
+    so retries still get an answer.  Anything that wasn't recorded gets an empty 404.
+
+    A recorded failure fails the same way after the same bytes.  A recorded cancel delivers
+    its bytes and then nothing more - whatever canceled it the first time (usually a
+    timeout) has to do it again.  Redirects aren't replayed; the final response is served
+    for the original URL.
+
+    Callbacks run on the run loop a connection is scheduled in, like NSURLConnection's, so
+    whatever runs that run loop has to keep running it. */
+
+#import <Foundation/Foundation.h>
+#import "NKURLConnectionBridge.h"
+#import "NKTrafficRecorder.h"
+
+
+@interface NKReplayURLConnectionBridge : NSObject <NKURLConnectionBridge>
+
+// speed is how many times faster than real life to play things back: 1.0 is as recorded,
+// 10.0 is ten times faster, and zero (or anything below) is as fast as the run loop goes.
+-(NKReplayURLConnectionBridge*) initWithRecords:(NSArray*)records speed:(double)speed;
+
+@property (nonatomic, readonly) double speed;
+
+@property (atomic, readonly) UInt64 numConnectionsStarted;
+@property (atomic, readonly) UInt64 numConnectionsFinished;    // succeeded or failed
+@property (atomic, readonly) UInt64 numConnectionsCanceled;
+@property (atomic, readonly) UInt64 numUnmatchedRequests;
+@property (atomic, readonly) UInt64 numBodyBytesDelivered;
+
+// From NKURLConnectionBridge:
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately;
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode;
+-(void) startConnection:(NSURLConnection*)connection;
+-(void) cancelConnection:(NSURLConnection*)connection;
+
+@end
@@ -0,0 +1,318 @@
+//
+//  NKReplayURLConnectionBridge.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKReplayURLConnectionBridge.h"
+#import "Logging.h"
+
+NSString* const LOGTAG_NKRB = @"network";
+
+// Bodies are played back in pieces about this big, spread over the recorded body time:
+#define kReplayChunkSize (16 * 1024)
+
+
+// A connection that plays back one record.  It holds its delegate until it's done or
+// canceled, like NSURLConnection does.
+@interface _NKReplayedURLConnection : NSURLConnection
+
+@property (nonatomic, retain) NSURLRequest* replayRequest;
+@property (atomic, retain)    id replayDelegate;
+@property (nonatomic, retain) NKTrafficRecord* record;
+@property (nonatomic) CFRunLoopRef runLoop;
+@property (nonatomic, retain) NSString* mode;
+
+// Steps are: the response, then each chunk of body, then the end.  Each is due a fixed
+// time after the connection started:
+@property (nonatomic) double startUptime;
+@property (nonatomic) NSUInteger numChunks;
+@property (nonatomic) unsigned long long chunkSize;
+
+@property (atomic) BOOL started;
+@property (atomic) BOOL canceled;
+@property (atomic) BOOL done;
+
+@end
+
+@implementation _NKReplayedURLConnection
+
+-(_NKReplayedURLConnection*) initWithReplayRequest:(NSURLRequest*)request delegate:(id)delegate record:(NKTrafficRecord*)record {
+    if(self = [super init]) {
+        self.replayRequest = request;
+        self.replayDelegate = delegate;
+        self.record = record;
+        self.runLoop = NULL;
+        self.mode = NSDefaultRunLoopMode;
+        self.started = FALSE;
+        self.canceled = FALSE;
+        self.done = FALSE;
+
+        self.numChunks = (NSUInteger)((record.bodyLength + kReplayChunkSize - 1) / kReplayChunkSize);
+        self.chunkSize = kReplayChunkSize;
+    }
+    return self;
+}
+
+-(void) dealloc {
+    if(_runLoop != NULL) {
+        CFRelease(_runLoop);
+    }
+}
+
+-(void) setRunLoop:(CFRunLoopRef)runLoop {
+    if(runLoop != NULL) CFRetain(runLoop);
+    if(_runLoop != NULL) CFRelease(_runLoop);
+    _runLoop = runLoop;
+}
+
+// These only make sense for a real connection.  The bridge drives us instead:
+-(void) scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode { }
+-(void) start { }
+-(void) cancel {
+    self.canceled = TRUE;
+}
+
+-(NSURLRequest*) originalRequest {
+    return self.replayRequest;
+}
+
+-(NSURLRequest*) currentRequest {
+    return self.replayRequest;
+}
+
+// Bytes [offset, offset+length) of the recorded body, with zeros past what was kept:
+-(NSData*) bodyBytesAt:(unsigned long long)offset length:(unsigned long long)length {
+    NSMutableData* data = [NSMutableData dataWithLength:(NSUInteger)length];
+    NSData* body = self.record.body;
+    if(offset < body.length) {
+        NSUInteger available = (NSUInteger)MIN(length, body.length - offset);
+        memcpy(data.mutableBytes, (const uint8_t*)body.bytes + offset, available);
+    }
+    return data;
+}
+
+@end
+
+
+@interface NKReplayURLConnectionBridge ()
+
+@property (nonatomic) double speed;
+
+// matchKey -> NSMutableArray of records, and matchKey -> index of the next one to use:
+@property (nonatomic, retain) NSMutableDictionary* recordsByKey;
+@property (nonatomic, retain) NSMutableDictionary* nextIndexByKey;
+
+@property (nonatomic, retain) dispatch_queue_t timerQueue;
+
+@property (atomic) UInt64 numConnectionsStarted;
+@property (atomic) UInt64 numConnectionsFinished;
+@property (atomic) UInt64 numConnectionsCanceled;
+@property (atomic) UInt64 numUnmatchedRequests;
+@property (atomic) UInt64 numBodyBytesDelivered;
+
+@end
+
+
+@implementation NKReplayURLConnectionBridge
+
+-(NKReplayURLConnectionBridge*) initWithRecords:(NSArray*)records speed:(double)speed {
+    if(self = [super init]) {
+        self.speed = speed;
+        self.recordsByKey = [[NSMutableDictionary alloc] init];
+        self.nextIndexByKey = [[NSMutableDictionary alloc] init];
+        self.timerQueue = dispatch_queue_create("iosdemo.replaybridge", DISPATCH_QUEUE_SERIAL);
+
+        for(NKTrafficRecord* record in records) {
+            NSString* key = [record matchKey];
+            NSMutableArray* queue = [self.recordsByKey objectForKey:key];
+            if(queue == nil) {
+                queue = [[NSMutableArray alloc] init];
+                [self.recordsByKey setObject:queue forKey:key];
+            }
+            [queue addObject:record];
+        }
+    }
+    return self;
+}
+
+
+#pragma mark - NKURLConnectionBridge
+
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately {
+    _NKReplayedURLConnection* connection = [[_NKReplayedURLConnection alloc] initWithReplayRequest:request delegate:delegate
+                                                                                              record:[self recordForRequest:request]];
+    // Same default as NSURLConnection - the run loop of whoever made it:
+    connection.runLoop = CFRunLoopGetCurrent();
+    if(startImmediately) {
+        [self startConnection:connection];
+    }
+    return connection;
+}
+
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode {
+    if(![connection isKindOfClass:[_NKReplayedURLConnection class]]) return;
+    _NKReplayedURLConnection* replayed = (_NKReplayedURLConnection*)connection;
+    if(replayed.started) return;
+
+    replayed.runLoop = [runLoop getCFRunLoop];
+    replayed.mode = mode;
+}
+
+-(void) startConnection:(NSURLConnection*)connection {
+    if(![connection isKindOfClass:[_NKReplayedURLConnection class]]) return;
+    _NKReplayedURLConnection* replayed = (_NKReplayedURLConnection*)connection;
+    if(replayed.started || replayed.canceled) return;
+
+    replayed.started = TRUE;
+    replayed.startUptime = [[NSProcessInfo processInfo] systemUptime];
+    @synchronized(self) {
+        self.numConnectionsStarted++;
+    }
+    [self scheduleStep:0 forConnection:replayed];
+}
+
+-(void) cancelConnection:(NSURLConnection*)connection {
+    if(![connection isKindOfClass:[_NKReplayedURLConnection class]]) return;
+    _NKReplayedURLConnection* replayed = (_NKReplayedURLConnection*)connection;
+    if(replayed.canceled || replayed.done) return;
+
+    replayed.canceled = TRUE;
+    replayed.replayDelegate = nil;
+    @synchronized(self) {
+        self.numConnectionsCanceled++;
+    }
+}
+
+
+#pragma mark - Playback
+
+-(NKTrafficRecord*) recordForRequest:(NSURLRequest*)request {
+    NSString* key = [NSString stringWithFormat:@"%@ %@", (request.HTTPMethod != nil) ? request.HTTPMethod : @"GET", request.URL.absoluteString];
+
+    @synchronized(self) {
+        NSArray* queue = [self.recordsByKey objectForKey:key];
+        if(queue.count > 0) {
+            NSUInteger index = [[self.nextIndexByKey objectForKey:key] unsignedIntegerValue];
+            [self.nextIndexByKey setObject:@(index + 1) forKey:key];
+            return [queue objectAtIndex:MIN(index, queue.count - 1)];
+        }
+    }
+
+    LogW(LOGTAG_NKRB, @"NKReplayURLConnectionBridge has no recording of %@ - answering 404", key);
+    @synchronized(self) {
+        self.numUnmatchedRequests++;
+    }
+
+    NKTrafficRecord* record = [[NKTrafficRecord alloc] init];
+    record.method = request.HTTPMethod;
+    record.urlString = request.URL.absoluteString;
+    record.statusCode = 404;
+    record.responseDelay = 0.0;
+    return record;
+}
+
+// Seconds after the start, in playback time, that step is due.  The body is spread
+// evenly between the response and the end.
+-(double) dueTimeOfStep:(NSUInteger)step forConnection:(_NKReplayedURLConnection*)connection {
+    if(self.speed <= 0.0) return 0.0;
+
+    NKTrafficRecord* record = connection.record;
+    double responseTime = MAX(record.responseDelay, 0.0);
+    double endTime = MAX(record.duration, responseTime);
+    double due = endTime;
+    if(step == 0) {
+        due = responseTime;
+    } else if(step <= connection.numChunks) {
+        due = responseTime + (endTime - responseTime) * ((double)step / (double)(connection.numChunks + 1));
+    }
+    return due / self.speed;
+}
+
+// Steps are chained: each one schedules the next after it runs, so they can't overtake
+// each other on the run loop.
+-(void) scheduleStep:(NSUInteger)step forConnection:(_NKReplayedURLConnection*)connection {
+    double elapsed = [[NSProcessInfo processInfo] systemUptime] - connection.startUptime;
+    double delay = [self dueTimeOfStep:step forConnection:connection] - elapsed;
+
+    __weak NKReplayURLConnectionBridge* weakSelf = self;
+    void (^perform)(void) = ^{
+        CFRunLoopPerformBlock(connection.runLoop, (__bridge CFTypeRef)connection.mode, ^{
+            [weakSelf runStep:step forConnection:connection];
+        });
+        CFRunLoopWakeUp(connection.runLoop);
+    };
+
+    if(delay <= 0.0) {
+        perform();
+    } else {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.timerQueue, perform);
+    }
+}
+
+// Runs on the connection's run loop:
+-(void) runStep:(NSUInteger)step forConnection:(_NKReplayedURLConnection*)connection {
+    if(connection.canceled || connection.done) {
+        connection.replayDelegate = nil;
+        return;
+    }
+
+    NKTrafficRecord* record = connection.record;
+    id delegate = connection.replayDelegate;
+
+    if(step == 0) {
+        if(record.statusCode >= 0) {
+            // The body we hand over is already decoded, so the headers have to say so:
+            NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:record.responseHeaders];
+            for(NSString* name in [headers allKeys]) {
+                if([name caseInsensitiveCompare:@"Content-Encoding"] == NSOrderedSame ||
+                   [name caseInsensitiveCompare:@"Content-Length"] == NSOrderedSame) {
+                    [headers removeObjectForKey:name];
+                }
+            }
+            [headers setObject:[NSString stringWithFormat:@"%llu", record.bodyLength] forKey:@"Content-Length"];
+
+            NSHTTPURLResponse* response = [[NSHTTPURLResponse alloc] initWithURL:connection.replayRequest.URL statusCode:record.statusCode
+                                                                     HTTPVersion:@"HTTP/1.1" headerFields:headers];
+            if([delegate respondsToSelector:@selector(connection:didReceiveResponse:)]) {
+                [delegate connection:connection didReceiveResponse:response];
+            }
+        }
+    } else if(step <= connection.numChunks) {
+        unsigned long long offset = (step - 1) * connection.chunkSize;
+        unsigned long long length = MIN(connection.chunkSize, record.bodyLength - offset);
+        NSData* chunk = [connection bodyBytesAt:offset length:length];
+        @synchronized(self) {
+            self.numBodyBytesDelivered += length;
+        }
+        if([delegate respondsToSelector:@selector(connection:didReceiveData:)]) {
+            [delegate connection:connection didReceiveData:chunk];
+        }
+    } else {
+        if(record.errorCode == NSURLErrorCancelled) {
+            // Whoever canceled it last time will have to do it again:
+            return;
+        }
+
+        connection.done = TRUE;
+        connection.replayDelegate = nil;
+        @synchronized(self) {
+            self.numConnectionsFinished++;
+        }
+        if(record.errorCode != 0) {
+            NSError* error = [NSError errorWithDomain:NSURLErrorDomain code:record.errorCode userInfo:nil];
+            if([delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+                [delegate connection:connection didFailWithError:error];
+            }
+        } else if([delegate respondsToSelector:@selector(connectionDidFinishLoading:)]) {
+            [delegate connectionDidFinishLoading:connection];
+        }
+        return;
+    }
+
+    [self scheduleStep:step + 1 forConnection:connection];
+}
+
+@end
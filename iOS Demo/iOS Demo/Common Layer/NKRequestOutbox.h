@@ -0,0 +1,141 @@
+//
+//  NKRequestOutbox.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** A durable outbox for writes that couldn't go out because there was no connection.  Set
+    one as DemoNetworkManager's outbox, mark a POST, PUT or DELETE with queueWhenOffline (see
+    NKCallBehaviorURLRequest), and if that call fails with NetworkManagerErrorNoConnection it
+    lands in here instead, and its delegate gets NetworkManagerErrorQueued.  The outbox sends
+    it again later - even after the app has been killed and started again - and tells its
+    own delegate how that went.
+
+    Entries are kept in a journal file.  Like NKTrafficRecorder's files, it's append-only:
+    an 8-byte magic string, then records that are a 4-byte little-endian length and that
+    many bytes of binary plist.  A record either adds an entry or says an entry is gone
+    (delivered, dropped, or superseded).  Appends are collected for flushInterval and
+    written and fsync'ed together, so a burst of writes costs one sync, not one each.  A
+    crash can only cut off the last record, and loading stops there.  Once most of the
+    records in the file are about entries that are gone, it's rewritten with just the live
+    ones (into a new file that then replaces the old one, so that's crash-safe too).
+
+    Replay sends entries in the order they were queued, at most maxConcurrentReplays at a
+    time, and never two for the same URL at once, so writes to one resource land in order.
+    Each entry has an idempotency key, sent in the idempotencyKeyHeader, that stays the same
+    for every attempt - including one that went out right before a crash - so the server
+    can tell a replay from a new write.  A 2xx delivers the entry and a 4xx drops it (the
+    server said no, and it'll say no again).  Anything else leaves it queued and holds off
+    replay for retryIntervalSeconds, until the entry has failed maxReplayAttempts times in a
+    row - then it's dropped too, so one the server chokes on can't be retried forever.
+
+    A PUT or DELETE queued for a URL supersedes any PUT or DELETE for that URL still
+    waiting: only the last one would have mattered, so only the last one is sent.  POSTs
+    are never superseded.
+
+    There's no reachability check here.  DemoNetworkManager calls replay whenever one of
+    its calls succeeds (the link is evidently up) and replayIfDue from its maintenance
+    timer.  With any other manager, call replay yourself.
+
+    NKRequestOutbox is thread-safe.  Replays ask for their callbacks on the main thread, so
+    that's where its delegate normally hears about them. */
+
+#import <Foundation/Foundation.h>
+#import "AbstractNetworkManager.h"
+
+@class NKRequestOutbox;
+
+
+// One queued write:
+@interface NKRequestOutboxEntry : NSObject
+
+@property (nonatomic, readonly) NSString* entryID;   // also the idempotency key
+@property (nonatomic, readonly) NSString* method;
+@property (nonatomic, readonly) NSString* urlString;
+@property (nonatomic, readonly) NSDictionary* headers;
+@property (nonatomic, readonly) NSData* body;
+@property (nonatomic, readonly) NSDate* dateQueued;
+@property (atomic, readonly) unsigned numAttempts;   // replays sent so far, this run
+@property (atomic, readonly) int httpStatus;          // of the last replay's response (-1 before one comes)
+
+@end
+
+
+@protocol NKRequestOutboxDelegate <NSObject>
+
+// The server took it (2xx).  data is the response body.
+@optional
+-(void) requestOutbox:(NKRequestOutbox*)outbox didDeliver:(NKRequestOutboxEntry*)entry data:(NSData*)data;
+
+// The server turned it down (4xx), or it failed maxReplayAttempts times, so it's out of
+// the outbox for good.
+@optional
+-(void) requestOutbox:(NKRequestOutbox*)outbox didDrop:(NKRequestOutboxEntry*)entry
+                error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data;
+
+@end
+
+
+@interface NKRequestOutbox : NSObject <NetworkManagerDelegate>
+
+// Loads whatever is already queued in the file, or creates it.  Returns nil if the file
+// can't be opened or isn't an outbox journal.
+-(NKRequestOutbox*) initWithFileURL:(NSURL*)fileURL;
+
+@property (nonatomic, readonly) NSURL* fileURL;
+
+// Who replays go through, and who hears how they went.  Both are weak.  DemoNetworkManager
+// sets itself as networkManager when it's given the outbox.
+@property (atomic, weak) id<AbstractNetworkManager> networkManager;
+@property (atomic, weak) id<NKRequestOutboxDelegate> delegate;
+
+// Tuning:
+//    - maxConcurrentReplays: replays in flight at once (default 2).
+//    - flushInterval: how long appends wait to be synced along with others (default 0.05s).
+//    - retryIntervalSeconds: how long replay holds off after a replay fails in a way that
+//          might work later (default 5s).
+//    - maxReplayAttempts: how many replays of one entry can fail that way before it's
+//          dropped (default 10, 0 for no limit).  Attempts are counted per run.
+//    - idempotencyKeyHeader: where the entry's key goes (default "Idempotency-Key").  If a
+//          queued request already has this header, its value is used as the key.
+@property (atomic) NSUInteger maxConcurrentReplays;
+@property (atomic) double flushInterval;
+@property (atomic) double retryIntervalSeconds;
+@property (atomic) unsigned maxReplayAttempts;
+@property (atomic, retain) NSString* idempotencyKeyHeader;
+
+// Which requests can be queued at all: POST, PUT and DELETE.
++(BOOL) canQueueMethod:(NSString*)method;
+
+// Queues a request.  Its method, URL, headers and body are kept; a body stream can't be,
+// so a request with one isn't queued.  Returns the new entry, or nil if it wasn't queued.
+-(NKRequestOutboxEntry*) enqueueRequest:(NSURLRequest*)request;
+
+// What's queued, in order, including entries being replayed right now:
+-(NSArray*) pendingEntries;
+-(NSUInteger) count;
+
+// Starts sending queued entries, if there are any, whether or not replay was holding off.
+-(void) replay;
+
+// The same, but only once retryIntervalSeconds has passed since the last failed replay.
+-(void) replayIfDue;
+
+// Waits until everything queued or settled so far is synced to the file.
+-(void) flush;
+
+// Rewrites the journal with just the live entries, right now.
+-(void) compact;
+
+// Counters:
+@property (atomic, readonly) UInt64 numEntriesQueued;
+@property (atomic, readonly) UInt64 numEntriesSuperseded;
+@property (atomic, readonly) UInt64 numEntriesDelivered;
+@property (atomic, readonly) UInt64 numEntriesDropped;
+@property (atomic, readonly) UInt64 numReplaysDeferred;    // replays that failed and were left queued
+@property (atomic, readonly) UInt64 numJournalSyncs;       // fsyncs of the journal
+@property (atomic, readonly) UInt64 numJournalRewrites;
+
+@end
@@ -0,0 +1,620 @@
+//
+//  NKRequestOutbox.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKRequestOutbox.h"
+#import "MonotonicClock.h"
+#import "Logging.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <libkern/OSByteOrder.h>
+
+NSString* const LOGTAG_NKRO = @"network";
+
+static const char kOutboxFileMagic[8] = { 'N', 'K', 'O', 'U', 'T', 'B', '0', '1' };
+
+// Keys in each record's plist:
+#define kKeyOp          @"op"
+#define kKeyID          @"id"
+#define kKeyMethod      @"m"
+#define kKeyURL         @"u"
+#define kKeyHeaders     @"h"
+#define kKeyBody        @"b"
+#define kKeyDate        @"d"
+
+#define kOpAdd          @"a"
+#define kOpRemove       @"x"
+
+// The journal isn't rewritten until it has at least this many dead records, however few
+// live ones there are:
+#define kMinDeadRecordsForRewrite   64
+
+
+#pragma mark - NKRequestOutboxEntry
+
+@interface NKRequestOutboxEntry ()
+
+@property (nonatomic, readwrite) NSString* entryID;
+@property (nonatomic, readwrite) NSString* method;
+@property (nonatomic, readwrite) NSString* urlString;
+@property (nonatomic, readwrite) NSDictionary* headers;
+@property (nonatomic, readwrite) NSData* body;
+@property (nonatomic, readwrite) NSDate* dateQueued;
+@property (atomic, readwrite) unsigned numAttempts;
+@property (atomic, readwrite) int httpStatus;
+
+// Whether a replay of this entry is out right now.  Only touched under the outbox's lock:
+@property (nonatomic) BOOL inFlight;
+
+-(BOOL) isSupersedable;
+-(NSDictionary*) plist;
++(NKRequestOutboxEntry*) entryWithPlist:(NSDictionary*)plist;
+
+@end
+
+@implementation NKRequestOutboxEntry
+
+// Only a whole-resource write makes an earlier one pointless:
+-(BOOL) isSupersedable {
+    return [self.method isEqualToString:@"PUT"] || [self.method isEqualToString:@"DELETE"];
+}
+
+-(NSDictionary*) plist {
+    NSMutableDictionary* plist = [[NSMutableDictionary alloc] init];
+    [plist setObject:kOpAdd         forKey:kKeyOp];
+    [plist setObject:self.entryID   forKey:kKeyID];
+    [plist setObject:self.method    forKey:kKeyMethod];
+    [plist setObject:self.urlString forKey:kKeyURL];
+    [plist setObject:@([self.dateQueued timeIntervalSince1970]) forKey:kKeyDate];
+    if(self.headers.count > 0) [plist setObject:self.headers forKey:kKeyHeaders];
+    if(self.body.length > 0)   [plist setObject:self.body    forKey:kKeyBody];
+    return plist;
+}
+
++(NKRequestOutboxEntry*) entryWithPlist:(NSDictionary*)plist {
+    NSString* entryID = [plist objectForKey:kKeyID];
+    NSString* method = [plist objectForKey:kKeyMethod];
+    NSString* urlString = [plist objectForKey:kKeyURL];
+    if(![entryID isKindOfClass:[NSString class]] || ![method isKindOfClass:[NSString class]] || ![urlString isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+
+    NKRequestOutboxEntry* entry = [[NKRequestOutboxEntry alloc] init];
+    entry.entryID    = entryID;
+    entry.method     = method;
+    entry.urlString  = urlString;
+    entry.headers    = [plist objectForKey:kKeyHeaders];
+    entry.body       = [plist objectForKey:kKeyBody];
+    entry.dateQueued = [NSDate dateWithTimeIntervalSince1970:[[plist objectForKey:kKeyDate] doubleValue]];
+    entry.numAttempts = 0;
+    entry.httpStatus = -1;
+    entry.inFlight = FALSE;
+    return entry;
+}
+
+@end
+
+
+#pragma mark - NKRequestOutbox
+
+@interface NKRequestOutbox () {
+    int _fd;
+}
+
+@property (nonatomic, readwrite) NSURL* fileURL;
+@property (nonatomic, retain) dispatch_queue_t journalQueue;
+
+// The live entries, in the order they were queued:
+@property (nonatomic, retain) NSMutableArray* entries;
+
+// Encoded records waiting for the next sync, and whether one is scheduled:
+@property (nonatomic, retain) NSMutableData* pendingRecords;
+@property (nonatomic) BOOL syncScheduled;
+
+// Records in the journal (or on their way to it) about entries that are gone:
+@property (nonatomic) NSUInteger numDeadRecords;
+
+// Replay holds off until this time after a failure (0 when it isn't holding off):
+@property (nonatomic) MonotonicTime holdUntil;
+
+@property (atomic, readwrite) UInt64 numEntriesQueued;
+@property (atomic, readwrite) UInt64 numEntriesSuperseded;
+@property (atomic, readwrite) UInt64 numEntriesDelivered;
+@property (atomic, readwrite) UInt64 numEntriesDropped;
+@property (atomic, readwrite) UInt64 numReplaysDeferred;
+@property (atomic, readwrite) UInt64 numJournalSyncs;
+@property (atomic, readwrite) UInt64 numJournalRewrites;
+
+@end
+
+
+@implementation NKRequestOutbox
+
+-(NKRequestOutbox*) initWithFileURL:(NSURL*)fileURL {
+    if(self = [super init]) {
+        self.fileURL = fileURL;
+        self.journalQueue = dispatch_queue_create("iosdemo.requestoutbox", DISPATCH_QUEUE_SERIAL);
+        self.entries = [[NSMutableArray alloc] init];
+        self.pendingRecords = [[NSMutableData alloc] init];
+        self.syncScheduled = FALSE;
+        self.numDeadRecords = 0;
+        self.holdUntil = 0;
+
+        self.maxConcurrentReplays = 2;
+        self.flushInterval = 0.05;
+        self.retryIntervalSeconds = 5.0;
+        self.maxReplayAttempts = 10;
+        self.idempotencyKeyHeader = @"Idempotency-Key";
+
+        _fd = open([fileURL fileSystemRepresentation], O_RDWR | O_CREAT | O_APPEND, 0644);
+        if(_fd < 0) {
+            LogE(LOGTAG_NKRO, @"NKRequestOutbox could not open %@ (errno %d)", fileURL, errno);
+            return nil;
+        }
+
+        BOOL needsRewrite = FALSE;
+        if(![self loadJournal:&needsRewrite]) {
+            close(_fd);
+            _fd = -1;
+            return nil;
+        }
+        if(needsRewrite) {
+            dispatch_sync(self.journalQueue, ^{
+                [self rewriteJournal];
+            });
+        }
+    }
+    return self;
+}
+
+// Whatever is still waiting for its sync is written before the file is closed, or those
+// entries would be lost.  Nothing else can be on the journal queue by now: a scheduled
+// sync only holds the outbox weakly.
+-(void) dealloc {
+    if(_fd >= 0) {
+        if(self.pendingRecords.length > 0 && ![self writeData:self.pendingRecords toFD:_fd]) {
+            LogE(LOGTAG_NKRO, @"NKRequestOutbox write to %@ failed (errno %d)", self.fileURL, errno);
+        }
+        close(_fd);
+    }
+}
+
++(BOOL) canQueueMethod:(NSString*)method {
+    return [method isEqualToString:@"POST"] || [method isEqualToString:@"PUT"] || [method isEqualToString:@"DELETE"];
+}
+
+
+#pragma mark Queueing
+
+-(NKRequestOutboxEntry*) enqueueRequest:(NSURLRequest*)request {
+    NSString* method = request.HTTPMethod;
+    NSString* urlString = request.URL.absoluteString;
+    if(urlString.length == 0 || ![NKRequestOutbox canQueueMethod:method]) {
+        return nil;
+    }
+    if(request.HTTPBodyStream != nil) {
+        LogW(LOGTAG_NKRO, @"Can't queue %@ %@ - its body is a stream", method, urlString);
+        return nil;
+    }
+
+    // A key the caller already gave the request is the one the server knows it by:
+    NSString* keyHeader = self.idempotencyKeyHeader;
+    NSString* entryID = nil;
+    for(NSString* name in request.allHTTPHeaderFields) {
+        if([name caseInsensitiveCompare:keyHeader] == NSOrderedSame) {
+            entryID = [request.allHTTPHeaderFields objectForKey:name];
+        }
+    }
+
+    NKRequestOutboxEntry* entry = [[NKRequestOutboxEntry alloc] init];
+    entry.entryID    = (entryID.length > 0) ? entryID : [[NSUUID UUID] UUIDString];
+    entry.method     = method;
+    entry.urlString  = urlString;
+    entry.headers    = [request.allHTTPHeaderFields copy];
+    entry.body       = [request.HTTPBody copy];
+    entry.dateQueued = [NSDate date];
+    entry.numAttempts = 0;
+    entry.httpStatus = -1;
+    entry.inFlight = FALSE;
+
+    @synchronized (self) {
+        // The same write queued twice is still one write:
+        for(NKRequestOutboxEntry* queued in self.entries) {
+            if([queued.entryID isEqualToString:entry.entryID]) {
+                return queued;
+            }
+        }
+
+        // Anything this makes pointless goes, unless it's already on its way:
+        if([entry isSupersedable]) {
+            for(NKRequestOutboxEntry* queued in [self.entries copy]) {
+                if(!queued.inFlight && [queued isSupersedable] && [queued.urlString isEqualToString:urlString]) {
+                    LogD(LOGTAG_NKRO, @"Outbox entry %@ (%@ %@) superseded by a later %@", queued.entryID, queued.method, urlString, method);
+                    [self removeEntry:queued];
+                    self.numEntriesSuperseded++;
+                }
+            }
+        }
+
+        [self.entries addObject:entry];
+        [self appendRecord:[entry plist]];
+        self.numEntriesQueued++;
+        LogD(LOGTAG_NKRO, @"Queued %@ %@ in the outbox as %@", method, urlString, entry.entryID);
+    }
+    return entry;
+}
+
+-(NSArray*) pendingEntries {
+    @synchronized (self) {
+        return [self.entries copy];
+    }
+}
+
+-(NSUInteger) count {
+    @synchronized (self) {
+        return self.entries.count;
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) removeEntry:(NKRequestOutboxEntry*)entry {
+    [self.entries removeObjectIdenticalTo:entry];
+    [self appendRecord:@{ kKeyOp : kOpRemove, kKeyID : entry.entryID }];
+
+    // Its add record and this remove record are both dead weight now:
+    self.numDeadRecords += 2;
+}
+
+
+#pragma mark Replay
+
+-(void) replay {
+    @synchronized (self) {
+        self.holdUntil = 0;
+    }
+    [self startReplays];
+}
+
+-(void) replayIfDue {
+    @synchronized (self) {
+        if(self.holdUntil != 0 && [MonotonicClock now] < self.holdUntil) {
+            return;
+        }
+        self.holdUntil = 0;
+    }
+    [self startReplays];
+}
+
+-(void) startReplays {
+    id<AbstractNetworkManager> manager = self.networkManager;
+    if(manager == nil) return;
+
+    NSMutableArray* toStart = [[NSMutableArray alloc] init];
+    @synchronized (self) {
+        if(self.holdUntil != 0) return;
+
+        NSUInteger numInFlight = 0;
+        for(NKRequestOutboxEntry* entry in self.entries) {
+            if(entry.inFlight) numInFlight++;
+        }
+
+        // In order, skipping any entry with an earlier one for the same URL still unsettled:
+        NSMutableSet* busyURLs = [[NSMutableSet alloc] init];
+        for(NKRequestOutboxEntry* entry in self.entries) {
+            if(numInFlight >= MAX(self.maxConcurrentReplays, (NSUInteger)1)) break;
+            if(!entry.inFlight && ![busyURLs containsObject:entry.urlString]) {
+                entry.inFlight = TRUE;
+                entry.numAttempts++;
+                numInFlight++;
+                [toStart addObject:entry];
+            }
+            [busyURLs addObject:entry.urlString];
+        }
+    }
+
+    // The manager may call back before startNetworkCall returns, so this is done unlocked:
+    for(NKRequestOutboxEntry* entry in toStart) {
+        NSMutableURLRequest* request = [manager buildURLRequest:entry.urlString forRequestType:entry.method];
+        if(request == nil) {
+            [self settleEntry:entry delivered:FALSE error:NetworkManagerErrorBadRequest httpStatus:-1 data:nil];
+            continue;
+        }
+        for(NSString* name in entry.headers) {
+            [request setValue:[entry.headers objectForKey:name] forHTTPHeaderField:name];
+        }
+        [request setValue:entry.entryID forHTTPHeaderField:self.idempotencyKeyHeader];
+        request.HTTPBody = entry.body;
+
+        LogD(LOGTAG_NKRO, @"Replaying outbox entry %@ (%@ %@), attempt %u", entry.entryID, entry.method, entry.urlString, entry.numAttempts);
+        [manager startNetworkCall:request withDelegate:self onMainThread:YES withTimeout:0.0 withNumRetries:0 withContext:entry];
+    }
+}
+
+// Takes the entry out for good and tells the delegate:
+-(void) settleEntry:(NKRequestOutboxEntry*)entry delivered:(BOOL)delivered error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    @synchronized (self) {
+        entry.inFlight = FALSE;
+        if([self.entries indexOfObjectIdenticalTo:entry] == NSNotFound) return;
+        [self removeEntry:entry];
+        if(delivered) {
+            self.numEntriesDelivered++;
+        } else {
+            self.numEntriesDropped++;
+            LogW(LOGTAG_NKRO, @"Dropping outbox entry %@ (%@ %@) after %u attempts - the last got %d (error %d)",
+                 entry.entryID, entry.method, entry.urlString, entry.numAttempts, httpStatus, errorType);
+        }
+    }
+
+    id<NKRequestOutboxDelegate> delegate = self.delegate;
+    if(delivered && [delegate respondsToSelector:@selector(requestOutbox:didDeliver:data:)]) {
+        [delegate requestOutbox:self didDeliver:entry data:data];
+    } else if(!delivered && [delegate respondsToSelector:@selector(requestOutbox:didDrop:error:httpStatus:data:)]) {
+        [delegate requestOutbox:self didDrop:entry error:errorType httpStatus:httpStatus data:data];
+    }
+}
+
+// Holds off on replays for a while, and leaves the entry queued unless it's out of attempts:
+-(void) deferEntry:(NKRequestOutboxEntry*)entry error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    BOOL outOfAttempts = FALSE;
+    @synchronized (self) {
+        entry.inFlight = FALSE;
+        self.holdUntil = [MonotonicClock time:[MonotonicClock now] plusSeconds:self.retryIntervalSeconds];
+        outOfAttempts = (self.maxReplayAttempts > 0 && entry.numAttempts >= self.maxReplayAttempts);
+        if(!outOfAttempts) {
+            self.numReplaysDeferred++;
+            LogD(LOGTAG_NKRO, @"Replay of outbox entry %@ failed (error %d) - holding off for %.1lfs", entry.entryID, errorType, self.retryIntervalSeconds);
+        }
+    }
+    if(outOfAttempts) {
+        [self settleEntry:entry delivered:FALSE error:errorType httpStatus:httpStatus data:data];
+    }
+}
+
+
+#pragma mark Callbacks as NetworkManagerDelegate
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didReceiveResponse:(id)context httpStatus:(int)httpStatus {
+    ((NKRequestOutboxEntry*)context).httpStatus = httpStatus;
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
+    NKRequestOutboxEntry* entry = context;
+    [self settleEntry:entry delivered:TRUE error:NetworkManagerErrorNoError httpStatus:entry.httpStatus data:data];
+    [self startReplays];
+}
+
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
+                 error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
+    // A 4xx is the server's final answer, except for the two that mean "not now":
+    BOOL rejected = (httpStatus >= 400 && httpStatus < 500 && httpStatus != 408 && httpStatus != 429);
+    if(rejected) {
+        [self settleEntry:context delivered:FALSE error:errorType httpStatus:httpStatus data:data];
+        [self startReplays];
+    } else {
+        [self deferEntry:context error:errorType httpStatus:httpStatus data:data];
+    }
+}
+
+
+#pragma mark The journal
+
+-(void) flush {
+    dispatch_sync(self.journalQueue, ^{
+        [self syncPendingRecords];
+    });
+}
+
+-(void) compact {
+    dispatch_sync(self.journalQueue, ^{
+        [self rewriteJournal];
+    });
+}
+
+-(NSData*) encodeRecord:(NSDictionary*)plist {
+    NSError* error = nil;
+    NSData* payload = [NSPropertyListSerialization dataWithPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    if(payload == nil || payload.length > UINT32_MAX) {
+        LogE(LOGTAG_NKRO, @"NKRequestOutbox could not encode a record: %@", error);
+        return nil;
+    }
+
+    NSMutableData* record = [NSMutableData dataWithCapacity:4 + payload.length];
+    uint32_t length = OSSwapHostToLittleInt32((uint32_t)payload.length);
+    [record appendBytes:&length length:4];
+    [record appendData:payload];
+    return record;
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Buffers the record and makes sure a sync is coming for it:
+-(void) appendRecord:(NSDictionary*)plist {
+    NSData* record = [self encodeRecord:plist];
+    if(record == nil) return;
+    [self.pendingRecords appendData:record];
+
+    if(!self.syncScheduled) {
+        self.syncScheduled = TRUE;
+        __weak NKRequestOutbox* weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MAX(self.flushInterval, 0.0) * NSEC_PER_SEC)), self.journalQueue, ^{
+            [weakSelf syncPendingRecords];
+        });
+    }
+}
+
+-(BOOL) writeData:(NSData*)data toFD:(int)fd {
+    const uint8_t* bytes = data.bytes;
+    NSUInteger offset = 0;
+    while(offset < data.length) {
+        ssize_t written = write(fd, bytes + offset, data.length - offset);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return FALSE;
+        }
+        offset += (NSUInteger)written;
+    }
+    return (fsync(fd) == 0);
+}
+
+// A rename isn't durable until the directory it happened in is synced too:
+-(BOOL) syncDirectoryOfPath:(NSString*)path {
+    int fd = open([[path stringByDeletingLastPathComponent] fileSystemRepresentation], O_RDONLY);
+    if(fd < 0) return FALSE;
+    BOOL ok = (fsync(fd) == 0);
+    close(fd);
+    return ok;
+}
+
+// ONLY CALL THIS ON THE JOURNAL QUEUE!!!
+// Writes everything buffered in one go, and one fsync for all of it:
+-(void) syncPendingRecords {
+    NSData* chunk = nil;
+    BOOL needsRewrite = FALSE;
+    @synchronized (self) {
+        chunk = [self.pendingRecords copy];
+        [self.pendingRecords setLength:0];
+        self.syncScheduled = FALSE;
+        needsRewrite = (self.numDeadRecords >= kMinDeadRecordsForRewrite && self.numDeadRecords > 2 * self.entries.count);
+    }
+
+    if(chunk.length > 0 && _fd >= 0) {
+        if([self writeData:chunk toFD:_fd]) {
+            self.numJournalSyncs++;
+        } else {
+            LogE(LOGTAG_NKRO, @"NKRequestOutbox write to %@ failed (errno %d)", self.fileURL, errno);
+        }
+    }
+
+    if(needsRewrite) {
+        [self rewriteJournal];
+    }
+}
+
+// ONLY CALL THIS ON THE JOURNAL QUEUE!!!
+// Writes just the live entries to a new file and swaps it in.  The new file is complete
+// and synced before the rename, so a crash leaves either the old journal or the new one.
+-(void) rewriteJournal {
+    NSMutableData* contents = [NSMutableData dataWithBytes:kOutboxFileMagic length:sizeof(kOutboxFileMagic)];
+    NSData* leftover = nil;
+    @synchronized (self) {
+        for(NKRequestOutboxEntry* entry in self.entries) {
+            NSData* record = [self encodeRecord:[entry plist]];
+            if(record != nil) [contents appendData:record];
+        }
+
+        // What was waiting to be synced is already in here:
+        leftover = [self.pendingRecords copy];
+        [self.pendingRecords setLength:0];
+        self.numDeadRecords = 0;
+    }
+
+    NSString* path = [self.fileURL path];
+    NSString* tempPath = [path stringByAppendingString:@".rewrite"];
+    int fd = open([tempPath fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    BOOL ok = (fd >= 0) && [self writeData:contents toFD:fd];
+    ok = ok && (rename([tempPath fileSystemRepresentation], [path fileSystemRepresentation]) == 0);
+
+    if(!ok) {
+        // Keep the old journal, and put back what it was missing:
+        LogE(LOGTAG_NKRO, @"NKRequestOutbox could not rewrite %@ (errno %d)", self.fileURL, errno);
+        if(fd >= 0) {
+            close(fd);
+            unlink([tempPath fileSystemRepresentation]);
+        }
+        if(leftover.length > 0 && _fd >= 0 && [self writeData:leftover toFD:_fd]) {
+            self.numJournalSyncs++;
+        }
+        return;
+    }
+
+    if(_fd >= 0) {
+        close(_fd);
+    }
+    _fd = fd;
+    if(![self syncDirectoryOfPath:path]) {
+        LogW(LOGTAG_NKRO, @"NKRequestOutbox could not sync the directory of %@ (errno %d)", self.fileURL, errno);
+    }
+    self.numJournalSyncs++;
+    self.numJournalRewrites++;
+    LogD(LOGTAG_NKRO, @"Rewrote outbox journal %@ with %lu bytes", self.fileURL, (unsigned long)contents.length);
+}
+
+// Reads the journal into entries.  Sets *needsRewrite if the file has dead records or a
+// cut-off tail (appending after a cut-off record would make everything after it unreadable).
+// Returns FALSE if the file isn't an outbox journal.
+-(BOOL) loadJournal:(BOOL*)needsRewrite {
+    NSError* error = nil;
+    NSData* data = [NSData dataWithContentsOfURL:self.fileURL options:NSDataReadingMappedIfSafe error:&error];
+    if(data == nil) {
+        LogE(LOGTAG_NKRO, @"NKRequestOutbox could not read %@: %@", self.fileURL, error);
+        return FALSE;
+    }
+
+    // A new file gets the magic.  An old one had better already have it:
+    if(data.length == 0) {
+        if(![self writeData:[NSData dataWithBytes:kOutboxFileMagic length:sizeof(kOutboxFileMagic)] toFD:_fd]) {
+            LogE(LOGTAG_NKRO, @"NKRequestOutbox could not start %@ (errno %d)", self.fileURL, errno);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(data.length < sizeof(kOutboxFileMagic) || memcmp(data.bytes, kOutboxFileMagic, sizeof(kOutboxFileMagic)) != 0) {
+        LogE(LOGTAG_NKRO, @"NKRequestOutbox won't use %@ - it isn't an outbox journal", self.fileURL);
+        return FALSE;
+    }
+
+    NSMutableArray* entries = [[NSMutableArray alloc] init];
+    NSMutableDictionary* entriesByID = [[NSMutableDictionary alloc] init];
+    NSUInteger numDeadRecords = 0;
+    const uint8_t* bytes = data.bytes;
+    NSUInteger offset = sizeof(kOutboxFileMagic);
+
+    while(offset < data.length) {
+        uint32_t length = 0;
+        if(offset + 4 <= data.length) {
+            memcpy(&length, bytes + offset, 4);
+            length = OSSwapLittleToHostInt32(length);
+        }
+        if(offset + 4 > data.length || offset + 4 + length > data.length) {
+            LogW(LOGTAG_NKRO, @"%@ ends with a cut-off record - ignoring it", self.fileURL);
+            *needsRewrite = TRUE;
+            break;
+        }
+
+        NSData* payload = [data subdataWithRange:NSMakeRange(offset + 4, length)];
+        NSDictionary* plist = [NSPropertyListSerialization propertyListWithData:payload options:NSPropertyListImmutable format:NULL error:&error];
+        NSString* op = [plist isKindOfClass:[NSDictionary class]] ? [plist objectForKey:kKeyOp] : nil;
+        NSString* entryID = [plist isKindOfClass:[NSDictionary class]] ? [plist objectForKey:kKeyID] : nil;
+        NKRequestOutboxEntry* entry = [op isEqual:kOpAdd] ? [NKRequestOutboxEntry entryWithPlist:plist] : nil;
+
+        if(entry != nil) {
+            [entries addObject:entry];
+            [entriesByID setObject:entry forKey:entry.entryID];
+        } else if([op isEqual:kOpRemove] && [entryID isKindOfClass:[NSString class]]) {
+            NKRequestOutboxEntry* removed = [entriesByID objectForKey:entryID];
+            if(removed != nil) {
+                [entries removeObjectIdenticalTo:removed];
+                [entriesByID removeObjectForKey:entryID];
+            }
+            numDeadRecords += 2;
+        } else {
+            LogW(LOGTAG_NKRO, @"%@ has an unreadable record at offset %lu - stopping there", self.fileURL, (unsigned long)offset);
+            *needsRewrite = TRUE;
+            break;
+        }
+        offset += 4 + length;
+    }
+
+    @synchronized (self) {
+        [self.entries setArray:entries];
+        self.numDeadRecords = numDeadRecords;
+    }
+    if(numDeadRecords > 0) *needsRewrite = TRUE;
+    LogD(LOGTAG_NKRO, @"Loaded %lu queued entries from %@", (unsigned long)entries.count, self.fileURL);
+    return TRUE;
+}
+
+@end
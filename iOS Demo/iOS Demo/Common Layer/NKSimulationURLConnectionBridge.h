@@ -0,0 +1,137 @@
+//
+//  NKSimulationURLConnectionBridge.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** An NKURLConnectionBridge with no network behind it.  Its connections get their responses
+    from a responder block, and everything about HOW those responses arrive - latency,
+    bandwidth, stalls, dropped connections, errors - comes from an NKSimulationProfile and a
+    seeded random number generator.  Time is an NKVirtualClock, so nothing happens until the
+    clock is advanced, and then the delegate callbacks run on the thread that advanced it.
+
+    Same seed, same profile, same responder, same order of calls: same run, every time.  A
+    10,000-call load plays out in however long the callbacks take to run, not in however
+    long the simulated network would have taken.
+
+    Connections are scheduled and started through the bridge like any other, but the run
+    loop they're scheduled in is ignored - the clock is what drives them.
+
+    Only the connections run on the clock.  The managers' own call timeouts and retry
+    delays are still wall-clock NSTimers, so a hang here stays hung until a real timeout
+    fires; a simulated run that wants to see those needs hangProbability at 0 or real
+    time to pass. */
+
+#import <Foundation/Foundation.h>
+#import "NKURLConnectionBridge.h"
+#import "NKVirtualClock.h"
+
+
+// What the simulated server sends back:
+@interface NKSimulatedResponse : NSObject
+
++(NKSimulatedResponse*) responseWithStatus:(int)statusCode headers:(NSDictionary*)headers body:(NSData*)body;
+
+@property (nonatomic) int statusCode;
+@property (nonatomic, retain) NSDictionary* headers;   // Content-Length is filled in if it's missing
+@property (nonatomic, retain) NSData* body;
+
+@end
+
+typedef NKSimulatedResponse* (^NKSimulationResponder)(NSURLRequest* request);
+
+
+// How long it takes for the response header to arrive after a connection starts:
+//    - Fixed:       always latencySeconds.
+//    - Uniform:     anywhere in latencySeconds +/- latencySpreadSeconds.
+//    - Exponential: latencySeconds plus an exponential tail with mean latencySpreadSeconds.
+//    - LogNormal:   median of latencySeconds, and latencySpreadSeconds is the sigma of the
+//                   log.  This is the one that looks most like a real cell network.
+typedef enum {
+    NKSimulationLatencyFixed = 0,
+    NKSimulationLatencyUniform,
+    NKSimulationLatencyExponential,
+    NKSimulationLatencyLogNormal,
+} NKSimulationLatencyDistribution;
+
+
+// The network conditions.  The defaults are a perfect network: no latency, no bandwidth
+// limit, and nothing ever goes wrong.  Probabilities are 0.0 to 1.0.
+@interface NKSimulationProfile : NSObject
+
+@property (nonatomic) NKSimulationLatencyDistribution latencyDistribution;
+@property (nonatomic) double latencySeconds;
+@property (nonatomic) double latencySpreadSeconds;
+
+// One link shared by every connection, so concurrent bodies compete for it.  Zero means
+// unlimited.  Bodies are sent over it in chunks of chunkSize bytes (default 16KB).
+@property (nonatomic) double     bandwidthBytesPerSecond;
+@property (nonatomic) NSUInteger chunkSize;
+
+// Per chunk: the chance the chunk is held up as if a packet was lost and retransmitted,
+// and the mean length of that stall (exponentially distributed).
+@property (nonatomic) double stallProbability;
+@property (nonatomic) double stallSeconds;
+
+// Per connection: the chance the connection drops partway through the body (the delegate
+// gets NSURLErrorNetworkConnectionLost after a random number of bytes), and the chance it
+// never answers at all (only a timeout in the network manager will get it back).
+@property (nonatomic) double disconnectProbability;
+@property (nonatomic) double hangProbability;
+
+// Per connection: the chance of an error instead of the scripted response, and which error.
+// errorMix maps codes to relative weights (both NSNumbers).  Codes of 100 and up are HTTP
+// statuses sent with an empty body; negative codes are NSURLErrorDomain errors delivered
+// through didFailWithError (-1001 timed out, -1009 offline, etc).
+@property (nonatomic) double errorProbability;
+@property (nonatomic, retain) NSDictionary* errorMix;
+
+@end
+
+
+// The connections this bridge hands out:
+@interface NKSimulatedURLConnection : NSURLConnection
+
+@property (nonatomic, readonly) NSURLRequest* simulatedRequest;
+@property (nonatomic, readonly, weak) id simulatedDelegate;
+
+@end
+
+
+@interface NKSimulationURLConnectionBridge : NSObject <NKURLConnectionBridge>
+
+// A nil responder answers 404 to everything.
+-(NKSimulationURLConnectionBridge*) initWithClock:(NKVirtualClock*)clock
+                                             seed:(UInt64)seed
+                                        responder:(NKSimulationResponder)responder;
+
+@property (nonatomic, readonly) NKVirtualClock* clock;
+@property (nonatomic, readonly) UInt64 seed;
+
+// Changes take effect for connections started after the change.
+@property (atomic, retain) NKSimulationProfile* profile;
+
+// From NKURLConnectionBridge:
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately;
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode;
+-(void) startConnection:(NSURLConnection*)connection;
+-(void) cancelConnection:(NSURLConnection*)connection;
+
+// Subclasses that script responses or timing some other way can override these.  They're
+// called once per started connection.
+-(NKSimulatedResponse*) responseForRequest:(NSURLRequest*)request;
+-(double) latencyForRequest:(NSURLRequest*)request;
+
+// What happened so far:
+@property (atomic, readonly) UInt64 numConnectionsStarted;
+@property (atomic, readonly) UInt64 numConnectionsFinished;   // got connectionDidFinishLoading
+@property (atomic, readonly) UInt64 numConnectionsCanceled;
+@property (atomic, readonly) UInt64 numDisconnects;
+@property (atomic, readonly) UInt64 numHangs;
+@property (atomic, readonly) UInt64 numInjectedErrors;
+@property (atomic, readonly) UInt64 numStalls;
+@property (atomic, readonly) UInt64 numBodyBytesDelivered;
+
+@end
@@ -0,0 +1,415 @@
+//
+//  NKSimulationURLConnectionBridge.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKSimulationURLConnectionBridge.h"
+#import "Logging.h"
+#import <math.h>
+
+NSString* const LOGTAG_SIM = @"network";
+
+#define kDefaultSimulationChunkSize 16384
+
+
+#pragma mark - Random numbers
+
+// xorshift64* - small, fast, and the same on every device, which is the whole point.
+// (random() and friends aren't guaranteed to be.)
+static inline UInt64 nextRandom(UInt64* state) {
+    UInt64 x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// splitmix64, to turn any seed (even 0) into a good starting state:
+static inline UInt64 mixSeed(UInt64 seed) {
+    UInt64 z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (z == 0) ? 1 : z;
+}
+
+
+#pragma mark - Responses and profiles
+
+@implementation NKSimulatedResponse
+
++(NKSimulatedResponse*) responseWithStatus:(int)statusCode headers:(NSDictionary*)headers body:(NSData*)body {
+    NKSimulatedResponse* response = [[NKSimulatedResponse alloc] init];
+    response.statusCode = statusCode;
+    response.headers = (headers != nil) ? headers : [NSDictionary dictionary];
+    response.body = (body != nil) ? body : [NSData data];
+    return response;
+}
+
+@end
+
+
+@implementation NKSimulationProfile
+
+-(NKSimulationProfile*) init {
+    if(self = [super init]) {
+        self.latencyDistribution = NKSimulationLatencyFixed;
+        self.latencySeconds = 0.0;
+        self.latencySpreadSeconds = 0.0;
+        self.bandwidthBytesPerSecond = 0.0;
+        self.chunkSize = kDefaultSimulationChunkSize;
+        self.stallProbability = 0.0;
+        self.stallSeconds = 0.0;
+        self.disconnectProbability = 0.0;
+        self.hangProbability = 0.0;
+        self.errorProbability = 0.0;
+        self.errorMix = nil;
+    }
+    return self;
+}
+
+@end
+
+
+#pragma mark - Connections
+
+@interface NKSimulatedURLConnection ()
+
+@property (nonatomic, retain) NSURLRequest* simulatedRequest;
+@property (nonatomic, weak)   id simulatedDelegate;
+
+// Set up when the connection starts:
+@property (nonatomic, retain) NKSimulationProfile* profile;
+@property (nonatomic, retain) NSData* body;
+@property (nonatomic) NSUInteger stopAtByte;
+@property (nonatomic) BOOL disconnects;
+
+// State.  These are only touched under the bridge's lock or from clock events:
+@property (atomic) BOOL started;
+@property (atomic) BOOL canceled;
+@property (atomic) BOOL done;
+@property (nonatomic) NSUInteger bytesDelivered;
+
+@end
+
+@implementation NKSimulatedURLConnection
+
+-(NKSimulatedURLConnection*) initWithSimulatedRequest:(NSURLRequest*)request delegate:(id)delegate {
+    if(self = [super init]) {
+        self.simulatedRequest = request;
+        self.simulatedDelegate = delegate;
+        self.started = FALSE;
+        self.canceled = FALSE;
+        self.done = FALSE;
+        self.bytesDelivered = 0;
+    }
+    return self;
+}
+
+// These only make sense for a real connection.  The bridge drives us instead:
+-(void) scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode { }
+-(void) start { }
+-(void) cancel {
+    self.canceled = TRUE;
+}
+
+@end
+
+
+#pragma mark - The bridge
+
+@interface NKSimulationURLConnectionBridge () {
+    UInt64 _randomState;
+}
+
+@property (nonatomic, retain) NKVirtualClock* clock;
+@property (nonatomic) UInt64 seed;
+@property (nonatomic, copy) NKSimulationResponder responder;
+
+// When the shared link will be free to carry the next chunk:
+@property (nonatomic) double linkFreeAt;
+
+@property (atomic) UInt64 numConnectionsStarted;
+@property (atomic) UInt64 numConnectionsFinished;
+@property (atomic) UInt64 numConnectionsCanceled;
+@property (atomic) UInt64 numDisconnects;
+@property (atomic) UInt64 numHangs;
+@property (atomic) UInt64 numInjectedErrors;
+@property (atomic) UInt64 numStalls;
+@property (atomic) UInt64 numBodyBytesDelivered;
+
+@end
+
+
+@implementation NKSimulationURLConnectionBridge
+
+-(NKSimulationURLConnectionBridge*) initWithClock:(NKVirtualClock*)clock seed:(UInt64)seed responder:(NKSimulationResponder)responder {
+    if(self = [super init]) {
+        self.clock = clock;
+        self.seed = seed;
+        self.responder = responder;
+        self.profile = [[NKSimulationProfile alloc] init];
+        self.linkFreeAt = 0.0;
+        _randomState = mixSeed(seed);
+    }
+    return self;
+}
+
+
+#pragma mark NKURLConnectionBridge
+
+-(NSURLConnection*) getConnection:(NSURLRequest*)request delegate:(id)delegate startImmediately:(BOOL)startImmediately {
+    NKSimulatedURLConnection* connection = [[NKSimulatedURLConnection alloc] initWithSimulatedRequest:request delegate:delegate];
+    if(startImmediately) {
+        [self startConnection:connection];
+    }
+    return connection;
+}
+
+-(void) scheduleConnection:(NSURLConnection*)connection inRunLoop:(NSRunLoop*)runLoop forMode:(NSString*)mode {
+    // Nothing to do - the clock drives simulated connections.
+}
+
+-(void) startConnection:(NSURLConnection*)a_connection {
+    if(![a_connection isKindOfClass:[NKSimulatedURLConnection class]]) {
+        LogE(LOGTAG_SIM, @"NKSimulationURLConnectionBridge can't start a connection it didn't make: %@", a_connection);
+        return;
+    }
+    NKSimulatedURLConnection* connection = (NKSimulatedURLConnection*)a_connection;
+
+    NKSimulationProfile* profile = nil;
+    double latency = 0.0;
+    BOOL hangs = FALSE;
+    int errorCode = 0;
+    double disconnectFraction = -1.0;
+
+    @synchronized (self) {
+        if(connection.started || connection.canceled) {
+            return;
+        }
+        connection.started = TRUE;
+        self.numConnectionsStarted++;
+        profile = self.profile;
+
+        // Every connection takes the same number of draws no matter how things turn out, so
+        // changing one knob in the profile doesn't reshuffle everything that comes after it:
+        latency = [self latencyForRequest:connection.simulatedRequest];
+        double hangRoll       = [self nextDouble];
+        double errorRoll      = [self nextDouble];
+        double errorPick      = [self nextDouble];
+        double disconnectRoll = [self nextDouble];
+        double disconnectAt   = [self nextDouble];
+
+        if(hangRoll < profile.hangProbability) {
+            hangs = TRUE;
+            self.numHangs++;
+        } else if(errorRoll < profile.errorProbability && (errorCode = [self errorCodeFromMix:profile.errorMix pick:errorPick]) != 0) {
+            self.numInjectedErrors++;
+        }
+        if(disconnectRoll < profile.disconnectProbability) {
+            disconnectFraction = disconnectAt;
+        }
+    }
+
+    if(hangs) {
+        return;
+    }
+
+    // The responder runs outside the lock in case it wants to look at the bridge:
+    NKSimulatedResponse* response = nil;
+    if(errorCode >= 100) {
+        response = [NKSimulatedResponse responseWithStatus:errorCode headers:nil body:nil];
+    } else if(errorCode == 0) {
+        response = [self responseForRequest:connection.simulatedRequest];
+        if(response == nil) {
+            response = [NKSimulatedResponse responseWithStatus:404 headers:nil body:nil];
+        }
+    }
+
+    connection.profile = profile;
+    connection.body = response.body;
+    connection.stopAtByte = response.body.length;
+    if(disconnectFraction >= 0.0 && response.body.length > 0) {
+        connection.disconnects = TRUE;
+        connection.stopAtByte = (NSUInteger)(disconnectFraction * response.body.length);
+    }
+
+    [self.clock scheduleAfterDelay:latency block:^{
+        if(connection.canceled) return;
+
+        if(errorCode < 0) {
+            [self failConnection:connection code:errorCode];
+            return;
+        }
+
+        NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:response.headers];
+        if([headers objectForKey:@"Content-Length"] == nil) {
+            [headers setObject:[NSString stringWithFormat:@"%lu", (unsigned long)response.body.length] forKey:@"Content-Length"];
+        }
+        NSHTTPURLResponse* httpResponse = [[NSHTTPURLResponse alloc] initWithURL:connection.simulatedRequest.URL statusCode:response.statusCode
+                                                                     HTTPVersion:@"HTTP/1.1" headerFields:headers];
+
+        id delegate = connection.simulatedDelegate;
+        if([delegate respondsToSelector:@selector(connection:didReceiveResponse:)]) {
+            [delegate connection:connection didReceiveResponse:httpResponse];
+        }
+        [self sendNextChunk:connection];
+    }];
+}
+
+-(void) cancelConnection:(NSURLConnection*)connection {
+    if(![connection isKindOfClass:[NKSimulatedURLConnection class]]) {
+        return;
+    }
+    NKSimulatedURLConnection* simulated = (NKSimulatedURLConnection*)connection;
+
+    @synchronized (self) {
+        if(!simulated.canceled && simulated.started && !simulated.done) {
+            self.numConnectionsCanceled++;
+        }
+        [simulated cancel];
+    }
+}
+
+
+#pragma mark Scripting hooks
+
+-(NKSimulatedResponse*) responseForRequest:(NSURLRequest*)request {
+    return (self.responder != nil) ? self.responder(request) : nil;
+}
+
+// CALLED FROM A SYNCHRONIZED BLOCK.  Always takes two draws.
+-(double) latencyForRequest:(NSURLRequest*)request {
+    NKSimulationProfile* profile = self.profile;
+    double u1 = [self nextDouble];
+    double u2 = [self nextDouble];
+    double latency = profile.latencySeconds;
+
+    switch (profile.latencyDistribution) {
+        default: case NKSimulationLatencyFixed:
+            break;
+        case NKSimulationLatencyUniform:
+            latency += (2.0*u1 - 1.0) * profile.latencySpreadSeconds;
+            break;
+        case NKSimulationLatencyExponential:
+            latency += -profile.latencySpreadSeconds * log(1.0 - u1);
+            break;
+        case NKSimulationLatencyLogNormal: {
+            // Box-Muller for a standard normal:
+            double normal = sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+            latency *= exp(profile.latencySpreadSeconds * normal);
+            break;
+        }
+    }
+    return MAX(latency, 0.0);
+}
+
+
+#pragma mark Delivery
+
+// Sends the next chunk of the body over the shared link, or ends the connection if
+// there's nothing more to send.  Runs on the clock.
+-(void) sendNextChunk:(NKSimulatedURLConnection*)connection {
+    if(connection.canceled) return;
+
+    if(connection.bytesDelivered >= connection.stopAtByte) {
+        if(connection.disconnects) {
+            @synchronized (self) {
+                self.numDisconnects++;
+            }
+            [self failConnection:connection code:NSURLErrorNetworkConnectionLost];
+        } else {
+            connection.done = TRUE;
+            @synchronized (self) {
+                self.numConnectionsFinished++;
+            }
+            id delegate = connection.simulatedDelegate;
+            if([delegate respondsToSelector:@selector(connectionDidFinishLoading:)]) {
+                [delegate connectionDidFinishLoading:connection];
+            }
+        }
+        return;
+    }
+
+    NKSimulationProfile* profile = connection.profile;
+    NSUInteger length = MIN(MAX(profile.chunkSize, 1), connection.stopAtByte - connection.bytesDelivered);
+    double deliverAt = self.clock.now;
+
+    @synchronized (self) {
+        if(profile.bandwidthBytesPerSecond > 0.0) {
+            deliverAt = MAX(deliverAt, self.linkFreeAt) + length / profile.bandwidthBytesPerSecond;
+            self.linkFreeAt = deliverAt;
+        }
+        // Two draws for every chunk, stalled or not, for the same reason as in startConnection:
+        double stallRoll   = [self nextDouble];
+        double stallLength = [self nextDouble];
+        if(stallRoll < profile.stallProbability) {
+            deliverAt += -profile.stallSeconds * log(1.0 - stallLength);
+            self.numStalls++;
+        }
+    }
+
+    [self.clock scheduleAtTime:deliverAt block:^{
+        if(connection.canceled) return;
+
+        NSData* chunk = [connection.body subdataWithRange:NSMakeRange(connection.bytesDelivered, length)];
+        connection.bytesDelivered += length;
+        @synchronized (self) {
+            self.numBodyBytesDelivered += length;
+        }
+
+        id delegate = connection.simulatedDelegate;
+        if([delegate respondsToSelector:@selector(connection:didReceiveData:)]) {
+            [delegate connection:connection didReceiveData:chunk];
+        }
+        [self sendNextChunk:connection];
+    }];
+}
+
+-(void) failConnection:(NKSimulatedURLConnection*)connection code:(NSInteger)code {
+    connection.done = TRUE;
+    NSError* error = [NSError errorWithDomain:NSURLErrorDomain code:code
+                                     userInfo:@{ NSURLErrorFailingURLErrorKey : connection.simulatedRequest.URL }];
+    id delegate = connection.simulatedDelegate;
+    if([delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+        [delegate connection:connection didFailWithError:error];
+    }
+}
+
+
+#pragma mark Helpers
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Uniform in [0, 1).
+-(double) nextDouble {
+    return (nextRandom(&_randomState) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Picks a code from the weighted mix with pick in [0, 1).  We walk the codes in sorted
+// order because NSDictionary's order isn't something to build a repeatable run on.
+-(int) errorCodeFromMix:(NSDictionary*)errorMix pick:(double)pick {
+    NSArray* codes = [[errorMix allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    double total = 0.0;
+    for(NSNumber* code in codes) {
+        total += MAX([[errorMix objectForKey:code] doubleValue], 0.0);
+    }
+    if(total <= 0.0) {
+        return 0;
+    }
+
+    double target = pick * total;
+    for(NSNumber* code in codes) {
+        target -= MAX([[errorMix objectForKey:code] doubleValue], 0.0);
+        if(target < 0.0) {
+            return [code intValue];
+        }
+    }
+    return [[codes lastObject] intValue];
+}
+
+@end
@@ -0,0 +1,84 @@
+//
+//  NKTrafficRecorder.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Records network traffic to a file so it can be replayed later (see
+    NKReplayURLConnectionBridge).  Each connection attempt becomes one NKTrafficRecord:
+    what was asked for, what came back, and when.
+
+    The file is append-only.  It starts with an 8-byte magic string, and each record after
+    that is a 4-byte little-endian length followed by that many bytes of binary plist.  A
+    record goes out in a single write, so a crash can only ever cut off the last record, and
+    the reader just stops there.  Writes happen on a private serial queue so the thread
+    making the call never waits on the disk.
+
+    NKTrafficRecorder is thread-safe. */
+
+#import <Foundation/Foundation.h>
+
+@interface NKTrafficRecord : NSObject
+
+// When the connection started, in seconds since the recorder started, and how long after
+// that the response header came (-1 if it never did) and the connection ended:
+@property (nonatomic) double startTime;
+@property (nonatomic) double responseDelay;
+@property (nonatomic) double duration;
+
+// The request:
+@property (nonatomic, retain) NSString* method;
+@property (nonatomic, retain) NSString* urlString;
+@property (nonatomic, retain) NSDictionary* requestHeaders;
+@property (nonatomic) unsigned long long requestBodyLength;
+
+// The response.  statusCode is -1 if there wasn't one.  bodyLength is how many bytes
+// actually arrived; body may be shorter than that if the recorder was told to cap it.
+@property (nonatomic) int statusCode;
+@property (nonatomic, retain) NSDictionary* responseHeaders;
+@property (nonatomic) unsigned long long bodyLength;
+@property (nonatomic, retain) NSData* body;
+
+// If the connection failed, the NSURLErrorDomain code (0 otherwise).  A failure after a
+// response means the connection dropped partway through the body.
+@property (nonatomic) NSInteger errorCode;
+
+// "GET http://..." - what replay matches on:
+-(NSString*) matchKey;
+
+@end
+
+
+@interface NKTrafficRecorder : NSObject
+
+// Creates the file if it isn't there; appends to it if it is.  Returns nil if the file
+// can't be opened.
+-(NKTrafficRecorder*) initWithFileURL:(NSURL*)fileURL;
+
+@property (nonatomic, readonly) NSURL* fileURL;
+
+// Bodies longer than this are cut off in the file (the real length is still recorded,
+// and replay pads them back out).  Zero, the default, records bodies in full.
+@property (atomic) unsigned long long maxRecordedBodyLength;
+
+// Seconds since this recorder was made, on a clock that doesn't jump.  Use this for the
+// times in the records you hand to appendRecord:.
+-(double) currentTime;
+
+-(void) appendRecord:(NKTrafficRecord*)record;
+
+@property (atomic, readonly) UInt64 numRecordsWritten;
+
+// Waits for everything appended so far to reach the file:
+-(void) flush;
+
+// Flushes and closes the file.  Later appends are dropped.
+-(void) close;
+
+// Reads back every complete record in the file, in the order they were written.  Returns
+// nil if the file can't be read or isn't a traffic recording.
++(NSArray*) recordsFromFileURL:(NSURL*)fileURL;
+
+@end
@@ -0,0 +1,250 @@
+//
+//  NKTrafficRecorder.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKTrafficRecorder.h"
+#import "Logging.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <libkern/OSByteOrder.h>
+
+NSString* const LOGTAG_NKTR = @"network";
+
+static const char kTrafficFileMagic[8] = { 'N', 'K', 'T', 'R', 'A', 'F', '0', '1' };
+
+// Keys in each record's plist.  Short, because there are a lot of records:
+#define kKeyStartTime       @"t"
+#define kKeyResponseDelay   @"rd"
+#define kKeyDuration        @"d"
+#define kKeyMethod          @"m"
+#define kKeyURL             @"u"
+#define kKeyRequestHeaders  @"qh"
+#define kKeyRequestBodyLen  @"ql"
+#define kKeyStatus          @"s"
+#define kKeyHeaders         @"h"
+#define kKeyBodyLength      @"bl"
+#define kKeyBody            @"b"
+#define kKeyError           @"e"
+
+
+#pragma mark - NKTrafficRecord
+
+@interface NKTrafficRecord ()
+
+-(NSDictionary*) plistWithMaxBodyLength:(unsigned long long)maxBodyLength;
++(NKTrafficRecord*) recordWithPlist:(NSDictionary*)plist;
+
+@end
+
+@implementation NKTrafficRecord
+
+-(NKTrafficRecord*) init {
+    if(self = [super init]) {
+        self.startTime = 0.0;
+        self.responseDelay = -1.0;
+        self.duration = 0.0;
+        self.method = @"GET";
+        self.urlString = @"";
+        self.requestHeaders = nil;
+        self.requestBodyLength = 0;
+        self.statusCode = -1;
+        self.responseHeaders = nil;
+        self.bodyLength = 0;
+        self.body = nil;
+        self.errorCode = 0;
+    }
+    return self;
+}
+
+-(NSString*) matchKey {
+    return [NSString stringWithFormat:@"%@ %@", self.method, self.urlString];
+}
+
+-(NSDictionary*) plistWithMaxBodyLength:(unsigned long long)maxBodyLength {
+    NSMutableDictionary* plist = [[NSMutableDictionary alloc] init];
+    [plist setObject:@(self.startTime)      forKey:kKeyStartTime];
+    [plist setObject:@(self.responseDelay)  forKey:kKeyResponseDelay];
+    [plist setObject:@(self.duration)       forKey:kKeyDuration];
+    [plist setObject:(self.method != nil) ? self.method : @"GET"   forKey:kKeyMethod];
+    [plist setObject:(self.urlString != nil) ? self.urlString : @"" forKey:kKeyURL];
+    [plist setObject:@(self.requestBodyLength) forKey:kKeyRequestBodyLen];
+    [plist setObject:@(self.statusCode)     forKey:kKeyStatus];
+    [plist setObject:@(self.bodyLength)     forKey:kKeyBodyLength];
+    [plist setObject:@(self.errorCode)      forKey:kKeyError];
+
+    if(self.requestHeaders.count > 0)  [plist setObject:self.requestHeaders  forKey:kKeyRequestHeaders];
+    if(self.responseHeaders.count > 0) [plist setObject:self.responseHeaders forKey:kKeyHeaders];
+
+    NSData* body = self.body;
+    if(maxBodyLength > 0 && body.length > maxBodyLength) {
+        body = [body subdataWithRange:NSMakeRange(0, (NSUInteger)maxBodyLength)];
+    }
+    if(body.length > 0) [plist setObject:body forKey:kKeyBody];
+
+    return plist;
+}
+
++(NKTrafficRecord*) recordWithPlist:(NSDictionary*)plist {
+    if(![plist isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+
+    NKTrafficRecord* record = [[NKTrafficRecord alloc] init];
+    record.startTime         = [[plist objectForKey:kKeyStartTime] doubleValue];
+    record.responseDelay     = [[plist objectForKey:kKeyResponseDelay] doubleValue];
+    record.duration          = [[plist objectForKey:kKeyDuration] doubleValue];
+    record.method            = [plist objectForKey:kKeyMethod];
+    record.urlString         = [plist objectForKey:kKeyURL];
+    record.requestHeaders    = [plist objectForKey:kKeyRequestHeaders];
+    record.requestBodyLength = [[plist objectForKey:kKeyRequestBodyLen] unsignedLongLongValue];
+    record.statusCode        = [[plist objectForKey:kKeyStatus] intValue];
+    record.responseHeaders   = [plist objectForKey:kKeyHeaders];
+    record.bodyLength        = [[plist objectForKey:kKeyBodyLength] unsignedLongLongValue];
+    record.body              = [plist objectForKey:kKeyBody];
+    record.errorCode         = [[plist objectForKey:kKeyError] integerValue];
+    return record;
+}
+
+@end
+
+
+#pragma mark - NKTrafficRecorder
+
+@interface NKTrafficRecorder () {
+    int _fd;
+}
+
+@property (nonatomic, retain) NSURL* fileURL;
+@property (nonatomic, retain) dispatch_queue_t writeQueue;
+@property (nonatomic) NSTimeInterval startUptime;
+@property (atomic) UInt64 numRecordsWritten;
+
+@end
+
+
+@implementation NKTrafficRecorder
+
+-(NKTrafficRecorder*) initWithFileURL:(NSURL*)fileURL {
+    if(self = [super init]) {
+        self.fileURL = fileURL;
+        self.writeQueue = dispatch_queue_create("iosdemo.trafficrecorder", DISPATCH_QUEUE_SERIAL);
+        self.startUptime = [[NSProcessInfo processInfo] systemUptime];
+        self.maxRecordedBodyLength = 0;
+        self.numRecordsWritten = 0;
+
+        _fd = open([fileURL fileSystemRepresentation], O_RDWR | O_CREAT | O_APPEND, 0644);
+        if(_fd < 0) {
+            LogE(LOGTAG_NKTR, @"NKTrafficRecorder could not open %@ (errno %d)", fileURL, errno);
+            return nil;
+        }
+
+        // A new file gets the magic.  An old one had better already have it:
+        char magic[sizeof(kTrafficFileMagic)];
+        ssize_t n = pread(_fd, magic, sizeof(magic), 0);
+        if(n == 0) {
+            write(_fd, kTrafficFileMagic, sizeof(kTrafficFileMagic));
+        } else if(n != sizeof(magic) || memcmp(magic, kTrafficFileMagic, sizeof(magic)) != 0) {
+            LogE(LOGTAG_NKTR, @"NKTrafficRecorder won't append to %@ - it isn't a traffic recording", fileURL);
+            close(_fd);
+            _fd = -1;
+            return nil;
+        }
+    }
+    return self;
+}
+
+-(void) dealloc {
+    if(_fd >= 0) {
+        close(_fd);
+    }
+}
+
+-(double) currentTime {
+    return [[NSProcessInfo processInfo] systemUptime] - self.startUptime;
+}
+
+-(void) appendRecord:(NKTrafficRecord*)record {
+    // Serialize on the caller's thread (the record may change after we return), write later:
+    NSError* error = nil;
+    NSData* payload = [NSPropertyListSerialization dataWithPropertyList:[record plistWithMaxBodyLength:self.maxRecordedBodyLength]
+                                                                 format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    if(payload == nil || payload.length > UINT32_MAX) {
+        LogE(LOGTAG_NKTR, @"NKTrafficRecorder could not encode a record for %@: %@", record.urlString, error);
+        return;
+    }
+
+    NSMutableData* chunk = [NSMutableData dataWithCapacity:4 + payload.length];
+    uint32_t length = OSSwapHostToLittleInt32((uint32_t)payload.length);
+    [chunk appendBytes:&length length:4];
+    [chunk appendData:payload];
+
+    dispatch_async(self.writeQueue, ^{
+        if(_fd < 0) return;
+
+        // One write per record keeps records whole, even with other writers on the file:
+        ssize_t written = write(_fd, chunk.bytes, chunk.length);
+        if(written != (ssize_t)chunk.length) {
+            LogE(LOGTAG_NKTR, @"NKTrafficRecorder write to %@ failed (errno %d)", self.fileURL, errno);
+        } else {
+            self.numRecordsWritten++;
+        }
+    });
+}
+
+-(void) flush {
+    dispatch_sync(self.writeQueue, ^{ });
+}
+
+-(void) close {
+    dispatch_sync(self.writeQueue, ^{
+        if(_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+    });
+}
+
++(NSArray*) recordsFromFileURL:(NSURL*)fileURL {
+    NSError* error = nil;
+    NSData* data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:&error];
+    if(data == nil) {
+        LogE(LOGTAG_NKTR, @"NKTrafficRecorder could not read %@: %@", fileURL, error);
+        return nil;
+    }
+    if(data.length < sizeof(kTrafficFileMagic) || memcmp(data.bytes, kTrafficFileMagic, sizeof(kTrafficFileMagic)) != 0) {
+        LogE(LOGTAG_NKTR, @"%@ is not a traffic recording", fileURL);
+        return nil;
+    }
+
+    NSMutableArray* records = [[NSMutableArray alloc] init];
+    const uint8_t* bytes = data.bytes;
+    NSUInteger offset = sizeof(kTrafficFileMagic);
+
+    while(offset + 4 <= data.length) {
+        uint32_t length = 0;
+        memcpy(&length, bytes + offset, 4);
+        length = OSSwapLittleToHostInt32(length);
+        if(offset + 4 + length > data.length) {
+            LogW(LOGTAG_NKTR, @"%@ ends with a cut-off record - ignoring it", fileURL);
+            break;
+        }
+
+        NSData* payload = [data subdataWithRange:NSMakeRange(offset + 4, length)];
+        id plist = [NSPropertyListSerialization propertyListWithData:payload options:NSPropertyListImmutable format:NULL error:&error];
+        NKTrafficRecord* record = [NKTrafficRecord recordWithPlist:plist];
+        if(record == nil) {
+            LogW(LOGTAG_NKTR, @"%@ has an unreadable record at offset %lu - stopping there", fileURL, (unsigned long)offset);
+            break;
+        }
+        [records addObject:record];
+        offset += 4 + length;
+    }
+
+    return records;
+}
+
+@end
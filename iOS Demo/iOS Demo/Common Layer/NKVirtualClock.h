@@ -0,0 +1,48 @@
+//
+//  NKVirtualClock.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** A clock that only moves when you tell it to.  Things that want to happen "later" schedule
+    a block at a virtual time, and nothing runs until somebody calls advanceTo:, advanceBy:,
+    or runUntilIdle.  Then the due blocks run, in time order, on the thread that advanced the
+    clock.  Blocks scheduled for the same time run in the order they were scheduled, so a
+    run is exactly repeatable.
+
+    This is what lets NKSimulationURLConnectionBridge play out minutes of network traffic in
+    milliseconds, the same way every time.
+
+    Scheduling is thread-safe.  Advance the clock from one thread at a time. */
+
+#import <Foundation/Foundation.h>
+
+@interface NKVirtualClock : NSObject
+
+// Starts at time zero:
+-(NKVirtualClock*) init;
+
+// The current virtual time, in seconds:
+@property (atomic, readonly) double now;
+
+// How many blocks are waiting to run:
+@property (nonatomic, readonly) NSUInteger numPendingEvents;
+
+// Runs block when the clock reaches time (or on the next advance, if time is in the past).
+// Blocks may schedule more blocks.
+-(void) scheduleAtTime:(double)time block:(void (^)(void))block;
+-(void) scheduleAfterDelay:(double)delay block:(void (^)(void))block;
+
+// Runs everything due up to and including time, then sets now to time.  Returns the number
+// of blocks that ran.
+-(NSUInteger) advanceTo:(double)time;
+-(NSUInteger) advanceBy:(double)interval;
+
+// Runs until there's nothing left to run, moving the clock to each event as it goes.  Stops
+// early (and returns) once maxTime is reached, so a simulation that never settles down can't
+// spin forever.  Pass a negative maxTime for no limit.
+-(NSUInteger) runUntilIdleOrTime:(double)maxTime;
+
+@end
@@ -0,0 +1,156 @@
+//
+//  NKVirtualClock.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "NKVirtualClock.h"
+
+
+// One scheduled block.  sequence breaks ties between events at the same time:
+@interface _NKVirtualClockEvent : NSObject
+
+@property (nonatomic) double time;
+@property (nonatomic) UInt64 sequence;
+@property (nonatomic, copy) void (^block)(void);
+
+@end
+
+@implementation _NKVirtualClockEvent
+@end
+
+
+static inline BOOL eventIsEarlier(_NKVirtualClockEvent* a, _NKVirtualClockEvent* b) {
+    return (a.time < b.time) || (a.time == b.time && a.sequence < b.sequence);
+}
+
+
+@interface NKVirtualClock ()
+
+@property (atomic) double now;
+
+// A binary min-heap of _NKVirtualClockEvents, ordered by eventIsEarlier:
+@property (nonatomic, retain) NSMutableArray* heap;
+@property (nonatomic) UInt64 nextSequence;
+
+@end
+
+
+@implementation NKVirtualClock
+
+-(NKVirtualClock*) init {
+    if(self = [super init]) {
+        self.now = 0.0;
+        self.heap = [[NSMutableArray alloc] init];
+        self.nextSequence = 0;
+    }
+    return self;
+}
+
+-(NSUInteger) numPendingEvents {
+    @synchronized (self) {
+        return self.heap.count;
+    }
+}
+
+-(void) scheduleAtTime:(double)time block:(void (^)(void))block {
+    _NKVirtualClockEvent* event = [[_NKVirtualClockEvent alloc] init];
+    event.time = time;
+    event.block = block;
+
+    @synchronized (self) {
+        event.sequence = self.nextSequence++;
+        [self pushHelper:event];
+    }
+}
+
+-(void) scheduleAfterDelay:(double)delay block:(void (^)(void))block {
+    [self scheduleAtTime:self.now + MAX(delay, 0.0) block:block];
+}
+
+-(NSUInteger) advanceTo:(double)time {
+    NSUInteger numRun = [self runEventsDueBy:time];
+    if(time > self.now) {
+        self.now = time;
+    }
+    return numRun;
+}
+
+-(NSUInteger) advanceBy:(double)interval {
+    return [self advanceTo:self.now + MAX(interval, 0.0)];
+}
+
+-(NSUInteger) runUntilIdleOrTime:(double)maxTime {
+    return [self runEventsDueBy:(maxTime < 0.0) ? INFINITY : maxTime];
+}
+
+// Runs due events one at a time, moving now up to each.  We don't hold the lock while a
+// block runs, because blocks schedule more events.
+-(NSUInteger) runEventsDueBy:(double)time {
+    NSUInteger numRun = 0;
+    _NKVirtualClockEvent* event = nil;
+
+    while((event = [self popEventDueBy:time]) != nil) {
+        // Time never goes backwards, even for an event that was scheduled in the past:
+        if(event.time > self.now) {
+            self.now = event.time;
+        }
+        event.block();
+        numRun++;
+    }
+    return numRun;
+}
+
+
+#pragma mark - The heap
+
+// Removes and returns the earliest event if it's due by time, or returns nil:
+-(_NKVirtualClockEvent*) popEventDueBy:(double)time {
+    @synchronized (self) {
+        _NKVirtualClockEvent* first = [self.heap firstObject];
+        if(first == nil || first.time > time) {
+            return nil;
+        }
+
+        _NKVirtualClockEvent* last = [self.heap lastObject];
+        [self.heap removeLastObject];
+        if(self.heap.count > 0) {
+            self.heap[0] = last;
+            [self siftDownHelper:0];
+        }
+        return first;
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) pushHelper:(_NKVirtualClockEvent*)event {
+    NSMutableArray* heap = self.heap;
+    [heap addObject:event];
+
+    NSUInteger i = heap.count - 1;
+    while(i > 0) {
+        NSUInteger parent = (i - 1) / 2;
+        if(!eventIsEarlier(heap[i], heap[parent])) break;
+        [heap exchangeObjectAtIndex:i withObjectAtIndex:parent];
+        i = parent;
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+-(void) siftDownHelper:(NSUInteger)i {
+    NSMutableArray* heap = self.heap;
+    NSUInteger count = heap.count;
+
+    while(TRUE) {
+        NSUInteger left = 2*i + 1, right = left + 1, smallest = i;
+        if(left  < count && eventIsEarlier(heap[left],  heap[smallest])) smallest = left;
+        if(right < count && eventIsEarlier(heap[right], heap[smallest])) smallest = right;
+        if(smallest == i) break;
+        [heap exchangeObjectAtIndex:i withObjectAtIndex:smallest];
+        i = smallest;
+    }
+}
+
+@end
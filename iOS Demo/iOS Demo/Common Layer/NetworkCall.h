@@ -8,6 +8,8 @@
 
 #import <Foundation/Foundation.h>
 #import "DemoNetworkManager.h"
+#import "DownloadFileWriter.h"
+#import "MonotonicClock.h"
 
 /** This class is a wrapper for NSURLConnection.  It serves as the
  delegate for a NSURLConnection and it passes the callbacks
@@ -18,7 +20,11 @@
  delegate callbacks through to DemoNetworkManager.
  
  Keep in mind that this class and DemoNetworkManager are interdependant.
- I was going to put them in the same file but it got too long. */
+ I was going to put them in the same file but it got too long.
+
+ DemoNetworkManager keeps a pool of these and reuses them, so everything
+ a call sets up has to be put back by resetWithManager:... (and let go of
+ by prepareForReuse). */
 
 @interface NetworkCall : NSObject
 
@@ -32,6 +38,7 @@
 // Basic information used to build the NSURLConnection.
 @property (nonatomic, retain) NSString* urlString;
 @property (nonatomic, retain) NSURLRequest* request;
+@property (nonatomic, retain) NSURLRequest* originalRequest;
 @property (nonatomic, retain) NSRunLoop* runLoop;
 
 // Properties of this call.  We track these ourselves because we can't seem to trust
@@ -41,7 +48,7 @@
 @property (nonatomic) unsigned numRetries;
 @property (nonatomic) unsigned maxRetries;
 @property (nonatomic) double timeout;
-@property (nonatomic, retain) NSDate* dateCallStarted;
+@property (nonatomic) MonotonicTime timeCallStarted;   // 0 when no attempt is running
 
 // Store the connection object:
 @property (nonatomic, retain) NSURLConnection* connection;
@@ -49,11 +56,53 @@
 // Incrementally append the returned data:
 @property (nonatomic, retain) NSMutableData* data;
 
+// For download-to-file calls, the body goes here instead of into data (which is nil):
+@property (nonatomic, retain) DownloadFileWriter* fileWriter;
+@property (nonatomic) BOOL fileWriteFailed;
+
+// Set when the manager moved this body out of memory to stay under its budget (see
+// DemoNetworkManager's responseMemoryBudget).  The body is in fileWriter from then on,
+// but the file is ours, not the delegate's.
+@property (nonatomic) BOOL spilledToDisk;
+
+// What we need to resume an interrupted body on retry instead of starting over.  These
+// come from the last full (200) response: whether it took byte ranges, the ETag or
+// Last-Modified to send as If-Range, and the total length (-1 if unknown).  resumeOffset
+// is non-zero while the current connection is a Range request starting at that byte.
+@property (nonatomic) BOOL acceptsRanges;
+@property (nonatomic, retain) NSString* resumeValidator;
+@property (nonatomic) long long expectedTotalLength;
+@property (nonatomic) unsigned long long resumeOffset;
+
+// Where retries start.  When storeRedirectStack is set (NKRedirectRetryPolicyStoreRedirectStack),
+// redirectedRequest is the last hop this call was redirected to, temporary redirects
+// included, so a retry doesn't walk the whole chain again.  nil means start from the top.
+@property (nonatomic) BOOL storeRedirectStack;
+@property (nonatomic, retain) NSURLRequest* redirectedRequest;
+
+// The URLs whose cached permanent redirects this call skipped (see DemoNetworkManager's
+// redirectCache), first one first, or nil if it didn't skip any.
+@property (nonatomic, retain) NSArray* skippedRedirectSources;
+
+// Set from NKCallBehaviorURLRequest's queueWhenOffline.  A call that fails for want of a
+// connection goes to the manager's outbox instead (see NKRequestOutbox).
+@property (nonatomic) BOOL queueWhenOffline;
+
 -(NetworkCall*) initWithManager:(DemoNetworkManager*)manager
                        delegate:(id<NetworkManagerDelegate>)delegate
                 delegateContext:(id)delegateContext
                         timeout:(double)timeout
                      maxRetries:(int)maxRetries;
 
+// Sets the call up from scratch, the same as the initializer, so a pooled call can be used again.
+-(void) resetWithManager:(DemoNetworkManager*)manager
+                delegate:(id<NetworkManagerDelegate>)delegate
+         delegateContext:(id)delegateContext
+                 timeout:(double)timeout
+              maxRetries:(int)maxRetries;
+
+// Drops everything the call is holding on to (delegate context, requests, connection,
+// body) so a call sitting in the pool doesn't keep any of it alive.
+-(void) prepareForReuse;
 
 @end
\ No newline at end of file
@@ -14,6 +14,13 @@
 
 -(NetworkCall*) initWithManager:(DemoNetworkManager*)manager delegate:(id<NetworkManagerDelegate>)delegate delegateContext:(id)delegateContext timeout:(double)timeout maxRetries:(int)maxRetries {
     if(self = [super init]) {
+        [self resetWithManager:manager delegate:delegate delegateContext:delegateContext timeout:timeout maxRetries:maxRetries];
+    }
+    return self;
+}
+
+-(void) resetWithManager:(DemoNetworkManager*)manager delegate:(id<NetworkManagerDelegate>)delegate delegateContext:(id)delegateContext timeout:(double)timeout maxRetries:(int)maxRetries {
+    @synchronized (self) {
         self.manager = manager;
         self.delegate = delegate;
         self.delegateContext = delegateContext;
@@ -24,11 +31,44 @@
         self.connection = nil;
         self.urlString = nil;
         self.data = [[NSMutableData alloc] init];
+        self.fileWriter = nil;
+        self.fileWriteFailed = FALSE;
+        self.spilledToDisk = FALSE;
+        self.acceptsRanges = FALSE;
+        self.resumeValidator = nil;
+        self.expectedTotalLength = -1;
+        self.resumeOffset = 0;
+        self.storeRedirectStack = FALSE;
+        self.redirectedRequest = nil;
+        self.skippedRedirectSources = nil;
+        self.queueWhenOffline = FALSE;
         self.request = nil;
+        self.originalRequest = nil;
         self.runLoop = nil;
         self.numRetries = 0;
+        self.timeCallStarted = 0;
+    }
+}
+
+// The body buffer goes too.  It was handed to the delegate with the last callback, so it
+// isn't ours to empty and reuse - each call gets its own, and retries reuse that one.
+-(void) prepareForReuse {
+    @synchronized (self) {
+        self.manager = nil;
+        self.delegate = nil;
+        self.delegateContext = nil;
+        self.urlString = nil;
+        self.request = nil;
+        self.originalRequest = nil;
+        self.runLoop = nil;
+        self.connection = nil;
+        self.data = nil;
+        self.fileWriter = nil;
+        self.resumeValidator = nil;
+        self.redirectedRequest = nil;
+        self.skippedRedirectSources = nil;
+        self.timeCallStarted = 0;
     }
-    return self;
 }
 
 // TASK: This method requires us to call a specific method on NSURLConnection to handle the auth challenge.  I'm leaving
@@ -36,12 +76,17 @@
 // an advanced network interchange (it will sometimes default to cached credentials which are out of date).
 // - (void)connection:(NSURLConnection *)connection willSendRequestForAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge;
 
-// TASK: In situations where infinite redirects happen, or (more likely) a different redirect happens each time the URL
-// is called (for example with some immature loadbalancing schemes) this is the only point to reliably intercept the redirect.
-// I'm not implementing anything right now to keep the scope of this demo down but at least I've made the note.  Ideally, we'd
-// update the URLString to the final destination if it's a 301 redirect.
+// Redirects go through the manager so it can remember them (see RedirectCache) and tell
+// the delegate.  The first call here, before anything is sent, has no redirectResponse.
 - (NSURLRequest *)connection:(NSURLConnection *)connection willSendRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)response {
-    // For now, just proceed with the redirect.
+    if(response == nil) {
+        return request;
+    }
+    @synchronized (self) {
+        if(connection == self.connection) {
+            return [self.manager networkCall:self willRedirectTo:request redirectResponse:response];
+        }
+    }
     return request;
 }
 
@@ -56,11 +101,12 @@
     }
 }
 
-// Loaded some data (this needs to be appended to the store of all recieved data).
+// Loaded some data (this needs to be appended to the store of all recieved data).  The
+// manager does the appending, since it keeps track of how much all its calls are holding.
 - (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
     @synchronized (self) {
         if(connection == self.connection) {
-            [self.data appendData:data];
+            [self.manager networkCall:self didReceiveData:data];
         }
     }
 }
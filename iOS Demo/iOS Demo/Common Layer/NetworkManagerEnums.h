@@ -23,4 +23,8 @@ typedef enum {
     
     // A logic error – this is a critical failure of the network manager.
     NetworkManagerErrorInternal,
+    
+    // Added later, so they go after the rest to keep the values above where they were:
+    NetworkManagerErrorDeadlineMissed,  // dropped before it went out because it was too late
+    NetworkManagerErrorQueued,          // no connection, but it's in the outbox to go later (see NKRequestOutbox)
 } NetworkManagerError;
\ No newline at end of file
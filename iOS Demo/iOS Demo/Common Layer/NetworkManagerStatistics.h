@@ -21,6 +21,13 @@
 @property (nonatomic) UInt64  numCallsInFlight;
 @property (nonatomic) UInt64  numRetriesInFlight;
 
+// Response bodies held in memory by the calls in flight, and the most they've ever held
+// at once.  Calls waiting for that to come down (see DemoNetworkManager's
+// responseMemoryBudget) aren't counted as in flight.
+@property (nonatomic) UInt64  bufferedResponseBytes;
+@property (nonatomic) UInt64  bufferedResponseBytesHighWater;
+@property (nonatomic) UInt64  numCallsWaitingForMemory;
+
 // These are a global record – the mean average latency,
 // the number of failed calls of each type, etc.
 @property (nonatomic) UInt64 failuresNoConnection;
@@ -32,6 +39,16 @@
 @property (nonatomic) UInt64 totalFailedCalls;
 @property (nonatomic) UInt64 totalSuccessfulCalls;
 @property (nonatomic) UInt64 totalNumRetries;
+@property (nonatomic) UInt64 totalNumResumedRetries;  // retries that picked up a partial body with Range
+@property (nonatomic) UInt64 totalNumRedirects;           // redirects the server actually sent
+@property (nonatomic) UInt64 totalRedirectHopsSkipped;    // redirects we didn't have to follow (cached)
+@property (nonatomic) UInt64 totalBodiesSpilledToDisk;    // bodies moved to a file to stay under budget
+@property (nonatomic) UInt64 totalCallsHeldForMemory;     // calls that had to wait for the budget
 @property (nonatomic) double meanAverageLatency;  // for successful calls
 
+// How the manager's per-call bookkeeping objects were come by.  Once traffic settles
+// down nearly every call should be reused from the pool rather than allocated.
+@property (nonatomic) UInt64 totalCallObjectsAllocated;
+@property (nonatomic) UInt64 totalCallObjectsReused;
+
 @end
@@ -16,8 +16,12 @@
     
     [str appendFormat:@"Network Manager Snapshot: %@\n", self.date];
     [str appendFormat:@"%llu calls in flight.  %llu are retries.\n", self.numCallsInFlight, self.numRetriesInFlight];
-    [str appendFormat:@"Total of %llu failures versus %llu successful calls, with %llu retries.\n", self.totalFailedCalls, self.totalSuccessfulCalls, self.totalNumRetries];
+    [str appendFormat:@"%llu bytes of response buffered (high water %llu), %llu calls waiting for memory.\n", self.bufferedResponseBytes, self.bufferedResponseBytesHighWater, self.numCallsWaitingForMemory];
+    [str appendFormat:@"%llu bodies spilled to disk, %llu calls held back for memory.\n", self.totalBodiesSpilledToDisk, self.totalCallsHeldForMemory];
+    [str appendFormat:@"Total of %llu failures versus %llu successful calls, with %llu retries (%llu resumed).\n", self.totalFailedCalls, self.totalSuccessfulCalls, self.totalNumRetries, self.totalNumResumedRetries];
+    [str appendFormat:@"%llu redirects followed, %llu skipped from the redirect cache.\n", self.totalNumRedirects, self.totalRedirectHopsSkipped];
     [str appendFormat:@"Mean average latency is %lf\n", self.meanAverageLatency];
+    [str appendFormat:@"%llu call objects allocated, %llu reused from the pool.\n", self.totalCallObjectsAllocated, self.totalCallObjectsReused];
     [str appendFormat:@"Total failures to date by type:\n\tNo Connection: %llu\n\tTimed Out: %llu\n\tBad Request (400): %llu\n\tBad Server (500): %llu\n\tInternal Error: %llu\n",
                         self.failuresNoConnection, self.failuresTimedOut, self.failuresBadRequest,
                         self.failuresBadServer, self.failuresInternalError];
@@ -35,6 +39,9 @@
     new.date = [self.date copy];
     new.numCallsInFlight        = self.numCallsInFlight;
     new.numRetriesInFlight      = self.numRetriesInFlight;
+    new.bufferedResponseBytes   = self.bufferedResponseBytes;
+    new.bufferedResponseBytesHighWater = self.bufferedResponseBytesHighWater;
+    new.numCallsWaitingForMemory = self.numCallsWaitingForMemory;
     new.failuresNoConnection    = self.failuresNoConnection;
     new.failuresTimedOut        = self.failuresTimedOut;
     new.failuresBadRequest      = self.failuresBadRequest;
@@ -43,7 +50,14 @@
     new.totalFailedCalls        = self.totalFailedCalls;
     new.totalSuccessfulCalls    = self.totalSuccessfulCalls;
     new.totalNumRetries         = self.totalNumRetries;
+    new.totalNumResumedRetries  = self.totalNumResumedRetries;
+    new.totalNumRedirects       = self.totalNumRedirects;
+    new.totalRedirectHopsSkipped = self.totalRedirectHopsSkipped;
+    new.totalBodiesSpilledToDisk = self.totalBodiesSpilledToDisk;
+    new.totalCallsHeldForMemory = self.totalCallsHeldForMemory;
     new.meanAverageLatency      = self.meanAverageLatency;
+    new.totalCallObjectsAllocated = self.totalCallObjectsAllocated;
+    new.totalCallObjectsReused  = self.totalCallObjectsReused;
     
     return new;
 }
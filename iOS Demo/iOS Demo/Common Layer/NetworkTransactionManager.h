@@ -16,16 +16,30 @@
     a network call and an NSManagedObject subclass in CoreData.
     
     There are two ways that NetworkTransactionManager can handle calls... via
-    delegation and via blocks.  See the protocol and block typedefs below.
+    delegation and via blocks.  See the protocol and block typedefs below.  Either
+    way, the callbacks are delivered through a CallbackExecutor (see CallbackExecutor.h),
+    which is the main thread unless you say otherwise.
  
     Subclassers can override the verifyJSON: method to provide additional parsing
     for success/failure.  For example, some servers may return a 200 code but
     indicate a failure in the JSON package.  To go against such a server, override
     verifyJSON: and return the appropriate NetworkManagerError or
-    NetworkManagerErrorNoError if all is well. */
+    NetworkManagerErrorNoError if all is well.
+ 
+    JSON decoding and verifyJSON: happen on a pool of worker threads (see
+    maxConcurrentDecodes), not under the manager's lock.  That means verifyJSON:
+    can be called for several responses at once, so keep it thread-safe.
+
+    A successful response with no body at all (a 204, or a 304 to a conditional request)
+    succeeds with nil jsonData rather than failing to decode.
+
+    Several small transactions can go out together as one request (see
+    NetworkTransactionBatch below), which saves a round trip for each one after the first. */
 
 #import <Foundation/Foundation.h>
 #import "AbstractNetworkManager.h"
+#import "CallbackExecutor.h"
+#import "NKCallBehaviorURLRequest.h"
 
 
 
@@ -54,21 +68,30 @@
 typedef void (^NetworkTransactionManagerSuccessHandler) (NSDictionary* jsonData);
 typedef void (^NetworkTransactionManagerFailureHandler) (NetworkManagerError networkError, int httpStatus, BOOL jsonError, NSDictionary* jsonData);
 
+// A success handler that's told the HTTP status too (for when a 2xx other than 200, like a
+// 304, means something).  It's 200 if the network manager doesn't say.
+typedef void (^NetworkTransactionManagerStatusSuccessHandler) (NSDictionary* jsonData, int httpStatus);
+
 
 
 #pragma mark - The NetworkTransactionManager class
+@class NetworkTransactionBatch;
 @interface NetworkTransactionManager : NSObject
 
 // Critical information - the network manager to run the calls
 -(id<AbstractNetworkManager>) networkManager;
 -(NetworkTransactionManager*) initWithNetworkManager:(id<AbstractNetworkManager>)networkManager;
 
-// For delegation.  Callbacks are guaranteed to be asynchronous, and on the main thread.
+// Where callbacks go when a call doesn't name its own executor.  Defaults to
+// [CallbackExecutor mainThreadExecutor].  Setting nil puts the default back.
+@property (atomic, retain) CallbackExecutor* defaultCallbackExecutor;
+
+// For delegation.  Callbacks are guaranteed to be asynchronous, and on the defaultCallbackExecutor.
 -(void) get:(NSString*)url withData:(NSDictionary*)jsonData
                            delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context;
 -(void) post:(NSString*)url withData:(NSDictionary*)jsonData
                             delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context;
-// For block callbacks.  Callbacks are guaranteed to be asynchronous, and on the main thread.
+// For block callbacks.  Callbacks are guaranteed to be asynchronous, and on the defaultCallbackExecutor.
 -(void) get:(NSString*)url withData:(NSDictionary*)jsonData
                             success:(NetworkTransactionManagerSuccessHandler)successHandler
                             failure:(NetworkTransactionManagerFailureHandler)failureHandler;
@@ -76,11 +99,144 @@ typedef void (^NetworkTransactionManagerFailureHandler) (NetworkManagerError net
                             success:(NetworkTransactionManagerSuccessHandler)successHandler
                             failure:(NetworkTransactionManagerFailureHandler)failureHandler;
 
+// Same as above, but the callbacks for this call go to the given executor instead.
+// Passing nil for callbackExecutor means the defaultCallbackExecutor.
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                           delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                            delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+                    callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                    callbackExecutor:(CallbackExecutor*)callbackExecutor;
+
+// Same again, with the call in a call group (see NKCallBehaviorURLRequest's callGroup and the
+// group methods below).  group may be nil.
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                              group:(id)group
+                           delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                              group:(id)group
+                            delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+                    callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                              group:(id)group
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                              group:(id)group
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+
+// For when you need to build the request yourself (extra headers, conditional requests and
+// so on).  Start from [networkManager buildURLRequest:forRequestType:] so the request gets
+// the usual setup.  The response is handled just like get: and post:.  If the request is an
+// NKCallBehaviorURLRequest, the call goes in its callGroup.
+-(void) send:(NSURLRequest*)request
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler;
+-(void) send:(NSURLRequest*)request
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+-(void) send:(NSURLRequest*)request
+                  successWithStatus:(NetworkTransactionManagerStatusSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler
+                   callbackExecutor:(CallbackExecutor*)callbackExecutor;
+
 // In case you want to cancel a call:
 -(void) cancelFromDelegate:(id<NetworkTransactionManagerDelegate>)delegate withContext:(id)context;
 
+// Call groups, for everything a screen started at once.  Canceling works with any network
+// manager: no callbacks come for the group's calls afterwards.  Pausing, resuming and
+// changing priority are passed on to the network manager, so they only do anything if it
+// supports them (NKNetworkManager does).  Each returns the number of calls it touched.
+-(NSUInteger) cancelCallsInGroup:(id)group;
+-(NSUInteger) pauseCallsInGroup:(id)group;
+-(NSUInteger) resumeCallsInGroup:(id)group;
+-(NSUInteger) setPriority:(NKCallPriority)priority forCallsInGroup:(id)group;
+
+
+// Batches (see NetworkTransactionBatch).  batchURL is the server's batch endpoint; while
+// it's nil, batches just send their transactions one by one.  The counters say how many
+// envelopes have gone out, and how many of the transactions in them had to be sent again
+// on their own.
+@property (atomic, retain) NSString* batchURL;
+-(NetworkTransactionBatch*) batch;
+@property (atomic, readonly) UInt64 numBatchesSent;
+@property (atomic, readonly) UInt64 numBatchItemsRetried;
+
+
+// Every transaction is tracked by a wrapper object.  Wrappers are pooled, so once things
+// are warmed up these say they're reused rather than made new.
+@property (atomic, readonly) UInt64 numCallbackWrappersAllocated;
+@property (atomic, readonly) UInt64 numCallbackWrappersReused;
+
 
-// Helper for subclassers to override if they want JSON content validation to determine success or failure:
+// How many responses can be decoded and verified at the same time.  Defaults to the
+// number of active cores.  Values less than one are treated as one.
+@property (nonatomic) NSInteger maxConcurrentDecodes;
+
+
+// Helper for subclassers to override if they want JSON content validation to determine success or failure.
+// This is called on a decode worker thread, possibly for several responses at once!
 -(NetworkManagerError) verifyJSON:(NSDictionary*)json;
 
 @end
+
+
+
+#pragma mark - Batches
+/** Transactions added to a batch go to the server together, as one POST to the manager's
+    batchURL, when send is called.  The envelope looks like this:
+
+        { "requests" : [ { "id" : "0", "method" : "GET", "url" : "...", "body" : {...} }, ... ] }
+
+    where body is the transaction's jsonData (left out if there isn't any), and the server
+    answers with
+
+        { "responses" : [ { "id" : "0", "status" : 200, "body" : {...} }, ... ] }
+
+    Each transaction gets its own callbacks, exactly as if it had been sent on its own:
+        - a 2xx status succeeds with the item's body, after verifyJSON: (empty bodies
+              aren't verified, the same as a 204).
+        - a 4xx status fails with NetworkManagerErrorBadRequest and that status.
+        - anything else - a 5xx, no response for the item, or a bad envelope or a failed
+              batch call - sends the transaction again on its own.
+    Batched transactions don't have rawData for their failure callbacks.
+
+    Items can be canceled like any other transaction, with cancelFromDelegate:withContext:
+    or by callGroup.  A batch is sent once; make a new one for the next lot. */
+@interface NetworkTransactionBatch : NSObject
+
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                           delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                            delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context;
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler;
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+                            success:(NetworkTransactionManagerSuccessHandler)successHandler
+                            failure:(NetworkTransactionManagerFailureHandler)failureHandler;
+
+// For every transaction in the batch, and the envelope call too.  Set these before send.
+// A nil callbackExecutor means the manager's defaultCallbackExecutor.
+@property (nonatomic, retain) CallbackExecutor* callbackExecutor;
+@property (nonatomic, retain) id callGroup;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+// Sends everything added so far.  A batch of one goes out as a plain transaction.
+-(void) send;
+
+@end
@@ -9,16 +9,29 @@
 #import "NetworkTransactionManager.h"
 #import "Logging.h"
 #import "JSONHelpers.h"
+#import "NKNetworkManager.h"
+#import "SharedThreadPool.h"
 
 NSString* const LOGTAG_NTM = @"networktransaction";
 
+// How many finished wrappers we keep around to reuse:
+NSUInteger const kCallbackWrapperPoolCapacity = 64;
+
 /** This class is used to wrap a callback so things don't get out of hand.  I'm
     starting it with an underscore because of some of the flat-namespace issues
-    that Objective-C has ( see: https://developer.apple.com/library/mac/documentation/Cocoa/Conceptual/LoadingCode/Tasks/NameConflicts.html ).*/
+    that Objective-C has ( see: https://developer.apple.com/library/mac/documentation/Cocoa/Conceptual/LoadingCode/Tasks/NameConflicts.html ).
+
+    Wrappers are pooled and reused, so a block that holds on to one has to hold on to the
+    generation it was made for too, and give up if the wrapper has moved on since. */
 
+@class _InternalCallToken;
 @interface _InternalCallbackWrapper : NSObject
 
-// This is set during the call:
+// The network manager's context for the wrapper's call, while it has one out.  Lock on the
+// manager to touch it:
+@property (nonatomic, retain) _InternalCallToken* callToken;
+
+// This is set during the call, from didReceiveResponse.  Lock on the manager to touch it:
 @property (nonatomic) int httpStatus;
 
 // These are set at the beginning:
@@ -26,12 +39,77 @@ NSString* const LOGTAG_NTM = @"networktransaction";
 @property (nonatomic, weak)   id<NetworkTransactionManagerDelegate> delegate;
 @property (nonatomic, retain) id delegateContext;
 @property (nonatomic, copy) NetworkTransactionManagerSuccessHandler successHandler;
+@property (nonatomic, copy) NetworkTransactionManagerStatusSuccessHandler statusSuccessHandler;
 @property (nonatomic, copy) NetworkTransactionManagerFailureHandler failureHandler;
+@property (nonatomic, retain) CallbackExecutor* callbackExecutor;
+@property (nonatomic, retain) id callGroup;
+
+// For a transaction in a batch, what to send if it has to go out on its own:
+@property (nonatomic) BOOL isGetRequest;
+@property (nonatomic, retain) NSDictionary* requestData;
+
+// For a batch's envelope call, the transactions in it and the generation each was at when
+// the envelope went out:
+@property (nonatomic, retain) NSArray* batchItems;
+@property (nonatomic, retain) NSArray* batchGenerations;
+
+// Goes up by one every time the wrapper is canceled or goes back in the pool, so callbacks
+// already handed to the decode queue or the executor can tell they're stale and not run:
+@property (atomic) UInt64 generation;
+
+// A wrapper goes back in the pool once its call is finished (didFinish) AND its callbacks
+// have gone out, which can happen in either order:
+@property (nonatomic) BOOL callFinished;
+@property (nonatomic) BOOL callbacksDelivered;
+
+// Lets go of everything from the last call:
+-(void) prepareForReuse;
+
+@end
 
+/** What the network manager gets as a call's context.  There's a new one for every call, and
+    they're never reused, so a callback that comes in late - after its wrapper was canceled,
+    recycled and sent out again - can't pass for one of the new call's.  The wrapper holds
+    on to its token, so the token only holds the wrapper weakly. */
+@interface _InternalCallToken : NSObject
+@property (nonatomic, weak, readonly) _InternalCallbackWrapper* wrapper;
+-(_InternalCallToken*) initWithWrapper:(_InternalCallbackWrapper*)wrapper;
 @end
 
+@implementation _InternalCallToken
+-(_InternalCallToken*) initWithWrapper:(_InternalCallbackWrapper*)wrapper {
+    if(self = [super init]) {
+        _wrapper = wrapper;
+    }
+    return self;
+}
+@end
+
+
 @implementation _InternalCallbackWrapper
 @synthesize httpStatus = _httpStatus, urlString = _urlString, delegate = _delegate, delegateContext = _delegateContext, successHandler = _successHandler, failureHandler = _failureHandler;
+@synthesize callbackExecutor = _callbackExecutor, generation = _generation;
+
+-(void) prepareForReuse {
+    self.generation++;
+    self.callToken = nil;
+    self.httpStatus = -1;
+    self.urlString = nil;
+    self.delegate = nil;
+    self.delegateContext = nil;
+    self.successHandler = NULL;
+    self.statusSuccessHandler = NULL;
+    self.failureHandler = NULL;
+    self.callbackExecutor = nil;
+    self.callGroup = nil;
+    self.isGetRequest = FALSE;
+    self.requestData = nil;
+    self.batchItems = nil;
+    self.batchGenerations = nil;
+    self.callFinished = FALSE;
+    self.callbacksDelivered = FALSE;
+}
+
 @end
 
 
@@ -42,77 +120,263 @@ NSString* const LOGTAG_NTM = @"networktransaction";
 
 @property (nonatomic, retain) NSMutableSet* allCallbackWrappers;
 
+// Wrappers from finished calls, ready to be used again:
+@property (nonatomic, retain) NSMutableArray* callbackWrapperPool;
+
+// JSON decoding and verifyJSON: run here, outside of our lock:
+@property (nonatomic, retain) NSOperationQueue* decodeQueue;
+
+// Calls are started on this thread and call back on it, so the network manager's callbacks
+// come straight here instead of by way of the main thread.  The callback executor makes
+// the one hop to wherever the caller wants them:
+@property (nonatomic, retain) NSThread* networkThread;
+
+@property (atomic, readwrite) UInt64 numBatchesSent;
+@property (atomic, readwrite) UInt64 numBatchItemsRetried;
+@property (atomic, readwrite) UInt64 numCallbackWrappersAllocated;
+@property (atomic, readwrite) UInt64 numCallbackWrappersReused;
+
+// For NetworkTransactionBatch:
+-(_InternalCallbackWrapper*) dequeueCallbackWrapper;
+-(void) sendBatchItems:(NSArray*)items callbackExecutor:(CallbackExecutor*)callbackExecutor callGroup:(id)callGroup;
+
+@end
+
+
+@interface NetworkTransactionBatch ()
+
+-(NetworkTransactionBatch*) initWithManager:(NetworkTransactionManager*)manager;
+
+@property (nonatomic, retain) NetworkTransactionManager* manager;
+
+// _InternalCallbackWrappers for the transactions, not bound to any call until send:
+@property (nonatomic, retain) NSMutableArray* items;
+@property (nonatomic) BOOL sent;
+
 @end
 
 @implementation NetworkTransactionManager
 @synthesize networkManager = _networkManager;
 @synthesize allCallbackWrappers = _allCallbackWrappers;
+@synthesize defaultCallbackExecutor = _defaultCallbackExecutor;
 
 -(NetworkTransactionManager*) initWithNetworkManager:(id<AbstractNetworkManager>)networkManager {
     if(self = [super init]) {
         self.networkManager = networkManager;
         self.allCallbackWrappers = [[NSMutableSet alloc] init];
+        self.callbackWrapperPool = [[NSMutableArray alloc] initWithCapacity:kCallbackWrapperPoolCapacity];
+        self.defaultCallbackExecutor = [CallbackExecutor mainThreadExecutor];
+        self.batchURL = nil;
+        self.numBatchesSent = 0;
+        self.numBatchItemsRetried = 0;
+        self.numCallbackWrappersAllocated = 0;
+        self.numCallbackWrappersReused = 0;
+        
+        // One decode at a time per core.  Any more than that just fights over the CPU.
+        self.decodeQueue = [[NSOperationQueue alloc] init];
+        self.decodeQueue.name = @"iosdemo.networktransaction.decode";
+        self.decodeQueue.maxConcurrentOperationCount = [[NSProcessInfo processInfo] activeProcessorCount];
+        
+        self.networkThread = [[SharedThreadPool singleton] subscribeToThreadWithIdentifer:nil];
     }
     return self;
 }
 
+-(void) dealloc {
+    [[SharedThreadPool singleton] unsubscribeThreadWithIdentifier:nil];
+}
+
+-(NSInteger) maxConcurrentDecodes {
+    return self.decodeQueue.maxConcurrentOperationCount;
+}
+
+-(void) setMaxConcurrentDecodes:(NSInteger)maxConcurrentDecodes {
+    self.decodeQueue.maxConcurrentOperationCount = MAX(maxConcurrentDecodes, 1);
+}
+
+// Setting nil puts the main thread executor back:
+-(void) setDefaultCallbackExecutor:(CallbackExecutor*)defaultCallbackExecutor {
+    @synchronized (self) {
+        _defaultCallbackExecutor = defaultCallbackExecutor ?: [CallbackExecutor mainThreadExecutor];
+    }
+}
+
+-(CallbackExecutor*) defaultCallbackExecutor {
+    CallbackExecutor* executor = nil;
+    @synchronized (self) {
+        executor = _defaultCallbackExecutor;
+    }
+    return executor;
+}
+
 
 /** These four methods are just helpers and therefore all look identical. */
 // For delegation:
 -(void) get:(NSString*)url withData:(NSDictionary*)jsonData
    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context {
-    
-    _InternalCallbackWrapper* wrapper = [[_InternalCallbackWrapper alloc] init];
+    [self get:url withData:jsonData delegate:delegate context:context callbackExecutor:nil];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context {
+    [self post:url withData:jsonData delegate:delegate context:context callbackExecutor:nil];
+}
+// For block callbacks:
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+    success:(NetworkTransactionManagerSuccessHandler)successHandler
+    failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    [self get:url withData:jsonData success:successHandler failure:failureHandler callbackExecutor:nil];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+     success:(NetworkTransactionManagerSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    [self post:url withData:jsonData success:successHandler failure:failureHandler callbackExecutor:nil];
+}
+
+
+/** And these four are the same thing with an executor specified. */
+// For delegation:
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+   delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+    [self get:url withData:jsonData group:nil delegate:delegate context:context callbackExecutor:callbackExecutor];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+    [self post:url withData:jsonData group:nil delegate:delegate context:context callbackExecutor:callbackExecutor];
+}
+// For block callbacks:
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+    success:(NetworkTransactionManagerSuccessHandler)successHandler
+    failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+    [self get:url withData:jsonData group:nil success:successHandler failure:failureHandler callbackExecutor:callbackExecutor];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+     success:(NetworkTransactionManagerSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+    [self post:url withData:jsonData group:nil success:successHandler failure:failureHandler callbackExecutor:callbackExecutor];
+}
+
+
+/** With a call group. */
+// For delegation:
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+      group:(id)group
+   delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
     wrapper.delegate = delegate;
     wrapper.delegateContext = context;
     wrapper.successHandler = NULL;
     wrapper.failureHandler = NULL;
     wrapper.urlString = url;
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = group;
 
     [self sendRequestForWrapper:wrapper withData:jsonData isGetRequest:TRUE];
 }
 -(void) post:(NSString*)url withData:(NSDictionary*)jsonData
-    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context {
-    
-    _InternalCallbackWrapper* wrapper = [[_InternalCallbackWrapper alloc] init];
+       group:(id)group
+    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
     wrapper.delegate = delegate;
     wrapper.delegateContext = context;
     wrapper.successHandler = NULL;
     wrapper.failureHandler = NULL;
     wrapper.urlString = url;
-    
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = group;
+
     [self sendRequestForWrapper:wrapper withData:jsonData isGetRequest:FALSE];
 }
 // For block callbacks:
 -(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+      group:(id)group
     success:(NetworkTransactionManagerSuccessHandler)successHandler
-    failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
 
-    _InternalCallbackWrapper* wrapper = [[_InternalCallbackWrapper alloc] init];
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
     wrapper.delegate = nil;
     wrapper.delegateContext = nil;
     wrapper.successHandler = successHandler;
     wrapper.failureHandler = failureHandler;
     wrapper.urlString = url;
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = group;
     
     [self sendRequestForWrapper:wrapper withData:jsonData isGetRequest:TRUE];
 }
 -(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+       group:(id)group
      success:(NetworkTransactionManagerSuccessHandler)successHandler
-     failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
     
-    _InternalCallbackWrapper* wrapper = [[_InternalCallbackWrapper alloc] init];
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
     wrapper.delegate = nil;
     wrapper.delegateContext = nil;
     wrapper.successHandler = successHandler;
     wrapper.failureHandler = failureHandler;
     wrapper.urlString = url;
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = group;
     
     [self sendRequestForWrapper:wrapper withData:jsonData isGetRequest:FALSE];
 }
 
 
+/** And for requests the caller built. */
+-(void) send:(NSURLRequest*)request
+     success:(NetworkTransactionManagerSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    [self send:request success:successHandler failure:failureHandler callbackExecutor:nil];
+}
+-(void) send:(NSURLRequest*)request
+     success:(NetworkTransactionManagerSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
+    wrapper.delegate = nil;
+    wrapper.delegateContext = nil;
+    wrapper.successHandler = successHandler;
+    wrapper.failureHandler = failureHandler;
+    wrapper.urlString = request.URL.absoluteString;
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = [request isKindOfClass:[NKCallBehaviorURLRequest class]] ? ((NKCallBehaviorURLRequest*)request).callGroup : nil;
+
+    // mutableCopy would turn an NKCallBehaviorURLRequest into a plain one, so only copy if we must:
+    NSMutableURLRequest* mutableRequest = [request isKindOfClass:[NSMutableURLRequest class]] ? (NSMutableURLRequest*)request : [request mutableCopy];
+    [self sendURLRequest:mutableRequest forWrapper:wrapper];
+}
+-(void) send:(NSURLRequest*)request
+successWithStatus:(NetworkTransactionManagerStatusSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler
+callbackExecutor:(CallbackExecutor*)callbackExecutor {
+
+    _InternalCallbackWrapper* wrapper = [self dequeueCallbackWrapper];
+    wrapper.delegate = nil;
+    wrapper.delegateContext = nil;
+    wrapper.successHandler = NULL;
+    wrapper.statusSuccessHandler = successHandler;
+    wrapper.failureHandler = failureHandler;
+    wrapper.urlString = request.URL.absoluteString;
+    wrapper.callbackExecutor = callbackExecutor ?: self.defaultCallbackExecutor;
+    wrapper.callGroup = [request isKindOfClass:[NKCallBehaviorURLRequest class]] ? ((NKCallBehaviorURLRequest*)request).callGroup : nil;
+
+    NSMutableURLRequest* mutableRequest = [request isKindOfClass:[NSMutableURLRequest class]] ? (NSMutableURLRequest*)request : [request mutableCopy];
+    [self sendURLRequest:mutableRequest forWrapper:wrapper];
+}
+
+
 -(void) cancelFromDelegate:(id<NetworkTransactionManagerDelegate>)delegate withContext:(id)context {
+    id callContext = nil;
     @synchronized (self) {
         // Like in the DemoNetworkManager, this search should really use a map of some sort
         // for efficiency.  But I'll do it this way for now so I can get on to other stuff.
@@ -124,39 +388,265 @@ NSString* const LOGTAG_NTM = @"networktransaction";
             }
         }
         
-        // Now cancel that wrapper's call and clean up:
+        // Now clean up.  Recycling it moves it on to the next generation, which stops any
+        // callbacks already sitting in its executor from going out:
         if(wrapper != nil) {
-            if([self.networkManager respondsToSelector:@selector(cancelForDelegate:withContext:)]) {
-                [self.networkManager cancelForDelegate:self withContext:wrapper];
+            callContext = wrapper.callToken;
+            [self cleanUpAfterCall:wrapper];
+            [self recycleCallbackWrapper:wrapper];
+        }
+    }
+    
+    // The network manager's callbacks take our lock while holding its own, so its call is
+    // canceled only once ours is let go:
+    [self cancelNetworkCallWithContext:callContext];
+}
+
+
+-(NSUInteger) cancelCallsInGroup:(id)group {
+    if(group == nil) return 0;
+    
+    NSUInteger numCalls = 0;
+    NSMutableArray* callContexts = [[NSMutableArray alloc] init];
+    @synchronized (self) {
+        for(_InternalCallbackWrapper* wrapper in [self.allCallbackWrappers copy]) {
+            if(![wrapper.callGroup isEqual:group]) continue;
+            
+            // Same as cancelFromDelegate:, for each of them:
+            // (Batch items don't have a call of their own:)
+            if(wrapper.callToken != nil) {
+                [callContexts addObject:wrapper.callToken];
             }
             [self cleanUpAfterCall:wrapper];
+            [self recycleCallbackWrapper:wrapper];
+            numCalls++;
+        }
+    }
+    for(id callContext in callContexts) {
+        [self cancelNetworkCallWithContext:callContext];
+    }
+    return numCalls;
+}
+
+// CALL THIS OUTSIDE OF OUR SYNCHRONIZED BLOCK!!!
+// Cancels the network manager's call for the context we started it with, if there is one.
+-(void) cancelNetworkCallWithContext:(id)callContext {
+    if(callContext != nil && [self.networkManager respondsToSelector:@selector(cancelForDelegate:withContext:)]) {
+        [self.networkManager cancelForDelegate:self withContext:callContext];
+    }
+}
+
+-(NSUInteger) pauseCallsInGroup:(id)group {
+    if(group == nil || ![self.networkManager respondsToSelector:@selector(pauseCallsInGroup:)]) return 0;
+    return [self.networkManager pauseCallsInGroup:group];
+}
+
+-(NSUInteger) resumeCallsInGroup:(id)group {
+    if(group == nil || ![self.networkManager respondsToSelector:@selector(resumeCallsInGroup:)]) return 0;
+    return [self.networkManager resumeCallsInGroup:group];
+}
+
+-(NSUInteger) setPriority:(NKCallPriority)priority forCallsInGroup:(id)group {
+    if(group == nil || ![self.networkManager respondsToSelector:@selector(setPriority:forCallsInGroup:)]) return 0;
+    return [self.networkManager setPriority:priority forCallsInGroup:group];
+}
+
+
+/** Batches.  See NetworkTransactionBatch in the header. */
+-(NetworkTransactionBatch*) batch {
+    return [[NetworkTransactionBatch alloc] initWithManager:self];
+}
+
+// Everything in a batch goes in one envelope to batchURL, unless there's no batchURL or
+// only one transaction, in which case there's nothing to gain.  The items are tracked like
+// calls of their own from here on, so they can be canceled while the envelope's out.
+-(void) sendBatchItems:(NSArray*)items callbackExecutor:(CallbackExecutor*)callbackExecutor callGroup:(id)callGroup {
+    CallbackExecutor* executor = callbackExecutor ?: self.defaultCallbackExecutor;
+    for(_InternalCallbackWrapper* item in items) {
+        item.callbackExecutor = executor;
+        item.callGroup = callGroup;
+    }
+    
+    NSString* batchURL = self.batchURL;
+    if(batchURL == nil || items.count < 2) {
+        for(_InternalCallbackWrapper* item in items) {
+            [self sendRequestForWrapper:item withData:item.requestData isGetRequest:item.isGetRequest];
+        }
+        return;
+    }
+    
+    NSMutableArray* requests = [[NSMutableArray alloc] initWithCapacity:items.count];
+    NSMutableArray* generations = [[NSMutableArray alloc] initWithCapacity:items.count];
+    _InternalCallbackWrapper* envelope = [self dequeueCallbackWrapper];
+    @synchronized (self) {
+        for(NSUInteger i = 0; i < items.count; i++) {
+            _InternalCallbackWrapper* item = [items objectAtIndex:i];
+            NSMutableDictionary* request = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                            [NSString stringWithFormat:@"%lu", (unsigned long)i], @"id",
+                                            (item.isGetRequest ? @"GET" : @"POST"), @"method",
+                                            item.urlString, @"url", nil];
+            if(item.requestData != nil) {
+                [request setObject:item.requestData forKey:@"body"];
+            }
+            [requests addObject:request];
+            [generations addObject:@(item.generation)];
+            [self.allCallbackWrappers addObject:item];
+        }
+        self.numBatchesSent++;
+    }
+    
+    envelope.delegate = nil;
+    envelope.delegateContext = nil;
+    envelope.successHandler = NULL;
+    envelope.failureHandler = NULL;
+    envelope.urlString = batchURL;
+    envelope.callbackExecutor = executor;
+    envelope.callGroup = callGroup;
+    envelope.batchItems = items;
+    envelope.batchGenerations = generations;
+    
+    NSMutableURLRequest* request = [self.networkManager buildURLRequest:batchURL forRequestType:@"POST"];
+    request.HTTPBody = [JSONHelpers toData:@{ @"requests" : requests }];
+    [self sendURLRequest:request forWrapper:envelope];
+}
+
+// Runs on the decode queue.  Gives each item that hasn't been canceled its own response out
+// of the envelope (see NetworkTransactionBatch in the header).  A nil or unreadable envelope
+// has no responses in it, so everything goes out again on its own.
+-(void) splitBatchResponse:(NSData*)data items:(NSArray*)items generations:(NSArray*)generations {
+    NSDictionary* json = (data.length > 0) ? [self decodeJSON:data] : nil;
+    id responses = [json isKindOfClass:[NSDictionary class]] ? [json objectForKey:@"responses"] : nil;
+    
+    NSMutableDictionary* responsesByID = [[NSMutableDictionary alloc] initWithCapacity:items.count];
+    if([responses isKindOfClass:[NSArray class]]) {
+        for(id response in responses) {
+            if([response isKindOfClass:[NSDictionary class]] && [response objectForKey:@"id"] != nil) {
+                [responsesByID setObject:response forKey:[[response objectForKey:@"id"] description]];
+            }
         }
+    } else if(data != nil) {
+        LogW(LOGTAG_NTM, @"Batch response had no responses in it; sending its %lu transactions one by one", (unsigned long)items.count);
+    }
+    
+    for(NSUInteger i = 0; i < items.count; i++) {
+        _InternalCallbackWrapper* item = [items objectAtIndex:i];
+        UInt64 generation = [[generations objectAtIndex:i] unsignedLongLongValue];
+        if(item.generation != generation) continue;
+        
+        NSDictionary* response = [responsesByID objectForKey:[NSString stringWithFormat:@"%lu", (unsigned long)i]];
+        id status = [response objectForKey:@"status"];
+        int httpStatus = [status isKindOfClass:[NSNumber class]] ? [status intValue] : -1;
+        id body = [response objectForKey:@"body"];
+        NSDictionary* itemJSON = [body isKindOfClass:[NSDictionary class]] ? body : nil;
+        BOOL unreadableBody = (body != nil && body != [NSNull null] && itemJSON == nil);
+        
+        if(httpStatus >= 200 && httpStatus < 300) {
+            NetworkManagerError verificationError = NetworkManagerErrorNoError;
+            if(itemJSON != nil) {
+                verificationError = [self verifyJSON:itemJSON];
+            }
+            BOOL succeeded = !unreadableBody && verificationError == NetworkManagerErrorNoError;
+            if([self finishBatchItem:item generation:generation]) {
+                [self deliverToWrapper:item generation:generation succeeded:succeeded
+                          networkError:verificationError httpStatus:httpStatus jsonError:!succeeded json:itemJSON rawData:nil];
+            }
+        } else if(httpStatus >= 400 && httpStatus < 500) {
+            // The server won't change its mind about these:
+            if([self finishBatchItem:item generation:generation]) {
+                [self deliverToWrapper:item generation:generation succeeded:FALSE
+                          networkError:NetworkManagerErrorBadRequest httpStatus:httpStatus jsonError:NO json:itemJSON rawData:nil];
+            }
+        } else {
+            [self retryBatchItem:item generation:generation];
+        }
+    }
+}
+
+// The item's done as far as the network goes.  Returns FALSE if it was canceled meanwhile.
+-(BOOL) finishBatchItem:(_InternalCallbackWrapper*)item generation:(UInt64)generation {
+    @synchronized (self) {
+        if(item.generation != generation) return FALSE;
+        [self cleanUpAfterCall:item];
+        item.callFinished = TRUE;
+        return TRUE;
+    }
+}
+
+// Sends the item again on its own, with the same wrapper, so its callbacks and its place
+// in cancels and call groups carry on as before.
+-(void) retryBatchItem:(_InternalCallbackWrapper*)item generation:(UInt64)generation {
+    @synchronized (self) {
+        if(item.generation != generation) return;
+        [self cleanUpAfterCall:item];
+        self.numBatchItemsRetried++;
+        [self sendRequestForWrapper:item withData:item.requestData isGetRequest:item.isGetRequest];
     }
 }
 
 
 // Internal method for sending a request:
 -(void) sendRequestForWrapper:(_InternalCallbackWrapper*)wrapper withData:(NSDictionary*)jsonData isGetRequest:(BOOL)isGetRequest {
+    if(wrapper != nil) {
+        // Make a URLRequest and start the call:
+        NSMutableURLRequest* request = [self.networkManager buildURLRequest:wrapper.urlString forRequestType:(isGetRequest ? @"GET" : @"POST")];
+        request.HTTPBody = [JSONHelpers toData:jsonData];
+        [self sendURLRequest:request forWrapper:wrapper];
+    }
+}
+
+-(void) sendURLRequest:(NSMutableURLRequest*)request forWrapper:(_InternalCallbackWrapper*)wrapper {
     if(wrapper != nil) {
         @synchronized (self) {
             if([self.allCallbackWrappers containsObject:wrapper]) {
                 LogW(@"LOGTAG", @"Got already-bound callback wrapper %@!  Not starting another call.");
             } else {
-                // Add the wrapper to our callback list:
+                // Add the wrapper to our callback list, with a new context for this call:
                 [self.allCallbackWrappers addObject:wrapper];
                 wrapper.httpStatus = -1;
+                _InternalCallToken* token = [[_InternalCallToken alloc] initWithWrapper:wrapper];
+                wrapper.callToken = token;
                 
-                // Make a URLRequest and start the call:
-                NSMutableURLRequest* request = [self.networkManager buildURLRequest:wrapper.urlString forRequestType:(isGetRequest ? @"GET" : @"POST")];
-                request.HTTPBody = [JSONHelpers toData:jsonData];
-                
+                // The network manager needs the group too, to pause and reprioritize:
+                if(wrapper.callGroup != nil && [request isKindOfClass:[NKCallBehaviorURLRequest class]]) {
+                    ((NKCallBehaviorURLRequest*)request).callGroup = wrapper.callGroup;
+                }
                 
-                [self.networkManager startNetworkCall:request withDelegate:self onMainThread:TRUE withTimeout:8.0 withNumRetries:3 withContext:wrapper];
+                [[SharedThreadPool singleton] performBlock:^{
+                    [self startNetworkCall:request forToken:token];
+                } onThread:self.networkThread];
             }
         }
     }
 }
 
+// ONLY CALL THIS ON THE NETWORK THREAD!!!
+// Starts the token's call, unless it was canceled on the way here.  onMainThread is
+// FALSE, so the callbacks come back on this thread.  Like a cancel, the start happens
+// outside our lock; a cancel that slips in while it's going on is passed on afterwards.
+-(void) startNetworkCall:(NSMutableURLRequest*)request forToken:(_InternalCallToken*)token {
+    @synchronized (self) {
+        if([self wrapperForContext:token] == nil) return;
+    }
+    [self.networkManager startNetworkCall:request withDelegate:self onMainThread:FALSE withTimeout:8.0 withNumRetries:3 withContext:token];
+    
+    BOOL canceledMeanwhile = FALSE;
+    @synchronized (self) {
+        canceledMeanwhile = ([self wrapperForContext:token] == nil);
+    }
+    if(canceledMeanwhile) {
+        [self cancelNetworkCallWithContext:token];
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!
+// The wrapper a network manager callback is for, or nil if that call is over or canceled:
+-(_InternalCallbackWrapper*) wrapperForContext:(id)context {
+    if(![context isKindOfClass:[_InternalCallToken class]]) return nil;
+    _InternalCallbackWrapper* wrapper = ((_InternalCallToken*)context).wrapper;
+    if(wrapper == nil || wrapper.callToken != context || ![self.allCallbackWrappers containsObject:wrapper]) return nil;
+    return wrapper;
+}
+
 
 // Callbacks from the network kit:
 // Called when a call is started.  This will happen immediately when you call
@@ -169,6 +659,15 @@ NSString* const LOGTAG_NTM = @"networktransaction";
     // nothing to do here
 }
 
+// Called when a response arrives.  The last one before didSucceed has the status the
+// call succeeded with, so that's what the success callbacks get.
+-(void) networkManager:(id<AbstractNetworkManager>)networkManager didReceiveResponse:(id)context
+            httpStatus:(int)httpStatus {
+    @synchronized (self) {
+        [self wrapperForContext:context].httpStatus = httpStatus;
+    }
+}
+
 // Called when the network manager loads the header for the remote resource.
 // This allows the delegate to choose to cancel the call if one of the the
 // HTTP headers is not as expected, and it gives the Content-Length, too.
@@ -177,27 +676,26 @@ NSString* const LOGTAG_NTM = @"networktransaction";
     // Nothing to do with the headers for now.
 }
 
-// Success!  This will be followed by didFinish.
+// Success!  This will be followed by didFinish.  We only hold the lock long enough to
+// find the wrapper.  Decoding and verifying happen on the decode queue so one big response
+// doesn't stall every other send, cancel and finish behind our lock.
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didSucceed:(id)context data:(NSData*)data {
     _InternalCallbackWrapper* wrapper = nil;
-    NSDictionary* json = nil;
-    BOOL hadJSONError = FALSE;
-    NetworkManagerError verificationError = NetworkManagerErrorNoError;
+    UInt64 generation = 0;
+    NSArray* batchItems = nil;
+    NSArray* batchGenerations = nil;
+    int httpStatus = 200;
     
     @synchronized (self) {
-        if([self.allCallbackWrappers containsObject:context]) {
-            wrapper = (_InternalCallbackWrapper*)context;
-            if(data != nil) {
-                json = [self decodeJSON:data];
-                
-                // this will tell us if there was a verification error:
-                verificationError = [self verifyJSON:json];
-                
-                // if we had data but couldn't decode JSON, it's an error:
-                if(json == nil) {
-                    hadJSONError = TRUE;
-                }
-                
+        wrapper = [self wrapperForContext:context];
+        if(wrapper != nil) {
+            generation = wrapper.generation;
+            batchItems = wrapper.batchItems;
+            batchGenerations = wrapper.batchGenerations;
+            
+            // A manager that doesn't send didReceiveResponse only tells us it worked:
+            if(wrapper.httpStatus >= 0) {
+                httpStatus = wrapper.httpStatus;
             }
             
             // Note, we don't need to do any cleanup because we'll do that in didFinish, below.
@@ -207,43 +705,56 @@ NSString* const LOGTAG_NTM = @"networktransaction";
     }
     
     if(wrapper != nil) {
-        if(hadJSONError || verificationError != NetworkManagerErrorNoError) {
-            // We had a JSON deserialization error!  Call back:
-            if(wrapper.delegate != nil) {
-                [wrapper.delegate networkTransactionManager:self didFail:wrapper.delegateContext
-                                               networkError:verificationError
-                                                 httpStatus:200
-                                        jsonDecodingFailure:TRUE
-                                                   jsonData:json
-                                                    rawData:(NSData*)data];
-            }
+        [self.decodeQueue addOperationWithBlock:^{
+            // No point decoding for a call nobody's listening to anymore:
+            if(wrapper.generation != generation) return;
             
-            if(wrapper.failureHandler != NULL) {
-                wrapper.failureHandler(verificationError, 200, YES, json);
-            }
-        } else {
-            // Successfully recieved JSON!  We'll call back to the delegate and the success block
-            if(wrapper.delegate != nil) {
-                [wrapper.delegate networkTransactionManager:self didSucceed:wrapper.delegateContext jsonData:json];
+            if(batchItems != nil) {
+                [self splitBatchResponse:data items:batchItems generations:batchGenerations];
+                [self callbacksDeliveredForWrapper:wrapper generation:generation];
+                return;
             }
             
-            if(wrapper.successHandler != NULL) {
-                wrapper.successHandler(json);
+            NSDictionary* json = nil;
+            BOOL hadJSONError = FALSE;
+            NetworkManagerError verificationError = NetworkManagerErrorNoError;
+            
+            // No body at all (204, 304) isn't a decoding failure, it's just nothing to decode:
+            if(data.length > 0) {
+                json = [self decodeJSON:data];
+                
+                // this will tell us if there was a verification error:
+                verificationError = [self verifyJSON:json];
+                
+                // if we had data but couldn't decode JSON, it's an error:
+                if(json == nil) {
+                    hadJSONError = TRUE;
+                }
             }
-        }
+            
+            // A JSON deserialization or verification error is reported as a JSON failure:
+            BOOL succeeded = !hadJSONError && verificationError == NetworkManagerErrorNoError;
+            [self deliverToWrapper:wrapper generation:generation succeeded:succeeded
+                      networkError:verificationError httpStatus:httpStatus jsonError:!succeeded json:json rawData:data];
+        }];
     }
 }
 
-// An error occurred.  This will be immediately followed by didFinish.
+// An error occurred.  This will be immediately followed by didFinish.  Like didSucceed,
+// any JSON that came back with the error gets decoded on the decode queue.
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didFail:(id)context
                  error:(NetworkManagerError)errorType httpStatus:(int)httpStatus data:(NSData*)data {
     _InternalCallbackWrapper* wrapper = nil;
-    NSDictionary* json = nil;
+    UInt64 generation = 0;
+    NSArray* batchItems = nil;
+    NSArray* batchGenerations = nil;
     
     @synchronized (self) {
-        if([self.allCallbackWrappers containsObject:context]) {
-            wrapper = (_InternalCallbackWrapper*)context;
-            if(json != nil) json = [self decodeJSON:data];
+        wrapper = [self wrapperForContext:context];
+        if(wrapper != nil) {
+            generation = wrapper.generation;
+            batchItems = wrapper.batchItems;
+            batchGenerations = wrapper.batchGenerations;
             
             // Note, we don't need to do any cleanup because we'll do that in didFinish, below.
         } else {
@@ -252,20 +763,81 @@ NSString* const LOGTAG_NTM = @"networktransaction";
     }
     
     if(wrapper != nil) {
-        // We had an error!  Even if we couldn't decode JSON, we'll pass NO for jsonDecodingFailure
-        if(wrapper.delegate != nil) {
-            [wrapper.delegate networkTransactionManager:self didFail:wrapper.delegateContext
-                                           networkError:errorType
-                                             httpStatus:httpStatus
-                                    jsonDecodingFailure:NO
-                                               jsonData:json
-                                                rawData:data];
-        }
+        [self.decodeQueue addOperationWithBlock:^{
+            if(wrapper.generation != generation) return;
+            
+            // The envelope didn't make it, so nothing in it did either:
+            if(batchItems != nil) {
+                LogW(LOGTAG_NTM, @"Batch call failed (error %d, HTTP %d); sending its %lu transactions one by one",
+                     errorType, httpStatus, (unsigned long)batchItems.count);
+                [self splitBatchResponse:nil items:batchItems generations:batchGenerations];
+                [self callbacksDeliveredForWrapper:wrapper generation:generation];
+                return;
+            }
+            
+            // We had an error!  Even if we couldn't decode JSON, we'll pass NO for jsonDecodingFailure
+            NSDictionary* json = [self decodeJSON:data];
+            [self deliverToWrapper:wrapper generation:generation succeeded:FALSE
+                      networkError:errorType httpStatus:httpStatus jsonError:NO json:json rawData:data];
+        }];
+    }
+}
+
+// Hands the outcome of a wrapper's call to its delegate and blocks, on its executor.  The
+// wrapper can be reused as soon as it's canceled, so what the callbacks need is copied out
+// under the lock now, and nothing goes out if the wrapper has moved on from generation.
+-(void) deliverToWrapper:(_InternalCallbackWrapper*)wrapper generation:(UInt64)generation
+               succeeded:(BOOL)succeeded networkError:(NetworkManagerError)networkError httpStatus:(int)httpStatus
+               jsonError:(BOOL)jsonError json:(NSDictionary*)json rawData:(NSData*)rawData {
+    __weak id<NetworkTransactionManagerDelegate> delegate = nil;
+    id delegateContext = nil;
+    NetworkTransactionManagerSuccessHandler successHandler = NULL;
+    NetworkTransactionManagerStatusSuccessHandler statusSuccessHandler = NULL;
+    NetworkTransactionManagerFailureHandler failureHandler = NULL;
+    CallbackExecutor* callbackExecutor = nil;
+    
+    @synchronized (self) {
+        if(wrapper.generation != generation) return;
+        delegate = wrapper.delegate;
+        delegateContext = wrapper.delegateContext;
+        successHandler = wrapper.successHandler;
+        statusSuccessHandler = wrapper.statusSuccessHandler;
+        failureHandler = wrapper.failureHandler;
+        callbackExecutor = wrapper.callbackExecutor;
+    }
+    
+    [callbackExecutor execute:^{
+        if(wrapper.generation != generation) return;
         
-        if(wrapper.failureHandler != NULL) {
-            wrapper.failureHandler(errorType, httpStatus, NO, json);
+        if(succeeded) {
+            // Successfully recieved JSON!  We'll call back to the delegate and the success block
+            if(delegate != nil) {
+                [delegate networkTransactionManager:self didSucceed:delegateContext jsonData:json];
+            }
+            
+            if(successHandler != NULL) {
+                successHandler(json);
+            }
+            if(statusSuccessHandler != NULL) {
+                statusSuccessHandler(json, httpStatus);
+            }
+        } else {
+            if(delegate != nil) {
+                [delegate networkTransactionManager:self didFail:delegateContext
+                                       networkError:networkError
+                                         httpStatus:httpStatus
+                                jsonDecodingFailure:jsonError
+                                           jsonData:json
+                                            rawData:rawData];
+            }
+            
+            if(failureHandler != NULL) {
+                failureHandler(networkError, httpStatus, jsonError, json);
+            }
         }
-    }
+        
+        [self callbacksDeliveredForWrapper:wrapper generation:generation];
+    }];
 }
 
 // Called when a call is done, either by error or by success.  You'll always
@@ -274,9 +846,15 @@ NSString* const LOGTAG_NTM = @"networktransaction";
 // the manager is not obligated to do any more callbacks.
 -(void) networkManager:(id<AbstractNetworkManager>)networkManager didFinish:(id)context {
     @synchronized (self) {
-        if([self.allCallbackWrappers containsObject:context]) {
-            // We'll take this as the time to clean up, since we're guaranteed to get it:
-            [self cleanUpAfterCall:(_InternalCallbackWrapper*)context];
+        _InternalCallbackWrapper* wrapper = [self wrapperForContext:context];
+        if(wrapper != nil) {
+            // We'll take this as the time to clean up, since we're guaranteed to get it.  The
+            // wrapper itself waits for its callbacks to go out before it's reused:
+            [self cleanUpAfterCall:wrapper];
+            wrapper.callFinished = TRUE;
+            if(wrapper.callbacksDelivered) {
+                [self recycleCallbackWrapper:wrapper];
+            }
         }
     }
 }
@@ -304,9 +882,115 @@ NSString* const LOGTAG_NTM = @"networktransaction";
 // CALL THIS FROM A SYNCHRONIZED BLOCK!!
 -(void) cleanUpAfterCall:(_InternalCallbackWrapper*)wrapper {
     [self.allCallbackWrappers removeObject:wrapper];
+    wrapper.callToken = nil;
 }
 
 
+// Takes a wrapper from the pool, or makes a new one if it's empty:
+-(_InternalCallbackWrapper*) dequeueCallbackWrapper {
+    _InternalCallbackWrapper* wrapper = nil;
+    @synchronized (self) {
+        wrapper = [self.callbackWrapperPool lastObject];
+        if(wrapper != nil) {
+            [self.callbackWrapperPool removeLastObject];
+            self.numCallbackWrappersReused++;
+        } else {
+            self.numCallbackWrappersAllocated++;
+        }
+    }
+    return (wrapper != nil) ? wrapper : [[_InternalCallbackWrapper alloc] init];
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!
+// Moves the wrapper on to its next generation and puts it back in the pool.
+-(void) recycleCallbackWrapper:(_InternalCallbackWrapper*)wrapper {
+    [wrapper prepareForReuse];
+    if(self.callbackWrapperPool.count < kCallbackWrapperPoolCapacity) {
+        [self.callbackWrapperPool addObject:wrapper];
+    }
+}
 
+// Called from the executor once a wrapper's callbacks are done.  If didFinish has already
+// been and gone, nothing else will touch the wrapper, so it can be reused.
+-(void) callbacksDeliveredForWrapper:(_InternalCallbackWrapper*)wrapper generation:(UInt64)generation {
+    @synchronized (self) {
+        if(wrapper.generation != generation) return;
+        wrapper.callbacksDelivered = TRUE;
+        if(wrapper.callFinished) {
+            [self recycleCallbackWrapper:wrapper];
+        }
+    }
+}
+
+
+
+
+@end
+
+
+@implementation NetworkTransactionBatch
+
+-(NetworkTransactionBatch*) initWithManager:(NetworkTransactionManager*)manager {
+    if(self = [super init]) {
+        self.manager = manager;
+        self.items = [[NSMutableArray alloc] init];
+        self.sent = FALSE;
+        self.callbackExecutor = nil;
+        self.callGroup = nil;
+    }
+    return self;
+}
+
+-(NSUInteger) count {
+    return self.items.count;
+}
+
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+   delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context {
+    [self addItem:url withData:jsonData isGetRequest:TRUE delegate:delegate context:context success:NULL failure:NULL];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+    delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context {
+    [self addItem:url withData:jsonData isGetRequest:FALSE delegate:delegate context:context success:NULL failure:NULL];
+}
+-(void) get:(NSString*)url withData:(NSDictionary*)jsonData
+    success:(NetworkTransactionManagerSuccessHandler)successHandler
+    failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    [self addItem:url withData:jsonData isGetRequest:TRUE delegate:nil context:nil success:successHandler failure:failureHandler];
+}
+-(void) post:(NSString*)url withData:(NSDictionary*)jsonData
+     success:(NetworkTransactionManagerSuccessHandler)successHandler
+     failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    [self addItem:url withData:jsonData isGetRequest:FALSE delegate:nil context:nil success:successHandler failure:failureHandler];
+}
+
+-(void) addItem:(NSString*)url withData:(NSDictionary*)jsonData isGetRequest:(BOOL)isGetRequest
+       delegate:(id<NetworkTransactionManagerDelegate>)delegate context:(id)context
+        success:(NetworkTransactionManagerSuccessHandler)successHandler
+        failure:(NetworkTransactionManagerFailureHandler)failureHandler {
+    if(self.sent) {
+        LogW(LOGTAG_NTM, @"Transaction to %@ added to a batch that's already been sent!  Ignoring it.", url);
+        return;
+    }
+    
+    _InternalCallbackWrapper* item = [self.manager dequeueCallbackWrapper];
+    item.delegate = delegate;
+    item.delegateContext = context;
+    item.successHandler = successHandler;
+    item.failureHandler = failureHandler;
+    item.urlString = url;
+    item.isGetRequest = isGetRequest;
+    item.requestData = jsonData;
+    [self.items addObject:item];
+}
+
+-(void) send {
+    if(self.sent) {
+        LogW(LOGTAG_NTM, @"Batch sent twice!  Ignoring the second time.");
+        return;
+    }
+    self.sent = TRUE;
+    [self.manager sendBatchItems:[self.items copy] callbackExecutor:self.callbackExecutor callGroup:self.callGroup];
+}
 
 @end
@@ -0,0 +1,53 @@
+//
+//  RedirectCache.h
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+/** Remembers permanent redirects (301 and 308) so later calls can go straight to where
+    the server told us the resource lives now, instead of paying a round trip per hop.
+    Chains are followed (A -> B -> C resolves A to C), loops are cut off, and the cache is
+    bounded: once it's full, the least recently used redirect is forgotten.
+
+    Temporary redirects (302, 303, 307) are NOT stored here - they're only good for the
+    call that got them, so the network manager keeps those on the call itself.
+
+    This class is thread-safe. */
+
+#import <Foundation/Foundation.h>
+
+// One hop that resolveURL: skipped, so the caller can report it as if it had happened:
+@interface RedirectCacheHop : NSObject
+
+@property (nonatomic, retain) NSString* toURLString;
+@property (nonatomic) int httpStatus;
+
+@end
+
+
+@interface RedirectCache : NSObject
+
+// Maximum number of redirects remembered at one time (at least 1):
+-(RedirectCache*) initWithCapacity:(NSUInteger)capacity;
+
+@property (nonatomic, readonly) NSUInteger capacity;
+@property (nonatomic, readonly) NSUInteger count;
+
+// True for the statuses this cache will remember (301 and 308):
++(BOOL) isPermanentRedirectStatus:(int)httpStatus;
+
+// Remembers fromURL -> toURL if httpStatus is a permanent redirect; otherwise does nothing.
+-(void) recordRedirectFrom:(NSURL*)fromURL to:(NSURL*)toURL httpStatus:(int)httpStatus;
+
+// Follows remembered redirects from url and returns where they end up, or url itself if
+// there's nothing remembered for it.  If hops is non-NULL, it gets the RedirectCacheHops
+// that were skipped, in order (empty if none).
+-(NSURL*) resolveURL:(NSURL*)url hops:(NSArray**)hops;
+
+// Forgets what we know about one URL, or about everything:
+-(void) removeRedirectFrom:(NSURL*)fromURL;
+-(void) removeAll;
+
+@end
@@ -0,0 +1,137 @@
+//
+//  RedirectCache.m
+//  iOS Demo
+//
+//  (c) 2015
+//  Available under GNU Public License v2.0
+//
+
+#import "RedirectCache.h"
+#import "Logging.h"
+
+NSString* const LOGTAG_RC = @"network";
+
+// No sane server chains more than a handful of permanent redirects.  If we follow this
+// many, something is looping in a way the visited check didn't catch, so stop there.
+NSUInteger const kMaxRedirectHops = 10;
+
+
+@implementation RedirectCacheHop
+@end
+
+
+@interface RedirectCache ()
+
+@property (nonatomic) NSUInteger capacity;
+
+// fromURL string -> RedirectCacheHop.  recency runs from least to most recently used:
+@property (nonatomic, retain) NSMutableDictionary* hopsByURL;
+@property (nonatomic, retain) NSMutableOrderedSet* recency;
+
+@end
+
+
+@implementation RedirectCache
+
+-(RedirectCache*) initWithCapacity:(NSUInteger)capacity {
+    if(self = [super init]) {
+        self.capacity = MAX(capacity, 1);
+        self.hopsByURL = [[NSMutableDictionary alloc] init];
+        self.recency = [[NSMutableOrderedSet alloc] init];
+    }
+    return self;
+}
+
+-(NSUInteger) count {
+    @synchronized (self) {
+        return self.hopsByURL.count;
+    }
+}
+
++(BOOL) isPermanentRedirectStatus:(int)httpStatus {
+    return (httpStatus == 301 || httpStatus == 308);
+}
+
+-(void) recordRedirectFrom:(NSURL*)fromURL to:(NSURL*)toURL httpStatus:(int)httpStatus {
+    if(![RedirectCache isPermanentRedirectStatus:httpStatus] || fromURL == nil || toURL == nil) {
+        return;
+    }
+    NSString* from = fromURL.absoluteString;
+    NSString* to = toURL.absoluteString;
+    if([from isEqualToString:to]) {
+        return;
+    }
+
+    RedirectCacheHop* hop = [[RedirectCacheHop alloc] init];
+    hop.toURLString = to;
+    hop.httpStatus = httpStatus;
+
+    @synchronized (self) {
+        [self.hopsByURL setObject:hop forKey:from];
+        [self touchHelper:from];
+
+        while(self.recency.count > self.capacity) {
+            NSString* oldest = [self.recency firstObject];
+            LogD(LOGTAG_RC, @"RedirectCache is full, forgetting redirect from %@", oldest);
+            [self.hopsByURL removeObjectForKey:oldest];
+            [self.recency removeObjectAtIndex:0];
+        }
+    }
+}
+
+-(NSURL*) resolveURL:(NSURL*)url hops:(NSArray**)hops {
+    NSMutableArray* skipped = [[NSMutableArray alloc] init];
+    NSString* current = url.absoluteString;
+
+    if(current != nil) {
+        @synchronized (self) {
+            NSMutableSet* visited = [NSMutableSet setWithObject:current];
+            RedirectCacheHop* hop = nil;
+
+            while(skipped.count < kMaxRedirectHops && (hop = [self.hopsByURL objectForKey:current]) != nil) {
+                [self touchHelper:current];
+
+                // A loop means the redirects we stored don't go anywhere.  Stop before
+                // re-entering it and let the server sort it out:
+                if([visited containsObject:hop.toURLString]) {
+                    LogW(LOGTAG_RC, @"RedirectCache found a redirect loop at %@", current);
+                    break;
+                }
+                [visited addObject:hop.toURLString];
+                [skipped addObject:hop];
+                current = hop.toURLString;
+            }
+        }
+    }
+
+    if(hops != NULL) {
+        *hops = skipped;
+    }
+    return (skipped.count > 0) ? [NSURL URLWithString:current] : url;
+}
+
+-(void) removeRedirectFrom:(NSURL*)fromURL {
+    NSString* from = fromURL.absoluteString;
+    if(from == nil) return;
+
+    @synchronized (self) {
+        [self.hopsByURL removeObjectForKey:from];
+        [self.recency removeObject:from];
+    }
+}
+
+-(void) removeAll {
+    @synchronized (self) {
+        [self.hopsByURL removeAllObjects];
+        [self.recency removeAllObjects];
+    }
+}
+
+// CALL THIS FROM A SYNCHRONIZED BLOCK!!!
+// Marks the key as most recently used.
+-(void) touchHelper:(NSString*)key {
+    [self.recency removeObject:key];
+    [self.recency addObject:key];
+}
+
+@end
@@ -10,6 +10,40 @@
 
 #import <Foundation/Foundation.h>
 
+
+// A snapshot of one thread in the pool (see threadMetrics).  Times are in seconds.
+@interface SharedThreadPoolThreadMetrics : NSObject
+
+@property (nonatomic, retain) id identifier;       // NSNull for the nil identifier
+@property (nonatomic, retain) NSString* name;
+@property (nonatomic) long threadIndex;
+@property (nonatomic) long numberOfSubscribers;
+@property (nonatomic) BOOL pinned;
+@property (nonatomic, retain) NSDate* pinExpirationDate;
+
+// Work sent with performBlock:onThread: (the watchdog's probes included): how much is
+// waiting to run, how much has run, and how long it waited to start.
+@property (nonatomic) long   queueDepth;
+@property (nonatomic) UInt64 numPerformsRun;
+@property (nonatomic) double meanPerformLatency;
+@property (nonatomic) double maxPerformLatency;
+
+// How the run loop has spent its time since the thread started: handling something, or
+// asleep waiting for something to handle.  blockedSeconds is how long it's been busy
+// without a break right now, or how long the watchdog's probe has been waiting to run if
+// that's longer (0 if it's asleep).
+@property (nonatomic) double busySeconds;
+@property (nonatomic) double idleSeconds;
+@property (nonatomic) double blockedSeconds;
+
+// How many times the watchdog has flagged this thread:
+@property (nonatomic) UInt64 numWatchdogFlags;
+
+@end
+
+typedef void (^SharedThreadPoolWatchdogHandler)(SharedThreadPoolThreadMetrics* metrics);
+
+
 @interface SharedThreadPool : NSObject
 
 // To get and release a thread, do these things:
@@ -21,6 +55,22 @@
 -(void)      pinThread:(BOOL)pinned withIdentifier:(NSString*)threadIdentifier;
 
 
+// Runs block on thread's run loop, in the common modes.  Use this instead of
+// performSelector:onThread: for a thread from the pool and the wait and the work both
+// show up in threadMetrics.  Any other thread works too, it just isn't measured.
+-(void)      performBlock:(dispatch_block_t)block onThread:(NSThread*)thread;
+
+// A snapshot of every thread in the pool, oldest first:
+-(NSArray*)  threadMetrics;
+
+// The watchdog checks every thread a few times per threshold, and flags one whose run loop
+// has been stuck on one thing - or hasn't gotten to a perform - for longer than threshold.
+// A flag is logged and goes to handler (if there is one) on the pool's internal queue, once
+// per stuck stretch.  Starting it again replaces the threshold and handler.
+-(void)      startWatchdogWithThreshold:(NSTimeInterval)threshold handler:(SharedThreadPoolWatchdogHandler)handler;
+-(void)      stopWatchdog;
+
+
 // And for people who want a singleton...
 +(SharedThreadPool*) singleton;
 
@@ -8,9 +8,30 @@
 
 #import "SharedThreadPool.h"
 #import "Logging.h"
+#import "MonotonicClock.h"
 #import <pthread.h>
 
 
+#pragma mark - Metrics snapshot:
+
+@implementation SharedThreadPoolThreadMetrics
+
+@end
+
+
+#pragma mark - Work sent with performBlock:onThread:
+
+@interface _SharedThreadPoolPerform : NSObject
+@property (nonatomic, copy) dispatch_block_t block;
+@property (nonatomic) MonotonicTime postedAt;
+@property (nonatomic) BOOL isProbe;     // the watchdog's, with no block
+@end
+
+@implementation _SharedThreadPoolPerform
+
+@end
+
+
 #pragma mark - Custom NSThread subclass:
 
 // This simple NSThread subclass adds a couple extra properties:
@@ -27,10 +48,94 @@
 @property (nonatomic, retain) id<NSCopying> identifier;
 @property (nonatomic, retain) NSDate* pinExpirationDate;
 
+// Run loop and perform statistics.  These are under lock, since the thread itself writes
+// them and anyone can read them:
+@property (nonatomic) MonotonicTime busySince;      // 0 while the run loop waits
+@property (nonatomic) MonotonicTime idleSince;      // 0 while it's busy
+@property (nonatomic) double busySeconds;
+@property (nonatomic) double idleSeconds;
+@property (nonatomic) long   numPerformsQueued;
+@property (nonatomic) UInt64 numPerformsRun;
+@property (nonatomic) double totalPerformLatency;
+@property (nonatomic) double maxPerformLatency;
+@property (nonatomic) MonotonicTime probePostedAt;  // 0 when no watchdog probe is out
+@property (nonatomic) BOOL   watchdogFlagged;       // for the current busy stretch
+@property (nonatomic) UInt64 numWatchdogFlags;
+
+-(void) noteRunLoopActivity:(CFRunLoopActivity)activity;
+-(SharedThreadPoolThreadMetrics*) metricsAtTime:(MonotonicTime)now;
+
 @end
 
 @implementation SharedThreadPoolThread
 
+// Called by the run loop observer on this thread.  The run loop is busy from when it's
+// entered or woken up until it goes to sleep or returns:
+-(void) noteRunLoopActivity:(CFRunLoopActivity)activity {
+    MonotonicTime now = [MonotonicClock now];
+    @synchronized (self.lock) {
+        switch (activity) {
+            case kCFRunLoopEntry:
+            case kCFRunLoopAfterWaiting:
+                if(self.idleSince != 0) {
+                    self.idleSeconds += [MonotonicClock secondsFrom:self.idleSince to:now];
+                    self.idleSince = 0;
+                }
+                if(self.busySince == 0) {
+                    self.busySince = now;
+                }
+                break;
+            case kCFRunLoopBeforeWaiting:
+            case kCFRunLoopExit:
+                if(self.busySince != 0) {
+                    self.busySeconds += [MonotonicClock secondsFrom:self.busySince to:now];
+                    self.busySince = 0;
+                }
+                // Going to sleep means nothing's left to do, probes included, so whatever
+                // the watchdog saw is over:
+                if(activity == kCFRunLoopBeforeWaiting) {
+                    self.idleSince = now;
+                    self.watchdogFlagged = FALSE;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// CALL THIS FROM A BLOCK SYNCHRONIZED ON THE POOL'S LOCK!!!  (numberOfSubscribers and the
+// pin are the pool's.)
+-(SharedThreadPoolThreadMetrics*) metricsAtTime:(MonotonicTime)now {
+    SharedThreadPoolThreadMetrics* metrics = [[SharedThreadPoolThreadMetrics alloc] init];
+    metrics.identifier = self.identifier;
+    metrics.name = self.name;
+    metrics.threadIndex = self.threadIndex;
+    metrics.numberOfSubscribers = self.numberOfSubscribers;
+    metrics.pinExpirationDate = self.pinExpirationDate;
+    metrics.pinned = (self.pinExpirationDate != nil && [self.pinExpirationDate timeIntervalSinceNow] > 0.0);
+    
+    @synchronized (self.lock) {
+        metrics.queueDepth = self.numPerformsQueued;
+        metrics.numPerformsRun = self.numPerformsRun;
+        metrics.meanPerformLatency = (self.numPerformsRun > 0) ? self.totalPerformLatency / self.numPerformsRun : 0.0;
+        metrics.maxPerformLatency = self.maxPerformLatency;
+        metrics.numWatchdogFlags = self.numWatchdogFlags;
+        
+        // Count the stretch we're in the middle of, too:
+        double busyNow = (self.busySince != 0) ? [MonotonicClock secondsFrom:self.busySince to:now] : 0.0;
+        double idleNow = (self.idleSince != 0) ? [MonotonicClock secondsFrom:self.idleSince to:now] : 0.0;
+        metrics.busySeconds = self.busySeconds + MAX(busyNow, 0.0);
+        metrics.idleSeconds = self.idleSeconds + MAX(idleNow, 0.0);
+        
+        // A probe that hasn't run means the run loop isn't getting to its performs, even if
+        // it isn't stuck in one thing:
+        double probeWait = (self.probePostedAt != 0) ? [MonotonicClock secondsFrom:self.probePostedAt to:now] : 0.0;
+        metrics.blockedSeconds = MAX(MAX(busyNow, probeWait), 0.0);
+    }
+    return metrics;
+}
+
 @end
 
 
@@ -45,6 +150,11 @@
 @property (nonatomic, retain) NSObject* lock;
 @property (nonatomic, retain) NSMutableDictionary* allThreads;
 
+// The watchdog, if it's running (see startWatchdogWithThreshold:handler:):
+@property (nonatomic, retain) dispatch_source_t watchdogTimer;
+@property (nonatomic) NSTimeInterval watchdogThreshold;
+@property (nonatomic, copy) SharedThreadPoolWatchdogHandler watchdogHandler;
+
 // The internal dispatch queue where messages are posted to manage the thread pool:
 @property (nonatomic, retain) dispatch_queue_t queue;
 
@@ -71,6 +181,10 @@
 
 
 -(void) dealloc {
+    if(_watchdogTimer != nil) {
+        dispatch_source_cancel(_watchdogTimer);
+    }
+    
     // We don't need to release our internal dispatch queue because of ARC, but it's
     // important to remember what we ought to have done here: dispatch_release(self.queue);
 }
@@ -109,6 +223,14 @@
         [runLoop addTimer:thread.keepAliveTimer forMode:NSDefaultRunLoopMode];
     }
     
+    // Watch the run loop go between busy and waiting, for threadMetrics and the watchdog:
+    CFRunLoopObserverRef observer = CFRunLoopObserverCreateWithHandler(kCFAllocatorDefault,
+                                                                       kCFRunLoopEntry | kCFRunLoopBeforeWaiting | kCFRunLoopAfterWaiting | kCFRunLoopExit,
+                                                                       true, 0, ^(CFRunLoopObserverRef observerRef, CFRunLoopActivity activity) {
+        [thread noteRunLoopActivity:activity];
+    });
+    CFRunLoopAddObserver([runLoop getCFRunLoop], observer, kCFRunLoopCommonModes);
+    
     LogD(LOGTAG, @"Thread started: %@", thread.name);
     
     // This is the main loop for this thread - it runs until thread.threadShouldRun is set to NO.
@@ -127,6 +249,8 @@
     
     // Invalidate this just in case:
     [thread.keepAliveTimer invalidate];
+    CFRunLoopRemoveObserver([runLoop getCFRunLoop], observer, kCFRunLoopCommonModes);
+    CFRelease(observer);
     
     LogD(LOGTAG, @"Thread will exit: %@", thread.name);
 }
@@ -181,10 +305,147 @@
 }
 
 
+-(void) performBlock:(dispatch_block_t)block onThread:(NSThread*)thread {
+    if(block == NULL || thread == nil) return;
+    _SharedThreadPoolPerform* perform = [[_SharedThreadPoolPerform alloc] init];
+    perform.block = block;
+    perform.isProbe = FALSE;
+    [self postPerform:perform onThread:thread];
+}
+
+-(NSArray*) threadMetrics {
+    NSMutableArray* metrics = [[NSMutableArray alloc] init];
+    @synchronized (self.lock) {
+        MonotonicTime now = [MonotonicClock now];
+        for(SharedThreadPoolThread* thread in [self.allThreads allValues]) {
+            [metrics addObject:[thread metricsAtTime:now]];
+        }
+    }
+    [metrics sortUsingComparator:^NSComparisonResult(SharedThreadPoolThreadMetrics* a, SharedThreadPoolThreadMetrics* b) {
+        return (a.threadIndex < b.threadIndex) ? NSOrderedAscending : (a.threadIndex > b.threadIndex) ? NSOrderedDescending : NSOrderedSame;
+    }];
+    return metrics;
+}
+
+-(void) startWatchdogWithThreshold:(NSTimeInterval)threshold handler:(SharedThreadPoolWatchdogHandler)handler {
+    [self stopWatchdog];
+    if(threshold <= 0.0) return;
+    
+    // A few looks per threshold, so a stuck thread is caught not long after it crosses it:
+    double interval = MAX(threshold / 4.0, 0.01);
+    dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.queue);
+    dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)),
+                              (uint64_t)(interval * NSEC_PER_SEC), (uint64_t)(interval * NSEC_PER_SEC / 10.0));
+    __weak SharedThreadPool* weakSelf = self;
+    dispatch_source_set_event_handler(timer, ^{
+        [weakSelf watchdogFired];
+    });
+    
+    @synchronized (self.lock) {
+        self.watchdogThreshold = threshold;
+        self.watchdogHandler = handler;
+        self.watchdogTimer = timer;
+    }
+    dispatch_resume(timer);
+}
+
+-(void) stopWatchdog {
+    dispatch_source_t timer = nil;
+    @synchronized (self.lock) {
+        timer = self.watchdogTimer;
+        self.watchdogTimer = nil;
+        self.watchdogHandler = nil;
+    }
+    if(timer != nil) {
+        dispatch_source_cancel(timer);
+    }
+}
+
+
 
 
 #pragma mark - Internal helpers:
 
+-(void) postPerform:(_SharedThreadPoolPerform*)perform onThread:(NSThread*)thread {
+    perform.postedAt = [MonotonicClock now];
+    if([thread isKindOfClass:[SharedThreadPoolThread class]]) {
+        SharedThreadPoolThread* poolThread = (SharedThreadPoolThread*)thread;
+        @synchronized (poolThread.lock) {
+            poolThread.numPerformsQueued++;
+        }
+    }
+    [self performSelector:@selector(runPerform:) onThread:thread withObject:perform waitUntilDone:NO modes:@[NSRunLoopCommonModes]];
+}
+
+// Runs on the target thread:
+-(void) runPerform:(_SharedThreadPoolPerform*)perform {
+    NSThread* thread = [NSThread currentThread];
+    if([thread isKindOfClass:[SharedThreadPoolThread class]]) {
+        SharedThreadPoolThread* poolThread = (SharedThreadPoolThread*)thread;
+        double latency = [MonotonicClock secondsSince:perform.postedAt];
+        @synchronized (poolThread.lock) {
+            poolThread.numPerformsQueued--;
+            poolThread.numPerformsRun++;
+            poolThread.totalPerformLatency += latency;
+            poolThread.maxPerformLatency = MAX(poolThread.maxPerformLatency, latency);
+            if(perform.isProbe) {
+                poolThread.probePostedAt = 0;
+            }
+        }
+    }
+    
+    if(perform.block != NULL) {
+        perform.block();
+    }
+}
+
+// Runs on the internal queue.  Flags threads that have been stuck too long, and sends a
+// probe to each thread that doesn't have one out, so a thread that's stopped getting to its
+// performs shows up even when no one else is sending it any:
+-(void) watchdogFired {
+    NSMutableArray* flagged = [[NSMutableArray alloc] init];
+    NSMutableArray* threadsToProbe = [[NSMutableArray alloc] init];
+    SharedThreadPoolWatchdogHandler handler = nil;
+    NSTimeInterval threshold = 0.0;
+    
+    @synchronized (self.lock) {
+        if(self.watchdogTimer == nil) return;
+        handler = self.watchdogHandler;
+        threshold = self.watchdogThreshold;
+        MonotonicTime now = [MonotonicClock now];
+        
+        for(SharedThreadPoolThread* thread in [self.allThreads allValues]) {
+            SharedThreadPoolThreadMetrics* metrics = [thread metricsAtTime:now];
+            @synchronized (thread.lock) {
+                if(metrics.blockedSeconds > threshold && !thread.watchdogFlagged) {
+                    thread.watchdogFlagged = TRUE;
+                    thread.numWatchdogFlags++;
+                    metrics.numWatchdogFlags = thread.numWatchdogFlags;
+                    [flagged addObject:metrics];
+                }
+                if(thread.probePostedAt == 0) {
+                    thread.probePostedAt = now;
+                    [threadsToProbe addObject:thread];
+                }
+            }
+        }
+    }
+    
+    for(SharedThreadPoolThread* thread in threadsToProbe) {
+        _SharedThreadPoolPerform* probe = [[_SharedThreadPoolPerform alloc] init];
+        probe.isProbe = TRUE;
+        [self postPerform:probe onThread:thread];
+    }
+    
+    for(SharedThreadPoolThreadMetrics* metrics in flagged) {
+        LogW(LOGTAG, @"Watchdog: thread %@ has been blocked for %.3lfs (threshold %.3lfs, %ld waiting to run)",
+             metrics.name, metrics.blockedSeconds, threshold, metrics.queueDepth);
+        if(handler != nil) {
+            handler(metrics);
+        }
+    }
+}
+
 -(void) checkThreadIdentifier:(id)identifier afterDelay:(NSTimeInterval)delay {
     // Post a message to the internal dispatch queue requesting
     // that we check if this thread shoud be cleared: